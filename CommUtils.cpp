@@ -652,7 +652,7 @@ uint8_t CommUtils::receiveMessages(DeviceRole role)
 					while( xbeeZB.pos > 0 && !stop)
 					{	
 						error = 0;
-						uint8_t count = 0;
+						uint8_t framing = 0;
 						// Available information in 'xbeeZB.packet_finished' structure
 						// HERE it should be introduced the User's packet treatment        
 						// For example: show DATA field:
@@ -664,25 +664,15 @@ uint8_t CommUtils::receiveMessages(DeviceRole role)
 						}
 						
 						/// RECOVER ZEROS
-						for(uint8_t pos = 0; pos<xbeeZB.packet_finished[xbeeZB.pos-1]->data_length; pos++)
+						if(isValidPacket(&(xbeeZB.packet_finished[xbeeZB.pos-1]->packetID)))
 						{
-							if(xbeeZB.packet_finished[xbeeZB.pos-1]->data[pos] == -1 /*0xFF*/ &&
-							   xbeeZB.packet_finished[xbeeZB.pos-1]->data[pos+1] == -2)
-							{
-								xbeeZB.packet_finished[xbeeZB.pos-1]->data[pos - count] = 0;
-								pos++;  count++;
-							}
-							else
-							{
-								xbeeZB.packet_finished[xbeeZB.pos-1]->data[pos - count] = 
-									xbeeZB.packet_finished[xbeeZB.pos-1]->data[pos];
-							}
-						}						
+							framing = decodeIncomingMessage(xbeeZB.packet_finished[xbeeZB.pos-1]);
+						}
 				
 								#ifdef FINAL_USB_DEBUG
 									USB.print("ID = "); USB.print( (int) xbeeZB.packet_finished[xbeeZB.pos-1]->packetID);
 									USB.print(" Data: ");
-									for(int f=0;f<xbeeZB.packet_finished[xbeeZB.pos-1]->data_length - count;f++)
+									for(int f=0;f<xbeeZB.packet_finished[xbeeZB.pos-1]->data_length;f++)
 									{
 										receivedData[f] = xbeeZB.packet_finished[xbeeZB.pos-1]->data[f];
 											//USB.print(xbeeZB.packet_finished[xbeeZB.pos-1]->data[f],BYTE);
@@ -692,7 +682,13 @@ uint8_t CommUtils::receiveMessages(DeviceRole role)
 								#endif  						
 						
 						/// HERE THE PACKETS ARE TREATED ///
-						if(isValidPacket(&(xbeeZB.packet_finished[xbeeZB.pos-1]->packetID)))
+						if(framing != 0)
+						{
+							sendError(NODE_RECEIVED_A_PACKET_WITH_INVALID_FRAMING);
+							stop = true;
+							error = 3;
+						}
+						else if(isValidPacket(&(xbeeZB.packet_finished[xbeeZB.pos-1]->packetID)))
 						{
 							received = true;
 							error = (*myTreatPacket[xbeeZB.packet_finished[xbeeZB.pos-1]->packetID])
@@ -950,35 +946,41 @@ uint8_t CommUtils::sendWarning(Errors e)
 }
 
 
-char * CommUtils::escapeZeros(char * content, uint8_t contentLength)
+uint8_t CommUtils::decodeIncomingMessage(packetXBee * paq)
 {
-	uint8_t pos1 = 0, pos2 = 0;
-	char * contentToSend = (char *) calloc(contentLength*2, sizeof(char));
-		
-	while(pos1 < contentLength)
+	uint8_t length = paq->data_length;
+	uint16_t next = (uint8_t) paq->data[0];	// position of the next encoded zero
+	
+	// The terminating '\0' can't be part of the encoded data
+	if(length > 0 && paq->data[length-1] == 0)
+		length--;
+	
+	if(length == 0 || next == 0)
+		return 1;
+	
+	for(uint8_t pos = 1; pos < length; pos++)
 	{
-		if(content[pos1] == 0)
+		if(paq->data[pos] == 0)
+			return 1;
+		
+		if(pos == next)
 		{
-			contentToSend[pos2++] = 0xFF;	// FF = escape char
-			contentToSend[pos2++] = 0xFE; 	// FE = 0
-			pos1++;
+			next = pos + (uint8_t) paq->data[pos];
+			paq->data[pos-1] = 0;
 		}
-		else if(content[pos1] = 0xFF)
+		else
 		{
-			contentToSend[pos2++] = 0xFF;	
-			contentToSend[pos2++] = 0xFD; 
-			pos1++;		
+			paq->data[pos-1] = paq->data[pos];
 		}
-		else
-			contentToSend[pos2++] = content[pos1++];
 	}
-	contentToSend[pos2] = '\0';
 	
-	USB.print("contentToSend = ");
-	for(pos1=0; pos1<pos2; pos1++)
-		USB.print( (int) contentToSend[pos1]);
-	USB.print("\n");
-	return contentToSend;
+	if(next != length)
+		return 1;
+	
+	paq->data_length = length - 1;
+	paq->data[length-1] = '\0';
+	
+	return 0;
 }
 
 CommUtils COMM = CommUtils();
@@ -223,13 +223,14 @@ class CommUtils
 		uint8_t sendWarning(Errors);
 		
 		
-		//! It replaces the zeros in data by 0xFFFE so it can be sent correctly
-		/*! 
-		  \param data    : the data where zeros must be replaced
-		  \param length  : the length of the original data stream
-		  \return char * : the new data with escaped zeros
+		//! It is called by 'CommUtils::receiveMessages(DeviceRole)'
+		/*! It restores the zeros in packetXBee->data that were removed by the
+		 *  COBS framing of the sender (see 'PAQUtils::encodePacketData()'),
+		 *  in place, and adapts packetXBee->data_length.
+		 *  \return error=1 --> The data is not valid COBS framed data
+		 *			error=0 --> The data is decoded
 		 */
-		char * escapeZeros(char * data , uint8_t length);
+		uint8_t decodeIncomingMessage(packetXBee *);
 		
 		bool retryJoin;
 		
@@ -57,6 +57,18 @@ void HardwareSerial::flush(uint8_t portNum)
   serialFlush(portNum);
 }
 
+// non-blocking: returns how many bytes fitted in the transmit buffer
+int HardwareSerial::write(const uint8_t* buf, size_t len, uint8_t portNum)
+{
+  return serialWriteBuffer(buf, len, portNum);
+}
+
+// waits up to 'timeout' ms for the transmit buffer to drain, 1 on timeout
+uint8_t HardwareSerial::flushTX(unsigned long timeout, uint8_t portNum)
+{
+  return serialFlushTX(portNum, timeout);
+}
+
 void HardwareSerial::print(char c, uint8_t portNum)
 {
   printByte(c, portNum);
@@ -21,6 +21,7 @@
 #define HardwareSerial_h
 
 #include <inttypes.h>
+#include <stddef.h>
 
 #define DEC 10
 #define HEX 16
@@ -40,6 +41,8 @@ class HardwareSerial
     uint8_t available(uint8_t);
     int read(uint8_t);
     void flush(uint8_t);
+    int write(const uint8_t*, size_t, uint8_t);
+    uint8_t flushTX(unsigned long, uint8_t);
     void print(char, uint8_t);
     void print(const char[], uint8_t);
     void print(uint8_t, uint8_t);
@@ -9,6 +9,9 @@ InsertData * Inserter[NUM_SENSORS] = {&InsertTemperature, &InsertHumidity, &Inse
 				&InsertBattery, &InsertCO2, &InsertAnemo, &InsertVane, &InsertPluvio,
 				&InsertLuminosity, &InsertSolarRadiation};		//WORKS
 
+/// Bytes per sample in 'SensUtils.savedValues', see 'SensorUtils::keepSensorValueInMemory()'
+const uint8_t storedSampleWidth[NUM_SENSORS] = {2, 1, 2, 1, 2, 1, 1, 2, 1, 2};
+
 				
 TreatData * myTreatPacket[NUM_APP_IDS] = {&NotInUse, &Add_Node_Request, &Add_Node_Response,
 			&Mask_Request, &Mask_Response, &Change_Node_Frequency_Request,
@@ -97,37 +100,74 @@ uint8_t PAQUtils::sendMask(uint8_t * destination, uint8_t type, uint16_t mask)
 	
 	setPacketMask(mask);
 	
-	char * content = (char *) calloc(packetSize*2 + 1, sizeof(char));
-	escapeZerosInPacketData(content);
-	
-	error = COMM.sendMessage(destination, type, content);
+	if(encodePacketData() != 0)
+	{
+		COMM.sendError(NODE_HAD_AN_ERROR_IN_ENCODE_PACKET_DATA);
+		return 2;
+	}
 	
-	free(content);
-	content = NULL;
+	error = COMM.sendMessage(destination, type, packetData);
 	
 	return error;
 }
 
 
-void PAQUtils::escapeZerosInPacketData(char * content)
+uint8_t PAQUtils::encodePacketData()
 {
-	uint8_t pos = 0;
-	for(uint8_t i=0; i<packetSize; i++)
+	uint8_t code = 0;	// position of the byte waiting for the distance to the next zero
+	
+	if(packetSize > MAX_DATA - 2)
+		return 1;
+	
+	memmove(packetData + 1, packetData, packetSize);
+	
+	for(uint8_t i=1; i<=packetSize; i++)
 	{
 		if(packetData[i] == 0)
 		{
-			content[pos++] = 0xFF;	// FF = escape char
-			content[pos++] = 0xFE;	// FE = 0
+			packetData[code] = i - code;
+			code = i;
 		}
-		else if(packetData[i] == 0xFF)
+	}
+	packetData[code] = packetSize + 1 - code;
+	packetData[packetSize + 1] = '\0';
+	
+	return 0;
+}
+
+
+void PAQUtils::insertField(uint8_t * pos, char * data, uint8_t sensor, uint16_t value, uint8_t length)
+{
+	if(deltaPacket)
+	{
+		int16_t delta = value - lastFields[sensor];
+		uint16_t zigzag = (delta << 1) ^ (delta >> 15);	// small changes of both signs -> small numbers
+		
+		do
 		{
-			content[pos++] = 0xFF;
-			content[pos++] = 0xFD;
+			data[*pos] = zigzag & 0x7F;
+			zigzag >>= 7;
+			if(zigzag != 0)
+				data[*pos] |= 0x80;
+			(*pos)++;
+			packetSize++;
 		}
-		else
-			content[pos++] = packetData[i];	
+		while(zigzag != 0);
 	}
-	content[pos] = '\0';
+	else
+	{
+		if(length == 2)
+		{
+			data[(*pos)++] = MSByte(value);
+			packetSize++;
+		}
+		data[(*pos)++] = LSByte(value);
+		packetSize++;
+	}
+	
+	// Only kept once the packet has been sent, see 'sendMeasuredSensors()'
+	stagedFields[sensor] = value;
+	stagedFieldsMask |= 1 << sensor;
 }	
 
 
@@ -138,7 +178,15 @@ uint8_t PAQUtils::sendMeasuredSensors(uint8_t * destination, uint16_t mask)
 	packetSize = 2;  	// Need 2 bytes for the mask
 	uint16_t indicator = 1;
 	
-	setPacketMask(mask);	
+	// Send the fields as deltas if the gateway knows the previous value of all of them
+	deltaPacket = deltaFields && packetsSinceKeyframe < DELTA_KEYFRAME_INTERVAL &&
+				  (mask & ~deltaFieldsMask) == 0;
+	stagedFieldsMask = 0;
+	
+	if(deltaPacket)
+		setPacketMask(mask | DELTA_FIELDS_FLAG);
+	else
+		setPacketMask(mask);
 	
 		#ifdef FINAL_USB_DEBUG
 			USB.print("\nINSERTING: ");
@@ -171,14 +219,36 @@ uint8_t PAQUtils::sendMeasuredSensors(uint8_t * destination, uint16_t mask)
 
 	if(error == 0)
 	{
-		char * content = (char *) calloc(packetSize*2 + 1, sizeof(char));
-		
-		escapeZerosInPacketData(content);
+		if(encodePacketData() != 0)
+		{
+			COMM.sendError(NODE_HAD_AN_ERROR_IN_ENCODE_PACKET_DATA);
+			return 2;
+		}
 		
-		error = COMM.sendMessage(destination, IO_DATA, content);
+		error = COMM.sendMessage(destination, IO_DATA, packetData);
 
-		free(content);
-		content = NULL;
+		if(error != 0)
+		{
+			deltaFieldsMask = 0;	// the gateway may have missed these values
+		}
+		else
+		{
+			for(uint8_t i=0; i<NUM_SENSORS; i++)
+			{
+				if(stagedFieldsMask & (1 << i))
+					lastFields[i] = stagedFields[i];
+			}
+			
+			if(deltaPacket)
+			{
+				packetsSinceKeyframe++;
+			}
+			else
+			{
+				deltaFieldsMask |= stagedFieldsMask;
+				packetsSinceKeyframe = 0;
+			}
+		}
 		
 		switch(error)
 		{
@@ -226,24 +296,9 @@ uint8_t PAQUtils::sendStoredSensors(uint8_t * destination)
 	{
 		if(SensUtils.savedPositions[i] != 0)
 		{
-			packetData[0] = SensUtils.savedPositions[i];
-			for(int j=0; j<SensUtils.savedPositions[i]; j++)
-			{
-				packetData[j+1] = SensUtils.savedValues[i][j];
-			}
-			
-			char * content = (char *) calloc(SensUtils.savedPositions[i]*2 + 1, sizeof(char));
-			escapeZerosInPacketData(content);
-			
-			error = COMM.sendMessage(destination, i+NUM_APP_IDS, content);
-					
-			free(content);
-			content = NULL;		
-			
+			error = sendStoredSensor(destination, i);
 			if(error != 0)
 				break;
-				
-			SensUtils.savedPositions[i] = 0;
 		}
 	}
 	
@@ -273,6 +328,104 @@ uint8_t PAQUtils::sendStoredSensors(uint8_t * destination)
 }
 
 
+#ifdef POWER_MODES
+uint8_t PAQUtils::sendStoredSensor(uint8_t * destination, uint8_t sensor)
+{
+	uint8_t error = 0;
+	uint8_t width = storedSampleWidth[sensor];
+	uint8_t sent = 0;		// bytes of 'savedValues' already sent
+	uint8_t pos = 0;
+	uint16_t bits = 0;
+	uint16_t value = 0;
+	uint16_t previous = 0;
+	int32_t delta = 0;
+	int32_t previousDelta = 0;
+	int32_t dod = 0;
+	uint32_t zigzag = 0;
+	uint8_t * saved = SensUtils.savedValues[sensor];
+	
+	while(sent < SensUtils.savedPositions[sensor])
+	{
+		// 1. Start a new block with the first sample as is
+		memset(packetData, 0, MAX_DATA);
+		bits = 8;		// byte 0 holds the number of samples
+		pos = sent;
+		previousDelta = 0;
+		
+		value = (width == 2) ? (saved[pos] << 8) | saved[pos+1] : saved[pos];
+		writeBits(&bits, value, 8 * width);
+		packetData[0]++;
+		pos += width;
+		
+		// 2. Add the delta-of-deltas of the next samples while they fit
+		while(pos < SensUtils.savedPositions[sensor])
+		{
+			previous = value;
+			value = (width == 2) ? (saved[pos] << 8) | saved[pos+1] : saved[pos];
+			delta = (int32_t) value - previous;
+			dod = delta - previousDelta;
+			zigzag = (dod << 1) ^ (dod >> 31);
+			
+			if(dod == 0)
+			{
+				if(bits + 1 > 8 * STORED_SAMPLES_FRAME_SIZE) break;
+				writeBits(&bits, 0, 1);
+			}
+			else if(dod >= -8 && dod < 8)
+			{
+				if(bits + 6 > 8 * STORED_SAMPLES_FRAME_SIZE) break;
+				writeBits(&bits, (0x2UL << 4) | zigzag, 6);
+			}
+			else if(dod >= -128 && dod < 128)
+			{
+				if(bits + 11 > 8 * STORED_SAMPLES_FRAME_SIZE) break;
+				writeBits(&bits, (0x6UL << 8) | zigzag, 11);
+			}
+			else
+			{
+				if(bits + 21 > 8 * STORED_SAMPLES_FRAME_SIZE) break;
+				writeBits(&bits, (0x7UL << 18) | zigzag, 21);
+			}
+			
+			previousDelta = delta;
+			packetData[0]++;
+			pos += width;
+		}
+		
+		// 3. Send the block
+		packetSize = (bits + 7) / 8;
+		
+		error = encodePacketData();
+		if(error != 0)
+			break;
+		
+		error = COMM.sendMessage(destination, sensor+NUM_APP_IDS, packetData);
+		if(error != 0)
+			break;
+		
+		sent = pos;
+	}
+	
+	// 4. Keep the samples that were not sent for the next time
+	memmove(saved, saved + sent, SensUtils.savedPositions[sensor] - sent);
+	SensUtils.savedPositions[sensor] -= sent;
+	
+	return error;
+}
+
+
+void PAQUtils::writeBits(uint16_t * bits, uint32_t value, uint8_t length)
+{
+	for(uint8_t i=length; i>0; i--)
+	{
+		if( (value >> (i-1)) & 1 )
+			packetData[*bits / 8] |= 0x80 >> (*bits % 8);
+		(*bits)++;
+	}
+}
+#endif
+
+
 void PAQUtils::insertFrequenciesInPacketData(uint16_t mask)
 {
 	uint8_t pos = 2;	// Positions 0 and 1 are reserved for the mask
@@ -308,9 +461,7 @@ void PAQUtils::insertFrequenciesInPacketData(uint16_t mask)
 		
 		error = SensUtils.sensorValue2Chars(SensUtils.temperature, TEMPERATURE);
 
-		data[(*pos)++] = SensUtils.temp[0];
-		data[(*pos)++] = SensUtils.temp[1];
-		PackUtils.packetSize += 2;
+		PackUtils.insertField(pos, data, SEND_STORED_TEMPERATURES, ( (uint8_t) SensUtils.temp[0] << 8 ) | (uint8_t) SensUtils.temp[1], 2);
 		
 		return error;
 	}
@@ -324,8 +475,7 @@ void PAQUtils::insertFrequenciesInPacketData(uint16_t mask)
 			#endif
 			
 		error = SensUtils.sensorValue2Chars(SensUtils.humidity, HUMIDITY);
-		data[(*pos)++] = SensUtils.hum;
-		PackUtils.packetSize++;
+		PackUtils.insertField(pos, data, SEND_STORED_HUMIDITIES, (uint8_t) SensUtils.hum, 1);
 		
 		return error;
 	}
@@ -340,9 +490,7 @@ void PAQUtils::insertFrequenciesInPacketData(uint16_t mask)
 			
 		error = SensUtils.sensorValue2Chars(SensUtils.pressure, PRESSURE);
 		
-		data[(*pos)++] = SensUtils.pres[0];
-		data[(*pos)++] = SensUtils.pres[1];	
-		PackUtils.packetSize += 2;
+		PackUtils.insertField(pos, data, SEND_STORED_PRESSURES, ( (uint8_t) SensUtils.pres[0] << 8 ) | (uint8_t) SensUtils.pres[1], 2);
 		
 		return error;
 	}
@@ -357,8 +505,7 @@ void PAQUtils::insertFrequenciesInPacketData(uint16_t mask)
 			
 		error = SensUtils.sensorValue2Chars(SensUtils.battery, BATTERY);
 		
-		data[(*pos)++] = SensUtils.bat;
-		PackUtils.packetSize++;
+		PackUtils.insertField(pos, data, SEND_STORED_BATTERIES, (uint8_t) SensUtils.bat, 1);
 		
 		return error;
 	}
@@ -373,9 +520,7 @@ void PAQUtils::insertFrequenciesInPacketData(uint16_t mask)
 			
 		error = SensUtils.sensorValue2Chars(SensUtils.co2, CO2);
 		
-		data[(*pos)++] = SensUtils.co_2[0];
-		data[(*pos)++] = SensUtils.co_2[1];	
-		PackUtils.packetSize += 2;
+		PackUtils.insertField(pos, data, SEND_STORED_CO2S, ( (uint8_t) SensUtils.co_2[0] << 8 ) | (uint8_t) SensUtils.co_2[1], 2);
 		
 		return error;
 	}
@@ -391,8 +536,7 @@ void PAQUtils::insertFrequenciesInPacketData(uint16_t mask)
 		
 		error = SensUtils.sensorValue2Chars(SensUtils.anemo, ANEMO);	
 		
-		data[(*pos)++] = SensUtils.an;
-		PackUtils.packetSize++;
+		PackUtils.insertField(pos, data, SEND_STORED_ANEMOS, (uint8_t) SensUtils.an, 1);
 		
 		return error;		
 	}
@@ -405,8 +549,7 @@ void PAQUtils::insertFrequenciesInPacketData(uint16_t mask)
 				USB.print("VANE ");			
 			#endif
 			
-		data[(*pos)++] = (int) SensUtils.vaneDirection;
-		PackUtils.packetSize++;
+		PackUtils.insertField(pos, data, SEND_STORED_VANES, (uint8_t) SensUtils.vaneDirection, 1);
 		
 		return error = 0;	
 	}
@@ -422,9 +565,7 @@ void PAQUtils::insertFrequenciesInPacketData(uint16_t mask)
 			
 		error = SensUtils.sensorValue2Chars(SensUtils.pluviometerCounter, PLUVIO);
 		
-		data[(*pos)++] = SensUtils.rain_count[0];
-		data[(*pos)++] = SensUtils.rain_count[1];	
-		PackUtils.packetSize += 2;
+		PackUtils.insertField(pos, data, SEND_STORED_PLUVIOS, ( (uint8_t) SensUtils.rain_count[0] << 8 ) | (uint8_t) SensUtils.rain_count[1], 2);
 		
 		#ifdef WEATHER_STATION
 			SensUtils.resetPluviometer();
@@ -443,8 +584,7 @@ void PAQUtils::insertFrequenciesInPacketData(uint16_t mask)
 		
 		error = SensUtils.sensorValue2Chars(SensUtils.luminosity, LUMINOSITY);
 		
-		data[(*pos)++] = SensUtils.lum;
-		PackUtils.packetSize++;
+		PackUtils.insertField(pos, data, SEND_STORED_LUMINOSITIES, (uint8_t) SensUtils.lum, 1);
 		
 		return error;
 	}
@@ -459,9 +599,7 @@ void PAQUtils::insertFrequenciesInPacketData(uint16_t mask)
 			
 		error = SensUtils.sensorValue2Chars(SensUtils.solar_radiation, SOLAR_RADIATION);
 		
-		data[(*pos)++] = SensUtils.radiation[0];
-		data[(*pos)++] = SensUtils.radiation[1];	
-		PackUtils.packetSize += 2;
+		PackUtils.insertField(pos, data, SEND_STORED_RADIATIONS, ( (uint8_t) SensUtils.radiation[0] << 8 ) | (uint8_t) SensUtils.radiation[1], 2);
 		
 		return error;	
 	}
@@ -509,13 +647,14 @@ void PAQUtils::insertFrequenciesInPacketData(uint16_t mask)
 				
 				PackUtils.packetSize = 2;
 				PackUtils.setPacketMask(xbeeZB.physicalSensorMask);
-				char * contentToSend = (char *) calloc(PackUtils.packetSize + 1, sizeof(char));
-				PackUtils.escapeZerosInPacketData(contentToSend);
+				if( PackUtils.encodePacketData() != 0 )
+				{
+					COMM.sendError(NODE_HAD_AN_ERROR_IN_ENCODE_PACKET_DATA);
+					return 1;
+				}
 				
-				error = COMM.sendMessage(xbeeZB.GATEWAY_MAC, ADD_NODE_RES, contentToSend);				
+				error = COMM.sendMessage(xbeeZB.GATEWAY_MAC, ADD_NODE_RES, PackUtils.packetData);				
 				
-				free(contentToSend);
-				contentToSend = NULL;
 				return 1;
 			}
 			else
@@ -539,15 +678,16 @@ void PAQUtils::insertFrequenciesInPacketData(uint16_t mask)
 			PackUtils.packetSize = 2;
 			PackUtils.setPacketMask(xbeeZB.physicalSensorMask);
 			
-			char * contentToSend = (char *) calloc(PackUtils.packetSize + 1, sizeof(char));
-			PackUtils.escapeZerosInPacketData(contentToSend);
+			if( PackUtils.encodePacketData() != 0 )
+			{
+				COMM.sendError(NODE_HAD_AN_ERROR_IN_ENCODE_PACKET_DATA);
+				return 1;
+			}
 			
-			error = COMM.sendMessage(xbeeZB.GATEWAY_MAC, ADD_NODE_RES, contentToSend);
+			error = COMM.sendMessage(xbeeZB.GATEWAY_MAC, ADD_NODE_RES, PackUtils.packetData);
 				#ifdef ADD_NODE_REQ_DEBUG
 					USB.print("\nNODE_RES send error = "); USB.println( (int) error );
 				#endif
-			free(contentToSend);
-			contentToSend = NULL;
 		
 		// 5. Set in network = true
 			xbeeZB.inNetwork = true;
@@ -598,20 +738,20 @@ void PAQUtils::insertFrequenciesInPacketData(uint16_t mask)
 			PackUtils.packetSize = 2;
 			PackUtils.setPacketMask(xbeeZB.physicalSensorMask);
 			
-			char * contentToSend = (char *) calloc(PackUtils.packetSize + 1, sizeof(char));
-			PackUtils.escapeZerosInPacketData(contentToSend);
+			if( PackUtils.encodePacketData() != 0 )
+			{
+				COMM.sendError(NODE_HAD_AN_ERROR_IN_ENCODE_PACKET_DATA);
+				return 1;
+			}
 			
 				#ifdef MASK_REQ_DEBUG
-					USB.print("contentToSend: ");
-					USB.print( (int) contentToSend[0] );
-					USB.print( (int) contentToSend[1] );
-					USB.print( (int) contentToSend[2] );
+					USB.print("packetData: ");
+					USB.print( (int) PackUtils.packetData[0] );
+					USB.print( (int) PackUtils.packetData[1] );
+					USB.print( (int) PackUtils.packetData[2] );
 				#endif
 			
-			error = COMM.sendMessage(xbeeZB.GATEWAY_MAC, MASK_RES, contentToSend);
-			
-			free(contentToSend);
-			contentToSend = NULL;		
+			error = COMM.sendMessage(xbeeZB.GATEWAY_MAC, MASK_RES, PackUtils.packetData);
 			
 			return error;
 	}
@@ -658,13 +798,14 @@ void PAQUtils::insertFrequenciesInPacketData(uint16_t mask)
 				PackUtils.packetSize = 2;  //needed in escapZeros function
 				PackUtils.packetData[0] = MSByte(xbeeZB.defaultTime2WakeInt);
 				PackUtils.packetData[1] = LSByte(xbeeZB.defaultTime2WakeInt);
-				char * contentToSend = (char *) calloc(PackUtils.packetSize + 1, sizeof(char));
-				PackUtils.escapeZerosInPacketData(contentToSend);
+				if( PackUtils.encodePacketData() != 0 )
+				{
+					COMM.sendError(NODE_HAD_AN_ERROR_IN_ENCODE_PACKET_DATA);
+					return 1;
+				}
 				
-				error = COMM.sendMessage(xbeeZB.GATEWAY_MAC, CH_NODE_FREQ_RES, contentToSend); 	
+				error = COMM.sendMessage(xbeeZB.GATEWAY_MAC, CH_NODE_FREQ_RES, PackUtils.packetData); 	
 				
-				free(contentToSend);
-				contentToSend = NULL;
 				return 0;
 		}
 		else
@@ -725,13 +866,14 @@ void PAQUtils::insertFrequenciesInPacketData(uint16_t mask)
 			{	
 				PackUtils.insertFrequenciesInPacketData(receivedToChangeSensorsMask);
 				
-				char * contentToSend = (char *) calloc(PackUtils.packetSize*2 + 1, sizeof(char));
-				PackUtils.escapeZerosInPacketData(contentToSend);
+				if( PackUtils.encodePacketData() != 0 )
+				{
+					COMM.sendError(NODE_HAD_AN_ERROR_IN_ENCODE_PACKET_DATA);
+					return 1;
+				}
 				
-				error = COMM.sendMessage(xbeeZB.GATEWAY_MAC, CH_SENS_FREQ_RES, contentToSend); 	
+				error = COMM.sendMessage(xbeeZB.GATEWAY_MAC, CH_SENS_FREQ_RES, PackUtils.packetData); 	
 				
-				free(contentToSend);
-				contentToSend = NULL;
 				return 0;	
 			}
 			else
@@ -871,15 +1013,16 @@ void PAQUtils::insertFrequenciesInPacketData(uint16_t mask)
 			PackUtils.packetSize = 1;
 			PackUtils.packetData[0] = receivedPaq->data[0];
 			
-			char * contentToSend = (char *) calloc(PackUtils.packetSize + 1, sizeof(char));
-			PackUtils.escapeZerosInPacketData(contentToSend);
+			if( PackUtils.encodePacketData() != 0 )
+			{
+				COMM.sendError(NODE_HAD_AN_ERROR_IN_ENCODE_PACKET_DATA);
+				return 1;
+			}
 			
-			error = COMM.sendMessage(xbeeZB.GATEWAY_MAC, SET_POWER_PLAN_RES, contentToSend);
+			error = COMM.sendMessage(xbeeZB.GATEWAY_MAC, SET_POWER_PLAN_RES, PackUtils.packetData);
 				#ifdef ADD_NODE_REQ_DEBUG
 					USB.print("\nNODE_RES send error = "); USB.println( (int) error );
 				#endif
-			free(contentToSend);
-			contentToSend = NULL;	
 		}
 		else
 		{
@@ -921,13 +1064,14 @@ void PAQUtils::insertFrequenciesInPacketData(uint16_t mask)
 			PackUtils.packetSize = 1;
 			PackUtils.packetData[0] = receivedPaq->data[0];
 			
-			char * contentToSend = (char *) calloc(PackUtils.packetSize + 1, sizeof(char));
-			PackUtils.escapeZerosInPacketData(contentToSend);
+			if( PackUtils.encodePacketData() != 0 )
+			{
+				COMM.sendError(NODE_HAD_AN_ERROR_IN_ENCODE_PACKET_DATA);
+				return 1;
+			}
 			
-			error = COMM.sendMessage(xbeeZB.GATEWAY_MAC, SET_ENCRYPTION_RES, contentToSend);
+			error = COMM.sendMessage(xbeeZB.GATEWAY_MAC, SET_ENCRYPTION_RES, PackUtils.packetData);
 
-			free(contentToSend);
-			contentToSend = NULL;	
 		}
 		else
 		{
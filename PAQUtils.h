@@ -17,12 +17,35 @@
  ******************************************************************************/
 
 #include <inttypes.h>
+#include "SensorUtils.h"
 
 /******************************************************************************
  * Definitions & Declarations
  ******************************************************************************/
 //#define PACKET_DEBUG
 
+//!
+/*! Set in the packet mask of an IO_DATA packet when the sensor fields are
+ *  sent as zigzag varint deltas against the previous value of each sensor
+ *  instead of their 1 or 2 raw bytes.
+ */
+#define DELTA_FIELDS_FLAG 0x8000
+
+//!
+/*! Maximum number of delta packets sent in a row, the next one carries the
+ *  absolute values again so the gateway can resynchronize.
+ */
+#define DELTA_KEYFRAME_INTERVAL 10
+
+//!
+/*! Maximum size of a block of stored samples, so that the block is sent in
+ *  one XBee frame: 84 bytes unicast ZigBee payload - 6 bytes header added by
+ *  'sendXBee()' - 1 byte COBS framing. Use 59 with network encryption.
+ */
+#ifndef STORED_SAMPLES_FRAME_SIZE
+#define STORED_SAMPLES_FRAME_SIZE 77
+#endif
+
 //!
 /*! Defines the packet types recognized by the Waspmote
  */	
@@ -108,7 +131,11 @@ typedef enum {	// INVALID PACKET RECEIVED
 				/*45:*/	NODE_FAILED_TO_SEND_THE_MEASURED_SENSORS_AFTER_A_SUCCESSFULL_RETRY_JOINING,
 				//WARNINGS
 				/*46:*/	NODE_HAD_TO_RETRY_THE_JOINING_PROCESS__PROBABLY_LOW_RSSI,
-				/*47:*/	RAIN_METER_HAS_BEEN_RESET
+				/*47:*/	RAIN_METER_HAS_BEEN_RESET,
+				//INVALID PACKET CONTENT RECEIVED (appended to keep the numbering above)
+				/*48:*/	NODE_RECEIVED_A_PACKET_WITH_INVALID_FRAMING,
+				//PROGRAM ERRORS (appended to keep the numbering above)
+				/*49:*/	NODE_HAD_AN_ERROR_IN_ENCODE_PACKET_DATA
 			}
 	Errors;
 
@@ -283,6 +310,30 @@ class PAQUtils
 {
 	private:
 	
+		//! It is called by 'sendStoredSensors(uint8_t *)'
+		/*! It compresses the saved values of one sensor into blocks that each
+		 *  fit in STORED_SAMPLES_FRAME_SIZE bytes and sends them. A block can be
+		 *  decoded on its own:
+		 *    byte 0   : the number of samples in the block
+		 *    then a bit stream, most significant bit first, padded with zeros:
+		 *    - the first sample as is (8 or 16 bits, see 'keepSensorValueInMemory')
+		 *    - for every next sample the delta-of-delta 'dod' (the first delta
+		 *      is taken against 0), zigzag encoded as 'z':
+		 *        '0'                  dod == 0
+		 *        '10'  + 4 bits of z  -8 <= dod < 8
+		 *        '110' + 8 bits of z  -128 <= dod < 128
+		 *        '111' + 18 bits of z otherwise
+		 *  The values that were sent are removed from 'SensUtils.savedValues',
+		 *  the others are kept for the next time.
+		 */
+		uint8_t sendStoredSensor(uint8_t * destination, uint8_t sensor);
+		
+		
+		//!
+		/*! Appends the 'length' lowest bits of 'value' to 'packetData' at bit 'bits'
+		 */
+		void writeBits(uint16_t * bits, uint32_t value, uint8_t length);
+	
 	public:
 		//! class constructor
 		/*!
@@ -339,7 +390,11 @@ class PAQUtils
 		 */
 		uint8_t sendMeasuredSensors(uint8_t *, uint16_t);
 		
-		//! It sends the sensors 
+		//! It sends the sensor values kept in 'SensUtils.savedValues'
+		/*! Every sensor is sent as one or more blocks of at most
+		 *  STORED_SAMPLES_FRAME_SIZE bytes (see 'sendStoredSensor()'), of
+		 *  packet type NUM_APP_IDS + the index of the sensor.
+		 */
 		uint8_t sendStoredSensors(uint8_t *);
 		
 		uint8_t sendStoredErrors(uint8_t *);
@@ -361,12 +416,26 @@ class PAQUtils
 		
 		
 		//!
-		/*! It removes the zeros from data to be sent
+		/*! It removes the zeros from the data to be sent using COBS framing,
+		 *  in place: every zero becomes the distance to the next one and a
+		 *  leading byte holds the distance to the first, so the encoded data
+		 *  is exactly one byte longer and ends with '\0'.
 		 *  @pre: the data to send must be present in global 'packetData[MAX_DATA]'
-		 *  @pre: the content param must be allocated
-		 *  @param : the char *  to send, where the escaped data must be put in 
+		 *  @pre: 'packetSize' holds the length of the data
+		 *  \return error=1 --> The encoded data doesn't fit in 'packetData'
+		 *			error=0 --> The data is encoded, 'packetSize' is not changed
+		 */
+		uint8_t encodePacketData();
+		
+		
+		//! It is called by the 'Insert*' function pointers
+		/*! It inserts the value of a sensor (index as in 'SendStoredSampleApplicationIDs')
+		 *  at 'pos', as 'length' raw bytes or,
+		 *  when 'deltaPacket' is set, as a zigzag varint of the difference with
+		 *  the value sent the previous time (1 byte for a change of -64..63).
+		 *  It also increases 'packetSize' and stages the value in 'stagedFields'.
 		 */
-		void escapeZerosInPacketData(char *);
+		void insertField(uint8_t * pos, char * data, uint8_t sensor, uint16_t value, uint8_t length);
 		
 		
 		//!
@@ -403,6 +472,50 @@ class PAQUtils
 		/*! Contains the packet data
 		 */				
 		char packetData[MAX_DATA];
+		
+		
+		//!
+		/*! Enables the delta encoding of the sensor fields in IO_DATA packets
+		 */
+		bool deltaFields;
+		
+		
+		//!
+		/*! Set while an IO_DATA packet with delta encoded fields is being built
+		 */
+		bool deltaPacket;
+		
+		
+		//!
+		/*! Contains the last value of every sensor that was sent successfully
+		 */
+		uint16_t lastFields[NUM_SENSORS];
+		
+		
+		//!
+		/*! Contains the values inserted in the packet being built, they are
+		 *  copied to 'lastFields' once the packet has been sent
+		 */
+		uint16_t stagedFields[NUM_SENSORS];
+		
+		
+		//!
+		/*! Mask of the sensors inserted in the packet being built
+		 */
+		uint16_t stagedFieldsMask;
+		
+		
+		//!
+		/*! Mask of the sensors the gateway knows the last value of, i.e.
+		 *  which were sent successfully since the last failed send
+		 */
+		uint16_t deltaFieldsMask;
+		
+		
+		//!
+		/*! Number of delta packets sent since the last absolute one
+		 */
+		uint8_t packetsSinceKeyframe;
  };
  
  extern PAQUtils PackUtils;
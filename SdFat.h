@@ -25,6 +25,7 @@
  */
 #include <avr/pgmspace.h>
 #include "Sd2Card.h"
+#include "sd_cache.h"
 #include "FatStructs.h"
 //------------------------------------------------------------------------------
 /**
@@ -432,8 +433,9 @@ class SdVolume {
    */
   static uint8_t* cacheClear(void) {
     cacheFlush();
+    cacheBuffer_ = reinterpret_cast<cache_t*>(sd_cache_claim());
     cacheBlockNumber_ = 0XFFFFFFFF;
-    return cacheBuffer_.data;
+    return cacheBuffer_ ? cacheBuffer_->data : 0;
   }
   /**
    * Initialize a FAT volume.  Try partition one first then try super
@@ -490,15 +492,18 @@ class SdVolume {
   friend class SdFile;
 
   // value for action argument in cacheRawBlock to indicate read from cache
-  static uint8_t const CACHE_FOR_READ = 0;
+  static uint8_t const CACHE_FOR_READ = SD_CACHE_READ;
   // value for action argument in cacheRawBlock to indicate cache dirty
-  static uint8_t const CACHE_FOR_WRITE = 1;
+  static uint8_t const CACHE_FOR_WRITE = SD_CACHE_WRITE;
+  // or'ed with CACHE_FOR_WRITE when the whole block will be overwritten
+  static uint8_t const CACHE_NO_READ = SD_CACHE_NO_READ;
 
-  static cache_t cacheBuffer_;        // 512 byte cache for device blocks
-  static uint32_t cacheBlockNumber_;  // Logical number of block in the cache
+  // the blocks live in the sd_cache slots shared with sd_raw
+  static cache_t* cacheBuffer_;       // slot of the last block cached
+  static uint32_t cacheBlockNumber_;  // Logical number of that block
   static Sd2Card* sdCard_;            // Sd2Card object for cache
-  static uint8_t cacheDirty_;         // cacheFlush() will write block if true
-  static uint32_t cacheMirrorBlock_;  // block number for mirror FAT
+  static uint32_t cacheFatStart_;     // first block of the first FAT
+  static uint32_t cacheMirrorOffset_; // blocks to the mirror FAT, zero if none
 //
   uint32_t allocSearchStart_;   // start cluster for alloc search
   uint8_t blocksPerCluster_;    // cluster size in blocks
@@ -521,7 +526,11 @@ class SdVolume {
            return clusterStartBlock(cluster) + blockOfCluster(position);}
   static uint8_t cacheFlush(void);
   static uint8_t cacheRawBlock(uint32_t blockNumber, uint8_t action);
-  static void cacheSetDirty(void) {cacheDirty_ |= CACHE_FOR_WRITE;}
+  static uint8_t cacheReadBlock(uint32_t blockNumber, uint8_t* dst);
+  static uint8_t cacheWriteBlock(uint32_t blockNumber, const uint8_t* src);
+  static void cacheSetDirty(void) {
+    sd_cache_set_dirty(cacheBuffer_->data, cacheWriteBlock);
+  }
   static uint8_t cacheZeroBlock(uint32_t blockNumber);
   uint8_t chainSize(uint32_t beginCluster, uint32_t* size) const;
   uint8_t fatGet(uint32_t cluster, uint32_t* value) const;
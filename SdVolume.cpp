@@ -22,10 +22,10 @@
 // raw block cache
 // init cacheBlockNumber_to invalid SD block number
 uint32_t SdVolume::cacheBlockNumber_ = 0XFFFFFFFF;
-cache_t  SdVolume::cacheBuffer_;     // 512 byte cache for Sd2Card
+cache_t* SdVolume::cacheBuffer_;     // sd_cache slot for Sd2Card
 Sd2Card* SdVolume::sdCard_;          // pointer to SD card object
-uint8_t  SdVolume::cacheDirty_ = 0;  // cacheFlush() will write block if true
-uint32_t SdVolume::cacheMirrorBlock_ = 0;  // mirror  block for second FAT
+uint32_t SdVolume::cacheFatStart_ = 0;      // first block of first FAT
+uint32_t SdVolume::cacheMirrorOffset_ = 0;  // offset to second FAT
 //------------------------------------------------------------------------------
 // find a contiguous group of clusters
 uint8_t SdVolume::allocContiguous(uint32_t count, uint32_t* curCluster) {
@@ -96,43 +96,47 @@ uint8_t SdVolume::allocContiguous(uint32_t count, uint32_t* curCluster) {
   return true;
 }
 //------------------------------------------------------------------------------
+// write back every dirty block, including the ones written through sd_raw
 uint8_t SdVolume::cacheFlush(void) {
-  if (cacheDirty_) {
-    if (!sdCard_->writeBlock(cacheBlockNumber_, cacheBuffer_.data)) {
-      return false;
-    }
-    // mirror FAT tables
-    if (cacheMirrorBlock_) {
-      if (!sdCard_->writeBlock(cacheMirrorBlock_, cacheBuffer_.data)) {
-        return false;
-      }
-      cacheMirrorBlock_ = 0;
-    }
-    cacheDirty_ = 0;
-  }
-  return true;
+  return sd_cache_sync();
 }
 //------------------------------------------------------------------------------
+// no shortcut on cacheBlockNumber_: sd_raw may have reused the slot since
 uint8_t SdVolume::cacheRawBlock(uint32_t blockNumber, uint8_t action) {
-  if (cacheBlockNumber_ != blockNumber) {
-    if (!cacheFlush()) return false;
-    if (!sdCard_->readBlock(blockNumber, cacheBuffer_.data)) return false;
-    cacheBlockNumber_ = blockNumber;
+  uint8_t* data = sd_cache_get(blockNumber, action,
+                               cacheReadBlock, cacheWriteBlock);
+  if (!data) return false;
+  cacheBuffer_ = reinterpret_cast<cache_t*>(data);
+  cacheBlockNumber_ = blockNumber;
+  return true;
+}
+//------------------------------------------------------------------------------
+// read a block for sd_cache on a miss
+uint8_t SdVolume::cacheReadBlock(uint32_t blockNumber, uint8_t* dst) {
+  return sdCard_->readBlock(blockNumber, dst);
+}
+//------------------------------------------------------------------------------
+// write back a block for sd_cache, blocks of the first FAT also go to the
+// second one so the mirror is kept whoever evicts the block
+uint8_t SdVolume::cacheWriteBlock(uint32_t blockNumber, const uint8_t* src) {
+  if (!sdCard_->writeBlock(blockNumber, src)) return false;
+
+  // mirror FAT tables
+  if ((blockNumber - cacheFatStart_) < cacheMirrorOffset_) {
+    return sdCard_->writeBlock(blockNumber + cacheMirrorOffset_, src);
   }
-  cacheDirty_ |= action;
   return true;
 }
 //------------------------------------------------------------------------------
 // cache a zero block for blockNumber
 uint8_t SdVolume::cacheZeroBlock(uint32_t blockNumber) {
-  if (!cacheFlush()) return false;
-
-  // loop take less flash than memset(cacheBuffer_.data, 0, 512);
+  if (!cacheRawBlock(blockNumber, CACHE_FOR_WRITE | CACHE_NO_READ)) {
+    return false;
+  }
+  // loop take less flash than memset(cacheBuffer_->data, 0, 512);
   for (uint16_t i = 0; i < 512; i++) {
-    cacheBuffer_.data[i] = 0;
+    cacheBuffer_->data[i] = 0;
   }
-  cacheBlockNumber_ = blockNumber;
-  cacheSetDirty();
   return true;
 }
 //------------------------------------------------------------------------------
@@ -152,13 +156,11 @@ uint8_t SdVolume::fatGet(uint32_t cluster, uint32_t* value) const {
   if (cluster > (clusterCount_ + 1)) return false;
   uint32_t lba = fatStartBlock_;
   lba += fatType_ == 16 ? cluster >> 8 : cluster >> 7;
-  if (lba != cacheBlockNumber_) {
-    if (!cacheRawBlock(lba, CACHE_FOR_READ)) return false;
-  }
+  if (!cacheRawBlock(lba, CACHE_FOR_READ)) return false;
   if (fatType_ == 16) {
-    *value = cacheBuffer_.fat16[cluster & 0XFF];
+    *value = cacheBuffer_->fat16[cluster & 0XFF];
   } else {
-    *value = cacheBuffer_.fat32[cluster & 0X7F] & FAT32MASK;
+    *value = cacheBuffer_->fat32[cluster & 0X7F] & FAT32MASK;
   }
   return true;
 }
@@ -175,19 +177,15 @@ uint8_t SdVolume::fatPut(uint32_t cluster, uint32_t value) {
   uint32_t lba = fatStartBlock_;
   lba += fatType_ == 16 ? cluster >> 8 : cluster >> 7;
 
-  if (lba != cacheBlockNumber_) {
-    if (!cacheRawBlock(lba, CACHE_FOR_READ)) return false;
-  }
+  if (!cacheRawBlock(lba, CACHE_FOR_WRITE)) return false;
   // store entry
   if (fatType_ == 16) {
-    cacheBuffer_.fat16[cluster & 0XFF] = value;
+    cacheBuffer_->fat16[cluster & 0XFF] = value;
   } else {
-    cacheBuffer_.fat32[cluster & 0X7F] = value;
+    cacheBuffer_->fat32[cluster & 0X7F] = value;
   }
-  cacheSetDirty();
-
-  // mirror second FAT
-  if (fatCount_ > 1) cacheMirrorBlock_ = lba + blocksPerFat_;
+  // the sd-reader free cluster summary is out of date now
+  sd_cache_fat_changes++;
   return true;
 }
 //------------------------------------------------------------------------------
@@ -227,12 +225,15 @@ uint8_t SdVolume::freeChain(uint32_t cluster) {
 uint8_t SdVolume::init(Sd2Card* dev, uint8_t part) {
   uint32_t volumeStartBlock = 0;
   sdCard_ = dev;
+  // the card was just initialized, blocks cached before can't be trusted
+  sd_cache_invalidate(0, 0XFFFFFFFF);
+  cacheBlockNumber_ = 0XFFFFFFFF;
   // if part == 0 assume super floppy with FAT boot sector in block zero
   // if part > 0 assume mbr volume with partition table
   if (part) {
     if (part > 4)return false;
     if (!cacheRawBlock(volumeStartBlock, CACHE_FOR_READ)) return false;
-    part_t* p = &cacheBuffer_.mbr.part[part-1];
+    part_t* p = &cacheBuffer_->mbr.part[part-1];
     if ((p->boot & 0X7F) !=0  ||
       p->totalSectors < 100 ||
       p->firstSector == 0) {
@@ -242,7 +243,7 @@ uint8_t SdVolume::init(Sd2Card* dev, uint8_t part) {
     volumeStartBlock = p->firstSector;
   }
   if (!cacheRawBlock(volumeStartBlock, CACHE_FOR_READ)) return false;
-  bpb_t* bpb = &cacheBuffer_.fbs.bpb;
+  bpb_t* bpb = &cacheBuffer_->fbs.bpb;
   if (bpb->bytesPerSector != 512 ||
     bpb->fatCount == 0 ||
     bpb->reservedSectorCount == 0 ||
@@ -264,6 +265,10 @@ uint8_t SdVolume::init(Sd2Card* dev, uint8_t part) {
 
   fatStartBlock_ = volumeStartBlock + bpb->reservedSectorCount;
 
+  // let write backs of the first FAT reach the second one
+  cacheFatStart_ = fatStartBlock_;
+  cacheMirrorOffset_ = fatCount_ > 1 ? blocksPerFat_ : 0;
+
   // count for FAT16 zero for FAT32
   rootDirEntryCount_ = bpb->rootDirEntryCount;
 
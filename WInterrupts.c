@@ -44,6 +44,7 @@
 // definition of interrupt vectors
 volatile static voidFuncPtr intFunc[EXTERNAL_NUM_INTERRUPTS];
 volatile static voidFuncPtr twiIntFunc;
+volatile static voidFuncPtr radIntFunc;
 
 
 #if defined(__AVR_ATmega168__)
@@ -168,6 +169,16 @@ void detachInterrupt(uint8_t interruptNum) {
   sei();
 }
 
+/* attachInterruptRad( userFunc ) - attaches a pulse counter to the radiation interruption
+ *
+ * When a counter is attached, 'userFunc' is called from the interruption on each falling edge of the radiation
+ * board output and the interruption is kept enabled. Without it, the interruption is disabled on each pulse and
+ * must be enabled again once the pulse is read. It must be called before enableInterrupts(RAD_INT).
+ */
+void attachInterruptRad(void (*userFunc)(void) ) {
+  radIntFunc = userFunc;
+}
+
 void attachInterruptTwi(void (*userFunc)(void) ) {
   twiIntFunc = userFunc;
 }
@@ -353,7 +364,8 @@ void onLAIwakeUP(void)
             intCounter++;
             intFlag |= RAD_INT;
             intArray[RAD_POS]++;
-            disableInterrupts(RAD_INT);
+            if( radIntFunc ) radIntFunc();
+            else disableInterrupts(RAD_INT);
         }
     }
 
@@ -400,6 +412,17 @@ void	clearIntFlag()
 }
 
 
+/* laiMode() - trigger mode of the Low Activate Interrupts line
+ *
+ * LAI, BAT, PLV and RAD share INT3. While the radiation pulse counter is attached the line must stay edge triggered,
+ * otherwise each re-entry during a LOW pulse would count it again.
+ */
+static int laiMode(void)
+{
+	return ( (intConf & RAD_INT) && radIntFunc ) ? FALLING : LOW;
+}
+
+
 /* enableInterrupts( conf ) - enables the specified interruption
  *
  * It enables the specified interruption by 'conf' input.
@@ -419,7 +442,7 @@ void enableInterrupts(uint32_t conf)
 	if( conf & LAI_INT )
 	{
 		pinMode(MUX_TX, INPUT);
-		attachInterrupt(LAI_INT_ACT, onLAIwakeUP, LOW);
+		attachInterrupt(LAI_INT_ACT, onLAIwakeUP, laiMode());
 	}
 	if( conf & ACC_INT )
 	{
@@ -432,7 +455,7 @@ void enableInterrupts(uint32_t conf)
 		pinMode(MUX_TX, INPUT);
 		pinMode(BAT_INT_PIN_MON,INPUT);
 		digitalWrite(MUX_TX, HIGH);
-		attachInterrupt(BAT_INT_ACT, onLAIwakeUP, LOW);
+		attachInterrupt(BAT_INT_ACT, onLAIwakeUP, laiMode());
 	}	
 	if( conf & RTC_INT )
 	{
@@ -472,14 +495,15 @@ void enableInterrupts(uint32_t conf)
 		pinMode(MUX_TX, INPUT);
 		pinMode(SENS2_INT_PIN_MON,INPUT);
 		pinMode(SENS2_INT_PIN2_MON,INPUT);
-		attachInterrupt(PLV_INT_ACT, onLAIwakeUP, LOW);
+		attachInterrupt(PLV_INT_ACT, onLAIwakeUP, laiMode());
 	}
 	
 	if( conf & RAD_INT )
 	{
 		pinMode(RAD_INT_PIN_MON,INPUT);
         pinMode(MUX_TX, INPUT);
-        attachInterrupt(RAD_INT_ACT, onLAIwakeUP, LOW);
+        // Edge triggered when pulses are counted in the interruption
+        attachInterrupt(RAD_INT_ACT, onLAIwakeUP, laiMode());
 	}
 }
 
@@ -534,6 +558,17 @@ void disableInterrupts(uint32_t conf)
 	{
 		detachInterrupt(PLV_INT_ACT);
 	}
+	if( conf & RAD_INT )
+	{
+		detachInterrupt(RAD_INT_ACT);
+		radIntFunc = 0;
+	}
 	intConf &= ~(conf);
+	
+	// INT3 is shared, keep counting radiation pulses if another source was detached
+	if( (intConf & RAD_INT) && radIntFunc )
+	{
+		attachInterrupt(RAD_INT_ACT, onLAIwakeUP, FALLING);
+	}
 	sei();
 }
@@ -31,7 +31,11 @@
 
 WaspACC::WaspACC()
 {
-    // nothing to do
+    streamBuffer = NULL;
+    streamSize = 0;
+    streamHead = 0;
+    streamCount = 0;
+    streamOverruns = 0;
 }
 
 // Public Methods //////////////////////////////////////////////////////////////
@@ -344,6 +348,202 @@ int16_t WaspACC::getZ(void)
   return aux;
 }
 
+/*
+ * getXYZ (values) - checks accelerometer's acceleration on the three axis
+ *
+ * stores in 'values' the combined contents of the data registers of OX, OY
+ * and OZ, read in one I2C transaction using the address auto increment
+ *
+ * returns 0 on success or -1 if error, activating ACC_ERROR_READING
+ */
+int16_t WaspACC::getXYZ(int16_t* values)
+{
+  uint8_t data[6];
+
+  if( readRegisters(outXlow, data, 6) ) return -1;
+
+  for( uint8_t i=0; i<3; i++ )
+  {
+    values[i] = ((int8_t)data[2*i+1]*256) + data[2*i];
+  }
+  return 0;
+}
+
+/*******************************************************************************
+ * STREAM OF SAMPLES
+ *******************************************************************************/
+
+/*
+ * beginStream (buffer, samples) - starts storing samples in a ring buffer
+ *
+ * 'buffer' must have room for 3*'samples' values. It is owned by the caller
+ * and used by the stream until endStream()
+ */
+void WaspACC::beginStream(int16_t* buffer, uint16_t samples)
+{
+  streamBuffer = buffer;
+  streamSize = samples;
+  streamHead = 0;
+  streamCount = 0;
+  streamOverruns = 0;
+}
+
+/*
+ * stream (void) - stores a new sample if the accelerometer has one
+ *
+ * the status register is just before the data registers, so both are read
+ * in one I2C transaction. When the buffer is full the oldest sample is
+ * overwritten
+ *
+ * returns 1 if a sample was stored, 0 otherwise
+ */
+uint8_t WaspACC::stream(void)
+{
+  uint8_t data[7];
+
+  if( (streamBuffer == NULL) || (streamSize == 0) ) return 0;
+  if( readRegisters(statusReg, data, 7) ) return 0;
+  if( !(data[0] & ACC_STATUS_ZYXDA) ) return 0;
+  if( data[0] & ACC_STATUS_ZYXOR ) streamOverruns++;
+
+  for( uint8_t i=0; i<3; i++ )
+  {
+    streamBuffer[3*streamHead+i] = ((int8_t)data[2*i+2]*256) + data[2*i+1];
+  }
+  streamHead++;
+  if( streamHead >= streamSize ) streamHead = 0;
+  if( streamCount < streamSize ) streamCount++;
+
+  return 1;
+}
+
+/*
+ * captureStream (samples) - stores new samples until 'samples' are stored
+ *
+ * returns the number of samples stored, it stops before if there is no new
+ * data during ACC_STREAM_TIMEOUT ms
+ */
+uint16_t WaspACC::captureStream(uint16_t samples)
+{
+  uint16_t stored = 0;
+  unsigned long previous = millis();
+
+  while( stored < samples )
+  {
+    if( stream() )
+    {
+      stored++;
+      previous = millis();
+    }
+    else if( millis()-previous > ACC_STREAM_TIMEOUT ) break;
+  }
+  return stored;
+}
+
+/*
+ * available (void) - returns the number of samples stored in the stream
+ */
+uint16_t WaspACC::available(void)
+{
+  return streamCount;
+}
+
+/*
+ * readStream (values) - takes the oldest sample out of the stream
+ *
+ * returns 1 if there was a sample, 0 otherwise
+ */
+uint8_t WaspACC::readStream(int16_t* values)
+{
+  uint16_t index;
+
+  if( streamCount == 0 ) return 0;
+  index = (streamHead + streamSize - streamCount) % streamSize;
+  for( uint8_t i=0; i<3; i++ ) values[i] = streamBuffer[3*index+i];
+  streamCount--;
+  return 1;
+}
+
+/*
+ * endStream (void) - stops the stream, the buffer is not used any more
+ */
+void WaspACC::endStream(void)
+{
+  streamBuffer = NULL;
+  streamSize = 0;
+  streamHead = 0;
+  streamCount = 0;
+}
+
+/*
+ * getRMS (axis) - RMS of an axis over the stored samples, without its mean
+ */
+float WaspACC::getRMS(uint8_t axis)
+{
+  int16_t mean = getStreamMean(axis);
+  uint16_t index;
+  float sum = 0;
+  float aux;
+
+  if( streamCount == 0 ) return 0;
+  index = (streamHead + streamSize - streamCount) % streamSize;
+  for( uint16_t n=0; n<streamCount; n++ )
+  {
+    aux = streamBuffer[3*index+axis] - mean;
+    sum += aux*aux;
+    if( ++index >= streamSize ) index = 0;
+  }
+  return sqrt(sum/streamCount);
+}
+
+/*
+ * getPeak (axis) - highest difference from its mean of an axis over the
+ * stored samples
+ */
+int16_t WaspACC::getPeak(uint8_t axis)
+{
+  int16_t mean = getStreamMean(axis);
+  uint16_t index;
+  int16_t peak = 0;
+  int16_t aux;
+
+  if( streamCount == 0 ) return 0;
+  index = (streamHead + streamSize - streamCount) % streamSize;
+  for( uint16_t n=0; n<streamCount; n++ )
+  {
+    aux = abs(streamBuffer[3*index+axis] - mean);
+    if( aux > peak ) peak = aux;
+    if( ++index >= streamSize ) index = 0;
+  }
+  return peak;
+}
+
+/*
+ * getZeroCrossings (axis) - number of times an axis crosses its mean over the
+ * stored samples. Samples equal to the mean don't change the side
+ */
+uint16_t WaspACC::getZeroCrossings(uint8_t axis)
+{
+  int16_t mean = getStreamMean(axis);
+  uint16_t index;
+  uint16_t crossings = 0;
+  int8_t side = 0;
+  int16_t aux;
+
+  if( streamCount == 0 ) return 0;
+  index = (streamHead + streamSize - streamCount) % streamSize;
+  for( uint16_t n=0; n<streamCount; n++ )
+  {
+    aux = streamBuffer[3*index+axis] - mean;
+    if( (aux > 0) && (side < 0) ) crossings++;
+    if( (aux < 0) && (side > 0) ) crossings++;
+    if( aux > 0 ) side = 1;
+    if( aux < 0 ) side = -1;
+    if( ++index >= streamSize ) index = 0;
+  }
+  return crossings;
+}
+
 /*******************************************************************************
  * HANDLE ACCELEROMETER'S WORK MODES                                           *
  *******************************************************************************/
@@ -624,6 +824,32 @@ int16_t WaspACC::readRegister(uint8_t regNum)
   return -1;
 }
 
+// reads consecutive registers from the accelerometer in one transaction
+// returns 0 or -1 if error
+int16_t WaspACC::readRegisters(uint8_t regNum, uint8_t* data, uint8_t length)
+{
+  // reset the flag
+  flag &= ~(ACC_ERROR_READING);
+
+  Wire.beginTransmission(i2cID);
+  Wire.send(regNum | ACC_AUTO_INCREMENT);
+  Wire.endTransmission();
+
+  Wire.requestFrom((uint8_t)i2cID, length);
+  for( uint8_t i=0; i<length; i++ )
+  {
+    if( !Wire.available() )
+    {
+      // error, activate the reading flag
+      flag |= ACC_ERROR_READING;
+      return -1;
+    }
+    data[i] = Wire.receive();
+  }
+
+  return 0;
+}
+
 // writes a byte to a register in the accelerometer
 // returns 0 or -1 if error
 int16_t WaspACC::writeRegister(uint8_t address, uint8_t val)
@@ -650,6 +876,22 @@ int16_t WaspACC::writeRegister(uint8_t address, uint8_t val)
 
 // Private Methods /////////////////////////////////////////////////////////////
 
+// mean of an axis over the samples stored in the stream
+int16_t WaspACC::getStreamMean(uint8_t axis)
+{
+  uint16_t index;
+  int32_t sum = 0;
+
+  if( streamCount == 0 ) return 0;
+  index = (streamHead + streamSize - streamCount) % streamSize;
+  for( uint16_t n=0; n<streamCount; n++ )
+  {
+    sum += streamBuffer[3*index+axis];
+    if( ++index >= streamSize ) index = 0;
+  }
+  return sum/streamCount;
+}
+
 // Preinstantiate Objects //////////////////////////////////////////////////////
 
 WaspACC ACC = WaspACC();
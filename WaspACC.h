@@ -465,6 +465,41 @@
  */
 #define ACC_RATE_2560 	4
 
+/*! \def ACC_AUTO_INCREMENT
+    \brief Register address bit that makes the accelerometer increment the address after each byte read
+ */
+#define ACC_AUTO_INCREMENT 0x80
+
+/*! \def ACC_STATUS_ZYXDA
+    \brief Status register bit. New data available on the three axis
+ */
+#define ACC_STATUS_ZYXDA 0x08
+
+/*! \def ACC_STATUS_ZYXOR
+    \brief Status register bit. Data overwritten before being read
+ */
+#define ACC_STATUS_ZYXOR 0x80
+
+/*! \def ACC_STREAM_TIMEOUT
+    \brief Milliseconds without new data before captureStream gives up
+ */
+#define ACC_STREAM_TIMEOUT 100
+
+/*! \def ACC_AXIS_X
+    \brief Axis index in the samples of the stream
+ */
+#define ACC_AXIS_X 	0
+
+/*! \def ACC_AXIS_Y
+    \brief Axis index in the samples of the stream
+ */
+#define ACC_AXIS_Y 	1
+
+/*! \def ACC_AXIS_Z
+    \brief Axis index in the samples of the stream
+ */
+#define ACC_AXIS_Z 	2
+
 /******************************************************************************
  * Class
  ******************************************************************************/
@@ -483,6 +518,33 @@ class WaspACC
      */ 
     uint8_t accMode;
 
+    //! Variable : Ring buffer of the stream, three values per sample
+    /*!
+     */ 
+    int16_t* streamBuffer;
+
+    //! Variable : Number of samples of the ring buffer
+    /*!
+     */ 
+    uint16_t streamSize;
+
+    //! Variable : Position of the next sample to write in the ring buffer
+    /*!
+     */ 
+    uint16_t streamHead;
+
+    //! Variable : Number of samples stored in the ring buffer
+    /*!
+     */ 
+    uint16_t streamCount;
+
+    //! It gets the mean of an axis over the samples stored in the stream
+    /*!
+    \param uint8_t axis : ACC_AXIS_X, ACC_AXIS_Y or ACC_AXIS_Z
+    \return the mean value
+     */
+    int16_t getStreamMean(uint8_t axis);
+
   public:
 
     //! class constructor
@@ -518,6 +580,11 @@ class WaspACC
     /*!    
     */
     uint8_t isON;
+
+    //! Variable : Number of times the accelerometer overwrote data before it was read by the stream
+    /*!    
+    */
+    uint16_t streamOverruns;
     
     //! It opens I2C bus and powers the accelerometer
     /*!
@@ -631,6 +698,16 @@ class WaspACC
     \sa readRegister(uint8_t val)
      */
     int16_t writeRegister(uint8_t address, uint8_t val);
+
+    //! It reads consecutive registers from the accelerometer in one I2C transaction
+    /*!
+    \param uint8_t address : first register address
+    \param uint8_t* data : where the values are stored
+    \param uint8_t length : number of registers to read, up to the Wire buffer length
+    \return '0' on success, '-1' if error
+    \sa readRegister(uint8_t address)
+     */
+    int16_t readRegisters(uint8_t address, uint8_t* data, uint8_t length);
     
     //! It gets the accelerometer's ADC mode
     /*!
@@ -679,6 +756,88 @@ class WaspACC
      */
     int16_t getZ();
 
+    //! It gets the acceleration on the three axis at once
+    /*!
+    It reads the six data registers in one I2C transaction, instead of the six transactions of getX(), getY() and getZ()
+    \param int16_t* values : array of three values where OX, OY and OZ are stored
+    \return '0' on success, '-1' if error
+    \sa getX(), getY(), getZ()
+     */
+    int16_t getXYZ(int16_t* values);
+
+    //! It starts storing the samples of the accelerometer in a ring buffer
+    /*!
+    Samples are stored at the rate set by setSamplingRate(), calling stream() or captureStream() often enough. When the buffer is full the oldest samples are overwritten
+    \param int16_t* buffer : ring buffer, with room for three values per sample
+    \param uint16_t samples : number of samples of the buffer
+    \return void
+    \sa stream(), captureStream(), endStream()
+     */
+    void beginStream(int16_t* buffer, uint16_t samples);
+
+    //! It stores a new sample in the stream if the accelerometer has one
+    /*!
+    Status and data registers are read in one I2C transaction
+    \param void
+    \return '1' if a sample was stored, '0' otherwise
+    \sa beginStream(), captureStream()
+     */
+    uint8_t stream();
+
+    //! It stores new samples in the stream until the specified number is reached
+    /*!
+    \param uint16_t samples : number of new samples to store
+    \return the number of samples stored, less than specified if the accelerometer stops giving data for ACC_STREAM_TIMEOUT ms
+    \sa beginStream(), stream()
+     */
+    uint16_t captureStream(uint16_t samples);
+
+    //! It gets the number of samples stored in the stream
+    /*!
+    \param void
+    \return number of samples
+     */
+    uint16_t available();
+
+    //! It takes the oldest sample out of the stream
+    /*!
+    \param int16_t* values : array of three values where OX, OY and OZ are stored
+    \return '1' if there was a sample, '0' otherwise
+     */
+    uint8_t readStream(int16_t* values);
+
+    //! It stops the stream and releases the ring buffer
+    /*!
+    \param void
+    \return void
+    \sa beginStream()
+     */
+    void endStream();
+
+    //! It gets the RMS of an axis over the samples stored in the stream, without its mean
+    /*!
+    \param uint8_t axis : ACC_AXIS_X, ACC_AXIS_Y or ACC_AXIS_Z
+    \return RMS value
+    \sa getPeak(), getZeroCrossings()
+     */
+    float getRMS(uint8_t axis);
+
+    //! It gets the peak of an axis over the samples stored in the stream, as the highest difference from its mean
+    /*!
+    \param uint8_t axis : ACC_AXIS_X, ACC_AXIS_Y or ACC_AXIS_Z
+    \return peak value
+    \sa getRMS(), getZeroCrossings()
+     */
+    int16_t getPeak(uint8_t axis);
+
+    //! It gets the number of times an axis crosses its mean over the samples stored in the stream
+    /*!
+    \param uint8_t axis : ACC_AXIS_X, ACC_AXIS_Y or ACC_AXIS_Z
+    \return number of crossings
+    \sa getRMS(), getPeak()
+     */
+    uint16_t getZeroCrossings(uint8_t axis);
+
     //! It sets the Free Fall interrupt using the parameters previously defined
     /*!
     \param void
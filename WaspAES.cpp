@@ -25,13 +25,17 @@
 #include "WaspClasses.h"
 #endif
 
+#include "aes/aes_enc.h"
+#include "aes/aes_dec.h"
+
 /*******************************************************************************
  * Class methods
 *******************************************************************************/
 
 /// Constructors ///////////////////////////////////////////////////////
 WaspAES::WaspAES(){
-   // nothing to do here
+  keyBits = 0;
+  rounds = 0;
 }
 
 /// Private Methods ////////////////////////////////////////////////////////////
@@ -59,80 +63,34 @@ uint8_t WaspAES::derechazo(uint8_t val, int nr)
   return val;
 }
 
-void WaspAES::ECBEncrypt(uint8_t *original_data,uint16_t size,uint16_t keySize){
-
-// In ECB mode is separated from message in blocks of 16 bytes and cipher each one individually
+void WaspAES::ECBEncrypt(uint8_t *original_data,uint16_t size){
 
-  uint16_t index,index2;
-  index = 0;
-  index2 = 0;
-  while( index < size ){
-    
-    for (int i =0; i<16;i++){
-      block_data[i]=original_data[index];
-      index++;
-    }
-    // Encrypt
-    switch(keySize){
-      case 128:
-        aes128_enc(block_data, &ctx128);
-	      break;
-      case 192:
-        aes192_enc(block_data, &ctx192);
-        break;
-      case 256:
+// In ECB mode is separated from message in blocks of 16 bytes and cipher each one individually.
+// Blocks are encrypted in place with the cached key schedule
 
-        aes256_enc(block_data, &ctx256);
-        break;
-    }
-	             
-    for (int i = 0; i<16;i++){
-      original_data[index2] = block_data[i];
-      index2++;
-    }
-  }   
+  for (uint16_t index = 0; index < size; index += 16){
+    aes_encrypt_core((aes_cipher_state_t*)&original_data[index],
+                     (aes_genctx_t*)&ctx, rounds);
+  }
 }
 
 /*
  *
 */
-void WaspAES::ECBDecrypt(uint8_t *original_data,uint16_t size,uint16_t keySize){
+void WaspAES::ECBDecrypt(uint8_t *original_data,uint16_t size){
 
   // In ECB mode is separated from message in blocks of 16 bytes and cipher each one individually
 
-  uint16_t index,index2;
-  index = 0;
-  index2 = 0;
-  
-  while(index<size){
-    
-      for (int i =0; i<16;i++){
-	block_data[i]=original_data[index];
-	index++;
-      }     
-      // Decrypt
-      switch(keySize){
-	case 128:
-	  aes128_dec(block_data, &ctx128);
-	  break;
-	case 192:
-	  aes192_dec(block_data, &ctx192);
-	  break;
-	case 256:
-	  aes256_dec(block_data, &ctx256);
-	  break;
-      }       
-      for (int i = 0; i<16;i++){
-	original_data[index2] = block_data[i];
-	index2++;
-      }      
-  }   
+  for (uint16_t index = 0; index < size; index += 16){
+    aes_decrypt_core((aes_cipher_state_t*)&original_data[index],
+                     (aes_genctx_t*)&ctx, rounds);
+  }
 }
 
 /*
  *
 */
-void WaspAES::CBCEncrypt(uint8_t *original_data,uint16_t size, uint8_t *InitialVector,uint16_t keySize){
+void WaspAES::CBCEncrypt(uint8_t *original_data,uint16_t size, uint8_t *InitialVector){
 ///////////////////////////
 // In CBC mode the message is divided into blocks of 16 bytes, to 1 block
 // Applied to the XOR and calculated its block cipher with block
@@ -140,63 +98,26 @@ void WaspAES::CBCEncrypt(uint8_t *original_data,uint16_t size, uint8_t *InitialV
 // And the result is encrypted with AES given, the result will be the 2nd block
 // Encryption, so on.
 //
-// This function is:
-// 1 - separated data block of 16 bytes,
-// 2 - XOR operation is performed with the IV / block precesor
-// 3 - was called to the encryption function
-// 4 - Once all blocks are encrypted will join
-// 5 - forms the encrypted message and returns
+// Each block is XORed with the IV / previous ciphertext block and
+// encrypted in place, so the previous block is always the one just
+// written to original_data
 //
 ///////////////////////////
 
-  uint8_t IV[16];
-  uint8_t Plain_text[16];
-  uint8_t Previous_block[16];
-  
-  uint16_t index,index2;
-  index = 0;
-  index2 = 0;
-  
-  //Assign Initial Vector to IV variable
-  assignBlock(IV,InitialVector);
-  
-  while(index<size){
-    // Encrypt
-    for (int i =0; i<16;i++){
-      Plain_text[i]= original_data[index];	
-      index++;
-    }
-    if (index == 16){
-      XOR(Plain_text,IV,block_data);
-    }else {
-      XOR(Plain_text,Previous_block,block_data);
-    }
+  uint8_t* previous = InitialVector;
 
-    switch(keySize){
-      case 128:
-	aes128_enc(block_data, &ctx128);
-	break;
-      case 192:
-	aes192_enc(block_data, &ctx192);
-	break;
-      case 256:
-	aes256_enc(block_data, &ctx256);
-	break;
-    }
-  
-    assignBlock(Previous_block,block_data);
-    
-    for (int i = 0; i<16;i++){
-      original_data[index2] = block_data[i];
-      index2++;
-    }
+  for (uint16_t index = 0; index < size; index += 16){
+    XOR(&original_data[index],previous,&original_data[index]);
+    aes_encrypt_core((aes_cipher_state_t*)&original_data[index],
+                     (aes_genctx_t*)&ctx, rounds);
+    previous = &original_data[index];
   }
 }
 
 /*
  *
 */
-void WaspAES::CBCDecrypt(uint8_t *original_data,uint16_t size, uint8_t *InitialVector,uint16_t keySize){
+void WaspAES::CBCDecrypt(uint8_t *original_data,uint16_t size, uint8_t *InitialVector){
 ///////////////////////////
 // In CBC mode the message is divided into blocks of 16 bytes, to 1 block
 // Applied to the XOR and calculated its block cipher with block
@@ -204,58 +125,23 @@ void WaspAES::CBCDecrypt(uint8_t *original_data,uint16_t size, uint8_t *InitialV
 // And the result is encrypted with AES given, the result will be the 2nd block
 // Encryption, so on.
 //
-// This function is:
-// 1 - separated data block of 16 bytes,
-// 2 - XOR operation is performed with the IV / block precesor
-// 3 - was called to the encryption function
-// 4 - Once all blocks are encrypted will join
-// 5 - forms the encrypted message and returns
+// Blocks are decrypted in place, the ciphertext of each block is kept
+// aside because it is the XOR input of the next one
 //
 ///////////////////////////
 
-
-  uint8_t IV[16];
-  uint8_t Plain_text[16];
   uint8_t Previous_block[16];
-  
-  uint16_t index,index2;
-  index = 0;
-  index2 = 0;
-  
-  //Assign Initial Vector to IV variable
-  assignBlock(IV,InitialVector);
-   
-  while(index < size){
-    //Decrypt
-    for (int i =0; i<16;i++){
-      block_data[i]= original_data[index];	
-      index++;
-    }
+  uint8_t Cipher_block[16];
 
-    assignBlock(Previous_block,block_data);
-	
-    switch(keySize){
-      case 128:
-	aes128_dec(block_data, &ctx128);
-	break;
-      case 192:
-	aes192_dec(block_data, &ctx192);
-	break;
-      case 256:
-	aes256_dec(block_data, &ctx256);
-	break;
-    }
-	  
-    if (index == 16){
-      XOR(block_data,IV,Plain_text);
-    }else {
-      XOR(block_data,Previous_block,Plain_text);
-    }	
-	
-    for (int i = 0; i<16;i++){
-      original_data[index2] = Plain_text[i];
-      index2++;
-    }
+  //Assign Initial Vector to the previous block
+  assignBlock(Previous_block,InitialVector);
+
+  for (uint16_t index = 0; index < size; index += 16){
+    assignBlock(Cipher_block,&original_data[index]);
+    aes_decrypt_core((aes_cipher_state_t*)&original_data[index],
+                     (aes_genctx_t*)&ctx, rounds);
+    XOR(&original_data[index],Previous_block,&original_data[index]);
+    assignBlock(Previous_block,Cipher_block);
   }
 }
 
@@ -511,59 +397,38 @@ uint8_t WaspAES::sizeOfBlocks(char* message){
  *
 */
 uint8_t WaspAES::init(char* Password, uint16_t keySize){
-  uint8_t* key;
+  uint8_t new_key[32];
+  uint8_t length;
+  size_t password_length;
 
   // Key Initialition 
   switch(keySize){
     case 128:
-      key = (uint8_t*) calloc(16,sizeof(uint8_t));
-      if (strlen(Password) < 17) {
-      	for (int i=0; i < strlen(Password);i++){
-      	  key[i] = Password[i];
-      	}
-      	if (strlen(Password) < 16){
-      	  for(int aux = strlen(Password); aux < 16; aux++){
-      	    key[aux] = 0;
-      	  }      
-      	}
-      }
-    	aes128_init(key, &ctx128);
-      break;
-      
     case 192:
-      key = (uint8_t*) calloc(24,sizeof(uint8_t));
-      if (strlen(Password) < 25) {
-      	for (int i = 0; i < strlen(Password);i++){
-      	  key[i] = Password[i];
-      	}
-      	if (strlen(Password) < 24){
-      	  for(int aux = strlen(Password); aux < 24; aux++){
-      	    key[aux] = 0;
-      	  }      
-      	}      	
-      }
-      aes192_init(key, &ctx192);
-      break;
-      
     case 256:
-
-      key = (uint8_t*) calloc(32,sizeof(uint8_t));
-      if (strlen(Password) < 33) {
-      	for (int i = 0; i < strlen(Password);i++){
-      	  key[i] = Password[i];
-      	}
-      	if (strlen(Password) < 32){
-      	  for(int aux = strlen(Password); aux < 32; aux++){
-      	    key[aux] = 0;
-      	  }      
-      	}
-      }
-      aes256_init(key, &ctx256);
       break;
-      
     default:
       return 0;
   }
+  length = keySize / 8;
+
+  // The password fills the key and the rest is padded with zeros. Passwords
+  // longer than the key are not used, the key is left all zeros
+  memset(new_key,0,sizeof(new_key));
+  password_length = strlen(Password);
+  if (password_length <= length){
+    memcpy(new_key,Password,password_length);
+  }
+
+  // Same key as the last call, the schedule is still valid
+  if ((keyBits == keySize) && (memcmp(key,new_key,length) == 0)){
+    return 1;
+  }
+
+  aes_init(new_key, keySize, (aes_genctx_t*)&ctx);
+  memcpy(key,new_key,sizeof(key));
+  keyBits = keySize;
+  rounds = keySize / 32 + 6;
   return 1;
   
 }
@@ -637,28 +502,21 @@ uint8_t WaspAES::encrypt(uint16_t KeySize,char* Password,char original_message[]
   
   // Varibales Declaration  
   uint16_t size;
+  uint16_t length;
   size = sizeOfBlocks(original_message);
-  uint8_t original_data[size];   
-  
+  length = strlen(original_message);
 
   if (init(Password,KeySize)){
-    // convert to uint8_t
-    for (uint16_t i = 0; i < strlen(original_message); i++){
-      original_data[i] = original_message[i];
-    }
+    // The message is padded and encrypted in place in the output buffer
+    memcpy(encrypted_message,original_message,length);
 
     // Padding the block??
-    if (strlen(original_message) < size ) { 
-      paddingEncrypt(original_data,size,strlen(original_message),padding);
+    if (length < size ) { 
+      paddingEncrypt(encrypted_message,size,length,padding);
     }
 
     if (mode == ECB){
-      ECBEncrypt(original_data,size,KeySize);
-    }
-
-    // convert to char
-    for (uint16_t i=0; i < size+1;i++){
-      encrypted_message[i] = original_data[i];
+      ECBEncrypt(encrypted_message,size);
     }
 
     return 1;
@@ -689,27 +547,22 @@ uint8_t WaspAES::encrypt(uint16_t keySize,char* password,char original_message[]
   
   // Variables declaration 
   uint16_t size;
+  uint16_t length;
   size = sizeOfBlocks(original_message);
-  uint8_t original_data[size];   
+  length = strlen(original_message);
  
   if (init(password,keySize)){
     
-    // Convert original message to uint8_t format
-    for (uint16_t i = 0; i < strlen(original_message); i++){
-      original_data[i] = original_message[i];
-    }
-    if (strlen(original_message) < size ) { // Se necesita rellenar el bloque
-      paddingEncrypt(original_data,size,strlen(original_message),padding);
+    // The message is padded and encrypted in place in the output buffer
+    memcpy(encrypted_message,original_message,length);
+    if (length < size ) { // Se necesita rellenar el bloque
+      paddingEncrypt(encrypted_message,size,length,padding);
     }
    
     if (mode == CBC){
-       CBCEncrypt(original_data,size,initialVector,keySize);
+       CBCEncrypt(encrypted_message,size,initialVector);
     }
 
-    // Convert original_data to char format
-    for (uint16_t i=0; i < size+1;i++){
-      encrypted_message[i] = original_data[i];
-    }
     return 1;
   
   }else{
@@ -747,11 +600,9 @@ uint8_t WaspAES::decrypt(uint16_t KeySize,char* Password,uint8_t encrypted_messa
     
     uint8_t original_data[size];
     
-    for (uint16_t x = 0; x < size; x++){
-      original_data[x] = encrypted_message[x];
-    }
+    memcpy(original_data,encrypted_message,size);
      if (mode == CBC){
-      CBCDecrypt(original_data,size,InitialVector,KeySize);
+      CBCDecrypt(original_data,size,InitialVector);
     }     
       
     
@@ -800,11 +651,9 @@ uint8_t WaspAES::decrypt(uint16_t KeySize,char* Password,uint8_t encrypted_messa
     
     uint8_t original_data[size];
     
-    for (uint16_t x = 0; x < size; x++){
-      original_data[x] = encrypted_message[x];
-    }
+    memcpy(original_data,encrypted_message,size);
      if (mode == ECB){
-      ECBDecrypt(original_data,size,KeySize);
+      ECBDecrypt(original_data,size);
     }   
     
     decrypted_message = paddingDecrypt(original_data,size,padding);
@@ -815,11 +664,11 @@ uint8_t WaspAES::decrypt(uint16_t KeySize,char* Password,uint8_t encrypted_messa
     }
    
     *original_size = decrypted_message.size_txt;
+    return 1;
   }else{
     USB.println("Wrong Key Size");
+    return 0;
   }
-
- 
 }
 
  void WaspAES::seedGenerator(uint8_t* seed){
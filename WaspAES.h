@@ -69,17 +69,28 @@ class WaspAES{
   
   private:
  
-    /*! \def data
-  	\brief Variable used to store the data before and after of encryption
-    */   
-    uint8_t block_data[16];  
-      
-    /*! \def Variable used to store the keys
-  	\brief (Size 16*11, 11 = 10 round and initial)
+    /*! \def ctx
+  	\brief Expanded key schedule of the last key used
+  	
+  	Sized for AES-256 (15 round keys), the 128 and 192 bit schedules use
+  	its first 11 or 13 round keys
+    */  
+    aes256_ctx_t ctx;
+
+    /*! \def key
+  	\brief Padded key the current schedule was derived from
+    */  
+    uint8_t key[32];
+
+    /*! \def keyBits
+  	\brief Size of the cached key in bits, 0 when no key is loaded
+    */  
+    uint16_t keyBits;
+
+    /*! \def rounds
+  	\brief Number of rounds for the cached key (10, 12 or 14)
     */  
-    aes128_ctx_t ctx128;
-    aes192_ctx_t ctx192;
-    aes256_ctx_t ctx256;
+    uint8_t rounds;
 
     //! Its refers to encryption messages with ECB mode
     /*!
@@ -88,10 +99,9 @@ class WaspAES{
      
     \param original_data unencrypted message
     \param size number of bytes that should occupy the message 
-    \param keySize Size of the key, this value can be 128, 192 or 256
     \return void
     */
-    void ECBEncrypt(uint8_t *original_data,uint16_t size,uint16_t keySize);
+    void ECBEncrypt(uint8_t *original_data,uint16_t size);
       
     //! Its refers to decryption messages with ECB mode
     /*!
@@ -100,10 +110,9 @@ class WaspAES{
        
     \param original_data encrypted message
     \param size number of bytes that should occupy the message 
-    \param keySize Size of the key, this value can be 128, 192 or 256
     \return void
     */
-    void ECBDecrypt(uint8_t *original_data,uint16_t size,uint16_t keySize);
+    void ECBDecrypt(uint8_t *original_data,uint16_t size);
     
     //! It refers to encryption messages with CBC mode
     /*!
@@ -117,11 +126,10 @@ class WaspAES{
     \param original_data unencrypted message
     \param size number of bytes that should occupy the message 
     \param InitialVector Initial Vector use to cipher in CBC mode.
-    \param keySize Size of the key, this value can be 128, 192 or 256
     \return void
     */
     void CBCEncrypt(uint8_t *original_data,uint16_t size, 
-               uint8_t *InitialVector,uint16_t keySize);
+               uint8_t *InitialVector);
       
 
     //! It refers to decryption messages with CBC mode
@@ -136,11 +144,10 @@ class WaspAES{
     \param original_data unencrypted message
     \param size number of bytes that should occupy the message 
     \param InitialVector Initial Vector use to cipher in CBC mode.
-    \param keySize Size of the key, this value can be 128, 192 or 256
     \return void
     */
     void CBCDecrypt(uint8_t *original_data,uint16_t size, 
-               uint8_t *InitialVector,uint16_t keySize);
+               uint8_t *InitialVector);
 
     //! It refers to padding of incomplete blocks in encryption process
     /*!
@@ -178,6 +185,14 @@ class WaspAES{
       
     void assignBlock(uint8_t *a, uint8_t *b);   
       
+    //! It loads the key schedule for a password
+    /*!
+    The schedule is only expanded again when the password or the key size
+    differ from the ones of the previous call
+    \param Password Password choose by user in char*
+    \param keySize Size of the key, this value can be 128, 192 or 256
+    \return 1 on success, 0 if keySize is not valid
+    */
     uint8_t init(char* Password, uint16_t keySize);  
 
     uint8_t derechazo(uint8_t val, int nr);  
@@ -27,6 +27,65 @@
 #ifdef WASPBT_PRO
 // Private Methods //
 
+/*
+ Function: Converts two hex characters, upper or lower case, into a byte.
+ Returns: byte value.
+ Parameters: 
+	text: hex characters.
+ Values: 
+*/
+static uint8_t bt_hex(const char* text)
+{
+	uint8_t value=0;
+	for(uint8_t z=0;z<2;z++){
+		value <<= 4;
+		if ((text[z]>='0')&&(text[z]<='9')) value |= text[z]-'0';
+		else if ((text[z]>='a')&&(text[z]<='f')) value |= text[z]-'a'+10;
+		else if ((text[z]>='A')&&(text[z]<='F')) value |= text[z]-'A'+10;
+	}
+	return value;
+}
+
+/*
+ Function: Opens a file of current folder to append data, creating it if needed.
+ Returns: file descriptor, NULL on error.
+ Parameters: 
+	filename: file to open.
+ Values: 
+*/
+static struct fat_file_struct* bt_open_end(const char* filename)
+{
+	struct fat_file_struct* fd;
+	int32_t offset=0;
+
+	fd = SD.openFile(filename);
+	if (fd==NULL){
+		if (!SD.create(filename)) return NULL;
+		fd = SD.openFile(filename);
+		if (fd==NULL) return NULL;
+	}
+	if (!fat_seek_file(fd,&offset,FAT_SEEK_END)){
+		SD.closeFile(fd);
+		return NULL;
+	}
+	return fd;
+}
+
+/*
+ Function: Writes a text line, ended by CR+LF, on an opened file.
+ Returns: '1' on success, '0' otherwise
+ Parameters: 
+	fd: file descriptor.
+	line: text to write.
+ Values: 
+*/
+static uint8_t bt_write_line(struct fat_file_struct* fd, const char* line)
+{
+	intptr_t length = strlen(line);
+	if (fat_write_file(fd,(const uint8_t*)line,length)!=length) return 0;
+	return (fat_write_file(fd,(const uint8_t*)"\r\n",2)==2);
+}
+
 /*
  Function: Reads discovered devices from UART and saves them into specific array.
  Returns: 
@@ -42,7 +101,6 @@ void  WaspBT_Pro::waitInquiryAnswer(long inquiryTime, uint16_t MAX_DEVICES, bool
 	delay(100);
 	char dummy[4];						// Keyword
 	char block[BLOCK_SIZE+1];				// Block with MAC, CoD y RSSI
-	char number[4];
 	bool totalFound=false;
 	char total[4];	
 	total[3]='\0';
@@ -66,9 +124,8 @@ void  WaspBT_Pro::waitInquiryAnswer(long inquiryTime, uint16_t MAX_DEVICES, bool
 					if (dummy[2]=='L'){
 						while(serialAvailable(1)<BLOCK_SIZE);
 						for(uint8_t x=0;x<BLOCK_SIZE;x++) block[x]= serialRead(1);	
-						// Saves device
-						parseBlock(block);						
-						numberOfDevices++;
+						// Saves device, once per MAC.
+						parseBlock(block);
 						#ifdef DEBUG_MODE
 						printBuffer2();
 						#endif
@@ -98,9 +155,8 @@ void  WaspBT_Pro::waitInquiryAnswer(long inquiryTime, uint16_t MAX_DEVICES, bool
 	if (name) parseNames();
 	#endif
 
+	#ifdef DEBUG_MODE
 	if (!limited){
-		sprintf(number, "%02u", numberOfDevices);
-		#ifdef DEBUG_MODE
 		// Compare total of devices found and total of devices saved. 
 		a = Utils.array2long(total);
 		if (a!=numberOfDevices){
@@ -109,20 +165,9 @@ void  WaspBT_Pro::waitInquiryAnswer(long inquiryTime, uint16_t MAX_DEVICES, bool
 			USB.print("inquiried:");
 			USB.print(a);
 			USB.print("; saved:");
-			USB.println(number);
-		#endif
-
-		if(!(SD.append(INQFILE,TOTAL))){
-			#ifdef DEBUG_MODE
-			USB.print(ERRORSD1);
-			#endif
-		}
-		if(!(SD.appendln(INQFILE,number))){
-			#ifdef DEBUG_MODE
-			USB.println(ERRORSD1);
-			#endif
-		}
+			USB.println((int)numberOfDevices);
 	}
+	#endif
     	Utils.setLED(LED1, LED_OFF);  // Inquiry while led on
    	
 }
@@ -185,7 +230,7 @@ bool  WaspBT_Pro::waitScanDeviceAnswer(long inquiryTime, char* mac)
 }
 
 /*
- Function: Read nodeID from EEPROM and Date from RTC. Writes them into INQFILE.
+ Function: Read nodeID from EEPROM and Date from RTC. They are saved with the devices.
  Returns: 
  Parameters: 
  Values: 
@@ -200,34 +245,13 @@ void WaspBT_Pro::getSetDateID(){
 	identifier[i]=Utils.readEEPROM(mem_addr); 
     	mem_addr++; 
   	}
+	identifier[8]='\0';
   	RTC.getTime();  // Get date and time 
-
-	// Read line number before start a new inquiry
-	numLinesBefore = SD.numln(INQFILE);
-
-	#ifdef DEBUG_MODE
-	USB.print("numlines before:");		
-	USB.println(numLinesBefore);
-	#endif
-
-	// Build data and time string
-	char * dateTime;
-	dateTime = (char*) calloc(28,sizeof(char));
-	sprintf(dateTime,"%02u-%02u-%02u;%02u:%02u; %s; ",RTC.date,RTC.month,RTC.year,RTC.hour,RTC.minute, identifier);
-
-	if(!(SD.append(INQFILE,dateTime))){
-		#ifdef DEBUG_MODE		
-		USB.println(ERRORSD1);
-		#endif
-	}
-	// free variables
-	free(dateTime);
-	dateTime=NULL;
 }
 #endif
 
 /*
- Function: Looks for friendly names and stores them.
+ Function: Looks for friendly names and stores them in device table.
 	NOTE: Inquiring with friendly names is avery slow process. 
 	      Setting timeout (in milliseconds) the process can be aborted.
  Returns: 
@@ -239,17 +263,14 @@ void WaspBT_Pro::parseNames(){
 
 int namesFound =0;
 char dummy[4];	
-int dummies = 0;					
+int dummies = 0;
+uint8_t mac[6];
+bt_device_t* device;					
 for (i = 0; i < 40; i++) theCommand[i] = ' ';	// Clear variable
 #ifdef DEBUG_MODE
 USB.println("Scanning names...");
 #endif
 
-if(!(SD.appendln(INQFILE,"Friendly names: "))){
-	#ifdef DEBUG_MODE
-	USB.print(ERRORSD1);
-	#endif
-}	
 //+++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
 long timeout = 60000;	// Timeout to wait for name responses.			
 //+++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
@@ -277,21 +298,9 @@ while( (millis()-previous<timeout) && (namesFound<numberOfDevices)) {
 						while(serialAvailable(1)<11);
 						for(uint8_t z=0;z<11;z++) dummy[0]=serialRead(1);
 						
-						// read and save corresponding mac
+						// read corresponding mac. Name is left empty.
 						while(serialAvailable(1)<BLOCK_MAC_SIZE);
 						for(uint8_t x=0;x<BLOCK_MAC_SIZE;x++) theCommand[x]= serialRead(1);
-						theCommand[BLOCK_MAC_SIZE+2]='N';
-						theCommand[BLOCK_MAC_SIZE+3]='O';
-						theCommand[BLOCK_MAC_SIZE+4]='N';
-						theCommand[BLOCK_MAC_SIZE+5]='A';
-						theCommand[BLOCK_MAC_SIZE+6]='M';
-						theCommand[BLOCK_MAC_SIZE+7]='E';
-						//save on SD
-						if(!(SD.appendln(INQFILE,theCommand))){
-							#ifdef DEBUG_MODE
-							USB.print(ERRORSD1);
-							#endif
-						}	
 													
 						namesFound++;
 						#ifdef DEBUG_MODE
@@ -310,12 +319,19 @@ while( (millis()-previous<timeout) && (namesFound<numberOfDevices)) {
 							}
 						}
 							
-						// NAME read. Now save into SD
-						if(!(SD.appendln(INQFILE,theCommand))){
-							#ifdef DEBUG_MODE
-							USB.print(ERRORSD1);
-							#endif
-						}		
+						// NAME read. Now save it with its device
+						parseMac(theCommand,mac);
+						device = findDevice(mac,false);
+						if (device!=NULL){
+							uint8_t x=0;
+							while((x<COMMAND_SIZE)&&(theCommand[x]!='"')) x++;
+							x++;
+							for(uint8_t z=0;z<BT_NAME_SIZE;z++){
+								if((x>=COMMAND_SIZE)||(theCommand[x]=='"')) break;
+								device->name[z]=theCommand[x];
+								x++;
+							}
+						}
 						
 						namesFound++;
 						#ifdef DEBUG_MODE
@@ -351,53 +367,131 @@ USB.println("");
 #endif
 
 /*
- Function: Saves inquiry data into specific array.
+ Function: Saves inquiry data into device table. A device answering again 
+	   updates its entry: RSSI is the highest one and last time is updated.
  Returns: 
-	'1' on success, '0' otherwise
+	'1' on success, '0' if table is full
  Parameters: 
 	block: array which contains inquiry data.
-	device: index used in data array.
  Values: 
 */
 uint8_t WaspBT_Pro::parseBlock(char* block)
 {
-	uint8_t flag=1;
-	char * dev;
-	dev = (char*) calloc(60, sizeof(char));
-	uint8_t x=1;
-	for(uint8_t z=0;z<17;z++){
-	mac_address[z]=block[x];	// Saves mac
-	x++;
-	}
-	x++;	
-	for(uint8_t z=0;z<6;z++){
-	CoD[z]=block[x];		// Saves CoD
-	x++;
-	}		
-	x= x+4;	
-	for(uint8_t z=0;z<3;z++){
-	RSSI[z]=block[x];		// Saves RSSI
-	x++;
+	uint8_t mac[6];
+	char number[4];
+	int8_t rssi;
+	uint16_t now;
+	bt_device_t* device;
+
+	// Block is " xx:xx:xx:xx:xx:xx cccccc ... rrr" with Mac, CoD and RSSI
+	parseMac(&block[1],mac);
+	device = findDevice(mac,true);
+	if (device==NULL){
+		lostDevices++;
+		return 0;
 	}
-	//save in file 
-	sprintf(dev, "%s; %s; %s;",mac_address,CoD,RSSI);
-	// Inside data, Check inquiry file
-	if ((SD.isFile(INQFILE))!=1) {
-		#ifdef DEBUG_MODE		
-		USB.println("No file1");
-		#endif
-		SD.create(INQFILE);
+
+	now = (millis()-inquiryStart)/100;
+	if (device->hits==0){
+		// New device
+		for(uint8_t z=0;z<3;z++) device->cod[z]=bt_hex(&block[19+2*z]);
+		device->rssi=-128;
+		device->first=now;
+		numberOfDevices++;
 	}
-	if(!(SD.appendln(INQFILE,dev))){
-		#ifdef DEBUG_MODE		
-		USB.println(ERRORSD1);
-		#endif
-		flag = 0;
+	for(uint8_t z=0;z<3;z++) number[z]=block[29+z];
+	number[3]='\0';
+	rssi=atoi(number);
+	if (rssi>device->rssi) device->rssi=rssi;
+	if (device->hits<255) device->hits++;
+	device->last=now;
+
+	return 1;
+}
+
+/*
+ Function: Allocates device table if needed and clears it. Called when an inquiry starts.
+ Returns: 
+	'1' on success, '0' if there is no memory for the table
+ Parameters: 
+ Values: 
+*/
+uint8_t WaspBT_Pro::clearDevices()
+{
+	if (devices==NULL) devices = (bt_device_t*) calloc(BT_TABLE_SIZE, sizeof(bt_device_t));
+	else memset(devices,0,BT_TABLE_SIZE*sizeof(bt_device_t));
+
+	numberOfDevices=0;
+	lostDevices=0;
+	inquiryStart=millis();
+	return (devices!=NULL);
+}
+
+/*
+ Function: Looks for a MAC in device table. Entries are placed by a hash of 
+	   the MAC and collisions go to the next free entry.
+ Returns: 
+	Entry of the device. If not found, a free entry with the MAC when 'add'
+	is true. NULL if not found and not added.
+ Parameters: 
+	mac: 6 bytes of MAC.
+	add: adds the MAC if not found.
+ Values: 
+*/
+bt_device_t* WaspBT_Pro::findDevice(uint8_t* mac, bool add)
+{
+	uint16_t hash=0;
+	uint16_t index;
+
+	if (devices==NULL) return NULL;
+
+	// All bytes are mixed, first ones are usually the same vendor.
+	for(uint8_t z=0;z<6;z++) hash = hash*31 + mac[z];
+	index = hash & (BT_TABLE_SIZE-1);
+
+	for(uint16_t n=0;n<BT_TABLE_SIZE;n++){
+		if (devices[index].hits==0){
+			if (!add) return NULL;
+			memcpy(devices[index].mac,mac,6);
+			return &devices[index];
+		}
+		if (!memcmp(devices[index].mac,mac,6)) return &devices[index];
+		index = (index+1) & (BT_TABLE_SIZE-1);
 	}
-	free(dev);
-	dev=NULL;
+	return NULL;	// Table full
+}
 
-	return flag;
+/*
+ Function: Parses a MAC written as "xx:xx:xx:xx:xx:xx".
+ Returns: 
+ Parameters: 
+	text: MAC text.
+	mac: 6 bytes array to store MAC.
+ Values: 
+*/
+void WaspBT_Pro::parseMac(char* text, uint8_t* mac)
+{
+	for(uint8_t z=0;z<6;z++) mac[z]=bt_hex(&text[3*z]);
+}
+
+/*
+ Function: Writes a device as "Mac; CoD; RSSI;" plus friendly name if known.
+ Returns: 
+ Parameters: 
+	device: entry of device table.
+	line: array of 48 bytes at least.
+ Values: 
+*/
+void WaspBT_Pro::formatDevice(bt_device_t* device, char* line)
+{
+	sprintf(line,"%02x:%02x:%02x:%02x:%02x:%02x; %02x%02x%02x; %d;",
+	device->mac[0],device->mac[1],device->mac[2],device->mac[3],device->mac[4],device->mac[5],
+	device->cod[0],device->cod[1],device->cod[2],device->rssi);
+	if (device->name[0]!='\0'){
+		strcat(line," ");
+		strncat(line,device->name,BT_NAME_SIZE);
+		strcat(line,";");
+	}
 }
 
 /*
@@ -737,7 +831,6 @@ uint8_t WaspBT_Pro::createSDFiles(){
 		#endif
 		flag = 0;
 		}
-		else SD.appendln(INQFILE,INQFILEHEAD);
 	}
 
 	if ((SD.isFile(HANDSFREEFILE))!=1) {
@@ -787,6 +880,9 @@ uint8_t WaspBT_Pro::createSDFiles(){
 WaspBT_Pro::WaspBT_Pro() {
 
 	i=0;
+	devices=NULL;
+	numberOfDevices=0;
+	lostDevices=0;
 	_baudRate=BT_BLUEGIGA_RATE;
 	_pwrMode=BT_ON;
 	_uart=1;
@@ -821,6 +917,10 @@ void WaspBT_Pro::OFF() {
 
 	setMode(BT_OFF);
 	closeSerial(_uart);
+
+	// Device table is not needed any more
+	free(devices);
+	devices=NULL;
 	Utils.setMux(MUX_TO_LOW,MUX_TO_LOW);
 	
 }
@@ -934,7 +1034,7 @@ return a;
 
 /*
  Function: Makes an inquiry to discover new devices.
- Returns: returns number of devices found.
+ Returns: returns number of devices found. '-1' if there is no memory for the device table.
  Parameters: 
 	time: Inquiry time.
 	power: Allowed TX power levels
@@ -956,31 +1056,30 @@ int8_t WaspBT_Pro::scanNetwork(uint8_t time, int8_t power) {
 			
 	inquiryTime = setInquiryTime(time);
 	
-	// write header for inquiry file
-	SD.cd("..");
 	#ifdef ENABLE_DATE_AND_TIME
 	getSetDateID();
 	#endif
-	if(!(SD.appendln(INQFILE,"ScanNetwork"))){
-		#ifdef DEBUG_MODE		
-		USB.println("err writting");
+
+	// the table is needed to count answers, do not start the inquiry without it
+	if (!clearDevices()){
+		#ifdef DEBUG_MODE
+		USB.println(ERRORMEM);
 		#endif
+		return -1;
 	}
 
 	sprintf(theCommand, "inquiry %u", time);		
 	sendCommand(theCommand);
 	
-	numberOfDevices = 0;
 	waitInquiryAnswer(inquiryTime, maxDevices, name, limited);
 	
-	// write line
-	if(!(SD.appendln(INQFILE,ENDSTRING))){
+	// save devices of this inquiry at once
+	SD.cd("..");
+	if(!saveDevices(BT_SCAN_NETWORK)){
 		#ifdef DEBUG_MODE		
 		USB.println(ERRORSD1);
 		#endif
 	}
-
-	numLinesAfter = SD.numln(INQFILE);
 	
 	delay(3000);
 	return numberOfDevices;
@@ -988,7 +1087,7 @@ int8_t WaspBT_Pro::scanNetwork(uint8_t time, int8_t power) {
 
 /*
  Function: It scans network and stops when finds "MAX_DEVICES". If max not reaches it scans max time (60s).
- Returns: Returns number of devices found.
+ Returns: Returns number of devices found. '-1' if there is no memory for the device table.
  Parameters: 
 	MAX_DEVICES: Maximum number of devices to find.
 	power: Allowed TX power levels
@@ -1005,21 +1104,21 @@ int8_t WaspBT_Pro::scanNetworkLimited(uint16_t MAX_DEVICES, int8_t power) {
 	
 	inquiryTime = setInquiryTime(48);
 	
-	// write header for inquiry file
-	SD.cd("..");
 	#ifdef ENABLE_DATE_AND_TIME
 	getSetDateID();
 	#endif
-	if(!(SD.appendln(INQFILE,"ScanNetworkLimited. "))){
-		#ifdef DEBUG_MODE		
-		USB.println(ERRORSD1);
+	
+	// the table is needed to count answers, do not start the inquiry without it
+	if (!clearDevices()){
+		#ifdef DEBUG_MODE
+		USB.println(ERRORMEM);
 		#endif
+		return -1;
 	}
-	
+
 	sprintf(theCommand, "inquiry 48");			// Inquiry command for max time
 	sendCommand(theCommand);
 	
-	numberOfDevices = 0;
 	waitInquiryAnswer(inquiryTime, MAX_DEVICES, name,limited);
 
 	if (numberOfDevices>=MAX_DEVICES){
@@ -1031,14 +1130,13 @@ int8_t WaspBT_Pro::scanNetworkLimited(uint16_t MAX_DEVICES, int8_t power) {
 	#endif
 	}
 
-	// write end line
-	if(!(SD.appendln(INQFILE,";"))){
+	// save devices of this inquiry at once
+	SD.cd("..");
+	if(!saveDevices(BT_SCAN_LIMITED)){
 		#ifdef DEBUG_MODE		
 		USB.println(ERRORSD1);
 		#endif
 	}
-
-	numLinesAfter = SD.numln(INQFILE);
 	
 	delay(3000);
 	return numberOfDevices;
@@ -1046,7 +1144,7 @@ int8_t WaspBT_Pro::scanNetworkLimited(uint16_t MAX_DEVICES, int8_t power) {
 
 /*
  Function: Makes an inquiry to discover specific device by its Mac.
- Returns: '0' if not found. Position in array otherwise.
+ Returns: '0' if not found. Position in array otherwise. '-1' if there is no memory for the device table.
  Parameters: 
 	Mac: Mac of device to discover
 	maxTime: Maximum time searching device
@@ -1056,7 +1154,7 @@ int8_t WaspBT_Pro::scanNetworkLimited(uint16_t MAX_DEVICES, int8_t power) {
 int16_t WaspBT_Pro::scanDevice(char* Mac, uint8_t maxTime, int8_t power) {	
 	
 	long inquiryTime= 0;
-	uint16_t maxDevices = DEFAULT_MAX_INQUIRY_RESULTS;					
+	bool found;
 
 	for (i = 0; i < COMMAND_SIZE; i++) theCommand[i] = ' ';		// Clears variable
 	if (txPower != power)changeInquiryPower(power);		// Checks previous value. Change only if different.
@@ -1067,57 +1165,36 @@ int16_t WaspBT_Pro::scanDevice(char* Mac, uint8_t maxTime, int8_t power) {
 	
 	inquiryTime = setInquiryTime(maxTime);
 
-	// write header for inquiry file
-	SD.cd("..");
 	#ifdef ENABLE_DATE_AND_TIME
 	getSetDateID();
 	#endif
-	if(!(SD.append(INQFILE,"ScanDevice: "))){
-		#ifdef DEBUG_MODE		
-		USB.println(ERRORSD1);
-		#endif
-	}
-	if(!(SD.appendln(INQFILE,Mac))){
-		#ifdef DEBUG_MODE		
-		USB.println(ERRORSD1);
+
+	// the table is needed to count answers, do not start the inquiry without it
+	if (!clearDevices()){
+		#ifdef DEBUG_MODE
+		USB.println(ERRORMEM);
 		#endif
+		return -1;
 	}
 
 	sprintf(theCommand, "inquiry %u", maxTime);			
 	sendCommand(theCommand);
 
-	numberOfDevices = 0;
+	found = waitScanDeviceAnswer(inquiryTime,Mac);
 
-	if(waitScanDeviceAnswer(inquiryTime,Mac)) {
-		// write end line
-		if(!(SD.appendln(INQFILE,";"))){
-			#ifdef DEBUG_MODE		
-			USB.println(ERRORSD1);
-			#endif
-		}
-		numLinesAfter = SD.numln(INQFILE);
-		return 1;
+	// save scan record, with the device if found
+	SD.cd("..");
+	if(!saveDevices(BT_SCAN_DEVICE)){
+		#ifdef DEBUG_MODE		
+		USB.println(ERRORSD1);
+		#endif
 	}
-	else {
-		// write end line
-		if(!(SD.appendln(INQFILE,"Not found."))){
-			#ifdef DEBUG_MODE		
-			USB.println(ERRORSD1);
-			#endif
-		}
-		if(!(SD.appendln(INQFILE,";"))){
-			#ifdef DEBUG_MODE		
-			USB.println(ERRORSD1);
-			#endif
-		}
-		numLinesAfter = SD.numln(INQFILE);
-		return 0;
-	}	
+	return found;
 }
 
 /*
  Function: Makes an inquiry to discover new devices
- Returns: returns number of devices found.
+ Returns: returns number of devices found. '-1' if there is no memory for the device table.
  Parameters: 
 	time: Inquiry time.
 	power: Allowed TX power levels
@@ -1140,33 +1217,31 @@ int8_t WaspBT_Pro::scanNetworkName(uint8_t time, int8_t power) {
 	
 	inquiryTime = setInquiryTime(time);
 	
-	// write header for inquiry file
-	SD.cd("..");
 	#ifdef ENABLE_DATE_AND_TIME
 	getSetDateID();
 	#endif
-	if(!(SD.appendln(INQFILE,"ScanNetworkName"))){
-		#ifdef DEBUG_MODE		
-		USB.println(ERRORSD1);
+
+	// the table is needed to count answers, do not start the inquiry without it
+	if (!clearDevices()){
+		#ifdef DEBUG_MODE
+		USB.println(ERRORMEM);
 		#endif
+		return -1;
 	}
 
 	sprintf(theCommand, "inquiry %u name", time);		
 	sendCommand(theCommand);
 	
-	numberOfDevices = 0;
-	
 	waitInquiryAnswer(inquiryTime, maxDevices, name, limited);
 
-	// write end line
-	if(!(SD.appendln(INQFILE,";"))){
+	// save devices of this inquiry at once, with their names
+	SD.cd("..");
+	if(!saveDevices(BT_SCAN_NAME)){
 		#ifdef DEBUG_MODE		
 		USB.println(ERRORSD1);
 		#endif
 	}
 
-	numLinesAfter = SD.numln(INQFILE);
-
 	delay(3000);
 	return numberOfDevices;
 }
@@ -1183,21 +1258,15 @@ uint8_t WaspBT_Pro::printInquiry(){
 
 	uint8_t flag=1;
 	USB.println("");
-	i=0;
-	SD.cd("..");
 
-	// check if file exist
-	if ((SD.isFile(INQFILE))!=1){
+	// check if there are devices
+	if ((devices==NULL)||(numberOfDevices==0)){
 		flag=0;
 		#ifdef DEBUG_MODE		
 		USB.println("no print");
 		#endif
 	}
-	else {
-		for(i=numLinesBefore+1;i<numLinesAfter-1;i++){
-			USB.print(SD.catln(INQFILE,i,1));
-		}
-	}
+	else printDevices(BT_CLASS_ALL);
 	return flag;
 }
 
@@ -1212,25 +1281,8 @@ uint8_t WaspBT_Pro::printMobiles(){
 
 	uint8_t flag=1;
 	USB.println("");
-	i=0;
-
-	if (mobileCounter!=0){
-	SD.cd("..");
 
-	// check if file exist
-	if ((SD.isFile(MOBILEFILE))!=1){
-		flag=0;
-		#ifdef DEBUG_MODE		
-		USB.println("no print");
-		#endif
-	}
-	else {
-		for(i=mobNumLinesBefore+2;i<mobNumLinesAfter-1;i++){
-			USB.print(SD.catln(MOBILEFILE,i,1));
-		}
-	}
-	
-	}
+	if (mobileCounter!=0) printDevices(BT_CLASS_MOBILE);
 	else USB.println("0 Mobile phones");
 
 	return flag;
@@ -1245,26 +1297,10 @@ uint8_t WaspBT_Pro::printMobiles(){
 uint8_t WaspBT_Pro::printHandsFree(){
 
 	uint8_t flag=1;
-	i=0;
 	USB.println("");
 
 	// if no new handsfree, print no handsfree
-	if (handsCounter!=0){
-	SD.cd("..");
-
-	// check if file exist
-	if ((SD.isFile(HANDSFREEFILE))!=1){
-		flag=0;
-		#ifdef DEBUG_MODE		
-		USB.println("no print");
-		#endif
-	}
-	else {
-		for(i=handsNumLinesBefore+2;i<handsNumLinesAfter-1;i++){
-			USB.print(SD.catln(HANDSFREEFILE,i,1));
-		}
-	}
-	}
+	if (handsCounter!=0) printDevices(BT_CLASS_HANDSFREE);
 	else USB.println("0 handsfree");
 
 	return flag;
@@ -1307,6 +1343,137 @@ MINOR DEVICE CLASS:
 
 */
 
+/*
+ Function: Gets class of a device from major device class of its CoD.
+ Returns: 
+	BT_CLASS_HANDSFREE, BT_CLASS_MOBILE or BT_CLASS_OTHERS
+ Parameters: 
+	device: entry of device table.
+ Values: 
+*/
+uint8_t WaspBT_Pro::deviceClass(bt_device_t* device){
+
+	switch (device->cod[1] & 0x1F){
+		case 0x04:	return BT_CLASS_HANDSFREE;	// Audio/video
+		case 0x02:	return BT_CLASS_MOBILE;		// Phone
+		default:	return BT_CLASS_OTHERS;
+	}
+}
+
+/*
+ Function: Prints devices of last inquiry of a class.
+ Returns: 
+ Parameters: 
+	type: BT_CLASS_ALL or class of devices to print.
+ Values: 
+*/
+void WaspBT_Pro::printDevices(uint8_t type){
+
+	char line[48];
+
+	if (devices==NULL) return;
+	for(uint16_t k=0;k<BT_TABLE_SIZE;k++){
+		if (devices[k].hits==0) continue;
+		if ((type!=BT_CLASS_ALL)&&(deviceClass(&devices[k])!=type)) continue;
+		formatDevice(&devices[k],line);
+		USB.println(line);
+	}
+}
+
+/*
+ Function: Saves device table of last inquiry on INQFILE, all through one 
+	   opened file. A scan record goes first, then one record per device.
+	   All records have BT_RECORD_SIZE bytes:
+	   Scan:   'S', type, year, month, date, hour, minute, second, ID (8 bytes),
+		   devices (2 bytes), lost devices (2 bytes), 4 reserved bytes.
+	   Device: 'D', bt_device_t (23 bytes).
+	   Numbers of more than one byte are little endian.
+ Returns: 
+	'1' on success, '0' otherwise
+ Parameters: 
+	scanType: type of inquiry, BT_SCAN_NETWORK, BT_SCAN_LIMITED...
+ Values: 
+*/
+uint8_t WaspBT_Pro::saveDevices(uint8_t scanType){
+
+	struct fat_file_struct* fd;
+	uint8_t record[BT_RECORD_SIZE];
+	uint8_t flag=1;
+
+	fd = bt_open_end(INQFILE);
+	if (fd==NULL) return 0;
+
+	memset(record,0,BT_RECORD_SIZE);
+	record[0]=BT_RECORD_SCAN;
+	record[1]=scanType;
+	record[2]=RTC.year;
+	record[3]=RTC.month;
+	record[4]=RTC.date;
+	record[5]=RTC.hour;
+	record[6]=RTC.minute;
+	record[7]=RTC.second;
+	memcpy(&record[8],identifier,8);
+	record[16]=numberOfDevices & 0xFF;
+	record[17]=numberOfDevices >> 8;
+	record[18]=lostDevices & 0xFF;
+	record[19]=lostDevices >> 8;
+	if (fat_write_file(fd,record,BT_RECORD_SIZE)!=BT_RECORD_SIZE) flag=0;
+
+	if (devices!=NULL){
+		for(uint16_t k=0;(k<BT_TABLE_SIZE)&&flag;k++){
+			if (devices[k].hits==0) continue;
+			record[0]=BT_RECORD_DEVICE;
+			memcpy(&record[1],&devices[k],sizeof(bt_device_t));
+			if (fat_write_file(fd,record,BT_RECORD_SIZE)!=BT_RECORD_SIZE) flag=0;
+		}
+	}
+
+	SD.closeFile(fd);
+	if (!sd_raw_sync()) flag=0;
+	return flag;
+}
+
+/*
+ Function: Appends devices of last inquiry of a class to a text file, with 
+	   date, ID and total. All lines are written through one opened file.
+ Returns: 
+	'1' on success, '0' otherwise
+ Parameters: 
+	filename: text file of the class.
+	type: class of devices to save.
+	counter: number of devices of the class.
+ Values: 
+*/
+uint8_t WaspBT_Pro::saveClass(const char* filename, uint8_t type, uint8_t counter){
+
+	struct fat_file_struct* fd;
+	char line[48];
+	uint8_t flag=1;
+
+	fd = bt_open_end(filename);
+	if (fd==NULL) return 0;
+
+	// Header with date and ID of the inquiry
+	sprintf(line,"%02u-%02u-%02u;%02u:%02u; %s; ",RTC.date,RTC.month,RTC.year,RTC.hour,RTC.minute,identifier);
+	flag &= bt_write_line(fd,line);
+
+	if (devices!=NULL){
+		for(uint16_t k=0;(k<BT_TABLE_SIZE)&&flag;k++){
+			if ((devices[k].hits==0)||(deviceClass(&devices[k])!=type)) continue;
+			formatDevice(&devices[k],line);
+			flag &= bt_write_line(fd,line);
+		}
+	}
+
+	sprintf(line,"%s%02u",TOTAL,counter);
+	flag &= bt_write_line(fd,line);
+	flag &= bt_write_line(fd,ENDSTRING);
+
+	SD.closeFile(fd);
+	if (!sd_raw_sync()) flag=0;
+	return flag;
+}
+
 /*
  Function: Classify devices of last inquiry
  Returns: 
@@ -1316,132 +1483,34 @@ MINOR DEVICE CLASS:
 */
 uint8_t WaspBT_Pro::classifyDevices(){
 
-	// !!!!_!!!!
-	// warning, used here global variables CoD and Mac. check if this has no relevance in other methods.	
-	
 	uint8_t flag=1;
-	char * readLine;
-	uint8_t deviceType;
 	handsCounter=0;
 	mobileCounter=0;
 	othersCounter=0;
-	char number[4];
 
 	// check if an Sd is present
 	if (SD.isSD()==0) USB.println("No SD");
 
-	i=0;
-	SD.cd("..");
-
-	// set variables for printing
-	mobNumLinesBefore = SD.numln(MOBILEFILE);
-	handsNumLinesBefore = SD.numln(HANDSFREEFILE);
-	
-	// Write headers it into each file.
-	readLine = SD.catln(INQFILE,numLinesBefore,1);	// also possible with strcpy
-	SD.appendln(HANDSFREEFILE,readLine);
-	SD.appendln(MOBILEFILE,readLine);
-	SD.appendln(OTHERSFILE,readLine);
-	// (...)
-	
-	// Loop to get each line of last inquiry and parse it.
-	for(i=numLinesBefore+1;i<numLinesAfter-2;i++){
-
-		readLine = SD.catln(INQFILE,i,1);	// also possible with strcpy
-		
-		// classify mac - develop this part
-		// ----
-		// read mac
-		sprintf(mac_address,"%c%c%c%c%c%c%c%c%c%c%c%c%c%c%c%c%c",readLine[0],readLine[1],readLine[2],readLine[3],
-		readLine[4],readLine[5],readLine[6],readLine[7],readLine[8],readLine[9],readLine[10],readLine[11],readLine[12],
-		readLine[13],readLine[14],readLine[15],readLine[16]);
-
-		//read CoD
-		sprintf(CoD,"%c%c%c%c%c%c",readLine[19],readLine[20],readLine[21],readLine[22],readLine[23],readLine[24]);
-		
-		// Classify CoD 	//develop this part
-
-		// Easy way. Redo for more accurate classification
-
-		// Handsfree
-		if (CoD[3]=='4'){
-			handsCounter++;
-			if(!(SD.append(HANDSFREEFILE,mac_address))){
-				flag=0;
-				#ifdef DEBUG_MODE		
-				USB.println(ERRORSD1);
-				#endif
-			}
-			#ifdef DEBUG_MODE		
-				USB.println("hansfree");
-			#endif
-
-			SD.append(HANDSFREEFILE,";");
-			SD.append(HANDSFREEFILE," ");
-			SD.append(HANDSFREEFILE,CoD);
-			SD.appendln(HANDSFREEFILE,";");
-
-		}
-		else {
-			// Mobile
-			if (CoD[3]=='2'){
-				mobileCounter++;
-				if(!(SD.append(MOBILEFILE,mac_address))){
-					flag=0;
-					#ifdef DEBUG_MODE		
-					USB.println(ERRORSD1);
-					#endif
-				}
-				#ifdef DEBUG_MODE		
-				USB.println("Mobile");
-				#endif
-				SD.append(MOBILEFILE,";");
-				SD.append(MOBILEFILE," ");
-				SD.append(MOBILEFILE,CoD);
-				SD.appendln(MOBILEFILE,";");
-			}
-			else {
-				//others
-				othersCounter++;
-				if(!(SD.append(OTHERSFILE,mac_address))){
-					flag=0;
-					#ifdef DEBUG_MODE		
-					USB.println(ERRORSD1);
-					#endif
-				}
-				#ifdef DEBUG_MODE		
-				USB.println("other");
-				#endif
-
-				SD.append(OTHERSFILE,";");
-				SD.append(OTHERSFILE," ");
-				SD.append(OTHERSFILE,CoD);
-				SD.appendln(OTHERSFILE,";");
+	// Classify devices from table, no need to read them again from SD
+	if (devices!=NULL){
+		for(uint16_t k=0;k<BT_TABLE_SIZE;k++){
+			if (devices[k].hits==0) continue;
+			switch (deviceClass(&devices[k])){
+				case BT_CLASS_HANDSFREE:	handsCounter++; break;
+				case BT_CLASS_MOBILE:		mobileCounter++; break;
+				default:			othersCounter++; break;
 			}
 		}
-	}	//end loop
+	}
 
-	// write totals
-	sprintf(number, "%02u", mobileCounter);
-	SD.append(MOBILEFILE,TOTAL);
-	SD.appendln(MOBILEFILE,number);
-		
-	sprintf(number, "%02u", handsCounter);
-	SD.append(HANDSFREEFILE,TOTAL);
-	SD.appendln(HANDSFREEFILE,number);
-
-	sprintf(number, "%02u", othersCounter);
-	SD.append(OTHERSFILE,TOTAL);
-	SD.appendln(OTHERSFILE,number);
-
-	// write end of inquiry.
-	SD.appendln(HANDSFREEFILE,ENDSTRING);
-	SD.appendln(MOBILEFILE,ENDSTRING);
-	SD.appendln(OTHERSFILE,ENDSTRING);
-	
-	// set variables for printing
-	mobNumLinesAfter = SD.numln(MOBILEFILE);
-	handsNumLinesAfter = SD.numln(HANDSFREEFILE);
+	SD.cd("..");
+	if (!saveClass(HANDSFREEFILE,BT_CLASS_HANDSFREE,handsCounter)) flag=0;
+	if (!saveClass(MOBILEFILE,BT_CLASS_MOBILE,mobileCounter)) flag=0;
+	if (!saveClass(OTHERSFILE,BT_CLASS_OTHERS,othersCounter)) flag=0;
+
+	#ifdef DEBUG_MODE
+	if (!flag) USB.println(ERRORSD1);
+	#endif
 
 	return flag;
 
@@ -62,10 +62,31 @@
 #define BT_PW   42				// Bluetooth pin
 #define TOTAL			"Total: "
 #define ERRORSD1		"errSD1"	// Error writting.
+#define ERRORMEM		"errMem"	// No memory for the device table.
+
+// Device table
+#ifndef BT_TABLE_SIZE
+#define BT_TABLE_SIZE		32		// Devices kept in RAM per inquiry (power of two). 23 bytes each
+#endif
+#define BT_NAME_SIZE		8		// Bytes of friendly name kept per device
+#define BT_RECORD_SIZE		24		// Bytes per record in INQFILE
+#define BT_RECORD_SCAN		'S'		// Record with date, ID and totals of an inquiry
+#define BT_RECORD_DEVICE	'D'		// Record with a discovered device
+
+// Inquiry types, saved in scan records
+#define BT_SCAN_NETWORK		0
+#define BT_SCAN_LIMITED		1
+#define BT_SCAN_NAME		2
+#define BT_SCAN_DEVICE		3
+
+// Device classes, from major device class of CoD
+#define BT_CLASS_ALL		0
+#define BT_CLASS_HANDSFREE	1
+#define BT_CLASS_MOBILE		2
+#define BT_CLASS_OTHERS		3
 
 // File names definitions
-#define INQFILE 		"Devices.txt"
-#define INQFILEHEAD     	"Discovered devices"
+#define INQFILE 		"Devices.dat"	// Binary file, BT_RECORD_SIZE bytes per record
 #define HANDSFREEFILE		"Handsfree.txt"
 #define HANDSFREEFILEHEAD	"Discovered handsfree"
 #define MOBILEFILE		"Mobile.txt"
@@ -87,6 +108,45 @@
 #define TX_POWER_MAX_WT12	3	// maximum value
 
 
+//! Structure : used for storing the discovered devices of an inquiry
+/*!
+	Saved as is in INQFILE, after a BT_RECORD_DEVICE byte.
+ */
+typedef struct
+{
+	//! Variable : MAC address
+    	/*!
+	 */
+	uint8_t mac[6];
+
+	//! Variable : class of device
+    	/*!
+	 */
+	uint8_t cod[3];
+
+	//! Variable : highest RSSI received
+    	/*!
+	 */
+	int8_t rssi;
+
+	//! Variable : number of inquiry answers. '0' if entry is free
+    	/*!
+	 */
+	uint8_t hits;
+
+	//! Variable : first and last answer, in tenths of second from inquiry start
+    	/*!
+	 */
+	uint16_t first;
+	uint16_t last;
+
+	//! Variable : friendly name. Not terminated if it fills the array
+    	/*!
+	 */
+	char name[BT_NAME_SIZE];
+} bt_device_t;
+
+
 /******************************************************************************
  * Class
  ******************************************************************************/
@@ -109,20 +169,15 @@ class WaspBT_Pro
 	 */
 	int8_t txPower;
 
-	//! Variable : MAC address
-    	/*!
-	 */
-	char mac_address[BLOCK_MAC_SIZE+1];
-	
-	//! Variable : class of device
-    	/*!
+	//! Variable : table of devices of last inquiry, indexed by a hash of MAC
+    	/*! Allocated when an inquiry starts and freed by OFF()
 	 */
-	char CoD[7];
-	
-	//! Variable : RSSI
+	bt_device_t* devices;
+
+	//! Variable : stores millis() when inquiry started
     	/*!
 	 */
-	char RSSI[4];	
+	unsigned long inquiryStart;
 
 	//! Variable : array for storing the data received from the module
     	/*!
@@ -162,35 +217,6 @@ class WaspBT_Pro
 	 */
 	char identifier[9];
 
-	//! Variable : Stores number of lines of devices file before inquiry
-    	/*!
-	 */
-	uint32_t numLinesBefore;
-
-	//! Variable : Stores number of lines of devices file after inquiry.
-    	/*!
-	 */
-	uint32_t numLinesAfter;
-
-	//! Variable : Stores number of lines of mobile file before inquiry
-    	/*!
-	 */
-	uint32_t mobNumLinesBefore;
-
-	//! Variable : Stores number of lines of mobile file after inquiry.
-    	/*!
-	 */
-	uint32_t mobNumLinesAfter;
-
-	//! Variable : Stores number of lines of handsfree file before inquiry
-    	/*!
-	 */
-	uint32_t handsNumLinesBefore;
-
-	//! Variable : Stores number of lines of handsfree file after inquiry.
-    	/*!
-	 */
-	uint32_t handsNumLinesAfter;
 	
 	//! Set power saving mode of bluetooth device.  
     	/*!
@@ -233,6 +259,46 @@ class WaspBT_Pro
 	 */
 	uint8_t parseBlock(char* block);
 
+	//! Allocates and clears device table before an inquiry.
+    	/*!
+	 */
+	uint8_t clearDevices();
+
+	//! Looks for a MAC in device table. Adds it if not found and 'add' is true.
+    	/*!
+	 */
+	bt_device_t* findDevice(uint8_t* mac, bool add);
+
+	//! Parses a MAC written as "xx:xx:xx:xx:xx:xx".
+    	/*!
+	 */
+	void parseMac(char* text, uint8_t* mac);
+
+	//! Writes a device of the table as a text line.
+    	/*!
+	 */
+	void formatDevice(bt_device_t* device, char* line);
+
+	//! Gets class of a device from its CoD.
+    	/*!
+	 */
+	uint8_t deviceClass(bt_device_t* device);
+
+	//! Saves device table on INQFILE, after a scan record.
+    	/*!
+	 */
+	uint8_t saveDevices(uint8_t scanType);
+
+	//! Appends devices of a class and its total to a text file.
+    	/*!
+	 */
+	uint8_t saveClass(const char* filename, uint8_t type, uint8_t counter);
+
+	//! Prints devices of a class.
+    	/*!
+	 */
+	void printDevices(uint8_t type);
+
 	//! Reads UART while inquiry is being answered.
     	/*!
 	 */
@@ -295,10 +361,15 @@ class WaspBT_Pro
 	WaspBT_Pro();
 	
 	//! Variable : Stores number of discovered devices during an inquiry
-    	/*!
+    	/*! Devices answering several times are counted once
 	 */
 	uint16_t numberOfDevices;
 
+	//! Variable : Stores number of devices not saved because table was full
+    	/*!
+	 */
+	uint16_t lostDevices;
+
 	//! Variable : Stores number of discovered handsfree during an inquiry
     	/*!
 	 */
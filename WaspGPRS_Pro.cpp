@@ -34,6 +34,12 @@ WaspGPRS_Pro::WaspGPRS_Pro()
 	_pwrMode=GPRS_PRO_ON;
 	_uart=1;
 	not_ready=1;
+	for(uint8_t i=0; i<GPRS_PRO_MAX_URC; i++)
+	{
+		urc_prefix[i]=NULL;
+		urc_handler[i]=NULL;
+	}
+	urc_length=0;
 }
 
 
@@ -247,20 +253,12 @@ byte WaspGPRS_Pro::sendCommand(const char* theText, const char* endOfCommand, co
 byte WaspGPRS_Pro::sendCommand(const char* theText, const char* endOfCommand, const char* expectedAnswer, int MAX_TIMEOUT, int sendOnce) {
     int timeout = 0;
 
-    int length=sprintf(theCommand, "%s%s", theText,endOfCommand);
-    
+    sprintf(theCommand, "%s%s", theText,endOfCommand);
 
   // try sending the command
   // wait for serial response
-    timeout = 0;
     serialFlush(_uart);
-    while(!serialAvailable(_uart) && timeout < MAX_TIMEOUT) {
-        if (!sendOnce || !timeout) {
-            printString(theCommand,_uart);
-        }
-        delay(DELAY_ON_SEND);
-        timeout++;
-    };
+    timeout = sendWithRetries(MAX_TIMEOUT, sendOnce);
 
     int answer= waitForData( expectedAnswer, MAX_TIMEOUT, timeout, 0);
     
@@ -319,20 +317,12 @@ byte WaspGPRS_Pro::sendCommand(const char* theText, const char* endOfCommand, co
 byte WaspGPRS_Pro::sendCommand(const char* theText, const char* endOfCommand, const char* expectedAnswer1, const char* expectedAnswer2, int MAX_TIMEOUT, int sendOnce) {
     int timeout = 0;
 
-    int length=sprintf(theCommand, "%s%s", theText,endOfCommand);
-    
+    sprintf(theCommand, "%s%s", theText,endOfCommand);
 
   // try sending the command
   // wait for serial response
-    timeout = 0;
     serialFlush(_uart);
-    while(!serialAvailable(_uart) && timeout < MAX_TIMEOUT) {
-        if (!sendOnce || !timeout) {
-            printString(theCommand,_uart);
-        }
-        delay(DELAY_ON_SEND);
-        timeout++;
-    };
+    timeout = sendWithRetries(MAX_TIMEOUT, sendOnce);
 
     int answer= waitForData( expectedAnswer1, expectedAnswer2, MAX_TIMEOUT, timeout, 0);
     
@@ -341,212 +331,18 @@ byte WaspGPRS_Pro::sendCommand(const char* theText, const char* endOfCommand, co
 
 
 byte WaspGPRS_Pro::waitForData(const char* expectedAnswer1, const char* expectedAnswer2, int MAX_TIMEOUT, int timeout, int seconds) {
-
-	for (int i = 0; i < 100; i++) theCommand[i] = ' ';
-
-	int theLength1 = 0;
-	int theLength2 = 0;
-	int it=0;
-	bool theSame=false;	
-	uint8_t first=1;
-	int cont=0;
-	int cont2=0;
-	char aux;
-    
-	while( expectedAnswer1[theLength1]!='\0' ) theLength1++;
-	while( expectedAnswer2[theLength2]!='\0' ) theLength2++;
-		
-	// if there is a heating time, then wait to see if you got
-	// any data from the serial port
-	while (seconds >0) {
-		delay(1000);
-		seconds--;
-	}
-		
-	while(timeout < MAX_TIMEOUT) {
-		while(!serialAvailable(_uart) && timeout < MAX_TIMEOUT) {
-			timeout++;
-			delay(1000);
-		}
-		
-		while( serialAvailable(_uart))
-		{
-			if( first )
-			{
-				if(theLength1>=theLength2)
-				{					
-					for(it=0;it<theLength2;it++)
-					{
-						theCommand[it]=serialRead(_uart);
-						delay(20);
-					}
-				}
-				else
-				{
-					for(it=0;it<theLength1;it++)
-					{
-						theCommand[it]=serialRead(_uart);
-						delay(20);
-					}
-				}
-				first=0;
-			}
-			else
-			{
-				if(serialAvailable(_uart))
-				{
-					theCommand[it]=serialRead(_uart);
-					it++;
-				}
-			}
-			
-			cont=0;
-			cont2=0;
-			boolean ok=false;
-			while(cont<it)	//compares with expectedAnswer1
-			{
-				if(theCommand[cont]==expectedAnswer1[cont2])
-				{
-					cont2=0;
-					while(expectedAnswer1[cont2]!='\0')
-					{
-						if (theCommand[cont+cont2]==expectedAnswer1[cont2])
-						{    
-							cont2++;
-							ok=true; 
-						}
-						else
-						{
-							ok=false; 
-							break;
-						}
-					}
-					if(ok)
-					{
-						return 1;
-					}
-				}
-			
-				
-				cont++;
-				cont2=0;
-			}
-  
-			cont=0;
-			cont2=0;
-			ok=false;
-			
-			while(cont<it)	//compares with expectedAnswer2
-			{
-				if (theCommand[cont]==expectedAnswer2[cont2])
-				{
-					cont2=0;
-					while(expectedAnswer2[cont2]!='\0')
-					{
-						if (theCommand[cont+cont2]==expectedAnswer2[cont2])
-						{    
-							cont2++;
-							ok=true; 
-						}
-						else
-						{
-							ok=false; 
-							break;
-						}
-					}  
-					if(ok)
-					{
-						/*USB.println("ERROR CME");
-						if(expectedAnswer2==ERROR_CME){
-							USB.println("ERROR ESPECIAL");
-							while(serialRead(_uart)!=' ');
-							
-							CME_CMS_code=0;
-							aux=serialRead(_uart);
-							do{	//gets the length of the data string
-								CME_CMS_code*=10;
-								CME_CMS_code+=aux-0x30;
-								aux=serialRead(_uart);
-							}while(aux!='\r');
-						}*/
-						return 2;
-					} 
-				}
-				cont++;
-				cont2=0;
-			}
-  			
-		}
-	}
-	return 0;
+	
+	// 'timeout' seconds of the 'MAX_TIMEOUT' budget are already used. The
+	// heating time is added to the wait, data received meanwhile stays in the
+	// UART buffer and is matched as soon as the wait starts
+	if( timeout>MAX_TIMEOUT ) timeout=MAX_TIMEOUT;
+	return readAnswer(expectedAnswer1, expectedAnswer2, (unsigned long)(MAX_TIMEOUT-timeout+seconds)*1000);
 }
 
 byte WaspGPRS_Pro::waitForData(const char* expectedAnswer, int MAX_TIMEOUT, int timeout, int seconds) {
-
-	for (int i = 0; i < 100; i++) theCommand[i] = ' ';
-
-	int theLength = 0;
-	int it=0;
-	bool theSame=false;	
-	uint8_t first=1;
-	uint8_t match=0;
-    
-	while( expectedAnswer[theLength]!='\0' ) theLength++;
-		
-	// if there is a heating time, then wait to see if you got
-	// any data from the serial port
-	while (seconds >0) {
-		delay(1000);
-		seconds--;
-	}
-		
-	while(timeout < MAX_TIMEOUT) {
-		while(!serialAvailable(_uart) && timeout < MAX_TIMEOUT) {
-			timeout++;
-			delay(1000);
-		}
-		
-		while( serialAvailable(_uart) && !match )
-		{
-			if( first )
-			{
-				for(it=0;it<theLength;it++)
-				{
-					theCommand[it]=serialRead(_uart);
-					delay(20);
-				}
-				first=0;
-			}
-			it=0;
-		
-			if( serialAvailable(_uart) )
-			{
-				theSame=true;
-				for(it=0; it<theLength ; it++)
-				{
-					if(theCommand[it]!=expectedAnswer[it]){
-						theSame= false;
-						break;
-					}
-				}
-				if( theSame ){
-					match=1;
-					return 1;
-				}
-				else
-				{
-					for(it=0; it<theLength-1 ; it++)
-					{
-						theCommand[it]=theCommand[it+1];
-					}
-					theCommand[it]=serialRead(_uart);
-					delay(20);
-				}
-			}
-		}
-	}
-	if( match ) return 1;
-	else return 0;
+	
+	if( timeout>MAX_TIMEOUT ) timeout=MAX_TIMEOUT;
+	return readAnswer(expectedAnswer, NULL, (unsigned long)(MAX_TIMEOUT-timeout+seconds)*1000);
 }
 
 uint16_t WaspGPRS_Pro::waitForData(const char* data, const char* expectedAnswer){
@@ -600,24 +396,202 @@ uint16_t WaspGPRS_Pro::waitForData(const char* data, const char* expectedAnswer)
 
 
 
+int WaspGPRS_Pro::sendWithRetries(int MAX_TIMEOUT, int sendOnce){
+	int attempts=0;
+	unsigned long previous;
+	
+	while(!serialAvailable(_uart) && attempts < MAX_TIMEOUT)
+	{
+		if (!sendOnce || !attempts)
+		{
+			printString(theCommand,_uart);
+		}
+		// waits for the first byte of the answer instead of the whole delay
+		previous=millis();
+		while( !serialAvailable(_uart) && (millis()-previous)<DELAY_ON_SEND );
+		attempts++;
+	}
+	return attempts;
+}
+
+uint8_t WaspGPRS_Pro::readAnswer(const char* expectedAnswer1, const char* expectedAnswer2, unsigned long timeout){
+	uint8_t matched1=0;
+	uint8_t matched2=0;
+	unsigned long previous;
+	char c;
+	
+	urc_length=0;
+	previous=millis();
+	do{
+		while( serialAvailable(_uart) )
+		{
+			c=serialRead(_uart);
+			
+			matched1=matchByte(expectedAnswer1,matched1,c);
+			if( expectedAnswer1[matched1]=='\0' ) return 1;
+			
+			if( expectedAnswer2!=NULL )
+			{
+				matched2=matchByte(expectedAnswer2,matched2,c);
+				if( expectedAnswer2[matched2]=='\0' ) return 2;
+			}
+			
+			frameByte(c);
+		}
+	}while( (millis()-previous)<timeout );
+	
+	return 0;
+}
+
+uint8_t WaspGPRS_Pro::matchByte(const char* pattern, uint8_t matched, char c){
+	uint8_t k;
+	
+	if( pattern[matched]==c ) return matched+1;
+	
+	// falls back to the longest beginning of 'pattern' that still ends the
+	// received data, so the answer is found wherever it starts
+	k=matched;
+	while( k>0 )
+	{
+		k--;
+		if( (pattern[k]==c) && !strncmp(pattern,pattern+matched-k,k) ) return k+1;
+	}
+	return 0;
+}
+
+uint8_t WaspGPRS_Pro::frameByte(char c){
+	
+	if( c=='\r' ) return 0;
+	
+	if( c!='\n' )
+	{
+		if( urc_length<(GPRS_PRO_LINE_SIZE-1) ) urc_line[urc_length++]=c;
+		return 0;
+	}
+	
+	if( urc_length==0 ) return 0;
+	urc_line[urc_length]='\0';
+	urc_length=0;
+	
+	for(uint8_t i=0; i<GPRS_PRO_MAX_URC; i++)
+	{
+		if( (urc_handler[i]!=NULL) && !strncmp(urc_line,urc_prefix[i],strlen(urc_prefix[i])) )
+		{
+			urc_handler[i](urc_line);
+			return 1;
+		}
+	}
+	return 0;
+}
+
+
+
 //FTP private functions
+int16_t WaspGPRS_Pro::readNumber(char end){
+	int16_t length=0;
+	unsigned long previous;
+	char c;
+	
+	do{	//gets the length of the data string
+		previous=millis();
+		while( !serialAvailable(_uart) )
+		{
+			if( (millis()-previous)>1000 ) return -1;
+		}
+		c=serialRead(_uart);
+		if( (c>='0') && (c<='9') ) length=length*10+(c-0x30);
+	}while( c!=end );
+	
+	return length;
+}
+
+int16_t WaspGPRS_Pro::readPayload(uint16_t length, uint8_t* buffer, uint16_t size, gprs_data_handler_t handler){
+	uint8_t chunk[32];
+	uint8_t* dest;
+	uint16_t room;
+	uint16_t stored=0;
+	int n;
+	unsigned long previous=millis();
+	
+	// The payload is copied straight from the UART buffer to 'buffer', or
+	// passed to 'handler' in pieces. Bytes that do not fit are discarded
+	while( length>0 )
+	{
+		if( handler!=NULL )
+		{
+			dest=chunk;
+			room=sizeof(chunk);
+		}
+		else if( stored<size )
+		{
+			dest=&buffer[stored];
+			room=size-stored;
+		}
+		else
+		{
+			dest=chunk;
+			room=sizeof(chunk);
+		}
+		if( room>length ) room=length;
+		
+		n=serialReadBytes(_uart,dest,room);
+		if( n==0 )
+		{
+			if( (millis()-previous)>1000 ) return -1;
+			continue;
+		}
+		previous=millis();
+		length-=n;
+		
+		if( handler!=NULL )
+		{
+			handler(chunk,n);
+			stored+=n;
+		}
+		else if( dest!=chunk )
+		{
+			stored+=n;
+		}
+	}
+	return stored;
+}
+
 int8_t WaspGPRS_Pro::sendDataFTP(const char* file, const char* path){
 	char* command = (char*) calloc(100,sizeof(char));
 	if( command==NULL ) return -1;
 	char aux='"';
-	char* buffer_int = (char*) calloc(250,sizeof(char));
-	if( command==NULL ) return -1;
+	char* buffer_int = (char*) calloc(100,sizeof(char));
+	if( buffer_int==NULL ){
+		free(command);
+		return -1;
+	}
 	char* file_name = (char*) calloc(50,sizeof(char));
-	if( command==NULL ) return -1;
+	if( file_name==NULL ){
+		free(command);
+		free(buffer_int);
+		return -1;
+	}
+	uint8_t* data = (uint8_t*) calloc(GPRS_PRO_FTP_BUFFER,sizeof(uint8_t));
+	if( data==NULL ){
+		free(command);
+		free(buffer_int);
+		free(file_name);
+		return -1;
+	}
+	struct fat_file_struct* fd=NULL;
 	long previous=0;
 	uint8_t answer=0;
-	uint8_t end=0;
+	int8_t result=0;
+	uint8_t eof=0;
 	uint32_t i,j=0;
-	int max_FTP_data=0,aux2,n_bytes=0;
+	int aux2=-1;
+	int16_t max_FTP_data=0,length;
+	uint16_t pending=0,sent;
+	intptr_t n_bytes;
 
 	Utils.strExplode(path,'/');	//Explores the destination file string
 	i=0;
-	while(path[i]!='\0')
+	while( (path[i]!='\0') && (i<99) )
 	{
 		if( path[i]== '/' ){ 
 			j++;
@@ -626,35 +600,15 @@ int8_t WaspGPRS_Pro::sendDataFTP(const char* file, const char* path){
 		buffer_int[i]=path[i];
 		i++;
 	}
-	i=0;
 	buffer_int[aux2+1]='\0';
 	
 	//Sets server path and name
 	sprintf(command,"%s%c%s%c",AT_FTP_PUT_NAME,aux,Utils.arguments[j],aux);
-	if(sendATCommand(command,AT_FTP_PUT_NAME_R,ERROR_CME)!=1) return 0;	
+	if(sendATCommand(command,AT_FTP_PUT_NAME_R,ERROR_CME)!=1) goto ftp_exit;
 	sprintf(command,"%s%c%s%c",AT_FTP_PUT_PATH,aux,buffer_int,aux);
-	if(sendATCommand(command,AT_FTP_PUT_PATH_R,ERROR_CME)!=1) return 0;
-
-	//Opens the FTP put session
-	sprintf(command,"AT%s1\r\n",AT_FTP_PUT);
-	printString(command,_uart);
-	previous=millis();
-	while( (!serialAvailable(_uart)) && ((millis()-previous)<10000) );
-	delay(10);
-	answer=waitForData("+FTPPUT:1,1,",20,0,0);
-	
-	if(answer!=1) return 0;
-	
-	max_FTP_data=0;
-	aux2=serialRead(_uart);
-	do{	//gets the length of the data string
-		max_FTP_data*=10;
-		max_FTP_data+=aux2-0x30;
-		aux2=serialRead(_uart);
-	}while(aux2!='\r');
-
+	if(sendATCommand(command,AT_FTP_PUT_PATH_R,ERROR_CME)!=1) goto ftp_exit;
 
-	serialFlush(_uart);
+	//Opens the origin file before the FTP session, so it is not left open on errors
 	Utils.strExplode(file,'/');	//Explores the origin file string
 	i=0;
 	j=0;
@@ -663,72 +617,86 @@ int8_t WaspGPRS_Pro::sendDataFTP(const char* file, const char* path){
 		if( file[i]== '/' ) j++;
 		i++;
 	}
-		
-	i=1;
 	
 	Utils.strCp(Utils.arguments[j],file_name);
 	
 	SD.ON();	//Goes to the directory
+	i=1;
 	while( j>1 ){
-		if(!SD.cd(Utils.arguments[i])){
-			SD.OFF();
-			free(command);
-			free(buffer_int);
-			free(file_name);
-			return 0;
-		}
+		if(!SD.cd(Utils.arguments[i])) goto ftp_exit_sd;
 		i++;
 		j--;
 	}
-	i=0;
-	j=0;
-	n_bytes=0;
-	end=0;
-	do{	//Starts to send data
-		//reads a fragment of the file
-		if(max_FTP_data>250){
-			buffer_int=SD.cat(file_name,n_bytes,250);
-			n_bytes+=250;
-		}else{
-			buffer_int=SD.cat(file_name,n_bytes,max_FTP_data);
-			n_bytes+=max_FTP_data;
-		}
-		while(buffer_int[j]!='\0' ) j++;//gets the length of the fragment
-		if( j<249 ) end=1;
+	fd=SD.openFile(file_name);
+	if( fd==NULL ) goto ftp_exit_sd;
+
+	//Opens the FTP put session
+	sprintf(command,"AT%s1\r\n",AT_FTP_PUT);
+	printString(command,_uart);
+	previous=millis();
+	while( (!serialAvailable(_uart)) && ((millis()-previous)<10000) );
+	answer=waitForData("+FTPPUT:1,1,",20,0,0);
+	if(answer!=1) goto ftp_exit_sd;
+	max_FTP_data=readNumber('\r');
+	if(max_FTP_data<=0) goto ftp_exit_sd;
+
+	// The file is read in order and kept open. After each fragment is sent, the
+	// buffer is refilled from the SD while the module uploads the fragment
+	n_bytes=fat_read_file(fd,data,GPRS_PRO_FTP_BUFFER);
+	if( n_bytes<0 ) goto ftp_exit_sd;
+	pending=n_bytes;
+	if( pending<GPRS_PRO_FTP_BUFFER ) eof=1;
+	
+	while( pending>0 )
+	{
+		length=pending;
+		if( length>max_FTP_data ) length=max_FTP_data;
 		
-		sprintf(command,"AT%s2,%u\r\n",AT_FTP_PUT,j);
+		sprintf(command,"AT%s2,%d\r\n",AT_FTP_PUT,length);
 		printString(command,_uart);
-		while(!serialAvailable(_uart));
 		answer=waitForData("+FTPPUT:2,",20,0,0);
-		if(answer!=1) return 0;
+		if(answer!=1) goto ftp_exit_sd;
 		
-		printString(buffer_int,_uart);
-		while(!serialAvailable(_uart));
-		answer=waitForData("+FTPPUT:1,1,",20,0,0);	
-		if(answer!=1) return 0;
+		// the module may accept less data than requested
+		length=readNumber('\r');
+		if( (length<=0) || (length>(int16_t)pending) ) goto ftp_exit_sd;
 		
-		max_FTP_data=0;
-		aux2=serialRead(_uart);
-		do{	//gets the length of the data string
-			max_FTP_data*=10;
-			max_FTP_data+=aux2-0x30;
-			aux2=serialRead(_uart);
-		}while(aux2!='\r');
-		j=0;
-	}while(end==0);
+		sent=0;
+		while( sent<length )
+		{
+			sent+=serialWriteBuffer(&data[sent],length-sent,_uart);
+		}
+		pending-=length;
+		memmove(data,&data[length],pending);
+		
+		if( !eof )
+		{
+			n_bytes=fat_read_file(fd,&data[pending],GPRS_PRO_FTP_BUFFER-pending);
+			if( n_bytes<0 ) goto ftp_exit_sd;
+			if( n_bytes<(GPRS_PRO_FTP_BUFFER-pending) ) eof=1;
+			pending+=n_bytes;
+		}
+		
+		answer=waitForData("+FTPPUT:1,1,",20,0,0);	
+		if(answer!=1) goto ftp_exit_sd;
+		max_FTP_data=readNumber('\r');
+		if(max_FTP_data<=0) goto ftp_exit_sd;
+	}
 	
 	sprintf(command,"AT%s2,0\r\n",AT_FTP_PUT);
 	printString(command,_uart);
-	while(!serialAvailable(_uart));
 	answer=waitForData("+FTPPUT:1,0",20,0,0);	
+	if(answer==1) result=1;
+	
+ftp_exit_sd:
+	if( fd!=NULL ) SD.closeFile(fd);
+	SD.OFF();
+ftp_exit:
 	free(command);
 	free(buffer_int);
 	free(file_name);
-	if(answer!=1) return 0;
-	
-	SD.OFF();
-	
-	return 1;	
+	free(data);
+	return result;	
 }
 
 int8_t WaspGPRS_Pro::readDataFTP(const char* file, const char* path){
@@ -1740,6 +1708,51 @@ int8_t	WaspGPRS_Pro::manageIncomingData(){
 	return a;
 }
 
+/* setURCHandler(prefix, handler) - registers a handler for an unsolicited result code
+ *
+ * This function registers a function to call with every line received from the module that begins with 'prefix'
+ *
+ * Registering a prefix again replaces its handler and a NULL handler removes it
+ *
+ * Returns '1' on success and '0' if there is no free handler
+*/
+uint8_t WaspGPRS_Pro::setURCHandler(const char* prefix, gprs_urc_handler_t handler){
+	int8_t free_slot=-1;
+	
+	for(uint8_t i=0; i<GPRS_PRO_MAX_URC; i++)
+	{
+		if( (urc_prefix[i]!=NULL) && !strcmp(urc_prefix[i],prefix) )
+		{
+			urc_handler[i]=handler;
+			if( handler==NULL ) urc_prefix[i]=NULL;
+			return 1;
+		}
+		if( (urc_prefix[i]==NULL) && (free_slot<0) ) free_slot=i;
+	}
+	
+	if( handler==NULL ) return 1;
+	if( free_slot<0 ) return 0;
+	urc_prefix[free_slot]=prefix;
+	urc_handler[free_slot]=handler;
+	return 1;
+}
+
+/* pollURC() - processes the bytes received from the module without waiting
+ *
+ * This function reads the bytes available in the UART and passes every complete line to the registered handlers
+ *
+ * Returns the number of unsolicited result codes dispatched
+*/
+uint8_t WaspGPRS_Pro::pollURC(){
+	uint8_t dispatched=0;
+	
+	while( serialAvailable(_uart) )
+	{
+		dispatched+=frameByte(serialRead(_uart));
+	}
+	return dispatched;
+}
+
 /*switchtoDataMode() - switchs from command mode to data mode
  *
  * This function switchs from command mode to data modes
@@ -1787,7 +1800,7 @@ int8_t WaspGPRS_Pro::switchtoCommandMode(){
 int8_t WaspGPRS_Pro::sendCommand(const char* ATcommand){
 	char* command = (char*) calloc(30,sizeof(char));
 	if( command==NULL ) return -1;
-	uint8_t timeout=0;
+	unsigned long previous;
 	uint8_t i=0;
 	
 	sprintf(command, "AT%s%c%c", ATcommand,'\r','\n');
@@ -1798,19 +1811,17 @@ int8_t WaspGPRS_Pro::sendCommand(const char* ATcommand){
 		delay(DELAY_ON_SEND);
 	}
 	free(command);
-	while( timeout < 5 )
+	
+	// reads until the module is quiet for 5 seconds
+	previous=millis();
+	while( (millis()-previous)<5000 && i<(sizeof(answer_command)-1) )
 	{
-		while(!serialAvailable(_uart) && timeout < 5) {
-			timeout++;
-			delay(1000);
-		}
-		while(serialAvailable(_uart) && timeout < 5){
+		if( serialAvailable(_uart) )
+		{
 			answer_command[i] = serialRead(_uart);
 			USB.print(char(answer_command[i]));
-			delay(20);
 			i++;
-			timeout=0;
-			if(i>=199) timeout=5;
+			previous=millis();
 		}
 	}
 	answer_command[i]='\0';
@@ -2927,67 +2938,81 @@ int8_t WaspGPRS_Pro::sendData(const char* data){
  * Returns '1' on success, '0' if error and '-1' if no memory
 */
 int8_t WaspGPRS_Pro::sendData(const char* data, uint8_t n_connection){
+	return(sendData((const uint8_t*)data, strlen(data), n_connection));
+}
+
+/* sendData(const uint8_t*, uint16_t) - sends 'length' bytes of 'data'
+ *
+ * This function sends 'length' bytes of 'data' in single connection mode. The data may contain any byte value
+ *
+ * It modifies 'flag' if expected answer is not received after sending a command to GPRS module
+ *
+ * Returns '1' on success, '0' if error and '-1' if no memory
+*/
+int8_t WaspGPRS_Pro::sendData(const uint8_t* data, uint16_t length){
+	return(sendData(data, length, NULL));
+}
+
+/* sendData(const uint8_t*, uint16_t, uint8_t) - sends 'length' bytes of 'data' to the specified 'n_connection'
+ *
+ * This function sends 'length' bytes of 'data' to the specified 'n_connection'. In single connection not specifies 'n_connection'.
+ *
+ * The length is given to the module with AT+CIPSEND, so the data may contain any byte value, including 0x1A and 0x00
+ *
+ * It modifies 'flag' if expected answer is not received after sending a command to GPRS module
+ *
+ * Returns '1' on success, '0' if error and '-1' if no memory
+*/
+int8_t WaspGPRS_Pro::sendData(const uint8_t* data, uint16_t length, uint8_t n_connection){
 	char* command = (char*) calloc(30,sizeof(char));
 	if( command==NULL ) return -1;
 	uint8_t answer=0;
+	uint16_t sent=0;
 	
 	flag &= ~(GPRS_ERROR_DATA);
 	
 	if(IP_app_mode==0){//non transparent mode
 		switch(IP_mode){
 			case 0:	//single mode
-				sprintf(command,"%s",AT_IP_SEND);
+				sprintf(command,"%s=%u",AT_IP_SEND,length);
 				break;
 			case 1:	//multi mode
-				sprintf(command,"%s=%c",AT_IP_SEND,n_connection+0x30);
+				sprintf(command,"%s=%c,%u",AT_IP_SEND,n_connection+0x30,length);
 				break;
 		}
 
-
 		//Wait the connection with the server to send data	
 		answer=sendATCommand(command,">",ERROR_CME);
+		free(command);
 
-		switch(answer)
+		if(answer!=1)
 		{
-			case 0:
-				flag |= GPRS_ERROR_DATA;
-				free(command);
-				return 0;
-				break;
-			case 2 :
-				flag |= GPRS_ERROR_DATA;
-				free(command);
-				return 0;
-				break;
+			flag |= GPRS_ERROR_DATA;
+			return 0;
 		}
 
-		//sends data to the server
-		sprintf(command,"%s%c",data,0x1A);
-		printString(command,_uart);
+		//sends data to the server, the module sends it after 'length' bytes
+		while( sent<length )
+		{
+			sent+=serialWriteBuffer(&data[sent],length-sent,_uart);
+		}
 		answer=waitForData(AT_IP_SEND_R,AT_IP_SEND_FAIL,20,0,0);
 
-		free(command);
-
-		switch(answer)
+		if(answer!=1)
 		{
-			case 0:
-				flag |= GPRS_ERROR_DATA;
-				return 0;
-				break;
-			case 2 :
-				flag |= GPRS_ERROR_DATA;
-				return 0;
-				break;
+			flag |= GPRS_ERROR_DATA;
+			return 0;
 		}
-		
-		if(answer!=1) return 0;
 		return 1;
 
 	}else{	//transparent mode
-		printString(data,_uart);
+		free(command);
+		while( sent<length )
+		{
+			sent+=serialWriteBuffer(&data[sent],length-sent,_uart);
+		}
 	}
 	
-	if(flag & GPRS_ERROR_DATA) return 0;
 	return 1;
 }
 
@@ -2995,14 +3020,14 @@ int8_t WaspGPRS_Pro::sendData(const char* data, uint8_t n_connection){
  *
  * This function gets data receive from a TCP or UDP connection and stores it in 'IP_data'.
  *
- * In multi connection mode also stores the connection number in 'IP_data_from.
+ * In multi connection mode also stores the connection number in 'IP_data_from'.
  *
  * This function should be executed only inside 'manageIncomingData' function.
  *
  * Returns '1' on success and '0' if error
 */
 int8_t WaspGPRS_Pro::readIPData(char* dataIN){
-	int IP_data_length=0,IP_data_from=0;
+	int IP_data_length=0;
 	int i=0,j;
 	int8_t answer=0;
 	for( j=0;j<100;j++){ IP_data[j]='\0';}
@@ -3012,23 +3037,22 @@ int8_t WaspGPRS_Pro::readIPData(char* dataIN){
 			if(parse(dataIN,"+CIPRXGET")){
 				answer=GetDataManually(150,0);
 			}else if(parse(dataIN,"+IPD")){
-				do{
-					i++;
-				}while(dataIN[i]!=':');
+				// +IPD,<length>:<data>
+				while( (dataIN[i]!=',') && (dataIN[i]!='\0') ) i++;
+				if( dataIN[i]==',' ) i++;
 				
-				do{	//gets the length of the data string
-				IP_data_length*=10;
-				IP_data_length=dataIN[i];
-				i++;
-				}while(dataIN[i]!=',');
-				
-				do{
+				while( (dataIN[i]>='0') && (dataIN[i]<='9') ){	//gets the length of the data string
+					IP_data_length*=10;
+					IP_data_length+=dataIN[i]-0x30;
 					i++;
-				}while(dataIN[i]!=':');
+				}
+				if( dataIN[i]==':' ) i++;
 				
-				for(j=0;j<IP_data_length;j++){
+				if( IP_data_length>99 ) IP_data_length=99;
+				for(j=0;(j<IP_data_length) && (dataIN[i+j]!='\0');j++){
 					IP_data[j]=dataIN[i+j];
 				}
+				answer=1;
 				
 			}else{
 				Utils.strCp(dataIN, IP_data);
@@ -3052,18 +3076,22 @@ int8_t WaspGPRS_Pro::readIPData(char* dataIN){
 		
 			IP_data_from=dataIN[i+1]-0x30;	//gets the connection number
 
+			// +RECEIVE,<n>,<length>:\r\n<data>
 			i+=3;
 			IP_data_length=0;
-			do{	//gets the length of the data string
+			while( (dataIN[i]>='0') && (dataIN[i]<='9') ){	//gets the length of the data string
 				IP_data_length*=10;
-				IP_data_length=dataIN[i];
+				IP_data_length+=dataIN[i]-0x30;
 				i++;
-			}while(dataIN[i]!='\r');
-			i++;	//skips \n
+			}
+			while( (dataIN[i]!='\n') && (dataIN[i]!='\0') ) i++;
+			if( dataIN[i]=='\n' ) i++;	//skips \n
 	
-			for(int x=0;x< IP_data_length; x++){
+			if( IP_data_length>99 ) IP_data_length=99;
+			for(int x=0;(x<IP_data_length) && (dataIN[i+x]!='\0'); x++){
 				IP_data[x]=dataIN[i+x];
 			}
+			answer=1;
 		}
 	}
 	
@@ -3071,6 +3099,99 @@ int8_t WaspGPRS_Pro::readIPData(char* dataIN){
 	return 1;
 }
 
+/* receiveData(uint8_t*, uint16_t, unsigned long) - waits for data from a TCP or UDP connection and stores it in 'buffer'
+ *
+ * This function waits up to 'timeout' ms for a '+IPD,<length>:' (single connection, needs IPHeader(1)) or 
+ * '+RECEIVE,<n>,<length>:' (multi connection) header and copies the data that follows straight to 'buffer'. 
+ *
+ * In multi connection mode also stores the connection number in 'IP_data_from'.
+ *
+ * Data that does not fit in 'buffer' is discarded
+ *
+ * Returns the number of bytes stored, '0' if no data is received and '-1' if error
+*/
+int16_t WaspGPRS_Pro::receiveData(uint8_t* buffer, uint16_t size, unsigned long timeout){
+	return receiveData(buffer, size, NULL, timeout);
+}
+
+/* receiveData(gprs_data_handler_t, unsigned long) - waits for data from a TCP or UDP connection and passes it to 'handler'
+ *
+ * This function works as receiveData(uint8_t*, uint16_t, unsigned long) but the data is passed to 'handler' as it is read
+ * from the UART, so the size of the data is not limited by a buffer
+ *
+ * Returns the number of bytes received, '0' if no data is received and '-1' if error
+*/
+int16_t WaspGPRS_Pro::receiveData(gprs_data_handler_t handler, unsigned long timeout){
+	return receiveData(NULL, 0, handler, timeout);
+}
+
+int16_t WaspGPRS_Pro::receiveData(uint8_t* buffer, uint16_t size, gprs_data_handler_t handler, unsigned long timeout){
+	int16_t length;
+	uint8_t answer;
+	
+	answer=readAnswer("+IPD,","+RECEIVE,",timeout);
+	if( answer==0 ) return 0;
+	
+	if( answer==2 )
+	{
+		length=readNumber(',');
+		if( length<0 ) return -1;
+		IP_data_from=length;
+	}
+	
+	length=readNumber(':');
+	if( length<0 ) return -1;
+	
+	if( answer==2 )
+	{
+		// skips the \r\n after the header
+		if( readPayload(2,NULL,0,NULL)<0 ) return -1;
+	}
+	
+	return readPayload(length,buffer,size,handler);
+}
+
+/* readDataManually(uint8_t*, uint16_t, uint8_t) - gets data manually from a TCP or UDP connection
+ *
+ * This function requests up to 'size' bytes with AT+CIPRXGET=2 and copies the data straight to 'buffer'. 
+ * In single connection not specifies 'id'.
+ *
+ * Returns the number of bytes stored, '0' if there is no data and '-1' if error
+*/
+int16_t WaspGPRS_Pro::readDataManually(uint8_t* buffer, uint16_t size, uint8_t id){
+	char command[30];
+	int16_t length;
+	
+	flag &= ~(GPRS_ERROR_DATA);
+	
+	if(IP_mode==0){
+		sprintf(command,"AT%s=2,%u\r\n",AT_IP_GET_MANUALLY,size);
+	}else{
+		sprintf(command,"AT%s=2,%u,%u\r\n",AT_IP_GET_MANUALLY,id,size);
+	}
+	serialFlush(_uart);
+	printString(command,_uart);
+	
+	// +CIPRXGET: 2,[<id>,]<length>,<pending>\r\n<data>
+	if( waitForData("+CIPRXGET: 2,",ERROR,DEFAULT_TIMEOUT,0,0)!=1 )
+	{
+		flag |= GPRS_ERROR_DATA;
+		return -1;
+	}
+	if( IP_mode==1 )
+	{
+		if( readNumber(',')<0 ) return -1;
+	}
+	length=readNumber(',');
+	if( (length<0) || (readNumber('\n')<0) )
+	{
+		flag |= GPRS_ERROR_DATA;
+		return -1;
+	}
+	
+	return readPayload(length,buffer,size,NULL);
+}
+
 /* closeSocket() - closes the socket specified by 'socket'
  *
  * This function closes the connection specified by 'n_connection'.In single not specifies number of connenction. For server use 8
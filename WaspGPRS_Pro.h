@@ -239,6 +239,31 @@
  */
 #define SEND_ONCE 1
 
+/*! \def GPRS_PRO_MAX_URC
+    \brief Maximum number of unsolicited result code handlers
+ */
+#define GPRS_PRO_MAX_URC 4
+
+/*! \def GPRS_PRO_LINE_SIZE
+    \brief Size of the buffer used to frame the lines received from the module
+ */
+#define GPRS_PRO_LINE_SIZE 64
+
+/*! \def GPRS_PRO_FTP_BUFFER
+    \brief Size of the buffer used to upload files from the SD by FTP
+ */
+#define GPRS_PRO_FTP_BUFFER 512
+
+/*! \def gprs_urc_handler_t
+    \brief Function called with the line of an unsolicited result code
+ */
+typedef void (*gprs_urc_handler_t)(const char* line);
+
+/*! \def gprs_data_handler_t
+    \brief Function called with the data received from a TCP or UDP connection
+ */
+typedef void (*gprs_data_handler_t)(const uint8_t* data, uint16_t length);
+
 /*! \def PORT_USED
     \brief Constants for AT commands. Port used in AT commands functions in this case
  */
@@ -338,6 +363,26 @@ class WaspGPRS_Pro
 	 */		
 	char theEnd[10];
 	
+	//! Variable : prefixes of the registered unsolicited result codes
+    	/*!
+	 */
+	const char* urc_prefix[GPRS_PRO_MAX_URC];
+	
+	//! Variable : handlers of the registered unsolicited result codes
+    	/*!
+	 */
+	gprs_urc_handler_t urc_handler[GPRS_PRO_MAX_URC];
+	
+	//! Variable : line being received from the module
+    	/*!
+	 */
+	char urc_line[GPRS_PRO_LINE_SIZE];
+	
+	//! Variable : number of bytes stored in 'urc_line'
+    	/*!
+	 */
+	uint8_t urc_length;
+	
 	//! Gets IP direction when configure a TCP/UDP profiles
 	/*!
 	\param void
@@ -633,6 +678,43 @@ class WaspGPRS_Pro
     */
 	uint16_t waitForData(const char* data, const char* expectedAnswer);
 	
+	//! It sends 'theCommand' to the module until it starts answering
+    /*!
+	Each attempt waits up to DELAY_ON_SEND ms for the first byte of the answer
+	\param int MAX_TIMEOUT : specifies the maximum number of attempts
+	\param int sendOnce : specifies if the data is sent once
+	\return the number of attempts used
+	 */
+	int sendWithRetries(int MAX_TIMEOUT, int sendOnce);
+	
+	//! It reads the answer of the module until one of the expected strings is found
+    /*!
+	Bytes are matched as they arrive and the reading stops right after the 
+	expected string, so the rest of the answer stays in the UART buffer. Complete
+	lines are checked against the registered unsolicited result codes
+	\param char* expectedAnswer1 : string 1 expected to be answered by the module
+	\param char* expectedAnswer2 : string 2 expected to be answered by the module, or NULL
+	\param unsigned long timeout : milliseconds to wait for the answer
+	\return '1' if expectedAnswer1 is found, '2' if expectedAnswer2 is found, '0' if timeout
+	 */
+	uint8_t readAnswer(const char* expectedAnswer1, const char* expectedAnswer2, unsigned long timeout);
+	
+	//! It advances the match of 'pattern' with a new received byte
+    /*!
+	\param char* pattern : string to find
+	\param uint8_t matched : number of bytes of 'pattern' matched before 'c'
+	\param char c : byte received
+	\return number of bytes of 'pattern' matched after 'c'
+	 */
+	uint8_t matchByte(const char* pattern, uint8_t matched, char c);
+	
+	//! It adds a received byte to 'urc_line' and dispatches complete lines
+    /*!
+	\param char c : byte received
+	\return '1' if a line was passed to an unsolicited result code handler, '0' if not
+	 */
+	uint8_t frameByte(char c);
+	
     //! It sends data via FTP
     /*!
     \param char* file : path within SD card to find the file to upload
@@ -641,6 +723,33 @@ class WaspGPRS_Pro
     */
 	int8_t sendDataFTP(const char* file, const char* path);
 	
+    //! It reads a decimal number sent by the module, up to the 'end' character
+    /*!
+    \param char end : character sent after the number
+	\return the number, '-1' if the module does not answer
+	 */
+	int16_t readNumber(char end);
+	
+    //! It reads 'length' bytes of data from the module
+    /*!
+    \param uint16_t length : number of bytes to read
+    \param uint8_t* buffer : buffer to store the data, or NULL
+    \param uint16_t size : size of 'buffer'. Bytes that do not fit are discarded
+    \param gprs_data_handler_t handler : function that receives the data instead of 'buffer', or NULL
+	\return the number of bytes stored or passed to 'handler', '-1' if the module stops sending
+	 */
+	int16_t readPayload(uint16_t length, uint8_t* buffer, uint16_t size, gprs_data_handler_t handler);
+	
+    //! It waits for data from a TCP or UDP connection
+    /*!
+    \param uint8_t* buffer : buffer to store the data, or NULL
+    \param uint16_t size : size of 'buffer'
+    \param gprs_data_handler_t handler : function that receives the data instead of 'buffer', or NULL
+    \param unsigned long timeout : milliseconds to wait for the data
+	\return the number of bytes received, '0' if no data and '-1' if error
+	 */
+	int16_t receiveData(uint8_t* buffer, uint16_t size, gprs_data_handler_t handler, unsigned long timeout);
+	
     //! It reads data via FTP
     /*!
     \param char* file : path in the FTP server where find the file to download
@@ -746,6 +855,9 @@ class WaspGPRS_Pro
 	//! Variable : IP data receive
 	char IP_data[100];
 	
+	//! Variable : connection number of the last data received in multi connection mode
+	uint8_t IP_data_from;
+	
 	//! Variable : IMSI from the SIM card
 	char IMSI[20];
         
@@ -938,6 +1050,25 @@ class WaspGPRS_Pro
 	 */
 	int8_t	manageIncomingData();
 	
+	//! It registers a handler for an unsolicited result code
+	/*!
+	The handler is called with every line received from the module that begins
+	with 'prefix', e.g. "+CMTI", "+IPD" or "RING". Registering a prefix again
+	replaces its handler and a NULL handler removes it
+	\param char* prefix : beginning of the unsolicited result code. It must remain valid while registered
+	\param gprs_urc_handler_t handler : function to call
+	\return '1' on success, '0' if there is no free handler
+	 */
+	uint8_t setURCHandler(const char* prefix, gprs_urc_handler_t handler);
+	
+	//! It processes the bytes received from the module without waiting
+	/*!
+	Complete lines are passed to the registered unsolicited result code handlers
+	\param void
+	\return number of unsolicited result codes dispatched
+	 */
+	uint8_t pollURC();
+	
 	//! Resumes the connection and switches back from Command mode to data mode
 	/*!
 	\param void
@@ -1209,6 +1340,45 @@ class WaspGPRS_Pro
 	*/
 	int8_t sendData(const char* data, uint8_t n_connection);
 	
+	//! It sends 'length' bytes of 'data' in single connection mode
+    /*!
+	The data may contain any byte value
+	\param const uint8_t* data : the data to send to the socket
+	\param uint16_t length : number of bytes to send
+	\return '1' on success, '0' if error, '-1' if no memory
+	*/
+	int8_t sendData(const uint8_t* data, uint16_t length);
+	
+	//! It sends 'length' bytes of 'data' to the specified 'socket'
+    /*!
+	The data may contain any byte value
+	\param const uint8_t* data : the data to send to the socket
+	\param uint16_t length : number of bytes to send
+	\param uint8_t n_connection: the connection's number
+	\return '1' on success, '0' if error, '-1' if no memory
+	*/
+	int8_t sendData(const uint8_t* data, uint16_t length, uint8_t n_connection);
+	
+	//! It waits for data from a TCP or UDP connection and stores it in 'buffer'
+    /*!
+	In single connection mode the IP header must be enabled with IPHeader(1). In multi
+	connection mode the connection number is stored in 'IP_data_from'
+	\param uint8_t* buffer : buffer to store the data
+	\param uint16_t size : size of 'buffer'. Data that does not fit is discarded
+	\param unsigned long timeout : milliseconds to wait for the data
+	\return the number of bytes stored, '0' if no data and '-1' if error
+	*/
+	int16_t receiveData(uint8_t* buffer, uint16_t size, unsigned long timeout);
+	
+	//! It waits for data from a TCP or UDP connection and passes it to 'handler'
+    /*!
+	The data is passed to 'handler' in pieces as it is read from the UART
+	\param gprs_data_handler_t handler : function that receives the data
+	\param unsigned long timeout : milliseconds to wait for the data
+	\return the number of bytes received, '0' if no data and '-1' if error
+	*/
+	int16_t receiveData(gprs_data_handler_t handler, unsigned long timeout);
+	
 	//! Gets data receive from a TCP or UDP connection and stores it in 'IP_data'
     /*!
 	\param char* dataIN : string of data with TCP/UDP info
@@ -1316,6 +1486,15 @@ class WaspGPRS_Pro
 	\return '1' on success, '0' if error, '-1' if no memory
 	 */
 	int8_t GetDataManually(uint16_t data_length, uint8_t id);
+	
+	//! It gets data manually from a TCP or UDP connection and stores it in 'buffer'
+    /*! 
+	\param uint8_t* buffer : buffer to store the data
+	\param uint16_t size : maximum number of bytes to get
+	\param uint8_t id : id connection number
+	\return the number of bytes stored, '0' if there is no data and '-1' if error
+	 */
+	int16_t readDataManually(uint8_t* buffer, uint16_t size, uint8_t id);
 
 };
 
@@ -1021,6 +1021,7 @@ int8_t WaspGPS::saveEphems(const char* filename)
 	if(tempData==NULL) return -1;
 	uint8_t endFile[7] ={0xAA,0xBB,0xCC,0xCC,0xBB,0xAA,0xAA};
 	uint8_t counter3=0;
+	uint8_t received=0;
 	uint8_t end=0;
 	uint16_t interval=1000;
 	long previous=millis();
@@ -1056,10 +1057,10 @@ int8_t WaspGPS::saveEphems(const char* filename)
 		// read ephemeris data and store into ByteIN
 		while(end==0)
 		{
-			if(serialAvailable(_uart)>0)
+			received=serialReadBytes(_uart,&ByteIN[counter3],110-counter3);
+			if( received>0 )
 			{
-				ByteIN[counter3]=serialRead(_uart);
-				counter3++;
+				counter3+=received;
 				previous=millis();
 			}
 			if( (millis()-previous) > interval )
@@ -1122,6 +1123,7 @@ int8_t WaspGPS::loadEphems(const char* filename)
 	uint8_t endFile=0;
 	uint16_t offset=0;
 	uint8_t counter3=0;
+	uint8_t received=0;
 	uint8_t end=0;
 	uint16_t interval=1000;
 	long previous=millis();
@@ -1177,10 +1179,10 @@ int8_t WaspGPS::loadEphems(const char* filename)
 			delay(100);
 			while(end==0)
 			{
-				if(serialAvailable(_uart)>0)
+				received=serialReadBytes(_uart,&answer[counter3],10-counter3);
+				if( received>0 )
 				{
-					answer[counter3]=serialRead(_uart);
-					counter3++;
+					counter3+=received;
 					previous=millis();
 				}
 				if( (millis()-previous) > interval )
@@ -860,10 +860,8 @@ char* WaspSD::cat (const char* filename, int32_t offset, uint16_t scope)
     return buffer;
   }
 
-  // iterate through the file
-  byte maxBuffer = 10;  // size of the buffer to use when reading
-  uint8_t bufferSD[maxBuffer];
   uint32_t cont = 0;
+  uint16_t len;
   
   // first jump over the offset
   if(!fat_seek_file(_fd, &offset, FAT_SEEK_SET))
@@ -872,22 +870,19 @@ char* WaspSD::cat (const char* filename, int32_t offset, uint16_t scope)
 	  fat_close_file(_fd);
 	  return buffer;
   }
-  
-  uint8_t readRet = fat_read_file(_fd, bufferSD, sizeof(bufferSD));
+  windowOffset = offset;
+  windowLength = 0;
 
   // second, read the data and store it in the DOS.buffer
   // as long as there is room in it
-  while(readRet > 0 && scope > 0 && cont < DOS_BUFFER_SIZE)
+  while(scope > 0 && cont < DOS_BUFFER_SIZE && fillWindow(_fd, 0) > 0)
   {
-    for(uint8_t i = 0; i < readRet; ++i)
-    {
-      buffer[cont++] = bufferSD[i];
-      scope--;
-      if( scope <=0 ) break;
-      if( cont>=DOS_BUFFER_SIZE ) break;
-    }
-    if( readRet<maxBuffer ) break;
-    readRet = fat_read_file(_fd, bufferSD, sizeof(bufferSD));
+    len = windowLength;
+    if( len > scope ) len = scope;
+    if( len > DOS_BUFFER_SIZE - cont ) len = DOS_BUFFER_SIZE - cont;
+    memcpy(&buffer[cont], window, len);
+    cont += len;
+    scope -= len;
   }
   if (cont < DOS_BUFFER_SIZE - 1) {
     buffer[cont++] = '\0';
@@ -965,10 +960,8 @@ uint8_t* WaspSD::catBin (const char* filename, int32_t offset, uint16_t scope)
 		return bufferBin;
 	}
 
-  // iterate through the file
-	byte maxBuffer = 1;  // size of the buffer to use when reading
-	uint8_t bufferSD[maxBuffer];
 	uint32_t cont = 0;
+	uint16_t len;
   
   // first jump over the offset
 	if(!fat_seek_file(_fd, &offset, FAT_SEEK_SET))
@@ -977,19 +970,19 @@ uint8_t* WaspSD::catBin (const char* filename, int32_t offset, uint16_t scope)
 		fat_close_file(_fd);
 		return bufferBin;
 	}
-  
-	uint8_t readRet = fat_read_file(_fd, bufferSD, sizeof(bufferSD));
+	windowOffset = offset;
+	windowLength = 0;
 
-  // second, read the data and store it in the DOS.buffer
+  // second, read the data and store it in the DOS.bufferBin
   // as long as there is room in it
-	while(readRet > 0 && scope > 0 && cont < BIN_BUFFER_SIZE)
+	while(scope > 0 && cont < BIN_BUFFER_SIZE && fillWindow(_fd, 0) > 0)
 	{
-		for(uint8_t i = 0; i < maxBuffer; ++i)
-		{
-			bufferBin[cont++] = bufferSD[i];
-			scope--;
-			readRet = fat_read_file(_fd, bufferSD, sizeof(bufferSD));
-		}
+		len = windowLength;
+		if( len > scope ) len = scope;
+		if( len > BIN_BUFFER_SIZE - cont ) len = BIN_BUFFER_SIZE - cont;
+		memcpy(&bufferBin[cont], window, len);
+		cont += len;
+		scope -= len;
 	}
 
 	fat_close_file(_fd);
@@ -1055,45 +1048,44 @@ char* WaspSD::catln (const char* filename, uint32_t offset, uint16_t scope)
     return buffer;
   }
 
-  byte maxBuffer = 1;  // size of the buffer to use when reading
-  uint8_t bufferSD[maxBuffer];
   uint32_t cont = 0;
+  uint16_t pos = 0;
+  uint8_t* eol;
+  
+  windowOffset = 0;
+  windowLength = 0;
   
   // jump over offset lines
-  uint8_t readRet = fat_read_file(_fd, bufferSD, sizeof(bufferSD));
-  if (offset > 0) 
+  while( offset > 0 )
   {
-    while( readRet > 0 && offset > 0)   
+    if( pos >= windowLength )
     {
-      for(uint8_t i = 0; i < maxBuffer; ++i)
-      {
-        if (bufferSD[i] == '\n')
-          offset--;
-      }
-      readRet = fat_read_file(_fd, bufferSD, sizeof(bufferSD));
+      if( !fillWindow(_fd, 0) ) break;
+      pos = 0;
     }
-
-    // do not forget the first buffer  
-    for(uint8_t i = 0; i < maxBuffer; ++i)
+    eol = (uint8_t*) memchr(&window[pos], '\n', windowLength - pos);
+    if( eol == NULL )
     {
-      buffer[cont++] = bufferSD[i];
-      if (bufferSD[i] == '\n')
-        scope--;
+      pos = windowLength;
+    }
+    else
+    {
+      pos = eol - window + 1;
+      offset--;
     }
-
-    readRet = fat_read_file(_fd, bufferSD, sizeof(bufferSD));
   }
   
   // add to buffer scope lines
-  while(readRet > 0 && scope > 0 && cont < DOS_BUFFER_SIZE)
+  while(scope > 0 && cont < DOS_BUFFER_SIZE)
   {
-    for(uint8_t i = 0; i < maxBuffer; ++i)
+    if( pos >= windowLength )
     {
-      buffer[cont++] = bufferSD[i];
-      if (bufferSD[i] == '\n')
-        scope--;
+      if( !fillWindow(_fd, 0) ) break;
+      pos = 0;
     }
-    readRet = fat_read_file(_fd, bufferSD, sizeof(bufferSD));
+    buffer[cont] = window[pos++];
+    if (buffer[cont++] == '\n')
+      scope--;
   }
 
   // are we at the end of the buffer yet?
@@ -1169,68 +1161,74 @@ int32_t WaspSD::indexOf (const char* filename, const char* pattern, uint32_t off
     return -1;
   }
 
-  uint32_t limitSize = getFileSize(filename);
-
-  uint8_t limitPattern = Utils.sizeOf(pattern);
-  uint8_t bufferSD[1];
-  uint8_t* cmpPattern = (uint8_t*) calloc(limitPattern,sizeof(uint8_t));
-  if( cmpPattern==NULL ) return -1;
-  uint8_t exit = 0, contPattern = 0;
-  uint32_t cont = 0;
-
+  int limitPattern = Utils.sizeOf(pattern);
+  int32_t found = -1;
+  
+  // an empty pattern is found right at the offset
+  if( limitPattern == 0 )
+  {
+    fat_close_file(_fd);
+    return 0;
+  }
+  
+  // the pattern has to fit in the window (and in the jump table below)
+  if( limitPattern > 255 || limitPattern >= SD_WINDOW_SIZE )
+  {
+    fat_close_file(_fd);
+    return -1;
+  }
+  
   // jump over the offset
-  uint8_t readRet = fat_read_file(_fd, bufferSD, sizeof(bufferSD));
-  if (offset > 0) while(readRet > 0 && offset > 0) 
-  { 
-    readRet = fat_read_file(_fd, bufferSD, sizeof(bufferSD));
-    offset--; 
-    //cont++;  // we don't wanna count until we are done with the offset
+  int32_t seek = offset;
+  if(!fat_seek_file(_fd, &seek, FAT_SEEK_SET))
+  {
+    fat_close_file(_fd);
+    return -1;
   }
-
-  // fill in the first buffer
-  for(int j=0; j < limitPattern - 1; j++)
-    if (readRet > 0)
+  windowOffset = seek;
+  windowLength = 0;
+  
+  // Boyer-Moore-Horspool: the last byte under the pattern says how far it
+  // can be moved without skipping over a match
+  uint8_t* jump = (uint8_t*) calloc(256,sizeof(uint8_t));
+  if( jump==NULL )
+  {
+    fat_close_file(_fd);
+    return -1;
+  }
+  memset(jump, limitPattern, 256);
+  for(int j = 0; j < limitPattern - 1; j++)
+    jump[(uint8_t) pattern[j]] = limitPattern - 1 - j;
+  
+  uint8_t last = pattern[limitPattern - 1];
+  uint32_t base = 0;  // distance from the offset to window[0]
+  uint16_t pos = 0;   // pattern position being checked inside the window
+  uint8_t c;
+  
+  // the bytes the pattern has not moved past yet are kept for the next
+  // window, so matches crossing a window boundary are found as well
+  while( found < 0 && fillWindow(_fd, windowLength - pos) > 0 )
+  {
+    base += pos;
+    pos = 0;
+    while( pos + limitPattern <= windowLength )
     {
-      cmpPattern[j] = bufferSD[0];
-      readRet = fat_read_file(_fd, bufferSD, sizeof(bufferSD));
+      c = window[pos + limitPattern - 1];
+      if( c == last && memcmp(&window[pos], pattern, limitPattern - 1) == 0 )
+      {
+        found = base + pos;
+        break;
+      }
+      pos += jump[c];
     }
-    else
-      exit = 1;  // exit if the filesize is smaller than the pattern
-
-//to debug the code in the library it is possible to use the buffer together with sprintf, e.g.
-//sprintf(buffer,"%s - %c%c%c%c - %lu - %u -%lu", pattern, cmpPattern[0], cmpPattern[1], cmpPattern[2], bufferSD[0], cont, limitPattern, limitSize);
-
-  // run inside the buffer
-  while(readRet > 0 && cont < limitSize && !exit)
-  {
-    // take the last position in the buffer
-    cmpPattern[limitPattern-1] = bufferSD[0];
-    
-    // compare the strings, exit if found
-//    if(strcmp((const char*) pattern, (const char*) cmpPattern) == 0)
-    if(Utils.strCmp((const char*) pattern, (const char*) cmpPattern, limitPattern) == 0)
-      exit = 1;
-      
-    // if not exit, increment counter
-    if (!exit) 
-      cont++;
-      
-    // shift cmpPattern to the left one position
-    for(int j = 0; j < limitPattern - 1; j++) cmpPattern[j] = cmpPattern[j+1];
-    
-    // read the next buffer
-    readRet = fat_read_file(_fd, bufferSD, sizeof(bufferSD));
   }
 
   fat_close_file(_fd);
 
-  free(cmpPattern);
-  // in case we checked the whole buffer, we return error
-  if (cont >= limitSize - limitPattern ) 
-    return -1; 
+  free(jump);
 
-  // otherwise we return the pattern's location
-  return cont;
+  // the pattern's location, or -1 if it is not in the file
+  return found;
 
 }
 
@@ -1722,20 +1720,25 @@ int32_t WaspSD::numln(const char* filename)
     return -1;
   }
 
-  byte maxBuffer = 1;  // size of the buffer to use when reading
-  uint8_t bufferSD[maxBuffer];
   uint32_t cont = 0;
+  uint8_t* pos;
+  uint8_t* eol;
+  uint16_t left;
   
-  // jump over offset lines
-  uint8_t readRet = fat_read_file(_fd, bufferSD, sizeof(bufferSD));
-  while( readRet > 0)   
+  windowOffset = 0;
+  windowLength = 0;
+  
+  // count the EOLs a whole window at a time
+  while( fillWindow(_fd, 0) > 0 )
   {
-    for(uint8_t i = 0; i < maxBuffer; ++i)
+    pos = window;
+    left = windowLength;
+    while( (eol = (uint8_t*) memchr(pos, '\n', left)) != NULL )
     {
-      if (bufferSD[i] == '\n')
-        cont++;
+      cont++;
+      left -= eol + 1 - pos;
+      pos = eol + 1;
     }
-    readRet = fat_read_file(_fd, bufferSD, sizeof(bufferSD));
   }
 
   fat_close_file(_fd);
@@ -1758,9 +1761,569 @@ uint16_t WaspSD::cleanFlags(void)
 
 // Private Methods /////////////////////////////////////////////////////////////
 
+/*
+ * fillWindow ( _fd, keep ) - reads the next chunk of a file into the window
+ *
+ * moves the last 'keep' bytes of the window to its start and fills the rest
+ * with data read from '_fd' at 'windowOffset'. Reads are cut at sector
+ * boundaries, so after the first one every read covers whole sectors
+ *
+ * It returns the amount of new bytes in the window, 0 at the end of the file
+ */
+uint16_t WaspSD::fillWindow(struct fat_file_struct* _fd, uint16_t keep)
+{
+  uint16_t len;
+  uint16_t over;
+  intptr_t readRet;
+
+  if( keep > windowLength ) keep = windowLength;
+  memmove(window, &window[windowLength - keep], keep);
+  windowLength = keep;
+
+  len = SD_WINDOW_SIZE - keep;
+  over = (windowOffset + len) % 512;
+  if( over < len ) len -= over;
+
+  readRet = fat_read_file(_fd, &window[keep], len);
+  if( readRet <= 0 ) return 0;
+
+  windowLength += readRet;
+  windowOffset += readRet;
+  return readRet;
+}
+
 // Preinstantiate Objects //////////////////////////////////////////////////////
 
 WaspSD SD = WaspSD();
 
+// SDLog ///////////////////////////////////////////////////////////////////////
+
+SDLog::SDLog()
+{
+  _fd = NULL;
+  _length = 0;
+  _room = SD_LOG_BUFFER_SIZE;
+  _syncInterval = 0;
+  _lastSync = 0;
+}
+
+/*
+ * open ( filename, syncInterval ) - opens a file for appending
+ *
+ * opens "filename" in the current directory, creating it if needed, and
+ * places the log at its end. The cluster chain is followed once here, the
+ * following appends continue from the last cluster
+ *
+ * returns 1 on success, 0 if error, will mark the SD.flag with
+ * FILE_OPEN_ERROR
+ */
+uint8_t SDLog::open(const char* filename, unsigned long syncInterval)
+{
+  struct fat_dir_entry_struct file_entry;
+  int32_t offset = 0;
+
+  if (_fd) close();
+
+  if (!SD.isSD())
+  {
+    SD.flag = CARD_NOT_PRESENT;
+    SD.flag |= FILE_OPEN_ERROR;
+    return 0;
+  }
+
+  SD.flag &= ~(FILE_OPEN_ERROR);
+
+  // reuse the existing entry, only create the file if it is missing
+  if (SD.find_file_in_dir(filename, &file_entry))
+  {
+    if (SD.isDir(file_entry))
+    {
+      SD.flag |= FILE_OPEN_ERROR;
+      return 0;
+    }
+  }
+  else if (!fat_create_file(SD.dd, filename, &file_entry))
+  {
+    SD.flag |= FILE_OPEN_ERROR;
+    return 0;
+  }
+  fat_reset_dir(SD.dd);
+
+  _fd = fat_open_file(SD.fs, &file_entry);
+  if (!_fd || !fat_seek_file(_fd, &offset, FAT_SEEK_END))
+  {
+    if (_fd) fat_close_file(_fd);
+    _fd = NULL;
+    SD.flag |= FILE_OPEN_ERROR;
+    return 0;
+  }
+  fat_delay_dir_entry(_fd, 1);
+
+  // the first flush only fills up the sector the file ends in
+  _length = 0;
+  _room = SD_LOG_BUFFER_SIZE - (offset & (SD_LOG_BUFFER_SIZE - 1));
+  _syncInterval = syncInterval;
+  _lastSync = millis();
+  return 1;
+}
+
+/*
+ * flush ( void ) - writes the buffered bytes to the file
+ */
+uint8_t SDLog::flush(void)
+{
+  if (!_length) return 1;
+
+  if (fat_write_file(_fd, _buffer, _length) != _length)
+  {
+    SD.flag |= FILE_WRITING_ERROR;
+    return 0;
+  }
+  _length = 0;
+  _room = SD_LOG_BUFFER_SIZE;
+  return 1;
+}
+
+/*
+ * append ( data, length ) - writes bytes at the end of the log
+ *
+ * the bytes are buffered and written a sector at a time. The file size is
+ * updated when the sync interval has gone by
+ *
+ * returns 1 on success, 0 if error, will mark the SD.flag with
+ * FILE_WRITING_ERROR
+ */
+uint8_t SDLog::append(const uint8_t* data, uint16_t length)
+{
+  uint16_t chunk;
+
+  if (!_fd) return 0;
+  SD.flag &= ~(FILE_WRITING_ERROR);
+
+  while (length > 0)
+  {
+    chunk = _room - _length;
+    if (chunk > length) chunk = length;
+    memcpy(&_buffer[_length], data, chunk);
+    _length += chunk;
+    data += chunk;
+    length -= chunk;
+
+    if (_length == _room && !flush()) return 0;
+  }
+
+  if (_syncInterval)
+  {
+    if (millis() < _lastSync) _lastSync = millis();
+    if (millis() - _lastSync >= _syncInterval) return sync();
+  }
+  return 1;
+}
+
+uint8_t SDLog::append(const char* str)
+{
+  return append((const uint8_t*) str, strlen(str));
+}
+
+uint8_t SDLog::appendln(const char* str)
+{
+  uint8_t exit = append(str);
+#ifndef FILESYSTEM_LINUX
+  if (exit) exit &= append("\r");
+#endif
+  if (exit) exit &= append("\n");
+  return exit;
+}
+
+/*
+ * sync ( void ) - makes the log safe against power loss
+ *
+ * writes the buffered bytes, the directory entry with the new file size
+ * and the card's write cache
+ *
+ * returns 1 on success, 0 if error
+ */
+uint8_t SDLog::sync(void)
+{
+  if (!_fd) return 0;
+
+  _lastSync = millis();
+  if (!flush()) return 0;
+  if (!fat_sync_file(_fd) || !sd_raw_sync())
+  {
+    SD.flag |= FILE_WRITING_ERROR;
+    return 0;
+  }
+  return 1;
+}
+
+/*
+ * close ( void ) - syncs and closes the log
+ */
+void SDLog::close(void)
+{
+  if (!_fd) return;
+
+  sync();
+  fat_close_file(_fd);
+  _fd = NULL;
+}
+
+// SDQueue /////////////////////////////////////////////////////////////////////
+
+#define SD_QUEUE_MAGIC 0x5146
+
+/*
+ * copy of the read cursor, two of them fill the file header
+ */
+struct sd_queue_header
+{
+  uint16_t magic;
+  uint8_t seq;
+  uint8_t recordSize;
+  uint32_t head;
+  uint8_t reserved[7];
+  uint8_t check;
+};
+
+/*
+ * sd_queue_check ( data, length ) - check byte of a record or a cursor
+ *
+ * it is the complement of the sum, so a zeroed area is never valid
+ */
+static uint8_t sd_queue_check(const uint8_t* data, uint8_t length)
+{
+  uint8_t sum = 0;
+  while (length--) sum += *data++;
+  return ~sum;
+}
+
+SDQueue::SDQueue()
+{
+  _fd = NULL;
+  _recordSize = 0;
+  _seq = 0;
+  _head = 0;
+  _count = 0;
+  _pending = 0;
+}
+
+/*
+ * writeHeader ( void ) - stores the read cursor
+ *
+ * the copy not holding the last cursor is overwritten, so a reset while
+ * writing leaves the previous cursor valid. A failed write is retried by
+ * the next push() or pop()
+ */
+uint8_t SDQueue::writeHeader(void)
+{
+  struct sd_queue_header header;
+  int32_t offset;
+
+  memset(&header, 0, sizeof(header));
+  header.magic = SD_QUEUE_MAGIC;
+  header.seq = ++_seq;
+  header.recordSize = _recordSize;
+  header.head = _head;
+  header.check = sd_queue_check((uint8_t*) &header, sizeof(header) - 1);
+
+  offset = (_seq & 1) * sizeof(header);
+  if (!fat_seek_file(_fd, &offset, FAT_SEEK_SET) ||
+      fat_write_file(_fd, (uint8_t*) &header, sizeof(header)) != sizeof(header) ||
+      !sd_raw_sync())
+  {
+    _pending = 1;
+    SD.flag |= FILE_WRITING_ERROR;
+    return 0;
+  }
+  _pending = 0;
+  return 1;
+}
+
+/*
+ * open ( filename, recordSize ) - opens a queue
+ *
+ * opens "filename" in the current directory, creating it if needed. The
+ * newest valid cursor is loaded and a record torn by a reset at the end of
+ * the file is dropped
+ *
+ * returns 1 on success, 0 if error, will mark the SD.flag with
+ * FILE_OPEN_ERROR
+ */
+uint8_t SDQueue::open(const char* filename, uint8_t recordSize)
+{
+  struct fat_dir_entry_struct file_entry;
+  struct sd_queue_header header[2];
+  int32_t size = 0;
+  int32_t offset = 0;
+  uint8_t valid = 0;
+
+  if (_fd) close();
+
+  if (!SD.isSD())
+  {
+    SD.flag = CARD_NOT_PRESENT;
+    SD.flag |= FILE_OPEN_ERROR;
+    return 0;
+  }
+
+  SD.flag &= ~(FILE_OPEN_ERROR);
+
+  if (recordSize < 3 || recordSize > SD_QUEUE_MAX_RECORD)
+  {
+    SD.flag |= FILE_OPEN_ERROR;
+    return 0;
+  }
+
+  // reuse the existing entry, only create the file if it is missing
+  if (SD.find_file_in_dir(filename, &file_entry))
+  {
+    if (SD.isDir(file_entry))
+    {
+      SD.flag |= FILE_OPEN_ERROR;
+      return 0;
+    }
+  }
+  else if (!fat_create_file(SD.dd, filename, &file_entry))
+  {
+    SD.flag |= FILE_OPEN_ERROR;
+    return 0;
+  }
+  fat_reset_dir(SD.dd);
+
+  _fd = fat_open_file(SD.fs, &file_entry);
+  if (!_fd || !fat_seek_file(_fd, &size, FAT_SEEK_END) ||
+      !fat_seek_file(_fd, &offset, FAT_SEEK_SET))
+  {
+    if (_fd) fat_close_file(_fd);
+    _fd = NULL;
+    SD.flag |= FILE_OPEN_ERROR;
+    return 0;
+  }
+
+  _recordSize = recordSize;
+  _seq = 0;
+  _head = 0;
+  _pending = 0;
+
+  if (size < SD_QUEUE_HEADER_SIZE)
+  {
+    // new file, the header starts with no valid cursor
+    memset(header, 0, sizeof(header));
+    if (!fat_resize_file(_fd, 0) ||
+        fat_write_file(_fd, (uint8_t*) header, sizeof(header)) != sizeof(header))
+    {
+      close();
+      SD.flag |= FILE_OPEN_ERROR;
+      return 0;
+    }
+    size = SD_QUEUE_HEADER_SIZE;
+  }
+  else if (fat_read_file(_fd, (uint8_t*) header, sizeof(header)) == sizeof(header))
+  {
+    // picks the newest of the two cursors
+    for (uint8_t i = 0; i < 2; i++)
+    {
+      if (header[i].magic != SD_QUEUE_MAGIC ||
+          header[i].check != sd_queue_check((uint8_t*) &header[i], sizeof(header[i]) - 1))
+        continue;
+
+      if (header[i].recordSize != recordSize)
+      {
+        // the file holds records of another size
+        close();
+        SD.flag |= FILE_OPEN_ERROR;
+        return 0;
+      }
+      if (!valid || (int8_t) (header[i].seq - _seq) > 0)
+      {
+        _seq = header[i].seq;
+        _head = header[i].head;
+      }
+      valid = 1;
+    }
+  }
+
+  // a record torn by a reset is dropped
+  _count = (size - SD_QUEUE_HEADER_SIZE) / _recordSize;
+  if ((size - SD_QUEUE_HEADER_SIZE) % _recordSize &&
+      !fat_resize_file(_fd, SD_QUEUE_HEADER_SIZE + _count * _recordSize))
+  {
+    close();
+    SD.flag |= FILE_OPEN_ERROR;
+    return 0;
+  }
+
+  if (_head > _count || (_head == _count && _count))
+  {
+    // everything was sent, the records are removed
+    _head = 0;
+    if (_count)
+    {
+      _count = 0;
+      if (!fat_resize_file(_fd, SD_QUEUE_HEADER_SIZE))
+      {
+        close();
+        SD.flag |= FILE_OPEN_ERROR;
+        return 0;
+      }
+    }
+    valid = 0;
+  }
+
+  if (!valid && !writeHeader())
+  {
+    close();
+    SD.flag |= FILE_OPEN_ERROR;
+    return 0;
+  }
+  return 1;
+}
+
+/*
+ * push ( data, length ) - adds a record at the end of the queue
+ *
+ * the record is on the card when the function returns
+ *
+ * returns 1 on success, 0 if error, will mark the SD.flag with
+ * FILE_WRITING_ERROR
+ */
+uint8_t SDQueue::push(const uint8_t* data, uint8_t length)
+{
+  uint8_t record[SD_QUEUE_MAX_RECORD];
+  int32_t offset;
+
+  if (!_fd) return 0;
+  SD.flag &= ~(FILE_WRITING_ERROR);
+
+  if (length > _recordSize - 2)
+  {
+    SD.flag |= FILE_WRITING_ERROR;
+    return 0;
+  }
+
+  // the records would be lost behind a stale cursor
+  if (_pending && !writeHeader()) return 0;
+
+  record[0] = length;
+  memcpy(&record[1], data, length);
+  memset(&record[1 + length], 0, _recordSize - 2 - length);
+  record[_recordSize - 1] = sd_queue_check(record, _recordSize - 1);
+
+  offset = SD_QUEUE_HEADER_SIZE + _count * _recordSize;
+  if (!fat_seek_file(_fd, &offset, FAT_SEEK_SET) ||
+      fat_write_file(_fd, record, _recordSize) != _recordSize ||
+      !sd_raw_sync())
+  {
+    SD.flag |= FILE_WRITING_ERROR;
+    return 0;
+  }
+  _count++;
+  return 1;
+}
+
+uint8_t SDQueue::push(const char* str)
+{
+  uint16_t length = strlen(str);
+  if (length > 0xFF) length = 0xFF;
+  return push((const uint8_t*) str, length);
+}
+
+/*
+ * peek ( buffer, size, maxRecords, separator, records ) - copies the oldest
+ * records to "buffer"
+ *
+ * records are copied while they fit in "buffer". Records found corrupted
+ * are skipped, but counted in "records" so pop() removes them too
+ *
+ * returns the number of bytes copied
+ */
+uint16_t SDQueue::peek(uint8_t* buffer, uint16_t size, uint8_t maxRecords, int16_t separator, uint8_t* records)
+{
+  uint8_t record[SD_QUEUE_MAX_RECORD];
+  uint16_t length = 0;
+  uint8_t taken = 0;
+  int32_t offset;
+
+  *records = 0;
+  if (!_fd || _head >= _count) return 0;
+
+  offset = SD_QUEUE_HEADER_SIZE + _head * _recordSize;
+  if (!fat_seek_file(_fd, &offset, FAT_SEEK_SET)) return 0;
+
+  while (taken < maxRecords && _head + taken < _count)
+  {
+    if (fat_read_file(_fd, record, _recordSize) != _recordSize) break;
+
+    if (record[0] <= _recordSize - 2 &&
+        record[_recordSize - 1] == sd_queue_check(record, _recordSize - 1))
+    {
+      if (length + record[0] + 1 > size) break;
+
+      if (separator < 0) buffer[length++] = record[0];
+      memcpy(&buffer[length], &record[1], record[0]);
+      length += record[0];
+      if (separator >= 0) buffer[length++] = separator;
+    }
+    taken++;
+  }
+
+  *records = taken;
+  return length;
+}
+
+/*
+ * pop ( records ) - removes the oldest records
+ *
+ * the cursor is stored before returning. When the queue gets empty the file
+ * is cut back to its header
+ *
+ * returns 1 on success, 0 if error, will mark the SD.flag with
+ * FILE_WRITING_ERROR
+ */
+uint8_t SDQueue::pop(uint8_t records)
+{
+  uint32_t head;
+
+  if (!_fd) return 0;
+  SD.flag &= ~(FILE_WRITING_ERROR);
+
+  if (records > _count - _head) records = _count - _head;
+  head = _head;
+  _head += records;
+
+  // the cursor is written before the file is cut, a reset in between
+  // leaves a cursor at the end, which open() takes as an empty queue
+  if (!writeHeader())
+  {
+    _head = head;
+    return 0;
+  }
+
+  if (_head == _count && _count)
+  {
+    if (!fat_resize_file(_fd, SD_QUEUE_HEADER_SIZE))
+    {
+      SD.flag |= FILE_WRITING_ERROR;
+      return 0;
+    }
+    _head = 0;
+    _count = 0;
+    return writeHeader();
+  }
+  return 1;
+}
+
+/*
+ * close ( void ) - closes the queue
+ */
+void SDQueue::close(void)
+{
+  if (!_fd) return;
+
+  fat_close_file(_fd);
+  _fd = NULL;
+}
+
 
 #endif
\ No newline at end of file
@@ -69,6 +69,32 @@
 #define DOS_BUFFER_SIZE 256
 #define	BIN_BUFFER_SIZE	100
 
+/*! \def SD_WINDOW_SIZE
+    \brief Size of the read window the file functions stream through. It is one SD sector
+ */
+#ifndef SD_WINDOW_SIZE
+#define	SD_WINDOW_SIZE	512
+#endif
+
+/*! \def SD_LOG_BUFFER_SIZE
+    \brief Size of the SDLog write buffer. A power of two no bigger than a sector, so flushes end on sector boundaries
+ */
+#ifndef SD_LOG_BUFFER_SIZE
+#define	SD_LOG_BUFFER_SIZE	512
+#endif
+
+/*! \def SD_QUEUE_MAX_RECORD
+    \brief Biggest SDQueue record, including its length and check bytes
+ */
+#ifndef SD_QUEUE_MAX_RECORD
+#define	SD_QUEUE_MAX_RECORD	128
+#endif
+
+/*! \def SD_QUEUE_HEADER_SIZE
+    \brief Bytes at the beginning of an SDQueue file holding the two copies of the read cursor
+ */
+#define	SD_QUEUE_HEADER_SIZE	32
+
 /*! \def NAMES
     \brief shows information available from files and directories. It shows the name
  */
@@ -175,6 +201,29 @@ class WaspSD
 {
   private:
 
+  //! Variable : read window shared by cat, catBin, catln, indexOf and numln
+  /*!    
+   */
+  uint8_t window[SD_WINDOW_SIZE];
+  
+  //! Variable : number of valid bytes in 'window'
+  /*!    
+   */
+  uint16_t windowLength;
+  
+  //! Variable : file offset of the next byte to read into 'window'
+  /*!    
+   */
+  uint32_t windowOffset;
+  
+  //! It reads the next chunk of an open file into 'window'
+  /*!
+  \param struct fat_file_struct* _fd : the open file
+  \param uint16_t keep : bytes at the end of the current window moved to its start before reading
+  \return the number of new bytes read, '0' at the end of the file
+   */
+  uint16_t fillWindow(struct fat_file_struct* _fd, uint16_t keep);
+
   public:
 
   //! Variable : buffer containing the information coming from the card used to avoid calls to UART functions inside the library. Beware, there could be data longer than the buffer size
@@ -614,5 +663,242 @@ class WaspSD
 
 extern WaspSD SD;
 
+//! SDLog Class
+/*!
+	SDLog keeps a file of the current SD directory open for appending. The file end, its last
+	cluster and the pending bytes are kept between calls, so appending does not depend on the
+	file size. Data is written in whole sectors and the file size in the directory entry is
+	only updated by sync(), close() or every 'syncInterval' milliseconds.
+	The file must not be written through the WaspSD functions while the log is open.
+ */
+class SDLog
+{
+  private:
+
+  //! Variable : file handle kept open while logging
+  /*!    
+   */
+  struct fat_file_struct* _fd;
+  
+  //! Variable : bytes waiting to be written
+  /*!    
+   */
+  uint8_t _buffer[SD_LOG_BUFFER_SIZE];
+  
+  //! Variable : number of bytes in '_buffer'
+  /*!    
+   */
+  uint16_t _length;
+  
+  //! Variable : bytes '_buffer' takes before the next sector boundary of the file
+  /*!    
+   */
+  uint16_t _room;
+  
+  //! Variable : milliseconds between directory entry updates, '0' for explicit sync() only
+  /*!    
+   */
+  unsigned long _syncInterval;
+  
+  //! Variable : time of the last sync
+  /*!    
+   */
+  unsigned long _lastSync;
+  
+  //! It writes '_buffer' to the file
+  /*!
+  \param void
+  \return '1' on success, '0' otherwise
+   */
+  uint8_t flush(void);
+
+  public:
+
+  //! class constructor
+  /*!
+  It does nothing
+  \param void
+  \return void
+  */
+  SDLog();
+  
+  //! It opens a file for appending, creating it if it does not exist
+  /*!
+  \param const char* filename : the file in the current directory
+  \param unsigned long syncInterval : milliseconds between directory entry updates, '0' to update only on sync()
+  \return '1' on success, '0' otherwise. SD.flag shows FILE_OPEN_ERROR on error
+   */
+  uint8_t open(const char* filename, unsigned long syncInterval);
+  
+  //! It appends bytes at the end of the file
+  /*!
+  \param const uint8_t* data : the bytes to append
+  \param uint16_t length : number of bytes
+  \return '1' on success, '0' otherwise. SD.flag shows FILE_WRITING_ERROR on error
+   */
+  uint8_t append(const uint8_t* data, uint16_t length);
+  
+  //! It appends a string at the end of the file
+  /*!
+  \param const char* str : the string to append
+  \return '1' on success, '0' otherwise
+   */
+  uint8_t append(const char* str);
+  
+  //! It appends a string and an end of line at the end of the file
+  /*!
+  \param const char* str : the string to append
+  \return '1' on success, '0' otherwise
+   */
+  uint8_t appendln(const char* str);
+  
+  //! It writes the pending bytes and the file size to the card
+  /*!
+  \param void
+  \return '1' on success, '0' otherwise
+   */
+  uint8_t sync(void);
+  
+  //! It syncs and closes the file
+  /*!
+  \param void
+  \return void
+   */
+  void close(void);
+  
+  //! It tells whether the log is open
+  /*!
+  \param void
+  \return '1' if open, '0' otherwise
+   */
+  uint8_t isOpen(void) {return _fd!=NULL;};
+};
+
+//! SDQueue Class
+/*!
+	SDQueue is a FIFO of fixed size records kept in a file of the current SD directory, used to
+	store readings while the uplink is down and to send them later in batches.
+	The file begins with two copies of the read cursor that are written alternately, so the
+	cursor survives a reset even if it happens while it is being written. Each record holds a
+	length byte, the data and a check byte, so records torn by a reset are detected and skipped.
+	Records are only removed by pop(), after the batch returned by peek() has been sent, and the
+	file is emptied when all its records have been sent.
+ */
+class SDQueue
+{
+  private:
+
+  //! Variable : file handle kept open while the queue is in use
+  /*!    
+   */
+  struct fat_file_struct* _fd;
+  
+  //! Variable : size of every record in the file
+  /*!    
+   */
+  uint8_t _recordSize;
+  
+  //! Variable : sequence number of the last cursor written
+  /*!    
+   */
+  uint8_t _seq;
+  
+  //! Variable : index of the first record not yet sent
+  /*!    
+   */
+  uint32_t _head;
+  
+  //! Variable : number of records in the file
+  /*!    
+   */
+  uint32_t _count;
+  
+  //! Variable : '1' if the last cursor could not be written
+  /*!    
+   */
+  uint8_t _pending;
+  
+  //! It writes the read cursor in the older of its two copies
+  /*!
+  \param void
+  \return '1' on success, '0' otherwise
+   */
+  uint8_t writeHeader(void);
+
+  public:
+
+  //! class constructor
+  /*!
+  It does nothing
+  \param void
+  \return void
+  */
+  SDQueue();
+  
+  //! It opens a queue, creating its file if it does not exist
+  /*!
+  \param const char* filename : the file in the current directory
+  \param uint8_t recordSize : size of each record, up to SD_QUEUE_MAX_RECORD. It holds recordSize-2 bytes of data
+  \return '1' on success, '0' otherwise. SD.flag shows FILE_OPEN_ERROR on error
+   */
+  uint8_t open(const char* filename, uint8_t recordSize);
+  
+  //! It adds a record at the end of the queue
+  /*!
+  \param const uint8_t* data : the bytes to store
+  \param uint8_t length : number of bytes, up to recordSize-2
+  \return '1' on success, '0' otherwise. SD.flag shows FILE_WRITING_ERROR on error
+   */
+  uint8_t push(const uint8_t* data, uint8_t length);
+  
+  //! It adds a string as a record at the end of the queue
+  /*!
+  \param const char* str : the string to store
+  \return '1' on success, '0' otherwise
+   */
+  uint8_t push(const char* str);
+  
+  //! It copies the oldest records to a buffer without removing them
+  /*!
+  Records are packed one after another. If 'separator' is negative, each record is preceded
+  by its length byte, otherwise it is followed by the 'separator' byte (e.g. '\n')
+  \param uint8_t* buffer : buffer for the batch
+  \param uint16_t size : size of 'buffer'
+  \param uint8_t maxRecords : maximum number of records to copy
+  \param int16_t separator : byte written after each record, or -1 to prefix the lengths
+  \param uint8_t* records : number of records taken from the queue, to be given to pop()
+  \return number of bytes copied to 'buffer'
+   */
+  uint16_t peek(uint8_t* buffer, uint16_t size, uint8_t maxRecords, int16_t separator, uint8_t* records);
+  
+  //! It removes the oldest records, once they have been sent
+  /*!
+  \param uint8_t records : number of records to remove
+  \return '1' on success, '0' otherwise. SD.flag shows FILE_WRITING_ERROR on error
+   */
+  uint8_t pop(uint8_t records);
+  
+  //! It gets the number of records waiting in the queue
+  /*!
+  \param void
+  \return number of records
+   */
+  uint32_t available(void) {return _count-_head;};
+  
+  //! It closes the queue file
+  /*!
+  \param void
+  \return void
+   */
+  void close(void);
+  
+  //! It tells whether the queue is open
+  /*!
+  \param void
+  \return '1' if open, '0' otherwise
+   */
+  uint8_t isOpen(void) {return _fd!=NULL;};
+};
+
 #endif
 
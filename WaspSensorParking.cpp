@@ -56,6 +56,9 @@ WaspSensorParking::WaspSensorParking()
 	digitalWrite(19,LOW);
 	digitalWrite(SENS_PW_3V3,LOW);
 	digitalWrite(SENS_PW_5V,LOW);
+
+	parkingState = PARKING_EMPTY;
+	fastReads = 0;
 }
 
 // Public Methods //////////////////////////////////////////////////////////////
@@ -77,8 +80,6 @@ void	WaspSensorParking::calibration(void)
 	uint16_t val_y = 0;
 	uint16_t val_z = 0;  
 	int temp = 0;
-	int temper = 0;
-	float temp2 = 0.0;
 	  
 	for(int i=0; i<8; i++)
 	{
@@ -93,20 +94,7 @@ void	WaspSensorParking::calibration(void)
 	initialY = val_y/8;
 	initialZ = val_z/8;
 
-	temper = 0;  
-	temp = 0;
-	for(int i=0; i<8; i++)
-	{
-		temper=analogRead(SENS_PARKING_T);  
-		delay(100);
-		temp2 = ((float(temper) * 3300 / 1023) - 500) / 10;
-		temper = int(temp2);
-		temp = temp + temper;
-	}
-
-	temp2 = float(temp)/8;
-	 
-	temp = int(temp2);
+	temp = readTemperature();
 
 	initialT = temp;
 	  
@@ -114,6 +102,19 @@ void	WaspSensorParking::calibration(void)
 	indexY = coefY2*temp*temp + coefY*temp + constY;
 	indexZ = coefZ2*temp*temp + coefZ*temp + constZ;
 
+	// Baselines start at calibration values and follow the empty lot later
+	baselineX = float(initialX) / indexX;
+	baselineY = float(initialY) / indexY;
+	baselineZ = float(initialZ) / indexZ;
+	temperature = temp;
+	calculateReference(temperature);
+	parkingState = PARKING_EMPTY;
+
+	// Next getState reads with set/reset
+	fastX = -PARKING_FAST_MARGIN;
+	fastY = -PARKING_FAST_MARGIN;
+	fastZ = -PARKING_FAST_MARGIN;
+	fastReads = 0;
 }
 
 void	WaspSensorParking::loadReference(void)
@@ -142,9 +143,9 @@ void	WaspSensorParking::loadReference(void)
 
 void	WaspSensorParking::calculateReference(int temperature)
 {
-	referenceX = int((float(initialX) / indexX)*( coefX2*temperature*temperature + coefX*temperature + constX ));
-	referenceY = int((float(initialY) / indexY)*( coefY2*temperature*temperature + coefY*temperature + constY ));
-	referenceZ = int((float(initialZ) / indexZ)*( coefZ2*temperature*temperature + coefZ*temperature + constZ ));
+	referenceX = int(baselineX*( coefX2*temperature*temperature + coefX*temperature + constX ));
+	referenceY = int(baselineY*( coefY2*temperature*temperature + coefY*temperature + constY ));
+	referenceZ = int(baselineZ*( coefZ2*temperature*temperature + coefZ*temperature + constZ ));
 }
 
 int	WaspSensorParking::readTemperature(void)
@@ -198,16 +199,72 @@ void	WaspSensorParking::readParkingSetReset(void)
 boolean	WaspSensorParking::estimateState(void)
 {
 	boolean status;
+	int threshold = PARKING_THRESHOLD;
 
-	if( (abs((valueX-referenceX))>=PARKING_THRESHOLD) || (abs((valueY-referenceY))>=PARKING_THRESHOLD) || (abs((valueZ-referenceZ))>=PARKING_THRESHOLD) ) status = PARKING_OCCUPIED;
+	// Hysteresis: an occupied lot needs a lower threshold to get empty again
+	if( parkingState==PARKING_OCCUPIED ) threshold = PARKING_THRESHOLD_EMPTY;
+
+	if( (abs((valueX-referenceX))>=threshold) || (abs((valueY-referenceY))>=threshold) || (abs((valueZ-referenceZ))>=threshold) ) status = PARKING_OCCUPIED;
 	else status = PARKING_EMPTY;
 
+	parkingState = status;
 	return status;
 }
 
+boolean	WaspSensorParking::getState(void)
+{
+	int setX;
+	int setY;
+	int setZ;
+
+	// Fast read, without set/reset pulses
+	readParking();
+	fastReads++;
+	if( (fastReads<PARKING_FULL_PERIOD) && (abs(valueX-fastX)<PARKING_FAST_MARGIN) && 
+	    (abs(valueY-fastY)<PARKING_FAST_MARGIN) && (abs(valueZ-fastZ)<PARKING_FAST_MARGIN) )
+	{
+		// Nothing has changed since last read with set/reset
+		return parkingState;
+	}
+
+	// Temperature changes slowly, it is only read periodically
+	if( fastReads>=PARKING_FULL_PERIOD ) temperature = readTemperature();
+	fastReads = 0;
+
+	readParkingSetReset();
+	calculateReference(temperature);
+	estimateState();
+	if( parkingState==PARKING_EMPTY ) updateBaseline(temperature);
+
+	// Values without set/reset for next fast reads
+	setX = valueX;
+	setY = valueY;
+	setZ = valueZ;
+	readParking();
+	fastX = valueX;
+	fastY = valueY;
+	fastZ = valueZ;
+	valueX = setX;
+	valueY = setY;
+	valueZ = setZ;
+
+	return parkingState;
+}
+
 
 // Private Methods //////////////////////////////////////////////////////////////
 
+void	WaspSensorParking::updateBaseline(int temperature)
+{
+	// Only reads close to the reference, to not follow a vehicle arriving slowly
+	if( (abs((valueX-referenceX))>=PARKING_THRESHOLD_EMPTY) || (abs((valueY-referenceY))>=PARKING_THRESHOLD_EMPTY) || (abs((valueZ-referenceZ))>=PARKING_THRESHOLD_EMPTY) ) return;
+
+	// Exponential moving average of the values without temperature dependance
+	baselineX += PARKING_BASELINE_ALPHA*( float(valueX) / ( coefX2*temperature*temperature + coefX*temperature + constX ) - baselineX );
+	baselineY += PARKING_BASELINE_ALPHA*( float(valueY) / ( coefY2*temperature*temperature + coefY*temperature + constY ) - baselineY );
+	baselineZ += PARKING_BASELINE_ALPHA*( float(valueZ) / ( coefZ2*temperature*temperature + coefZ*temperature + constZ ) - baselineZ );
+}
+
 
 WaspSensorParking SensorParking=WaspSensorParking();
 
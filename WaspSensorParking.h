@@ -78,6 +78,22 @@
 	\brief Sensor Types. Reference Threshold for state estimation
 */
 #define PARKING_THRESHOLD	20
+/*! 	\def PARKING_THRESHOLD_EMPTY
+	\brief Sensor Types. Reference Threshold to go back to empty state. Lower than PARKING_THRESHOLD to avoid state changes on noise
+*/
+#define PARKING_THRESHOLD_EMPTY	12
+/*! 	\def PARKING_FAST_MARGIN
+	\brief Sensor Types. Maximum change of a read without set/reset to keep last state
+*/
+#define PARKING_FAST_MARGIN	4
+/*! 	\def PARKING_FULL_PERIOD
+	\brief Sensor Types. Maximum number of reads without set/reset between two reads with set/reset and temperature
+*/
+#define PARKING_FULL_PERIOD	30
+/*! 	\def PARKING_BASELINE_ALPHA
+	\brief Sensor Types. Weight of each empty lot read in the baseline
+*/
+#define PARKING_BASELINE_ALPHA	0.05
 
 /*! 	\def PARKING_EMPTY
 	\brief Sensor Types. Empty lot state
@@ -139,6 +155,20 @@ class WaspSensorParking
 {
 	private:
 
+	//! It updates the baseline with the values read while the lot is empty
+  	/*!
+	\param int temperature : specifies the temperature of the sensors in Celsius degree
+	\return void
+	 */
+	void updateBaseline(int temperature);
+
+	//! Variable : values for the X, Y and Z axis read without set/reset after last read with set/reset
+	int  fastX;
+	int  fastY;
+	int  fastZ;
+
+	//! Variable : number of reads without set/reset since last read with set/reset
+	uint8_t  fastReads;
 	
 	public:
 
@@ -223,6 +253,37 @@ class WaspSensorParking
 	int  initialT;
 
 
+	//! Variable : baseline for the X axis sensor
+  	/*!
+	It specifies the value of the X axis for the empty lot, without temperature dependance. It is set by calibration and updated while the lot is empty
+	\sa calibration, calculateReference, getState
+   	*/
+	float  baselineX;
+	//! Variable : baseline for the Y axis sensor
+  	/*!
+	It specifies the value of the Y axis for the empty lot, without temperature dependance. It is set by calibration and updated while the lot is empty
+	\sa calibration, calculateReference, getState
+   	*/
+	float  baselineY;
+	//! Variable : baseline for the Z axis sensor
+  	/*!
+	It specifies the value of the Z axis for the empty lot, without temperature dependance. It is set by calibration and updated while the lot is empty
+	\sa calibration, calculateReference, getState
+   	*/
+	float  baselineZ;
+	//! Variable : temperature of last reference
+  	/*!
+	It specifies the temperature used by getState to calculate the reference
+   	*/
+	int  temperature;
+	//! Variable : state of the lot
+  	/*!
+	It specifies the last state estimated (PARKING_EMPTY or PARKING_OCCUPIED)
+	\sa estimateState, getState
+   	*/
+	boolean  parkingState;
+
+
 	//! Variable : reference index for temperature compensation
   	/*!
 	It specifies the initial index for temperature compensation for the X axis
@@ -308,7 +369,7 @@ class WaspSensorParking
 	 */
 	void loadReference(void);
 	
-	//! It calculates the reference for each axis in function of the initial values (initialX, initialY and initialZ), the compensation coefficeints (coefX2, coefY2, coefZ2, coefX, coefY, coefZ, constX, constY and constZ) and current temperature and stores them in variables referenceX, referenceY and referenceZ
+	//! It calculates the reference for each axis in function of the baselines (baselineX, baselineY and baselineZ), the compensation coefficeints (coefX2, coefY2, coefZ2, coefX, coefY, coefZ, constX, constY and constZ) and current temperature and stores them in variables referenceX, referenceY and referenceZ
   	/*!
 	\param int temperature : specifies the temperature of the sensors in Celsius degree
 	\return void
@@ -342,12 +403,22 @@ class WaspSensorParking
 
 	//! It uses the values in variables valueX, valueY, valueZ, referenceX, referenceY and referenceZ to estimate the state of the parking lot
   	/*!
+	An empty lot gets occupied when an axis differs PARKING_THRESHOLD from its reference, and gets empty again when all of them differ less than PARKING_THRESHOLD_EMPTY
 	\param void
 	\return estate of the lot (0 for empty, 1 for occupied)
 	\sa 
 	 */
 	boolean estimateState(void);
 
+	//! It estimates the state of the parking lot, reading the sensors with set/reset pulses only when needed
+  	/*!
+	The sensors are read without set/reset. If the values have not changed since last read with set/reset, last state is kept. Otherwise, or every PARKING_FULL_PERIOD reads, they are read with set/reset, the state is estimated and, if the lot is empty, the baselines are updated. Temperature is read every PARKING_FULL_PERIOD reads. calibration must be called first
+	\param void
+	\return estate of the lot (0 for empty, 1 for occupied)
+	\sa calibration, estimateState
+	 */
+	boolean getState(void);
+
 
 };
 
@@ -25,6 +25,46 @@
 #include "WaspClasses.h"
 #endif
 
+// Pulses per second of last RAD_BINS seconds plus current one. Only the 
+// interruption adds pulses, so measures do not keep the processor busy.
+static volatile uint16_t rad_bins[RAD_BINS+1];
+static volatile uint8_t rad_index;		// Bin of current second
+static volatile unsigned long rad_second;	// Current second
+static volatile unsigned long rad_start;	// Second when counting started
+
+/*
+ Function: Moves current bin to specified second, clearing the bins of seconds without pulses.
+	Must be called with interrupts disabled.
+ Returns: 
+ Parameters: 
+	second: current second
+ Values: 
+*/
+static void rad_advance(unsigned long second)
+{
+	unsigned long elapsed = second - rad_second;
+
+	if (elapsed>RAD_BINS+1) elapsed=RAD_BINS+1;
+	while (elapsed--){
+		rad_index++;
+		if (rad_index>RAD_BINS) rad_index=0;
+		rad_bins[rad_index]=0;
+	}
+	rad_second = second;
+}
+
+/*
+ Function: Adds one pulse to current bin. Called from the interruption.
+ Returns: 
+ Parameters: 
+ Values: 
+*/
+static void rad_pulse(void)
+{
+	rad_advance(millis()/1000);
+	if (rad_bins[rad_index]<0xFFFF) rad_bins[rad_index]++;
+}
+
 
 // Constructors //
 
@@ -75,7 +115,7 @@ void WaspSensorRadiation::ON(){
 void WaspSensorRadiation::OFF(){
 	PWR.setSensorPower(SENS_5V,SENS_OFF); 
   	PWR.setSensorPower(SENS_3V3,SENS_OFF);
-	disableInterrupts(LAI_INT);
+	disableInterrupts(RAD_INT);
 }
 
 /*
@@ -86,6 +126,16 @@ void WaspSensorRadiation::OFF(){
 */
 void WaspSensorRadiation::init(){
 
+	// Clear pulses and count them by interruption from now on
+	uint8_t oldSREG = SREG;
+	cli();
+	for (int i=0;i<=RAD_BINS;i++) rad_bins[i]=0;
+	rad_index = 0;
+	rad_second = millis()/1000;
+	rad_start = rad_second;
+	SREG = oldSREG;
+
+	attachInterruptRad(rad_pulse);
 	enableInterrupts(RAD_INT);
 
 	// configure led bar pins
@@ -102,7 +152,7 @@ void WaspSensorRadiation::init(){
 
 
 /*
- Function: Measures actual radiation value during 10 seconds.
+ Function: Gets radiation value of last 10 seconds.
  Returns: 
 	radiationValue: Returns value of radiation in uSv/H
  Parameters: 
@@ -110,34 +160,11 @@ void WaspSensorRadiation::init(){
 */
 float WaspSensorRadiation::getRadiation(){
 
-	long timeRepeat= 10000;        
-	long previous=millis();
-	
-	while( (millis()-previous<timeRepeat) )
-    {
-		if( intFlag & RAD_INT){
-			disableInterrupts(RAD_INT);
-			intFlag &= ~(RAD_INT);
-			countPulse();
-
-			while(!digitalRead(RAD_INT_PIN_MON));
-    			enableInterrupts(RAD_INT);
-  		}
-    
-    	// Condition to avoid an overflow (DO NOT REMOVE)
-    	if( millis()-previous < 0 ) previous=millis();
-    }
-
-    radiationValue = 6.0*count * CONV_FACTOR;
-   	timePreviousMeassure = millis();
-   	ledBar(6*count);  
-   	count = 0;
-
-	return radiationValue;
+	return getRadiation(10000);
 }
 
 /*
- Function: Measures actual radiation value during specified time. Maximum measure time is 60 seconds
+ Function: Gets radiation value of last specified time. Maximum measure time is 60 seconds
  Returns: 
 	radiationValue: Returns value of radiation in uSv/H
  Parameters: 
@@ -146,37 +173,16 @@ float WaspSensorRadiation::getRadiation(){
 */
 float WaspSensorRadiation::getRadiation(long time){
 
-	float k=0;      //used to obtain CPM
-	float minute = 60000;
-	long previous=millis();
-	
-	while( (millis()-previous<time) )
-    {
-		if( intFlag & RAD_INT){
-			disableInterrupts(RAD_INT);
-			intFlag &= ~(RAD_INT);
-			countPulse();
-
-			while(!digitalRead(RAD_INT_PIN_MON));
-    			enableInterrupts(RAD_INT);
-  		}
-    
-    	// Condition to avoid an overflow (DO NOT REMOVE)
-    	if( millis()-previous < 0 ) previous=millis();
-    }
-     	
-	k = (minute/time);
-	radiationValueCPM = k*count;
-   	radiationValue = k*count * CONV_FACTOR;
-   	timePreviousMeassure = millis();
-	ledBar(k*count);  
-   	count = 0;
+	getCPM(time);
+   	radiationValue = radiationValueCPM * CONV_FACTOR;
 
 	return radiationValue;
 }
 
 /*
- Function: Measures actual radiation value during specified time. Maximum time is 60 seconds
+ Function: Gets radiation value in cpm of last specified time. Maximum time is 60 seconds
+	Pulses are counted by interruption since init(). If less time has been 
+	counted, it waits for the rest.
  Returns: 
 	RadiationValueCPM: radiation value in CPM
  Parameters: 
@@ -185,33 +191,40 @@ float WaspSensorRadiation::getRadiation(long time){
 */
 float WaspSensorRadiation::getCPM(long time){
 
-	float k=0;
-	float minute = 60000;
-	long previous=millis();
-
-	while( (millis()-previous<time) )
-    {
-		if( intFlag & RAD_INT){
-			disableInterrupts(RAD_INT);
-			intFlag &= ~(RAD_INT);
-			countPulse();
-
-			while(!digitalRead(RAD_INT_PIN_MON));
-    			enableInterrupts(RAD_INT);
-  		}
-    
-    	// Condition to avoid an overflow (DO NOT REMOVE)
-    	if( millis()-previous < 0 ) previous=millis();
-    }
-	k = (minute/time);
-   	radiationValueCPM = k*count  ;
+	long seconds = (time+500)/1000;
+
+	// Whole seconds, up to the seconds kept
+	if (seconds<1) seconds = 1;
+	if (seconds>RAD_BINS) seconds = RAD_BINS;
+
+	// Wait only for the seconds not counted yet
+	while( (long)(millis()/1000 - rad_start) < seconds );
+
+	count = readPulses(seconds);
+   	radiationValueCPM = (60.0*count)/seconds;
    	timePreviousMeassure = millis();
-	ledBar(k*count);  
-   	count = 0;
+	ledBar(radiationValueCPM);  
 
 	return radiationValueCPM;
 }
 
+/*
+ Function: Gets radiation value in cpm of all counted time, up to 60 seconds. 
+ Returns: 
+	RadiationValueCPM: radiation value in CPM
+ Parameters: 
+ Values: 
+*/
+float WaspSensorRadiation::getCPM(){
+
+	unsigned long seconds = millis()/1000 - rad_start;
+
+	if (seconds>RAD_BINS) seconds = RAD_BINS;
+	if (seconds<1) seconds = 1;	// right after init() it waits until first second ends
+
+	return getCPM(seconds*1000);
+}
+
 /*
  Function: Refresh led bar value
  Returns: 
@@ -242,15 +255,30 @@ void WaspSensorRadiation::ledBar(float value){
 // Private methods
 
 /*
- Function: Adds one pulse to cpm counter
+ Function: Gets pulses counted during last complete seconds. Current second is not included.
  Returns: 
+	number of pulses
  Parameters: 
+	seconds: number of seconds, up to RAD_BINS
  Values: 
 */
-void WaspSensorRadiation::countPulse(){
-
- 	count++; 	
-  	
+unsigned long WaspSensorRadiation::readPulses(uint8_t seconds){
+
+	unsigned long pulses = 0;
+	uint8_t index;
+
+	uint8_t oldSREG = SREG;
+	cli();
+	rad_advance(millis()/1000);
+	index = rad_index;
+	for (uint8_t i=0;i<seconds;i++){
+		if (index==0) index = RAD_BINS+1;
+		index--;
+		pulses += rad_bins[index];
+	}
+	SREG = oldSREG;
+
+	return pulses;
 }
 
 //object initialization
@@ -51,6 +51,9 @@
 // Conversion factor - CPM to uSV/h
 #define CONV_FACTOR 0.008120
 
+// Seconds of pulses kept, maximum measure time
+#define RAD_BINS 60
+
 
 
 
@@ -63,10 +66,10 @@ class WaspSensorRadiation{
 	private:
 
 	
-	//! Function: Count pulses from sensor
+	//! Function: Gets pulses counted during last complete seconds
     	/*!
 	 */
-	void countPulse();
+	unsigned long readPulses(uint8_t seconds);
 
 	
 	public:
@@ -131,20 +134,28 @@ class WaspSensorRadiation{
 	 */
 	void init();
 
-	//! Function : Measures actual radiation value during 10 seconds.
+	//! Function : Gets radiation value of last 10 seconds.
     	/*!
 	 */
 	float getRadiation();
 
-	//! Function : Measures actual radiation value during specified time. Maximum measure time is 60 seconds
-    	/*!
+	//! Function : Gets radiation value of last specified time. Maximum measure time is 60 seconds
+    	/*! Pulses are counted by interruption since init(), so it only waits if
+	    less time than specified has been counted.
 	 */
 	float getRadiation(long time);
-	//! Function : Measures actual radiation value during specified time. Maximum time is 60 seconds
-    	/*!
+
+	//! Function : Gets radiation value in cpm of last specified time. Maximum time is 60 seconds
+    	/*! Pulses are counted by interruption since init(), so it only waits if
+	    less time than specified has been counted.
 	 */
 	float getCPM(long time);
 
+	//! Function : Gets radiation value in cpm of all counted time, up to 60 seconds. It does not wait.
+    	/*!
+	 */
+	float getCPM();
+
 	//! Function : Refresh led bar value
     	/*!
 	 */
@@ -268,9 +268,13 @@ long WaspUtils::map(long x, long in_min, long in_max, long out_min, long out_max
  * MUX_LOW = 1 & MUX_HIGH = 1 ---> GPRS MODULE
  * MUX_LOW = 1 & MUX_HIGH = 0 ---> AUX1 MODULE
  * MUX_LOW = 0 & MUX_HIGH = 0 ---> AUX2 MODULE
+ *
+ * UART1 transmits from a buffer, so any byte still queued for the module
+ * selected so far is sent before the lines are switched.
  */
 void WaspUtils::setMux(uint8_t MUX_LOW, uint8_t MUX_HIGH)
 {
+	serialFlushTX(1, MUX_TX_TIMEOUT);
 	pinMode(MUX_PW, OUTPUT);
 	pinMode(MUX0, OUTPUT);      
 	pinMode(MUX1, OUTPUT);   
@@ -292,6 +296,7 @@ void WaspUtils::setMux(uint8_t MUX_LOW, uint8_t MUX_HIGH)
  */
 void WaspUtils::setMuxGPS()
 {
+	serialFlushTX(1, MUX_TX_TIMEOUT);
 	pinMode(MUX_PW, OUTPUT);
 	pinMode(MUX0, OUTPUT);      
 	pinMode(MUX1, OUTPUT);   
@@ -313,6 +318,7 @@ void WaspUtils::setMuxGPS()
  */
 void WaspUtils::setMuxGPRS()
 {
+	serialFlushTX(1, MUX_TX_TIMEOUT);
 	pinMode(MUX_PW, OUTPUT);
 	pinMode(MUX0, OUTPUT);      
 	pinMode(MUX1, OUTPUT);   
@@ -334,6 +340,7 @@ void WaspUtils::setMuxGPRS()
  */
 void WaspUtils::setMuxAux1()
 {
+	serialFlushTX(1, MUX_TX_TIMEOUT);
 	pinMode(MUX_PW, OUTPUT);
 	pinMode(MUX0, OUTPUT);      
 	pinMode(MUX1, OUTPUT);   
@@ -355,6 +362,7 @@ void WaspUtils::setMuxAux1()
  */
 void WaspUtils::setMuxAux2()
 {
+	serialFlushTX(1, MUX_TX_TIMEOUT);
 	pinMode(MUX_PW, OUTPUT);
 	pinMode(MUX0, OUTPUT);      
 	pinMode(MUX1, OUTPUT);   
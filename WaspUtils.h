@@ -74,6 +74,11 @@
  */
 #define	MUX_TO_LOW	0
 
+/*! \def MUX_TX_TIMEOUT
+    \brief Milliseconds the multiplexer waits for pending UART1 bytes before switching
+ */
+#define	MUX_TX_TIMEOUT	100
+
 
 /******************************************************************************
  * Class
@@ -34,24 +34,18 @@
 
 //! Switches to command Mode
 uint8_t WaspWIFI::commandMode(){
-  uint8_t i=0;
-  // Sends Enter command Mode ($$$)
-  serialFlush(_uart);
-  while (serialAvailable(_uart)){}
-  printString("$$$",_uart);
-  while(serialAvailable(_uart)<3){}
-  // Waits Command Mode entered (CMD)
-    while(serialAvailable(_uart)){
-      if ((answer[i]=serialRead(_uart))!='\0'){
-	i++;
-      }
-      delay(10);
-    }
-  answer[i]='\0';
-  // Checks the answer.
-  if (contains(answer,"CMD\0"))
-  {  printString("*CM\n",_usb); return 1; }
-  else { return 0; }
+  // Retries a few times, the module drops '$$$' while it is still booting.
+  for (uint8_t r=0; r<WIFI_CMD_RETRIES; r++){
+    // Sends Enter command Mode ($$$)
+    serialFlush(_uart);
+    printString("$$$",_uart);
+    // Waits Command Mode entered (CMD) up to the timeout.
+    readAnswer(0);
+    // Checks the answer.
+    if (contains(answer,"CMD\0"))
+    {  printString("*CM\n",_usb); return 1; }
+  }
+  return 0;
 }
 
 //! Checks if 'word' is contatined in 'text'.
@@ -78,51 +72,90 @@ boolean WaspWIFI::contains(char* text, char* word){
   return false;
 }
 
-//! Reads data over the UART.
-uint8_t WaspWIFI::readData(uint8_t length)
+//! Result tokens of the module, the first one means success.
+static const char* const wifi_tokens[] = {"AOK", "ERR", "FAILED", "Disconn"};
+#define WIFI_TOKENS (sizeof(wifi_tokens)/sizeof(wifi_tokens[0]))
+
+//! Advances the match of 'token' with a new byte 'c'. Returns the number of 
+//! bytes of 'token' matched by the end of the received data.
+static uint8_t wifi_match(const char* token, uint8_t matched, char c)
+{
+  uint8_t k;
+  if (token[matched]==c) return matched+1;
+  // Falls back to the longest beginning of 'token' that ends the data.
+  k=matched;
+  while (k>0){
+    k--;
+    if ((token[k]==c)&&!strncmp(token,token+matched-k,k)) return k+1;
+  }
+  return 0;
+}
+
+//! Reads an answer of the module over the UART into 'answer'.
+uint16_t WaspWIFI::readAnswer(uint8_t stopOnToken)
 {
   uint16_t i=0;
-  if (serialAvailable(_uart)){ 
-  // If there are data available...
-    if (length!=0)while(serialAvailable(_uart)<length+3){}
-    // Waits until there are lenght + 3 data in the uart.
-    while(serialAvailable(_uart)){
-    // While serial available over the uart...
-      if ((i<512)&&((answer[i]=serialRead(_uart))!='\0')){
-	i++; printString(".",_usb);
+  uint8_t matched[WIFI_TOKENS];
+  uint8_t received=0;
+  unsigned long previous;
+  char c;
+  
+  memset(matched,0,sizeof(matched));
+  answerToken=WIFI_TOKEN_NONE;
+  previous=millis();
+  while (1){
+    if (serialAvailable(_uart)){
+      c=serialRead(_uart);
+      previous=millis();
+      received=1;
+      if ((c!='\0')&&(i<sizeof(answer)-1)){
+	answer[i]=c;
+	i++;
       }
-      delay(10);
+      // All the tokens are matched in the same pass over the data.
+      for (uint8_t t=0; t<WIFI_TOKENS; t++){
+	matched[t]=wifi_match(wifi_tokens[t],matched[t],c);
+	if (wifi_tokens[t][matched[t]]=='\0'){
+	  matched[t]=0;
+	  if (answerToken==WIFI_TOKEN_NONE){
+	    answerToken=(t==0)?WIFI_TOKEN_OK:WIFI_TOKEN_ERROR;
+	  }
+	}
+      }
+      if (stopOnToken&&(answerToken!=WIFI_TOKEN_NONE)) break;
+    }
+    else if (!received){
+      // Waits the first byte up to the timeout.
+      if (millis()-previous>_timeout) break;
+    }
+    else if (millis()-previous>WIFI_IDLE_TIME){
+      // The module has finished answering.
+      break;
     }
   }
   answer[i]='\0';
+  return i;
+}
+
+//! Reads the answer to a command over the UART.
+uint8_t WaspWIFI::readData()
+{
+  uint16_t length=readAnswer(1);
   // Checks the answer.
-  if (contains(answer,"AOK\0")){
-    printString("\n",_usb); return 1;
-  }
-  else
-  {
-    if (contains(answer,"ERR\0")||contains(answer,"Disconn\0")||
-      contains(answer,"FAILED\0"))
-    {  return 0;}
-    else 
-    {  return 1;}
-  }
+  if (answerToken==WIFI_TOKEN_ERROR) return 0;
+  if ((answerToken==WIFI_TOKEN_NONE)&&(length==0)) return 0;
+  return 1;
 }
 
 //! Sends the command 'comm' over the UART.
 uint8_t WaspWIFI::sendCommand(char* comm)
 {
-  uint8_t i=0;
   // Writes 'comm' over the UART.
   serialFlush(_uart);
-  while (serialAvailable(_uart)){}
   printString("@/: ",_usb); printString(comm,_usb);
   printString(comm,_uart);
-  // Waits an answer from the UART
-  while (!serialAvailable(_uart)) {}
-  while(comm[i]!='\0'){i++;}
   // Calls readData to take and to check the answer.
-  return readData(i);
+  return readData();
 }
 
 //! Saves current configuration and reboots the device in order to new 
@@ -254,6 +287,19 @@ WaspWIFI::WaspWIFI()
   _usb=0;
   scanTime=200;
   scanPassive=false;
+  _timeout=WIFI_TIMEOUT;
+  answerToken=WIFI_TOKEN_NONE;
+  _httpState=WIFI_HTTP_IDLE;
+  _httpChunked=0;
+  _httpHost[0]='\0';
+  _httpPort=0;
+  httpBodyLength=0;
+}
+
+//! Sets the time to wait for an answer of the module.
+void WaspWIFI::setTimeout(unsigned long timeout)
+{
+  _timeout=timeout;
 }
 
 // Basic Methods //////////////////////////////////////////////////////////////
@@ -295,12 +341,13 @@ void WaspWIFI::ON(uint8_t sock)
   //beginSerial(USB_RATE, _usb);
   beginSerial(UART_RATE, _uart); 	// Baud rate= 9600, uart= 1
   serialFlush(_uart);
-  readData(0);
+  readData();
   // Enters in command mode.
-  while(commandMode()!=1){}
-  
-  sprintf(question, "set s p 0x4000%c",'\r');
-  sendCommand(question);
+  if (commandMode()==1)
+  {
+    sprintf(question, "set s p 0x4000%c",'\r');
+    sendCommand(question);
+  }
 }
 
 //! Closes the UART and powers off the module.
@@ -341,7 +388,7 @@ uint8_t WaspWIFI::setJoinMode(uint8_t val)
   if ((sendCommand(question)==1)&&(saveReboot()==1))
   {
     // Enters in command Mode.
-    while(commandMode()!=1){}
+    if (commandMode()!=1) return 0;
     // If auto
     if ((val==AUTO_BEST)||(val==AUTO_STOR))
     { // If Auto Best check 2 times more for the scan.
@@ -554,7 +601,7 @@ uint8_t WaspWIFI::setSleep(uint8_t sTime, uint8_t sCycle)
   if ((u1==1)&&(u2==1))
   {
     if (saveReboot()==1)
-      while(commandMode()!=1){} return 1;
+      return commandMode();
   }
   return 0;
 }
@@ -694,8 +741,7 @@ uint8_t WaspWIFI::openFTP(char* user, char* password)
   if ((u1==1)&&(u2==1)&&(saveReboot()==1))
   {
     // Enters in command mode.
-    while(commandMode()!=1){}
-    return 1;
+    return commandMode();
   }
   return 0;
 }
@@ -881,8 +927,7 @@ uint8_t WaspWIFI::getURL(uint8_t opt, char* host, char* request)
     { // Reads the answer of the HTTP query.
       read(BLO); 
       // Enters in command mode again.
-      while(commandMode()!=1){} 
-      return 1;
+      return commandMode();
     }
   }
   return 0;  
@@ -1009,12 +1054,242 @@ void WaspWIFI::send(char* data)
 uint8_t WaspWIFI::close()
 {
   // Enters in command mode.
-  while(commandMode()!=1){}
+  if (commandMode()!=1) return 0;
   // Send command 'close'.
   sprintf(question,"close%c",'\r');
   return sendCommand(question);
 }
 
+// HTTP Client ////////////////////////////////////////////////////////////////
+
+//! Writes 'length' bytes of 'data' to the opened connection.
+void WaspWIFI::httpSend(const uint8_t* data, uint16_t length)
+{
+  uint16_t sent=0;
+  while (sent<length){
+    sent+=serialWriteBuffer(&data[sent],length-sent,_uart);
+  }
+}
+
+//! Reads a line of the HTTP response into 'question'.
+int16_t WaspWIFI::httpReadLine()
+{
+  uint16_t i=0;
+  unsigned long previous;
+  char c;
+  
+  while (1){
+    previous=millis();
+    while (!serialAvailable(_uart)){
+      if (millis()-previous>_timeout){
+	question[i]='\0';
+	return -1;
+      }
+    }
+    c=serialRead(_uart);
+    if (c=='\n') break;
+    if ((c!='\r')&&(i<sizeof(question)-1)){
+      question[i]=c;
+      i++;
+    }
+  }
+  question[i]='\0';
+  return i;
+}
+
+//! Reads 'length' bytes of the HTTP response body.
+uint8_t WaspWIFI::httpReadBody(uint32_t length)
+{
+  unsigned long previous;
+  char c;
+  
+  while (length>0){
+    previous=millis();
+    while (!serialAvailable(_uart)){
+      if (millis()-previous>_timeout) return 0;
+    }
+    c=serialRead(_uart);
+    if (httpBodyLength<sizeof(answer)-1){
+      answer[httpBodyLength]=c;
+      httpBodyLength++;
+    }
+    length--;
+  }
+  return 1;
+}
+
+//! Opens a TCP connection to an HTTP server, or keeps the open one.
+uint8_t WaspWIFI::httpConnect(ipAddr host, uint16_t port)
+{
+  if (_httpState==WIFI_HTTP_OPEN){
+    // Checks if the server has closed the connection meanwhile.
+    uint8_t matched=0;
+    while (serialAvailable(_uart)){
+      matched=wifi_match("*CLOS*",matched,serialRead(_uart));
+      if (matched==6){
+	_httpState=WIFI_HTTP_CLOSED;
+	break;
+      }
+    }
+    // Keeps the connection if it is still open to the same server.
+    if ((_httpState==WIFI_HTTP_OPEN)&&(_httpPort==port)&&
+      !strcmp(_httpHost,host))
+    {  return 1;}
+  }
+  // Returns to command mode to open a new connection.
+  if (_httpState!=WIFI_HTTP_IDLE) httpClose();
+  
+  strncpy(_httpHost,host,sizeof(_httpHost)-1);
+  _httpHost[sizeof(_httpHost)-1]='\0';
+  _httpPort=port;
+  if (setTCPclient(_httpHost,port,WIFI_HTTP_LOCAL_PORT)){
+    _httpState=WIFI_HTTP_OPEN;
+    return 1;
+  }
+  return 0;
+}
+
+//! Sends the request line and the headers of an HTTP/1.1 request.
+uint8_t WaspWIFI::httpRequest(const char* method, const char* path, 
+			      int32_t length)
+{
+  if (_httpState!=WIFI_HTTP_OPEN) return 0;
+  
+  // The strings are written straight to the UART, so the path is not 
+  // limited by the size of 'question'.
+  printString(method,_uart); printString(" ",_uart);
+  printString(path,_uart); 
+  printString(" HTTP/1.1\r\nHost: ",_uart); printString(_httpHost,_uart);
+  printString("\r\nConnection: keep-alive\r\n",_uart);
+  if (length==WIFI_HTTP_CHUNKED){
+    printString("Transfer-Encoding: chunked\r\n",_uart);
+    _httpChunked=1;
+  }
+  else {
+    sprintf(question,"Content-Length: %ld\r\n",length);
+    printString(question,_uart);
+    _httpChunked=0;
+  }
+  printString("\r\n",_uart);
+  return 1;
+}
+
+//! Sends a part of the body of the current request.
+void WaspWIFI::httpWrite(const uint8_t* data, uint16_t length)
+{
+  if (length==0) return;
+  if (_httpChunked){
+    // Each part is sent as a chunk: size in hex, CRLF, data, CRLF.
+    sprintf(question,"%X\r\n",length);
+    printString(question,_uart);
+    httpSend(data,length);
+    printString("\r\n",_uart);
+  }
+  else {
+    httpSend(data,length);
+  }
+}
+
+//! Sends a file of the current SD directory as the body of the request.
+uint8_t WaspWIFI::httpWriteFile(const char* filename)
+{
+  struct fat_file_struct* fd;
+  intptr_t length;
+  
+  fd=SD.openFile(filename);
+  if (fd==NULL) return 0;
+  do {
+    length=fat_read_file(fd,(uint8_t*)answer,sizeof(answer));
+    if (length>0) httpWrite((uint8_t*)answer,length);
+  } while (length==sizeof(answer));
+  SD.closeFile(fd);
+  return (length>=0);
+}
+
+//! Ends the current request and reads the response.
+int16_t WaspWIFI::httpResponse()
+{
+  int16_t status;
+  int32_t length=-1;
+  uint8_t chunked=0;
+  uint8_t keep=1;
+  
+  httpBodyLength=0;
+  answer[0]='\0';
+  if (_httpState!=WIFI_HTTP_OPEN) return -1;
+  
+  // Last chunk of the request body.
+  if (_httpChunked) printString("0\r\n\r\n",_uart);
+  _httpChunked=0;
+  
+  // Status line: "HTTP/1.1 200 OK".
+  if ((httpReadLine()<12)||strncmp(question,"HTTP/1.",7)){
+    _httpState=WIFI_HTTP_CLOSED;
+    return -1;
+  }
+  status=atoi(&question[9]);
+  if (question[7]=='0') keep=0;
+  
+  // Headers, only the ones about the body and the connection are kept.
+  while (1){
+    int16_t n=httpReadLine();
+    if (n<0){
+      _httpState=WIFI_HTTP_CLOSED;
+      return -1;
+    }
+    if (n==0) break;
+    if (!strncasecmp(question,"Content-Length:",15)){
+      length=atol(&question[15]);
+    }
+    else if (!strncasecmp(question,"Transfer-Encoding:",18)&&
+      contains(&question[18],"chunked")){
+      chunked=1;
+    }
+    else if (!strncasecmp(question,"Connection:",11)){
+      if (contains(&question[11],"close")) keep=0;
+      if (contains(&question[11],"keep-alive")) keep=1;
+    }
+  }
+  
+  // Body.
+  if (chunked){
+    do {
+      if (httpReadLine()<0) { keep=0; break; }
+      length=strtol(question,NULL,16);
+      if (length>0){
+	if (!httpReadBody(length)||(httpReadLine()<0)) { keep=0; break; }
+      }
+    } while (length>0);
+    // Trailer, up to the empty line.
+    if (keep){
+      int16_t n;
+      do { n=httpReadLine(); } while (n>0);
+      if (n<0) keep=0;
+    }
+  }
+  else if (length>0){
+    if (!httpReadBody(length)) keep=0;
+  }
+  else if ((length<0)&&(status!=204)&&(status!=304)&&(status>=200)){
+    // Without length the body ends when the server closes the connection.
+    readAnswer(0);
+    httpBodyLength=strlen(answer);
+    keep=0;
+  }
+  answer[httpBodyLength]='\0';
+  
+  if (!keep) _httpState=WIFI_HTTP_CLOSED;
+  return status;
+}
+
+//! Closes the HTTP connection and returns to command mode.
+uint8_t WaspWIFI::httpClose()
+{
+  if (_httpState==WIFI_HTTP_IDLE) return 1;
+  _httpState=WIFI_HTTP_IDLE;
+  return close();
+}
+
 //! Configures and sends broadcast packages.
 uint8_t WaspWIFI::sendAutoBroadcast(ipAddr ip_network, uint16_t port_remote, 
 				    uint8_t interval, char* id)
@@ -1076,7 +1351,7 @@ void WaspWIFI::reset()
   }
   answer[i]='\0';
   // Enters in command mode.
-  while(commandMode()!=1){}
+  commandMode();
 }
 	
 //! Restores the default settings of the device.
@@ -1113,7 +1388,7 @@ void WaspWIFI::wake()
     delay(10);
   }
   // Enters in command mode.
-  while(commandMode()!=1){}
+  commandMode();
 }
 	
 //! Synchronizes the time.
@@ -1126,26 +1401,15 @@ void WaspWIFI::synchronizeTime()
 //! Performs a DNS query on the supplied hostname.
 void WaspWIFI::resolve(char* name)
 {
-  uint16_t i=0;
   // Sends lookup command.
   sprintf(question, "lookup %s%c",name,'\r');
   serialFlush(_uart);
   while (serialAvailable(_uart)){}
   printString(question,_uart);
   // Waits an answer from the module.
-  while (!serialAvailable(_uart)) {}
-  while (question[i]!='\0') {  i++; }
-  i=i+5;
-  while(serialAvailable(_uart)<i){}
-  i=0;
-  while(serialAvailable(_uart)){
-    if (((answer[i]=serialRead(_uart))!='\0')&&(i<512)){
-      i++;
-    }
-    delay(10);
-  }
+  readAnswer(0);
   // Prints the result of the query.
-  answer[i]='\0'; printString(answer,_usb);
+  printString(answer,_usb);
 }
 	
 //! Sets the UART baud rate.
@@ -1168,21 +1432,12 @@ void WaspWIFI::storeData()
 //! (Check if it has an IP address).
 boolean WaspWIFI::isConnected()
 {
-  uint16_t i=0;
   // Sends 'get ip' command to know if the module has good IP address.
   serialFlush(_uart);
   while (serialAvailable(_uart)){}
   printString("get ip\r",_uart);
   // Waits an answer from the UART.
-  while (!serialAvailable(_uart)) {}
-  while(serialAvailable(_uart)<20){}
-  while(serialAvailable(_uart)){
-    if ((i<512)&&((answer[i]=serialRead(_uart))!='\0')){
-      i++;
-    }
-    delay(10);
-  }
-  answer[i]='\0';
+  readAnswer(0);
   // Checks the answer.
   if (contains(answer,"IF=UP\0"))
   {  return true;}
@@ -1192,7 +1447,6 @@ boolean WaspWIFI::isConnected()
 
 //! Displays connection status
 void WaspWIFI::getConnectionInfo(){
-  uint16_t i=0;
   uint8_t temp;
   // Sends command over the UART.
   sprintf(question, "show c%c",'\r');
@@ -1200,18 +1454,7 @@ void WaspWIFI::getConnectionInfo(){
   while (serialAvailable(_uart)){}
   printString(question,_uart);
   // Waits an answer.
-  while (!serialAvailable(_uart)) {}
-  while (question[i]!='\0') {  i++; }
-  i=i+5;
-  while(serialAvailable(_uart)<i){}
-  i=0;
-  while(serialAvailable(_uart)){
-    if (((answer[i]=serialRead(_uart))!='\0')&&(i<512)){
-      i++;
-    }
-    delay(10);
-  }
-  answer[i]='\0';
+  readAnswer(0);
 //  printString("\n***Connection info***\n",_usb);
   printString("Chann: ",_usb); serialWrite(answer[19],_usb); 
   serialWrite('\n',_usb);
@@ -1248,18 +1491,8 @@ void WaspWIFI::getAPstatus(){
   while (serialAvailable(_uart)){}
   printString(question,_uart);
   // Waits an answer.
-  while (!serialAvailable(_uart)) {}
-  while (question[i]!='\0') {  i++; }
-  i=i+5;
-  while(serialAvailable(_uart)<i){}
-  i=0;
-  while(serialAvailable(_uart)){
-    if (((answer[i]=serialRead(_uart))!='\0')&&(i<512)){
-      i++;
-    }
-    delay(10);
-  }
-  answer[i]='\0'; i=8;
+  readAnswer(0);
+  i=8;
   // Shows the network information.
 //  printString("\n***Network info***\n",_usb);
   while (i<126-7){
@@ -1278,18 +1511,8 @@ void WaspWIFI::getRSSI(){
   while (serialAvailable(_uart)){}
   printString(question,_uart);
   // Waits an answer.
-  while (!serialAvailable(_uart)) {}
-  while (question[i]!='\0') {  i++; }
-  i=i+5;
-  while(serialAvailable(_uart)<i){}
-  i=0;
-  while(serialAvailable(_uart)){
-    if (((answer[i]=serialRead(_uart))!='\0')&&(i<512)){
-      i++;
-    }
-    delay(10);
-  }
-  answer[i]='\0'; i=10;
+  readAnswer(0);
+  i=10;
   // Shows the information.
 //  printString("\n***Singal Strenght info***\n",_usb);
   while (i<34-7){
@@ -1308,18 +1531,8 @@ void WaspWIFI::getStats(){
   while (serialAvailable(_uart)){}
   printString(question,_uart);
   // Waits an answer.
-  while (!serialAvailable(_uart)) {}
-  while (question[i]!='\0') {  i++; }
-  i=i+5;
-  while(serialAvailable(_uart)<i){}
-  i=0;
-  while(serialAvailable(_uart)){
-    if (((answer[i]=serialRead(_uart))!='\0')&&(i<512)){
-      i++;
-    }
-    delay(10);
-  }
-  answer[i]='\0'; i=11;
+  readAnswer(0);
+  i=11;
   // Shows the information.
 //  printString("\n***Statistics info***\n",_usb);
   while (i<190-7){
@@ -1338,18 +1551,8 @@ void WaspWIFI::getUpTime(){
   while (serialAvailable(_uart)){}
   printString(question,_uart);
   // Waits an answer.
-  while (!serialAvailable(_uart)) {}
-  while (question[i]!='\0') {  i++; }
-  i=i+5;
-  while(serialAvailable(_uart)<i){}
-  i=0;
-  while(serialAvailable(_uart)){
-    if (((answer[i]=serialRead(_uart))!='\0')&&(i<512)){
-      i++;
-    }
-    delay(10);
-  }
-  answer[i]='\0'; i=10;
+  readAnswer(0);
+  i=10;
   // Shows the information.
 //  printString("\n***Seconds since last powerup or reboot***\n",_usb);
   while (i<45-7){
@@ -1368,18 +1571,8 @@ void WaspWIFI::getAdhocSettings(){
   while (serialAvailable(_uart)){}
   printString(question,_uart);
   // Waits an answer.
-  while (!serialAvailable(_uart)) {}
-  while (question[i]!='\0') {  i++; }
-  i=i+5;
-  while(serialAvailable(_uart)<i){}
-  i=0;
-  while(serialAvailable(_uart)){
-    if (((answer[i]=serialRead(_uart))!='\0')&&(i<512)){
-      i++;
-    }
-    delay(10);
-  }
-  answer[i]='\0'; i=10;
+  readAnswer(0);
+  i=10;
   // Shows the information.
 //  printString("\n***Adhoc settings***\n",_usb);
   while (i<40-7){
@@ -1398,18 +1591,8 @@ void WaspWIFI::getBroadcastSettings(){
   while (serialAvailable(_uart)){}
   printString(question,_uart);
   // Waits an answer.
-  while (!serialAvailable(_uart)) {}
-  while (question[i]!='\0') {  i++; }
-  i=i+5;
-  while(serialAvailable(_uart)<i){}
-  i=0;
-  while(serialAvailable(_uart)){
-    if (((answer[i]=serialRead(_uart))!='\0')&&(i<512)){
-      i++;
-    }
-    delay(10);
-  }
-  answer[i]='\0'; i=13;
+  readAnswer(0);
+  i=13;
   // Shows the information.
 //  printString("\n***Broadcast settings***\n",_usb);
   while (i<65-7){
@@ -1428,18 +1611,8 @@ void WaspWIFI::getComSettings(){
   while (serialAvailable(_uart)){}
   printString(question,_uart);
   // Waits an answer.
-  while (!serialAvailable(_uart)) {}
-  while (question[i]!='\0') {  i++; }
-  i=i+5;
-  while(serialAvailable(_uart)<i){}
-  i=0;
-  while(serialAvailable(_uart)){
-    if (((answer[i]=serialRead(_uart))!='\0')&&(i<512)){
-      i++;
-    }
-    delay(10);
-  }
-  answer[i]='\0'; i=8;
+  readAnswer(0);
+  i=8;
   // Shows the information.
 //  printString("\n***Communications settings***\n",_usb);
   while (i<126-7){
@@ -1458,18 +1631,8 @@ void WaspWIFI::getDNSsettings(){
   while (serialAvailable(_uart)){}
   printString(question,_uart);
   // Waits an answer.
-  while (!serialAvailable(_uart)) {}
-  while (question[i]!='\0') {  i++; }
-  i=i+5;
-  while(serialAvailable(_uart)<i){}
-  i=0;
-  while(serialAvailable(_uart)){
-    if (((answer[i]=serialRead(_uart))!='\0')&&(i<512)){
-      i++;
-    }
-    delay(10);
-  }
-  answer[i]='\0'; i=8;
+  readAnswer(0);
+  i=8;
   // Shows the information.
 //  printString("\n***DNS settings***\n",_usb);
   while (i<60-7){
@@ -1488,18 +1651,8 @@ void WaspWIFI::getFTPsettings(){
   while (serialAvailable(_uart)){}
   printString(question,_uart);
   // Waits an answer.
-  while (!serialAvailable(_uart)) {}
-  while (question[i]!='\0') {  i++; }
-  i=i+5;
-  while(serialAvailable(_uart)<i){}
-  i=0;
-  while(serialAvailable(_uart)){
-    if (((answer[i]=serialRead(_uart))!='\0')&&(i<512)){
-      i++;
-    }
-    delay(10);
-  }
-  answer[i]='\0'; i=8;
+  readAnswer(0);
+  i=8;
   // Shows the information.
 //  printString("\n***FTP settings***\n",_usb);
   while (i<124-7){
@@ -1518,18 +1671,8 @@ void WaspWIFI::getIP(){
   while (serialAvailable(_uart)){}
   printString(question,_uart);
   // Waits an answer.
-  while (!serialAvailable(_uart)) {}
-  while (question[i]!='\0') {  i++; }
-  i=i+5;
-  while(serialAvailable(_uart)<i){}
-  i=0;
-  while(serialAvailable(_uart)){
-    if (((answer[i]=serialRead(_uart))!='\0')&&(i<512)){
-      i++;
-    }
-    delay(10);
-  }
-  answer[i]='\0'; i=7;
+  readAnswer(0);
+  i=7;
   // Shows the information.
 //  printString("\n***IP Settings***\n",_usb);
   while (i<162-7){
@@ -1548,18 +1691,8 @@ void WaspWIFI::getMAC(){
   while (serialAvailable(_uart)){}
   printString(question,_uart);
   // Waits an answer.
-  while (!serialAvailable(_uart)) {}
-  while (question[i]!='\0') {  i++; }
-  i=i+5;
-  while(serialAvailable(_uart)<i){}
-  i=0;
-  while(serialAvailable(_uart)){
-    if (((answer[i]=serialRead(_uart))!='\0')&&(i<512)){
-      i++;
-    }
-    delay(10);
-  }
-  answer[i]='\0'; i=8;
+  readAnswer(0);
+  i=8;
   // Shows the information.
 //  printString("\n***MAC address***\n",_usb);
   while (i<45-7){
@@ -1578,18 +1711,8 @@ void WaspWIFI::getOptionSettings(){
   while (serialAvailable(_uart)){}
   printString(question,_uart);
   // Waits an answer.
-  while (!serialAvailable(_uart)) {}
-  while (question[i]!='\0') {  i++; }
-  i=i+5;
-  while(serialAvailable(_uart)<i){}
-  i=0;
-  while(serialAvailable(_uart)){
-    if (((answer[i]=serialRead(_uart))!='\0')&&(i<512)){
-      i++;
-    }
-    delay(10);
-  }
-  answer[i]='\0'; i=11;
+  readAnswer(0);
+  i=11;
   // Shows the information.
 //  printString("\n***Option settings***\n",_usb);
   while (i<112-7){
@@ -1608,18 +1731,8 @@ void WaspWIFI::getSystemSettings(){
   while (serialAvailable(_uart)){}
   printString(question,_uart);
   // Waits an answer.
-  while (!serialAvailable(_uart)) {}
-  while (question[i]!='\0') {  i++; }
-  i=i+5;
-  while(serialAvailable(_uart)<i){}
-  i=0;
-  while(serialAvailable(_uart)){
-    if (((answer[i]=serialRead(_uart))!='\0')&&(i<512)){
-      i++;
-    }
-    delay(10);
-  }
-  answer[i]='\0'; i=8;
+  readAnswer(0);
+  i=8;
   // Shows the information.
 // printString("\n***System settings***\n",_usb);
   while (i<121-7){
@@ -1638,18 +1751,8 @@ void WaspWIFI::getTime(){
   while (serialAvailable(_uart)){}
   printString(question,_uart);
   // Waits an answer.
-  while (!serialAvailable(_uart)) {}
-  while (question[i]!='\0') {  i++; }
-  i=i+5;
-  while(serialAvailable(_uart)<i){}
-  i=0;
-  while(serialAvailable(_uart)){
-    if (((answer[i]=serialRead(_uart))!='\0')&&(i<512)){
-      i++;
-    }
-    delay(10);
-  }
-  answer[i]='\0'; i=9;
+  readAnswer(0);
+  i=9;
   // Shows the information.
 //  printString("\n***Time server information***\n",_usb);
   while (i<62-7){
@@ -1668,18 +1771,8 @@ void WaspWIFI::getWLANsettings(){
   while (serialAvailable(_uart)){}
   printString(question,_uart);
   // Waits an answer.
-  while (!serialAvailable(_uart)) {}
-  while (question[i]!='\0') {  i++; }
-  i=i+5;
-  while(serialAvailable(_uart)<i){}
-  i=0;
-  while(serialAvailable(_uart)){
-    if (((answer[i]=serialRead(_uart))!='\0')&&(i<512)){
-      i++;
-    }
-    delay(10);
-  }
-  answer[i]='\0'; i=9;
+  readAnswer(0);
+  i=9;
   // Shows the information.
  // printString("\n***WLAN settings***\n",_usb);
   while (i<141-7){
@@ -1698,18 +1791,8 @@ void WaspWIFI::getUARTsettings(){
   while (serialAvailable(_uart)){}
   printString(question,_uart);
   // Waits an answer.
-  while (!serialAvailable(_uart)) {}
-  while (question[i]!='\0') {  i++; }
-  i=i+5;
-  while(serialAvailable(_uart)<i){}
-  i=0;
-  while(serialAvailable(_uart)){
-    if (((answer[i]=serialRead(_uart))!='\0')&&(i<512)){
-      i++;
-    }
-    delay(10);
-  }
-  answer[i]='\0'; i=9;
+  readAnswer(0);
+  i=9;
   // Shows the information.
  // printString("\n***UART settings***\n",_usb);
   while (i<53-7){
@@ -1728,18 +1811,8 @@ void WaspWIFI::getVersion(){
   while (serialAvailable(_uart)){}
   printString(question,_uart);
   // Waits an answer.
-  while (!serialAvailable(_uart)) {}
-  while (question[i]!='\0') {  i++; }
-  i=i+5;
-  while(serialAvailable(_uart)<i){}
-  i=0;
-  while(serialAvailable(_uart)){
-    if (((answer[i]=serialRead(_uart))!='\0')&&(i<512)){
-      i++;
-    }
-    delay(10);
-  }
-  answer[i]='\0'; i=4;
+  readAnswer(0);
+  i=4;
   // Shows the information.
  // printString("\n***Version***\n",_usb);
   while (i<51-7){
@@ -127,6 +127,25 @@
 #define BLO		0   // Read without timeout
 #define NOBLO		1   // Read with timeout
 
+//! ANSWER READING //
+
+#define WIFI_TIMEOUT	5000	// Default time to wait for an answer (ms).
+#define WIFI_IDLE_TIME	50	// Silence that ends an answer (ms).
+#define WIFI_CMD_RETRIES	3	// Attempts to enter command mode.
+
+#define WIFI_TOKEN_NONE		0   // No result token in the answer.
+#define WIFI_TOKEN_OK		1   // The answer has 'AOK'.
+#define WIFI_TOKEN_ERROR	2   // The answer has 'ERR', 'FAILED' or 'Disconn'.
+
+//! HTTP CLIENT //
+
+#define WIFI_HTTP_LOCAL_PORT	2000	// Local port of the HTTP connections.
+#define WIFI_HTTP_CHUNKED	-1	// Request body sent in chunks.
+
+#define WIFI_HTTP_IDLE		0   // Command mode, no connection.
+#define WIFI_HTTP_OPEN		1   // Connection open, data mode.
+#define WIFI_HTTP_CLOSED	2   // Connection closed by the server, data mode.
+
 /******************************************************************************
  * Class
  *****************************************************************************/
@@ -139,8 +158,8 @@
 class WaspWIFI
 {
   // Data Types ///////////////////////////////////////////////////////////////
-  //! Specifies the data type for IP addresses "255.255.255.255"
-  typedef char ipAddr[15];
+  //! Specifies the data type for IP addresses "255.255.255.255" plus the terminator
+  typedef char ipAddr[16];
   
   // PRIVATE //////////////////////////////////////////////////////////////////
   private:	
@@ -158,10 +177,28 @@ class WaspWIFI
 
     //! Specifies if the Ap scan is active or pasive.
     boolean scanPassive;
+
+    //! Specifies the time to wait for an answer of the module (in ms).
+    unsigned long _timeout;
+
+    //! Specifies the first result token found by readAnswer().
+    uint8_t answerToken;
+
+    //! Specifies the state of the HTTP connection (WIFI_HTTP_IDLE, 
+    //! WIFI_HTTP_OPEN or WIFI_HTTP_CLOSED).
+    uint8_t _httpState;
+
+    //! Specifies if the body of the current request is sent in chunks.
+    uint8_t _httpChunked;
+
+    //! Specifies the host and port of the HTTP connection.
+    ipAddr _httpHost;
+    uint16_t _httpPort;
     
     // INTERNAL FUNCTIONS /////////////////////////////////////////////////////
 
-    //! Switches to command Mode
+    //! Switches to command Mode. Each of the WIFI_CMD_RETRIES attempts 
+    //! waits up to '_timeout' ms for the 'CMD' answer.
     /*!
       \param void
       \return '1' on success, '0' otherwise
@@ -176,13 +213,24 @@ class WaspWIFI
     */
     boolean contains(char* text, char* word);
 
-    //! Reads data over the UART.
+    //! Reads an answer of the module over the UART into 'answer'.
     /*!
-      \param uint8_t length : Specifies the minimum length it is expected 
-      to read.
-      \return '1' on success, '0' otherwise.
+      The result tokens (AOK, ERR, FAILED, Disconn) are recognised as the 
+      bytes arrive and stored in 'answerToken'. The reading ends when no 
+      byte arrives in '_timeout' ms, when the module is silent for 
+      WIFI_IDLE_TIME ms after answering or, if 'stopOnToken', right after 
+      the first token.
+      \param uint8_t stopOnToken : Specifies if a token ends the answer.
+      \return the number of bytes stored in 'answer'.
     */
-    uint8_t readData(uint8_t length);
+    uint16_t readAnswer(uint8_t stopOnToken);
+
+    //! Reads the answer to a command over the UART.
+    /*!
+      \param void
+      \return '1' on success, '0' if error token or no answer.
+    */
+    uint8_t readData();
 
     //! Sends the command 'comm' over the UART.
     /*!
@@ -220,12 +268,41 @@ class WaspWIFI
     */ 
     void parseBroadcast();
 
+    //! Writes 'length' bytes of 'data' to the opened connection.
+    /*!
+      \param const uint8_t* data : specifies the data to send.
+      \param uint16_t length : specifies the number of bytes.
+      \return void
+    */ 
+    void httpSend(const uint8_t* data, uint16_t length);
+
+    //! Reads a line of the HTTP response into 'question', without the CRLF.
+    /*!
+      Longer lines are cut to the size of 'question'.
+      \param void
+      \return the length of the line, '-1' on timeout.
+    */ 
+    int16_t httpReadLine();
+
+    //! Reads 'length' bytes of the HTTP response body.
+    /*!
+      The bytes are stored in 'answer' while there is room, the rest 
+      are discarded.
+      \param uint32_t length : specifies the number of bytes.
+      \return '1' on success, '0' on timeout.
+    */ 
+    uint8_t httpReadBody(uint32_t length);
+
   // PUBLIC ///////////////////////////////////////////////////////////////////
   public:
     
     //! Specifies the answer that is read from the WIFI module
     char answer[512]; 
 
+    //! Specifies the number of bytes of the last HTTP response body 
+    //! stored in 'answer'.
+    uint16_t httpBodyLength;
+
     // BASIC METHODS //////////////////////////////////////////////////////////
 
     //! Class constructor. Initializes the necessary variables.
@@ -234,6 +311,14 @@ class WaspWIFI
       \return void
     */ 
     WaspWIFI();
+
+    //! Sets the time to wait for an answer of the module.
+    /*!
+      \param unsigned long timeout : Specifies the time in ms 
+      (WIFI_TIMEOUT by default).
+      \return void
+    */ 
+    void setTimeout(unsigned long timeout);
     
     //! Opens the UART.
     /*!
@@ -630,6 +715,63 @@ class WaspWIFI
       \return '1' on success, '0' otherwise.
       */
     uint8_t close();
+
+    // HTTP CLIENT ////////////////////////////////////////////////////////////
+
+    //! Opens a TCP connection to an HTTP server, or keeps the open one.
+    /*!
+      The connection is reused by the following requests while the server
+      keeps it alive. It is opened again if the server has closed it.
+      \param ipAddr host : specifies the IP address of the server.
+      \param uint16_t port : specifies the port of the server.
+      \return '1' on success, '0' otherwise.
+      */
+    uint8_t httpConnect(ipAddr host, uint16_t port);
+
+    //! Sends the request line and the headers of an HTTP/1.1 request.
+    /*!
+      The body is sent afterwards with httpWrite() or httpWriteFile().
+      \param const char* method : specifies the method (GET, POST, PUT...).
+      \param const char* path : specifies the path of the resource.
+      \param int32_t length : specifies the length of the body, '0' if 
+      there is no body or WIFI_HTTP_CHUNKED to send it in chunks.
+      \return '1' on success, '0' if the connection is not open.
+      */
+    uint8_t httpRequest(const char* method, const char* path, int32_t length);
+
+    //! Sends a part of the body of the current request.
+    /*!
+      \param const uint8_t* data : specifies the data to send.
+      \param uint16_t length : specifies the number of bytes.
+      \return void
+      */
+    void httpWrite(const uint8_t* data, uint16_t length);
+
+    //! Sends a file of the current SD directory as the body of the request.
+    /*!
+      The file is read and sent a block at a time, using 'answer' as 
+      buffer.
+      \param const char* filename : specifies the file to send.
+      \return '1' on success, '0' otherwise.
+      */
+    uint8_t httpWriteFile(const char* filename);
+
+    //! Ends the current request and reads the response.
+    /*!
+      The status line and the headers are parsed line by line. The first 
+      bytes of the body are stored in 'answer' and their number in 
+      'httpBodyLength', the rest of the body is read and discarded.
+      \param void
+      \return the status code of the response, '-1' on error.
+      */
+    int16_t httpResponse();
+
+    //! Closes the HTTP connection and returns to command mode.
+    /*!
+      \param void
+      \return '1' on success, '0' otherwise.
+      */
+    uint8_t httpClose();
     
     //! Configures and sends broadcast messages.
     /*!
@@ -112,6 +112,16 @@ void WaspXBee::flush()
   serialFlush(_uart);
 }
 
+uint16_t WaspXBee::write(const uint8_t* buf, uint16_t len)
+{
+  return serialWriteBuffer(buf, len, _uart);
+}
+
+uint8_t WaspXBee::flushTX(unsigned long timeout)
+{
+  return serialFlushTX(_uart, timeout);
+}
+
 void WaspXBee::print(char c)
 {
   printByte(c,  _uart);
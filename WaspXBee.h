@@ -171,6 +171,21 @@ class WaspXBee
 	 */
 	void flush();
 	
+	//! It queues a block of bytes in the UART transmit buffer
+  	/*!
+	\param const uint8_t* buf : bytes to send
+	\param uint16_t len : number of bytes
+	\return the number of bytes queued. It does not wait for the line, so it may be less than 'len' when the buffer is full
+	 */
+	uint16_t write(const uint8_t* buf, uint16_t len);
+	
+	//! It waits until every queued byte has left the UART
+  	/*!
+	\param unsigned long timeout : milliseconds to wait as much
+	\return '0' when sent, '1' on timeout
+	 */
+	uint8_t flushTX(unsigned long timeout);
+	
 	//! It prints a character
   	/*!
 	\param char c : the character to print
@@ -38,8 +38,8 @@ void	WaspXBee802::init(uint8_t protocol_used, uint8_t frequency, uint8_t model_u
 	model=model_used;
 	uart=uart_used;
 
-	totalFragmentsReceived=0;
-	pendingPackets=0;
+	rxSlotsHighWater=0;
+	rxSlotFailures=0;
 	pos=0;
 	discoveryOptions=0x00;
 	awakeTime[0]=AWAKE_TIME_802_15_4_H;
@@ -71,14 +71,13 @@ void	WaspXBee802::init(uint8_t protocol_used, uint8_t frequency, uint8_t model_u
 	mode=0;
 	frag_length=0;
 	TIME1=0;
-	nextIndex1=0;
-	frameNext=0;
+	rxState=XBEE_RX_DELIMITER;
 	replacementPolicy=XBEE_OUT;
-	indexNotModified=1;
 	error_AT=2;
 	error_RX=2;
 	error_TX=2;
 	clearFinishArray();
+	clearSlotArray();
 	clearCommand();
 }
 
@@ -54,16 +54,46 @@
 
 //Different Max Sizes Used in Libraries
 #define MAX_DATA		100
-#define	DATA_MATRIX		100
-#define	MAX_PARSE		300
+#define	MAX_FRAME		120
+// MAX_BROTHERS, MAX_FRAG_PACKETS, MAX_FINISH_PACKETS and MAX_RX_SLOTS can be
+// set for each build (e.g. -DMAX_RX_SLOTS=24 for coordinators)
+#ifndef MAX_BROTHERS
 #define	MAX_BROTHERS		5
+#endif
+#ifndef MAX_FRAG_PACKETS
 #define	MAX_FRAG_PACKETS	5
+#endif
+#ifndef MAX_FINISH_PACKETS
 #define MAX_FINISH_PACKETS	5
+#endif
+#ifndef MAX_RX_SLOTS
+#define MAX_RX_SLOTS		MAX_FINISH_PACKETS
+#endif
 #define	TIMEOUT			7000
 #define WAIT_TIME               2000
 #define WAIT_TIME2              20000
 #define WAIT_TIME_READ          5
 
+// Fragments are tracked in a 16b bitmap
+#if MAX_FRAG_PACKETS>16
+#error "MAX_FRAG_PACKETS must be 16 or less"
+#endif
+
+// Size of the reassembly hash table: power of two, at least twice MAX_RX_SLOTS
+#if MAX_RX_SLOTS<=4
+#define RX_HASH_SIZE		8
+#elif MAX_RX_SLOTS<=8
+#define RX_HASH_SIZE		16
+#elif MAX_RX_SLOTS<=16
+#define RX_HASH_SIZE		32
+#elif MAX_RX_SLOTS<=32
+#define RX_HASH_SIZE		64
+#elif MAX_RX_SLOTS<=64
+#define RX_HASH_SIZE		128
+#else
+#error "MAX_RX_SLOTS must be 64 or less"
+#endif
+
 // FIXME MAL ESTOS VALORES!!!
 //Differents types
 #define	MY_TYPE		0
@@ -86,6 +116,12 @@
 #define MEMORY      0
 #define DEBUG868    0
 
+// API frame parser states
+#define	XBEE_RX_DELIMITER	0
+#define	XBEE_RX_LENGTH		1
+#define	XBEE_RX_DATA		2
+#define	XBEE_RX_CHECKSUM	3
+
 // Replacement Policy
 #define	XBEE_LIFO	0
 #define	XBEE_FIFO	1
@@ -329,5 +365,9 @@
 #define	delay_end			1000
 #define	MAX_OTA_RETRIES			3
 #define	OTA_TIMEOUT			10000 //milliseconds
+#define NEW_FIRMWARE_MESSAGE_NACK	"PROGRAM NACK"
+#define	OTA_WINDOW			8 // chunks buffered ahead, multiple of 8
+#define	OTA_CHUNK_SIZE			92
+#define	OTA_FILE_SIZE			131584 // header sector + 128KB flash
 
 #endif
@@ -30,6 +30,28 @@
 #define LAME_SOLUTION
 
 
+/*
+ Function: Updates a CRC32 (IEEE 802.3, reflected) with a block of data. It is
+   computed bit by bit so it does not need a 1KB table
+ Returns: The updated CRC, before the final inversion
+*/
+static uint32_t ota_crc32(uint32_t crc, uint8_t* data, uint8_t length)
+{
+	uint8_t i;
+	
+	while( length-- )
+	{
+		crc ^= *data++;
+		for(i=0;i<8;i++)
+		{
+			if( crc & 1 ) crc = (crc >> 1) ^ 0xEDB88320UL;
+			else crc >>= 1;
+		}
+	}
+	return crc;
+}
+
+
 /*
 Function: Initializes all the global variables that will be used later
 Returns: Nothing
@@ -60,8 +82,8 @@ void	WaspXBeeCore::init(uint8_t protocol_used, uint8_t frequency, uint8_t model_
     model=model_used;
     uart=uart_used;
 
-    totalFragmentsReceived=0;
-    pendingPackets=0;
+    rxSlotsHighWater=0;
+    rxSlotFailures=0;
     pos=0;
     discoveryOptions=0x00;
     if(protocol==XBEE_802_15_4)
@@ -117,19 +139,19 @@ void	WaspXBeeCore::init(uint8_t protocol_used, uint8_t frequency, uint8_t model_
     mode=0;
     frag_length=0;
     TIME1=0;
-    nextIndex1=0;
-    frameNext=0;
+    rxState=XBEE_RX_DELIMITER;
     replacementPolicy=XBEE_OUT;
-    indexNotModified=1;
     error_AT=2;
     error_RX=2;
     error_TX=2;
     clearFinishArray();
+    clearSlotArray();
     clearCommand();
     apsEncryption=0;
     sd_on=0;
     firm_info.already_init=0;
     firm_info.multi_type=3;
+    firm_info.window=NULL;
 }
 
 /*
@@ -2182,18 +2204,7 @@ uint8_t WaspXBeeCore::sendXBeePriv(struct packetXBee* packet)
     // AP = 2
         gen_frame_ap2(packet,TX,protegido,tipo);
     // Frame OK
-        counter=0;
-
-        while(counter<(packet->frag_length+tipo+protegido))
-        {
-	    if( uart==UART0 ) XBee.print(TX[counter], BYTE); 
-	    else if( uart==UART1 )
-	    {
-		Utils.setMuxGPRS();
-		XBee2.print(TX[counter], BYTE); 
-            }
-            counter++;
-        }
+        writeFrame(TX,packet->frag_length+tipo+protegido);
         counter=0;
     
         command[0]=0xFF;
@@ -2503,16 +2514,7 @@ uint8_t WaspXBeeCore::sendXBeePriv(struct packetXBee* packet)
 	USB.print("sendXBeePriv4 "); USB.println(freeMemory());
 #endif				
     // Frame OK
-        while(counter<(packet->frag_length+tipo+protegido))
-        {
-			if( uart==UART0 ) XBee.print(TX[counter], BYTE); 
-			else if( uart==UART1 ) 
-			{
-				Utils.setMuxGPRS();
-				XBee2.print(TX[counter], BYTE);
-			}
-			counter++;
-        }
+        writeFrame(TX,packet->frag_length+tipo+protegido);
 #ifdef SEND_MEMORY_LEAK_DEBUG  // OK
 	USB.print("sendXBeePriv5 "); USB.println(freeMemory());
 #endif			
@@ -2977,9 +2979,7 @@ int8_t WaspXBeeCore::treatData()
 	int8_t error=2;
 	uint8_t pos_aux=0;
 	uint8_t pos_old=0;
-	uint8_t pos_disor=0;
 	uint8_t pos_max=0;
-	uint8_t first_stop=1;
 		
 	command[0]=0xEE;
 	error=parse_message(command);
@@ -3009,15 +3009,9 @@ int8_t WaspXBeeCore::treatData()
 						}
 						break;
 				case 0xFB:	new_firmware_packets();
-						if( !firm_info.paq_disordered )
-						{
-							free(packet_finished[pos-1]);
-							packet_finished[pos-1]=NULL;
-							pos_old--;
-						}
-						else if(firm_info.paq_disordered==1){
-							pos_disor=pos;
-						}
+						free(packet_finished[pos-1]);
+						packet_finished[pos-1]=NULL;
+						pos_old--;
 						break;
 				case 0xFC:	new_firmware_end();
 						while(pos_max>0)
@@ -3059,33 +3053,8 @@ int8_t WaspXBeeCore::treatData()
 						}
 						break;
 			}
-			// Handle disordered packets
-			if(!firm_info.paq_disordered && !pos_disor)
-			{
-				pos_aux--;
-				pos++;
-			}
-			else if(firm_info.paq_disordered==1)
-			{
-				pos++;
-				pos_aux--;
-			}
-			else if(pos_disor==1)
-			{
-				if( pos_old <= 1)
-				{
-					pos=1;
-					pos_aux=1;
-					pos_disor=0;
-				}
-				else if( first_stop )
-				{
-					pos=pos_max;
-					first_stop=0;
-				}
-				else pos--;
-				
-			}
+			pos_aux--;
+			pos++;
 		}
 	} 
 	else
@@ -3411,1135 +3380,138 @@ int8_t WaspXBeeCore::setOriginParams(packetXBee* paq, const char* address, uint8
 */
 int8_t WaspXBeeCore::readXBee(uint8_t* data)
 {
-    uint16_t aux=0;
-    uint16_t aux2=0;
-    uint8_t aux3=0;
-    int8_t error=2;
-    uint16_t cont3=0;
+    uint8_t base=0;
+    uint8_t first=0;
+    uint8_t type=0;
+    uint8_t* origin=NULL;
+    uint8_t origin_length=0;
     uint8_t header=0;
-    uint16_t temp=0;
-    int16_t temp2=0;
-    uint16_t temp3=0;
-    uint8_t samePacket=0;
-    uint8_t comp=0;
-    uint8_t index1=0;
-    uint8_t index2=0;
-    long time=0;
-    uint8_t finishIndex=0;
-  
-    it=0;	
-    if( indexNotModified )
-    {
-        for(it=0;it<MAX_FINISH_PACKETS;it++)
-        {
-            if( pendingFragments[it]==NULL ) break;
-        }
-        nextIndex1=it;
-    }
-	
-    it=0;
-#if DEBUG
-    XBee.println("");
-    XBee.println("-----------------------------------------------------");
-    XBee.print("Pending Packets: ");
-    XBee.println(pendingPackets,DEC);
-#endif
+    uint8_t numFragment=0;
+    uint8_t length=0;
+    uint8_t source[10];
+    uint8_t slot=0;
+    int8_t error=0;
+    rxSlot* s=NULL;
 	
-    temp=0;
     if( protocol!=XBEE_802_15_4 && data_length<12 ) return 1;
     if( protocol==XBEE_802_15_4 && add_type==_16B && data_length<5 ) return 1;
     if( protocol==XBEE_802_15_4 && add_type==_64B && data_length<11 ) return 1;
 	
-    while(temp<MAX_FINISH_PACKETS) // miramos si ya tenemos fragmentos de este paquete global
+    // Position of the application header (packetID) inside the RX frame
+    if( protocol==XBEE_802_15_4 )
     {
-#if DEBUG
-        XBee.println("Posible fragmento de paquete existente");
-#endif
-        it=0;
-        temp2=0;
-        temp3=0;
-        if( pendingFragments[temp]->time > 0 )
+        if( add_type==_16B ) base=4;
+        else base=10;
+    }
+    else
+    {
+        if( mode==CLUSTER ) base=17;
+        else base=11;
+    }
+    if( data_length<(base+4) ) return 1;
+	
+    // Application header: packetID, fragment number, '#' on the first fragment, origin
+    numFragment=data[base+1];
+    if( data[base+2]=='#' ) first=1;
+    type=data[base+2+first];
+    origin=&data[base+3+first];
+    switch( type )
+    {
+        case MY_TYPE:	origin_length=2;
+        header=base+3+first+2;
+        break;
+        case MAC_TYPE:	origin_length=8;
+        header=base+3+first+8;
+        break;
+        case NI_TYPE:	while( (origin_length<20) && ((base+3+first+origin_length)<data_length) && (origin[origin_length]!='#') )
         {
-            if(protocol==XBEE_802_15_4)
-            {
-                if(add_type==_16B)
-                {
-                    if( (data[4]) == pendingFragments[temp]->packetID )
-                    {
-                        if((data[6])==35)
-                        {
-                            temp2=1;
-                        }
-                        else
-                        {
-                            temp2=0;
-                        }
-                        temp3=data[6+temp2];
-                        it=0;
-                        switch(temp3)
-                        {
-                            case MY_TYPE:	if(pendingFragments[temp]->naO[0]==data[7+temp2])
-                            {
-                                if(pendingFragments[temp]->naO[1]==data[8+temp2])
-                                {
-                                    samePacket=1;
-                                }
-                            }
-                            break;
-                            case 1:	for(it=0;it<4;it++)
-                            {
-                                if(pendingFragments[temp]->macOH[it]!=data[7+temp2+it])
-                                {
-                                    comp=1;
-                                    break;
-                                }
-                            }
-                            for(it=0;it<4;it++)
-                            {
-                                if(pendingFragments[temp]->macOL[it]!=data[11+temp2+it])
-                                {
-                                    comp=1;
-                                    break;
-                                }
-                            }
-                            if(comp==0)
-                            {
-                                samePacket=1;
-                            }
-                            break;
-                            case 2:	while(pendingFragments[temp]->niO[it]!=35)
-                            {
-                                if(pendingFragments[temp]->niO[it]!=data[7+it+temp2])
-                                {
-                                    comp=1;
-                                    break;
-                                }
-                                it++;
-                            }
-                            if(comp==0)
-                            {
-                                samePacket=1;
-                            }
-                            break;
-                        }
-                        if(samePacket==1)  // Fragmento del mismo paquete
-                        {
-                            index1=temp;
-                            temp=MAX_FINISH_PACKETS;
-                            if(temp2==1)
-                            {
-                                pendingFragments[index1]->totalFragments=data[5];
-                            }
-                            pendingFragments[index1]->recFragments++;
-                            pendingFragments[index1]->RSSI=pendingFragments[index1]->RSSI+data[2];
-                            index2=data[5]-1;
-                            if( index2>= MAX_FRAG_PACKETS ){
-                                freeIndexMatrix(index1);
-                                return -1;
-                            }
-                        }
-                    }
-                }
-                else if(add_type==_64B)
-                {
-                    if((data[10])==pendingFragments[temp]->packetID)
-                    {
-                        if((data[12])==35)
-                        {
-                            temp2=1;
-                        }
-                        else
-                        {
-                            temp2=0;
-                        }
-                        temp3=data[12+temp2];
-                        it=0;
-                        switch(temp3)
-                        {
-                            case MY_TYPE:	if(pendingFragments[temp]->naO[0]==data[13+temp2])
-                            {
-                                if(pendingFragments[temp]->naO[1]==data[14+temp2])
-                                {
-                                    samePacket=1;
-                                }
-                            }
-                            break;
-                            case 1:	for(it=0;it<4;it++)
-                            {
-                                if(pendingFragments[temp]->macOH[it]!=data[13+temp2+it])
-                                {
-                                    comp=1;
-                                    break;
-                                }
-                            }
-                            for(it=0;it<4;it++)
-                            {
-                                if(pendingFragments[temp]->macOL[it]!=data[17+temp2+it])
-                                {
-                                    comp=1;
-                                    break;
-                                }
-                            }
-                            if(comp==0)
-                            {
-                                samePacket=1;
-                            }
-                            break;
-                            case 2:	while(pendingFragments[temp]->niO[it]!=35)
-                            {
-                                if(pendingFragments[temp]->niO[it]!=data[13+it+temp2])
-                                {
-                                    comp=1;
-                                    break;
-                                }
-                                it++;
-                            }
-                            if(comp==0)
-                            {
-                                samePacket=1;
-                            }
-                            break;
-                        }
-                        if(samePacket==1)  // Fragmento del mismo paquete
-                        {
-#if DEBUG
-                            XBee.println("Fragmento de paquete existente");
-#endif
-                            index1=temp;
-                            temp=MAX_FINISH_PACKETS;
-                            if(temp2==1)
-                            {
-                                pendingFragments[index1]->totalFragments=data[11];
-                            }
-                            pendingFragments[index1]->recFragments++;
-                            pendingFragments[index1]->RSSI=pendingFragments[index1]->RSSI+data[8];
-                            index2=data[11]-1;
-                            if( index2>= MAX_FRAG_PACKETS ){
-                                freeIndexMatrix(index1);
-                                return -1;
-                            }
-#if DEBUG
-                            XBee.print("Index1: ");
-                            XBee.println(index1,DEC);
-                            XBee.print("Index2: ");
-                            XBee.println(index2,DEC);
-#endif
-                        }
-                    }
-                }
-            }
-            else if( (protocol==DIGIMESH) || (protocol==ZIGBEE) || (protocol==XBEE_900) || (protocol==XBEE_868) )
-            {
-                if(mode==UNICAST)
-                {
-                    if((data[11])==pendingFragments[temp]->packetID)
-                    {
-                        if((data[13])==35)
-                        {
-                            temp2=1;
-                        }
-                        else
-                        {
-                            temp2=0;
-                        }
-                        temp3=data[13+temp2];
-                        it=0;
-                        switch(temp3)
-                        {
-                            case MY_TYPE: if(pendingFragments[temp]->naO[0]==data[14+temp2])
-                            {
-                                if(pendingFragments[temp]->naO[1]==data[15+temp2])
-                                {
-                                    samePacket=1;
-                                }
-                            }
-                            break;
-                            case 1: for(it=0;it<4;it++)
-                            {
-                                if(pendingFragments[temp]->macOH[it]!=data[14+temp2+it])
-                                {
-                                    comp=1;
-                                    break;
-                                }
-                            }
-                            for(it=0;it<4;it++)
-                            {
-                                if(pendingFragments[temp]->macOL[it]!=data[18+temp2+it])
-                                {
-                                    comp=1;
-                                    break;
-                                }
-                            }
-                            if(comp==0)
-                            {
-                                samePacket=1;
-                            }
-                            break;
-                            case 2: while(pendingFragments[temp]->niO[it]!=35)
-                            {
-                                if(pendingFragments[temp]->niO[it]!=data[14+it+temp2])
-                                {
-                                    comp=1;
-                                    break;
-                                }
-                                it++;
-                            }
-                            if(comp==0)
-                            {
-                                samePacket=1;
-                            }
-                            break;
-                        }
-                        if(samePacket==1)  // Fragmento del mismo paquete
-                        {
-                            index1=temp;
-#if DEBUG
-                            XBee.println("Fragmento de paquete existente");
-#endif
-                            temp=MAX_FINISH_PACKETS;
-                            if(temp2==1)
-                            {
-                                pendingFragments[index1]->totalFragments=data[12];
-                            }
-                            pendingFragments[index1]->recFragments++;
-                            index2=data[12]-1;
-#if DEBUG
-                            XBee.print("Index1: ");
-                            XBee.println(index1,DEC);
-                            XBee.print("Index2: ");
-                            XBee.println(index2,DEC);
-#endif
-                            if( index2>= MAX_FRAG_PACKETS ){
-                                freeIndexMatrix(index1);
-                                return -1;
-                            }
-                        }
-                    }
-                }
-                else if(mode==CLUSTER)
-                {
-                    if((data[17])==pendingFragments[temp]->packetID)
-                    {
-                        if((data[19])==35)
-                        {
-                            temp2=1;
-                        }
-                        else
-                        {
-                            temp2=0;
-                        }
-                        temp3=data[19+temp2];
-                        it=0;
-                        switch(temp3)
-                        {
-                            case MY_TYPE: if(pendingFragments[temp]->naO[0]==data[20+temp2])
-                            {
-                                if(pendingFragments[temp]->naO[1]==data[21+temp2])
-                                {
-                                    samePacket=1;
-                                }
-                            }
-                            break;
-                            case 1: for(it=0;it<4;it++)
-                            {
-                                if(pendingFragments[temp]->macOH[it]!=data[20+temp2+it])
-                                {
-                                    comp=1;
-                                    break;
-                                }
-                            }
-                            for(it=0;it<4;it++)
-                            {
-                                if(pendingFragments[temp]->macOL[it]!=data[24+temp2+it])
-                                {
-                                    comp=1;
-                                    break;
-                                }
-                            }
-                            if(comp==0)
-                            {
-                                samePacket=1;
-                            }
-                            break;
-                            case 2: while(pendingFragments[temp]->niO[it]!=35)
-                            {
-                                if(pendingFragments[temp]->niO[it]!=data[20+it+temp2])
-                                {
-                                    comp=1;
-                                    break;
-                                }
-                                it++;
-                            }
-                            if(comp==0)
-                            {
-                                samePacket=1;
-                            }
-                            break;
-                        }
-                        if(samePacket==1)  // Fragmento del mismo paquete
-                        {
-                            index1=temp;
-                            temp=MAX_FINISH_PACKETS;
-                            if(temp2==1)
-                            {
-                                pendingFragments[index1]->totalFragments=data[18];
-                            }
-                            pendingFragments[index1]->recFragments++;
-                            index2=data[18]-1;
-                            if( index2>= MAX_FRAG_PACKETS ){
-                                freeIndexMatrix(index1);
-                                return -1;
-                            }
-                        }
-                    }
-                }
-            }
+            origin_length++;
         }
-        temp++;
+        header=base+3+first+origin_length+1;
+        break;
+        default:	return 1;
     }
-    it=0;
-    if(samePacket==0) // Fragmento de un paquete nuevo
+    if( header>data_length ) return 1;
+    length=data_length-header;
+	
+    // Source addresses: 32b Higher Mac, 32b Lower Mac and 16b Network Address
+    memset(source,0,10);
+    if( protocol==XBEE_802_15_4 )
     {
-#if DEBUG
-        XBee.println("Fragmento de paquete nuevo");
-#endif
-        index1=nextIndex1;
-        indexNotModified=1;
-        if( pendingPackets>= MAX_FINISH_PACKETS ){
-            freeIndex();
-            index1=nextIndex1;
+        if( add_type==_16B )
+        {
+            source[8]=data[0];
+            source[9]=data[1];
         }
-        pendingPackets++;
-        pendingFragments[index1] = (index*) calloc(1,sizeof(index));
-        if(pendingFragments[index1]==NULL){
-            freeAll();
-            return -1;
+        else memcpy(source,data,8);
+    }
+    else memcpy(source,data,10);
+	
+    slot=findSlot(data[base],source);
+    if( (numFragment==0) || (numFragment>MAX_FRAG_PACKETS) )
+    {
+        if( slot<MAX_RX_SLOTS ) freeSlot(slot);
+        rxSlotFailures++;
+        return -1;
+    }
+	
+    // Fragment of a new packet: the addressing is taken from the first one received
+    if( slot>=MAX_RX_SLOTS )
+    {
+        slot=getFreeSlot();
+        s=&rxSlots[slot];
+        s->packetID=data[base];
+        memcpy(s->source,source,10);
+        s->typeSourceID=type;
+        s->origin_length=origin_length;
+        memcpy(s->origin,origin,origin_length);
+        s->time=millis();
+        s->address_typeS=add_type;
+        s->opt=data[base-1];
+        if( protocol==XBEE_802_15_4 )
+        {
+            if( (s->opt==0x01) || (s->opt==0x02) ) s->mode=BROADCAST;
+            else s->mode=UNICAST;
         }
-        if(protocol==XBEE_802_15_4)
+        else
         {
-            if(add_type==_16B)
+            if( mode==CLUSTER )
             {
-#if DEBUG
-                XBee.println("Entro en 16B");
-                XBee.println(pendingFragments[index1]->packetID,HEX);
-                XBee.println(pendingFragments[index1]->time,DEC);
-#endif
-                pendingFragments[index1]->address_typeS=add_type;
-                pendingFragments[index1]->packetID=data[4];
-                pendingFragments[index1]->time=millis();
-                for(it=0;it<2;it++)
-                {
-                    pendingFragments[index1]->naS[it]=data[it];
-#if DEBUG
-                    XBee.print(pendingFragments[index1]->naS[it],HEX);
-#endif
-                }
-                if((data[6])==35)
-                {
-                    temp2=1;
-                }
-                else
-                {
-                    temp2=0;
-                }
-                pendingFragments[index1]->typeSourceID=data[6+temp2];
-                it=0;
-                switch(pendingFragments[index1]->typeSourceID)
-                {
-                    case MY_TYPE:	pendingFragments[index1]->naO[0]=data[7+temp2];
-                    pendingFragments[index1]->naO[1]=data[8+temp2];
-                    break;
-                    case MAC_TYPE:	for(it=0;it<4;it++)
-                    {
-                        pendingFragments[index1]->macOH[it]=data[7+it+temp2];
-                    }
-                    for(it=0;it<4;it++)
-                    {
-                        pendingFragments[index1]->macOL[it]=data[11+it+temp2];
-                    }
-                    break;
-                    case NI_TYPE:	while(data[7+temp2+it]!=35)
-                    {
-                        pendingFragments[index1]->niO[it]=char(data[7+it+temp2]);
-                        it++;
-                        if(it>20)
-                        {
-                            break;
-                        }
-                    }
-                    pendingFragments[index1]->niO[it]=char(35);
-                    break;
-                }
-                if(temp2==1)
-                {
-                    pendingFragments[index1]->totalFragments=data[5];
-                }
-                pendingFragments[index1]->recFragments=1;
-                index2=data[5]-1;
-                if( index2>= MAX_FRAG_PACKETS ){
-                    freeIndexMatrix(index1);
-                    return -1;
-                }
-                pendingFragments[index1]->RSSI=data[2];
-                pendingFragments[index1]->opt=data[3];
-                if( (pendingFragments[index1]->opt==0x01) || (pendingFragments[index1]->opt==0x02) )
-                {
-                    pendingFragments[index1]->mode=BROADCAST;
-                }
-                else
-                {
-                    pendingFragments[index1]->mode=UNICAST;
-                }
-            }
-            else if(add_type==_64B)
-            {
-                pendingFragments[index1]->address_typeS=add_type;
-                pendingFragments[index1]->packetID=data[10];
-                pendingFragments[index1]->time=millis();
-#if DEBUG
-                XBee.println("Entro en 64B");
-                XBee.println(pendingFragments[index1]->packetID,HEX);
-                XBee.println(pendingFragments[index1]->time,DEC);
-#endif
-                for(it=0;it<4;it++)
-                {
-                    pendingFragments[index1]->macSH[it]=data[it];
-#if DEBUG
-                    XBee.print(pendingFragments[index1]->macSH[it],HEX);
-#endif
-                }
-                for(it=0;it<4;it++)
-                {
-                    pendingFragments[index1]->macSL[it]=data[it+4];
-#if DEBUG
-                    XBee.print(pendingFragments[index1]->macSL[it],HEX);
-#endif
-                }
-                if((data[12])==35)
-                {
-                    temp2=1;
-                }
-                else
-                {
-                    temp2=0;
-                }
-                pendingFragments[index1]->typeSourceID=data[12+temp2];
-#if DEBUG
-                XBee.println("");
-                XBee.println(pendingFragments[index1]->typeSourceID,DEC);
-#endif
-                it=0;
-                switch(pendingFragments[index1]->typeSourceID)
-                {
-                    case MY_TYPE:	pendingFragments[index1]->naO[0]=data[13+temp2];
-                    pendingFragments[index1]->naO[1]=data[14+temp2];
-#if DEBUG
-                    XBee.println(pendingFragments[index1]->naO[0],HEX);
-                    XBee.println(pendingFragments[index1]->naO[1],HEX);
-#endif
-                    break;
-                    case MAC_TYPE:	for(it=0;it<4;it++)
-                    {
-                        pendingFragments[index1]->macOH[it]=data[13+it+temp2];
-                    }
-                    for(it=0;it<4;it++)
-                    {
-                        pendingFragments[index1]->macOL[it]=data[17+it+temp2];
-                    }
-                    break;
-                    case NI_TYPE:	while(data[13+temp2+it]!=35)
-                    {
-                        pendingFragments[index1]->niO[it]=char(data[13+it+temp2]);
-#if DEBUG
-                        XBee.print(pendingFragments[index1]->niO[it],BYTE);
-#endif
-                        it++;
-                        if(it>20)
-                        {
-                            break;
-                        }
-                    }
-                    pendingFragments[index1]->niO[it]=char(35);
-                    break;
-                }
-                pendingFragments[index1]->RSSI=data[8];
-                pendingFragments[index1]->opt=data[9];
-                if( (pendingFragments[index1]->opt==0x01) || (pendingFragments[index1]->opt==0x02) )
-                {
-                    pendingFragments[index1]->mode=BROADCAST;
-                }
-                else
-                {
-                    pendingFragments[index1]->mode=UNICAST;
-                }
-                if(temp2==1)
-                {
-                    pendingFragments[index1]->totalFragments=data[11];
-                }
-                pendingFragments[index1]->recFragments=1;
-                index2=data[11]-1;
-                if( index2>= MAX_FRAG_PACKETS ){
-                    freeIndexMatrix(index1);
-                    return -1;
-                }
-#if DEBUG
-                XBee.print("Index1: ");
-                XBee.println(index1,DEC);
-                XBee.print("Index2: ");
-                XBee.println(index2,DEC);
-#endif
-            }
-        }
-        else if( (protocol==DIGIMESH) || (protocol==ZIGBEE) || (protocol==XBEE_900) || (protocol==XBEE_868) )
-        {
-            if(mode==UNICAST)
-            {
-                pendingFragments[index1]->packetID=data[11];
-                pendingFragments[index1]->time=millis();
-                if((data[13])==35)
-                {
-                    temp2=1;
-                }
-                else
-                {
-                    temp2=0;
-                }
-                pendingFragments[index1]->typeSourceID=data[13+temp2];
-                it=0;
-                switch(pendingFragments[index1]->typeSourceID)
-                {
-                    case MY_TYPE: pendingFragments[index1]->naO[0]=data[14+temp2];
-                    pendingFragments[index1]->naO[1]=data[15+temp2];
-                    aux3=2;
-                    break;
-                    case MAC_TYPE: for(it=0;it<4;it++)
-                    {
-                        pendingFragments[index1]->macOH[it]=data[14+it+temp2];
-                    }
-                    for(it=0;it<4;it++)
-                    {
-                        pendingFragments[index1]->macOL[it]=data[18+it+temp2];
-                    }
-                    aux3=8;
-                    break;
-                    case NI_TYPE: while(data[14+temp2+it]!=35)
-                    {
-                        pendingFragments[index1]->niO[it]=char(data[14+it+temp2]);
-                        it++;
-                        aux3++;
-                        if(it>20)
-                        {
-                            break;
-                        }
-                    }
-                    pendingFragments[index1]->niO[it]=char(35);
-                    break;
-                }
-                if(temp2==1)
-                {
-                    pendingFragments[index1]->totalFragments=data[12];
-                }
-                pendingFragments[index1]->recFragments=1;
-                index2=data[12]-1;
-                if( index2>= MAX_FRAG_PACKETS ){
-                    freeIndexMatrix(index1);
-                    return -1;
-                }
-                for(it=0;it<4;it++)
-                {
-                    pendingFragments[index1]->macSH[it]=data[it];
-                }
-                for(it=0;it<4;it++)
-                {
-                    pendingFragments[index1]->macSL[it]=data[it+4];
-                }
-                for(it=0;it<2;it++)
-                {
-                    pendingFragments[index1]->naS[it]=data[it+8];
-                }
-                pendingFragments[index1]->mode=UNICAST;
-                pendingFragments[index1]->opt=data[10];
-                if(pendingFragments[index1]->opt==0x02)
-                {
-                    pendingFragments[index1]->mode=BROADCAST;
-                }
-#if DEBUG
-                XBee.print("Index1: ");
-                XBee.println(index1,DEC);
-                XBee.print("Index2: ");
-                XBee.println(index2,DEC);
-#endif
-            }
-            else if(mode==CLUSTER)
-            {
-                pendingFragments[index1]->packetID=data[17];
-                pendingFragments[index1]->time=millis();
-                if((data[19])==35)
-                {
-                    temp2=1;
-                }
-                else
-                {
-                    temp2=0;
-                }
-                pendingFragments[index1]->typeSourceID=data[19+temp2];
-                it=0;
-                switch(pendingFragments[index1]->typeSourceID)
-                {
-                    case MY_TYPE: pendingFragments[index1]->naO[0]=data[20+temp2];
-                    pendingFragments[index1]->naO[1]=data[21+temp2];
-                    aux3=2;
-                    break;
-                    case MAC_TYPE: for(it=0;it<4;it++)
-                    {
-                        pendingFragments[index1]->macOH[it]=data[20+it+temp2];
-                    }
-                    for(it=0;it<4;it++)
-                    {
-                        pendingFragments[index1]->macOL[it]=data[24+it+temp2];
-                    }
-                    aux3=8;
-                    break;
-                    case NI_TYPE: while(data[20+temp2+it]!=35)
-                    {
-                        pendingFragments[index1]->niO[it]=char(data[20+it+temp2]);
-                        it++;
-                        aux3++;
-                        if(it>20)
-                        {
-                            break;
-                        }
-                    }
-                    pendingFragments[index1]->niO[it]=char(35);
-                    break;
-                }
-                if(temp2==1)
-                {
-                    pendingFragments[index1]->totalFragments=data[18];
-                }
-                pendingFragments[index1]->recFragments=1;
-                index2=data[18]-1;
-                if( index2>= MAX_FRAG_PACKETS ){
-                    freeIndexMatrix(index1);
-                    return -1;
-                }
-                for(it=0;it<4;it++)
-                {
-                    pendingFragments[index1]->macSH[it]=data[it];
-                }
-                for(it=0;it<4;it++)
-                {
-                    pendingFragments[index1]->macSL[it]=data[it+4];
-                }
-                for(it=0;it<2;it++)
-                {
-                    pendingFragments[index1]->naS[it]=data[it+8];
-                }
-                pendingFragments[index1]->mode=CLUSTER;
-                pendingFragments[index1]->SD=data[10];
-                pendingFragments[index1]->DE=data[11];
-                for(it=0;it<2;it++)
-                {
-                    pendingFragments[index1]->CID[it]=data[it+12];
-                }
-                for(it=0;it<2;it++)
-                {
-                    pendingFragments[index1]->PID[it]=data[it+14];
-                }
-                pendingFragments[index1]->opt=data[16];
-                if(pendingFragments[index1]->opt==0x02)
-                {
-                    pendingFragments[index1]->mode=BROADCAST;
-                }
-            }
-        }
-    }
-    samePacket=0;	
-    packet_fragments[index1][index2] = (matrix*) calloc(1,sizeof(matrix));
-    if(packet_fragments[index1][index2]==NULL){
-        freeAll();
-        return -1;
-    }
-    if(protocol==XBEE_802_15_4)
-    {
-        if(add_type==_16B)
-        {
-            packet_fragments[index1][index2]->numFragment=data[5];
-            if(data[6]==35)
-            {
-                packet_fragments[index1][index2]->endFragment=1;
-            }
-            else
-            {
-                packet_fragments[index1][index2]->endFragment=0;
-            }
-            aux2=packet_fragments[index1][index2]->endFragment;
-            it=0;
-            cont3=0;
-            switch(pendingFragments[index1]->typeSourceID)
-            {
-                case MY_TYPE:	cont3=2;
-                break;
-                case MAC_TYPE:	cont3=8;
-                break;
-                case NI_TYPE:	while(data[7+aux2+it]!=35)
-                {
-                    it++;
-                    cont3++;
-                }
-                cont3++;
-                break;
-            }
-            header=4+3+aux2+cont3;
-            if( header>data_length ) data_length=header;
-            packet_fragments[index1][index2]->frag_length=data_length-header;
-#if DEBUG
-            XBee.println("");
-            XBee.print("data_length: ");
-            XBee.println(data_length,DEC);
-            XBee.print("header: ");
-            XBee.println(header,DEC);
-            XBee.print("aux2: ");
-            XBee.println(aux2,DEC);
-            XBee.print("cont3: ");
-            XBee.println(cont3,DEC);
-            XBee.println(packet_fragments[index1][index2]->frag_length,DEC);
-#endif
-            for(it=0;it<packet_fragments[index1][index2]->frag_length;it++)
-            {     
-                packet_fragments[index1][index2]->data[it]=char(data[it+header]);
-#if DEBUG
-                XBee.print(packet_fragments[index1][index2]->data[it],BYTE);
-#endif
-            }
-        }
-        if(add_type==_64B)
-        {
-            packet_fragments[index1][index2]->numFragment=data[11];
-            if(data[12]==35)
-            {
-                packet_fragments[index1][index2]->endFragment=1;
-            }
-            else
-            {
-                packet_fragments[index1][index2]->endFragment=0;
-            }
-            aux2=packet_fragments[index1][index2]->endFragment;
-            it=0;
-            cont3=0;
-            switch(pendingFragments[index1]->typeSourceID)
-            {
-                case MY_TYPE:	cont3=2;
-                break;
-                case MAC_TYPE:	cont3=8;
-                break;
-                case NI_TYPE:	while(data[13+aux2+it]!=35)
-                {
-                    it++;
-                    cont3++;
-                }
-                cont3++;
-                break;
-            }
-            header=10+3+aux2+cont3;
-            if( header>data_length ) data_length=header;
-            packet_fragments[index1][index2]->frag_length=data_length-header;
-#if DEBUG
-            XBee.println("");
-            XBee.print("data_length: ");
-            XBee.println(data_length,DEC);
-            XBee.print("header: ");
-            XBee.println(header,DEC);
-            XBee.print("aux2: ");
-            XBee.println(aux2,DEC);
-            XBee.print("cont3: ");
-            XBee.println(cont3,DEC);
-            XBee.println(packet_fragments[index1][index2]->frag_length,DEC);
-#endif
-            for(it=0;it<packet_fragments[index1][index2]->frag_length;it++)
-            {     
-                packet_fragments[index1][index2]->data[it]=char(data[it+header]);
-#if DEBUG
-                XBee.print(packet_fragments[index1][index2]->data[it],BYTE);
-#endif
+                memcpy(s->cluster,&data[10],6);
+                s->mode=CLUSTER;
             }
+            else s->mode=UNICAST;
+            if( s->opt==0x02 ) s->mode=BROADCAST;
         }
+        addSlotHash(slot);
     }
+    s=&rxSlots[slot];
 	
-    if( (protocol==ZIGBEE) || (protocol==DIGIMESH) || (protocol==XBEE_900) || (protocol==XBEE_868) )
+    // Repeated fragments are ignored
+    if( s->fragMask & (1UL<<(numFragment-1)) ) return 0;
+    if( (s->data_length+length)>MAX_DATA )
     {
-        if(mode==UNICAST)
-        {
-            packet_fragments[index1][index2]->numFragment=data[12];
-            if(data[13]==35)
-            {
-                packet_fragments[index1][index2]->endFragment=1;
-            }
-            else
-            {
-                packet_fragments[index1][index2]->endFragment=0;
-            }
-            aux2=packet_fragments[index1][index2]->endFragment;
-            it=0;
-            cont3=0;
-            switch(pendingFragments[index1]->typeSourceID)
-            {
-                case MY_TYPE:	cont3=2;
-                break;
-                case MAC_TYPE:	cont3=8;
-                break;
-                case NI_TYPE:	while(data[14+aux2+it]!=35)
-                {
-                    it++;
-                    cont3++;
-                }
-                cont3++;
-                break;
-            }
-            header=11+3+aux2+cont3;
-            if( header>data_length ) data_length=header;
-            packet_fragments[index1][index2]->frag_length=data_length-header;
-#if DEBUG
-            XBee.println("");
-            XBee.print("data_length: ");
-            XBee.println(data_length,DEC);
-            XBee.print("header: ");
-            XBee.println(header,DEC);
-            XBee.print("aux2: ");
-            XBee.println(aux2,DEC);
-            XBee.print("cont3: ");
-            XBee.println(cont3,DEC);
-            XBee.println(packet_fragments[index1][index2]->frag_length,DEC);
-#endif
-            for(it=0;it<packet_fragments[index1][index2]->frag_length;it++)
-            {     
-                packet_fragments[index1][index2]->data[it]=char(data[it+header]);
-            }
-        }
-        else if(mode==CLUSTER)
-        {
-            packet_fragments[index1][index2]->numFragment=data[18];
-            if(data[19]==35)
-            {
-                packet_fragments[index1][index2]->endFragment=1;
-            }
-            else
-            {
-                packet_fragments[index1][index2]->endFragment=0;
-            }
-            aux2=packet_fragments[index1][index2]->endFragment;
-            it=0;
-            cont3=0;
-            switch(pendingFragments[index1]->typeSourceID)
-            {
-                case MY_TYPE:	cont3=2;
-                break;
-                case MAC_TYPE:	cont3=8;
-                break;
-                case NI_TYPE:	while(data[23+aux2+it]!=35)
-                {
-                    it++;
-                    cont3++;
-                }
-                cont3++;
-                break;
-            }
-            header=17+3+aux2+cont3;
-            if( header>data_length ) data_length=header;
-            packet_fragments[index1][index2]->frag_length=data_length-header;
-            for(it=0;it<packet_fragments[index1][index2]->frag_length;it++)
-            {     
-                packet_fragments[index1][index2]->data[it]=char(data[it+header]);
-            }
-        }
+        freeSlot(slot);
+        rxSlotFailures++;
+        return -1;
     }
-    totalFragmentsReceived++;
 	
-    if(totalFragmentsReceived==MAX_FRAG_PACKETS)
-    {
-        totalFragmentsReceived=0;
-    }
+    // The payload is written once, right after the fragments already received
+    memcpy(&s->data[s->data_length],&data[header],length);
+    s->fragOffset[numFragment-1]=s->data_length;
+    s->fragLength[numFragment-1]=length;
+    s->data_length+=length;
+    s->fragMask|=(1UL<<(numFragment-1));
+    s->recFragments++;
+    if( first ) s->totalFragments=numFragment;
+    if( protocol==XBEE_802_15_4 ) s->RSSI+=data[base-2];
 	
-    if(pendingFragments[index1]->recFragments==pendingFragments[index1]->totalFragments)
+    // Deliver the packet as soon as its last fragment arrives
+    if( s->totalFragments && (s->fragMask==(uint16_t)((1UL<<s->totalFragments)-1)) )
     {
-        pendingFragments[index1]->complete=1;
+        if( finishSlot(slot) ) error=-1;
     }
-
-    temp=0;
-    temp2=0;
-    temp3=0;
-    aux=0;
-    while(temp<MAX_FINISH_PACKETS)
-    {
-        it=0;
-        time=millis();
-        if( (pendingFragments[temp]!=NULL) )
-        {
-            if ( (pendingFragments[temp]->time>0) )
-            {
-                if( ((time-pendingFragments[temp]->time)<=TIMEOUT) )
-                {
-                    if ((pendingFragments[temp]->time>0) ) // se mira el contenido
-                    {
-                        if(pendingFragments[temp]->complete==1)
-                        {
-                            nextIndex1=temp;
-                            indexNotModified=0;
-                            pos++;
-                            finishIndex=getFinishIndex();
-                            if( pos>=MAX_FINISH_PACKETS ){
-                                switch( replacementPolicy )
-                                {
-                                    case	XBEE_FIFO:	finishIndex=getIndexFIFO();
-                                    break;
-                                    case	XBEE_LIFO:	finishIndex=getIndexLIFO();
-                                    break;
-                                    case	XBEE_OUT:	freeIndexMatrix(temp);
-                                    return -1;
-                                    break;
-                                }
-                            }
-                            packet_finished[finishIndex] = (packetXBee*) calloc(1,sizeof(packetXBee));
-                            if(packet_finished[finishIndex]==NULL){
-                                freeIndexMatrix(temp);
-                                return -1;
-                            }
-                            else pendingPackets--;
-                            packet_finished[finishIndex]->time=pendingFragments[temp]->time;
-                            packet_finished[finishIndex]->packetID=pendingFragments[temp]->packetID;
-                            packet_finished[finishIndex]->address_typeS=pendingFragments[temp]->address_typeS;
-                            packet_finished[finishIndex]->mode=pendingFragments[temp]->mode;
-                            if(protocol==XBEE_802_15_4)
-                            {
-                                if(packet_finished[finishIndex]->address_typeS==_64B)
-                                {
-                                    for(it=0;it<4;it++)
-                                    {
-                                        packet_finished[finishIndex]->macSH[it]=pendingFragments[temp]->macSH[it];
-                                    }
-                                    for(it=0;it<4;it++)
-                                    {
-                                        packet_finished[finishIndex]->macSL[it]=pendingFragments[temp]->macSL[it];
-                                    }
-                                }
-                                else if(packet_finished[finishIndex]->address_typeS==_16B)
-                                {
-                                    packet_finished[finishIndex]->naS[0]=pendingFragments[temp]->naS[0];
-                                    packet_finished[finishIndex]->naS[1]=pendingFragments[temp]->naS[1];
-                                }
-                            }
-                            else
-                            {
-                                for(it=0;it<4;it++)
-                                {
-                                    packet_finished[finishIndex]->macSH[it]=pendingFragments[temp]->macSH[it];
-                                }
-                                for(it=0;it<4;it++)
-                                {
-                                    packet_finished[finishIndex]->macSL[it]=pendingFragments[temp]->macSL[it];
-                                }
-                                packet_finished[finishIndex]->naS[0]=pendingFragments[temp]->naS[0];
-                                packet_finished[finishIndex]->naS[1]=pendingFragments[temp]->naS[1];
-                            }
-                            aux=(pendingFragments[temp]->RSSI)/(pendingFragments[temp]->totalFragments);
-                            packet_finished[finishIndex]->RSSI=aux;
-                            packet_finished[finishIndex]->typeSourceID=pendingFragments[temp]->typeSourceID;
-                            switch(packet_finished[finishIndex]->typeSourceID)
-                            {
-                                case MY_TYPE:	packet_finished[finishIndex]->naO[0]=pendingFragments[temp]->naO[0];
-                                packet_finished[finishIndex]->naO[1]=pendingFragments[temp]->naO[1];
-                                break;
-                                case MAC_TYPE:	for(it=0;it<4;it++)
-                                {
-                                    packet_finished[finishIndex]->macOH[it]=pendingFragments[temp]->macOH[it];
-                                }
-                                for(it=0;it<4;it++)
-                                {
-                                    packet_finished[finishIndex]->macOL[it]=pendingFragments[temp]->macOL[it];
-                                }
-                                break;
-                                case NI_TYPE:	it=0;
-                                do
-                                {
-                                    packet_finished[finishIndex]->niO[it]=pendingFragments[temp]->niO[it];
-                                    it++;
-                                } while(pendingFragments[temp]->niO[it]!=35);
-                                packet_finished[finishIndex]->niO[it]=char(35);
-                                break;
-                            }
-                            temp2=(pendingFragments[temp]->totalFragments)-1;
-                            aux=0;
-                            temp3=0;
-                            while(temp2>=0)
-                            {
-                                for(it=0;it<packet_fragments[temp][temp2]->frag_length;it++)
-                                {
-                                    packet_finished[finishIndex]->data[it+temp3]=packet_fragments[temp][temp2]->data[it];
-                                    aux++;
-                                }
-                                temp3=packet_fragments[temp][temp2]->frag_length+temp3;
-                                temp2--;
-                            }
-                            packet_finished[finishIndex]->data_length=aux;
-                            if(mode==CLUSTER)
-                            {
-                                packet_finished[finishIndex]->SD=pendingFragments[temp]->SD;
-                                packet_finished[finishIndex]->DE=pendingFragments[temp]->DE;
-                                packet_finished[finishIndex]->CID[0]=pendingFragments[temp]->CID[0];
-                                packet_finished[finishIndex]->CID[1]=pendingFragments[temp]->CID[1];
-                                packet_finished[finishIndex]->PID[0]=pendingFragments[temp]->PID[0];
-                                packet_finished[finishIndex]->PID[1]=pendingFragments[temp]->PID[1];
-                            }
-						// Vaciamos el index
-                            for(it=0;it<MAX_FRAG_PACKETS;it++)
-                            {
-                                free(packet_fragments[temp][it]);
-                                packet_fragments[temp][it]=NULL;
-                            }
-						
-                            pendingFragments[temp]->time=0;
-                            free(pendingFragments[temp]);
-                            pendingFragments[temp]=NULL;
-                        }
-                        else if(pendingFragments[temp]->totalFragments==pendingFragments[temp]->recFragments)
-                        {
-                            for(it=0;it<MAX_FRAG_PACKETS;it++)
-                            {
-							
-                                free(packet_fragments[temp][it]);
-                                packet_fragments[temp][it]=NULL;
-                            }
-						
-                            pendingFragments[temp]->time=0;
-                            free(pendingFragments[temp]);
-                            pendingFragments[temp]=NULL;
-                            pendingPackets--;
-                            nextIndex1=temp;
-                            indexNotModified=0;
-                        }
-                    }
-                }
-                else // se borra la fila de la matriz y el correspondiente al vector indexador
-                {
-                    for(it=0;it<MAX_FRAG_PACKETS;it++)
-                    {
-						
-                        free(packet_fragments[temp][it]);
-                        packet_fragments[temp][it]=NULL;
-                    }
-                    pendingFragments[temp]->time=0;
-                    free(pendingFragments[temp]);
-                    pendingFragments[temp]=NULL;
-                    pendingPackets--;
-                    nextIndex1=temp;
-                    indexNotModified=0;
-                }
-            }
-        }
-        temp++;
-    }  
-    temp=0; 
-    return 0;
+    return error;
 }
 
 
@@ -4750,7 +3722,6 @@ uint8_t WaspXBeeCore::gen_checksum(const char* data)
 uint8_t WaspXBeeCore::gen_send(const char* data)
 {
     uint8_t inc=0;
-    uint8_t inc2=0;
     int8_t error_int=2;
 	
     it=0;
@@ -4760,17 +3731,7 @@ uint8_t WaspXBeeCore::gen_send(const char* data)
     }
     inc/=2;
 	
-    while(inc2<inc)
-    {
-	if( uart==UART0 ) XBee.print(command[inc2], BYTE); 
-	else if( uart==UART1 )
-	{
-		Utils.setMuxGPRS();
-		XBee2.print(command[inc2], BYTE); 
-	}
-        inc2++;
-    }
-    inc2=0;
+    writeFrame(command,inc);
 
     error_int=parse_message(command);
 
@@ -5031,628 +3992,220 @@ void WaspXBeeCore::gen_frame_ap2(struct packetXBee* _packet, uint8_t* TX_array,
    error=2 --> The command has not been executed
    error=1 --> There has been an error while executing the command
    error=0 --> The command has been executed with no errors
+ Values: Bytes are fed one by one to 'parseByte' as they leave the UART buffer,
+ 	so a frame split between two calls is resumed on the next call
 */
 int8_t WaspXBeeCore::parse_message(uint8_t* frame)
 {
-#ifdef SEND_MEMORY_LEAK_DEBUG  // OK
-	USB.print("parse1 "); USB.println(freeMemory());
-#endif	
-
-#ifdef LAME_SOLUTION
-	uint8_t memoryBjorn[MAX_PARSE];	
-#else
-    uint8_t* memory = (uint8_t*) calloc(MAX_PARSE,sizeof(uint8_t));
-#endif
-
-#ifndef LAME_SOLUTION
-    if( memory==NULL )
-    {
-		#ifdef SEND_MEMORY_LEAK_DEBUG  // 302 BYTES LOST
-			USB.print("memory == null "); USB.println(freeMemory());
-		#endif	
-		if( uart==UART0 ) XBee.flush();
-		else if( uart==UART1 ) XBee2.flush();	
-		
-		return -1;
-    }
-#endif
-	#ifdef SEND_MEMORY_LEAK_DEBUG  // 302 BYTES LOST
-		USB.print("parse2 "); USB.println(freeMemory());
-	#endif		
-	#ifndef LAME_SOLUTION
-		#ifdef SEND_MEMORY_LEAK_DEBUG  // 302 BYTES LOST
-
-			free(memory);
-			memory = NULL;
-			USB.print("parse2a "); USB.println(freeMemory());
-		#endif
-	#endif
-
-    uint16_t i=0;
     long previous=millis();
     long previous2=millis();
-    uint8_t num_mes=0;
-    uint8_t num_esc=0;
-    uint16_t num_data=0;
-    uint16_t length_mes=0;
-    uint16_t length_prev=0;
     int8_t error=2;
+    int8_t status=0;
     long interval=50;
     long intervalMAX=40000;
     uint8_t good_frame=0;
-    uint8_t maxFrame=30;
+    uint8_t waitTX=0;
+    uint8_t scanning=0;
 	
-    // If a frame was truncated before, we set the first byte
-    if( frameNext ){
-        frameNext=0;
-		#ifndef LAME_SOLUTION
-			memory[0]=0x7E;
-		#else
-			memoryBjorn[0]=0x7E;
-		#endif
-        i=1;
-        num_mes=1;
-    }
-	
-    // If it is a TX we have a different behaviour
-    if( frame[0]==0xFF ){
-		#ifndef LAME_SOLUTION
-			error_TX=txStatusResponse(memory);
-		#else
-			error_TX=txStatusResponse(memoryBjorn);
-		#endif
-			#ifdef SEND_MEMORY_LEAK_DEBUG  // ?
-				USB.print("parse3 "); USB.println(freeMemory());
-			#endif	
-		#ifndef LAME_SOLUTION	
-        free(memory);
-        memory=NULL;
-			#ifdef SEND_MEMORY_LEAK_DEBUG  // ?
-				USB.print("parse3 free mem "); USB.println(freeMemory());
-			#endif	
-		#endif
-        return error_TX; 
-    }
-    else if( frame[0]==0xFE ){
-		#ifndef LAME_SOLUTION
-			error_TX=txZBStatusResponse(memory);
-				#ifdef SEND_MEMORY_LEAK_DEBUG  // ?
-					USB.print("parse4 "); USB.println(freeMemory());
-				#endif	
-			free(memory);
-			memory=NULL;
-				#ifdef SEND_MEMORY_LEAK_DEBUG  // ?
-					USB.print("parse4 behind free "); USB.println(freeMemory());
-				#endif	
-		#else
-			error_TX=txZBStatusResponse(memoryBjorn);
-		#endif
-        return error_TX; 
+    // If it is a TX we wait for the TX Status frame
+    if( (frame[0]==0xFF) || (frame[0]==0xFE) )
+    {
+        error_TX=2;
+        interval=2000;
+        waitTX=1;
     }
-	
     // If a RX we reduce the interval
-    if( frame[0]==0xEE ){
+    else if( frame[0]==0xEE )
+    {
         interval=5;
-        maxFrame=109;
     }
-#ifdef SEND_MEMORY_LEAK_DEBUG  // ?
-	USB.print("parse4 "); USB.println(freeMemory());
-#endif		
-    // Check if a ED is performed
-    if( frame[5]==0x45 && frame[6]==0x44 && protocol==XBEE_802_15_4 ) interval=3000;
-	
-    // Check if a DN is performed
-    if( frame[5]==0x44 && frame[6]==0x4E ) interval=1000;
+    else
+    {
+        // Check if a ED is performed
+        if( frame[5]==0x45 && frame[6]==0x44 && protocol==XBEE_802_15_4 ) interval=3000;
 		
-    // Check if a ND is performed
-    if( frame[5]==0x4E && frame[6]==0x44 ){
-        interval=20000;
-        if(protocol==DIGIMESH) interval=40000;
-        else if( (protocol==XBEE_900) || (protocol==XBEE_868) )
-        {
-            interval=14000;
+        // Check if a DN is performed
+        if( frame[5]==0x44 && frame[6]==0x4E ) interval=1000;
+			
+        // Check if a ND is performed
+        if( frame[5]==0x4E && frame[6]==0x44 ){
+            scanning=1;
+            interval=20000;
+            if(protocol==DIGIMESH) interval=40000;
+            else if( (protocol==XBEE_900) || (protocol==XBEE_868) )
+            {
+                interval=14000;
+            }
         }
     }
 	
     // Read data from XBee meanwhile data is available
-    previous2=millis();
-    previous=millis();
-
-/// /////////////////////////////////////////////////////////////////////////////////////////////////
-/// FULL COPY FROM HERE ON...
-#ifndef LAME_SOLUTION
-/// /////////////////////////////////////////////////////////////////////////////////////////////////
-
-    while( ((millis()-previous)<interval) && ((millis()-previous2)<intervalMAX) && i<MAX_PARSE && !frameNext )
-    {	
-	if( uart==UART0 )
-	{
-	   if(XBee.available())
-	   {
-		memory[i]=XBee.read();
-		i++;
-		if(memory[i-1]==0x7E)
-		{
-			if( (MAX_PARSE-i) < maxFrame ) frameNext=1;
-			else num_mes++;
-		}
-		previous=millis();
-	   }
-	}
-	else if( uart==UART1 )
-	{
-	   if(XBee2.available())
-	   {
-		memory[i]=XBee2.read();	
-		i++;
-		if(memory[i-1]==0x7E)
-		{
-			if( (MAX_PARSE-i) < maxFrame ) frameNext=1;
-			else num_mes++;
-		}
-		previous=millis();
-	   }
-	}
-	if( millis()-previous < 0 ) previous=millis(); //avoid millis overflow problem
-        if( millis()-previous2 < 0 ) previous2=millis(); //avoid millis overflow problem
-    }
-	
-#ifdef SEND_MEMORY_LEAK_DEBUG  // ?
-	USB.print("parse5 "); USB.println(freeMemory());
-#endif		
-		
-    num_data=i;
-    i=1;
-	
-	// If some corrupted frame has appeared we jump it
-    if( memory[0]!=0x7E ) num_mes++;
-	
-	// Parse the received messages from the XBee
-    while( num_mes>0 )
+    while( ((millis()-previous)<interval) && ((millis()-previous2)<intervalMAX) )
     {
-        while( memory[i]!=0x7E && i<num_data ) i++;
-        length_mes=i-length_prev;
-		
-		// If some char has been eschaped, it must be converted before parsing it
-        for( it=0;it<length_mes;it++ )
-        {
-            if( memory[it+length_prev]==0x7D ) num_esc++;
-        }
-        if( num_esc ) des_esc(memory,length_mes,i-length_mes);
-		
-        switch( memory[(i-length_mes)+3] )
+        if( serialAvailable(uart) )
         {
-            case 0x88 :	error=atCommandResponse(memory,frame,length_mes-num_esc+length_prev,i-length_mes);
-            error_AT=error;
-            break;
-            case 0x8A :	error=modemStatusResponse(memory,length_mes-num_esc+length_prev,i-length_mes);
-            break;
-            case 0x80 :	error=rxData(memory,length_mes-num_esc+length_prev,i-length_mes);
-            error_RX=error;
-            break;
-            case 0x81 :	error=rxData(memory,length_mes-num_esc+length_prev,i-length_mes);
-            error_RX=error;
-            break;
-            case 0x90 :	error=rxData(memory,length_mes-num_esc+length_prev,i-length_mes);
-            error_RX=error;
-            break;
-            case 0x91 :	error=rxData(memory,length_mes-num_esc+length_prev,i-length_mes);
-            error_RX=error;
-            break;
-            default   :	break;
+            status=parseByte(serialRead(uart));
+            previous=millis();
+            if( status==1 )
+            {
+                error=dispatchFrame(frame);
+                if( !error ) good_frame++;
+				
+                // Return as soon as the expected answer has arrived
+                if( waitTX && (error_TX!=2) ) break;
+                if( !waitTX && !scanning && (rxFrame[3]==0x88) && !error ) break;
+            }
+            else if( status==-1 ) error=1;
         }
-		
-        num_mes--;
-        length_prev=i;
-        i++;
-        num_esc=0;
-        if(!error) good_frame++;
-    }
-		
-    free(memory);
-    memory=NULL;
-	
-#ifdef SEND_MEMORY_LEAK_DEBUG  // Never reached via XBeeSendMessagePrivate
-	USB.print("parse6 "); USB.println(freeMemory());
-#endif	
-	
-    if(good_frame) return 0;
-    else return error;
-	
-
-/// /////////////////////////////////////////////////////////////////////////////////////////////////
-/// ...FULL COPY FROM HERE ON...
-#else
-/// /////////////////////////////////////////////////////////////////////////////////////////////////
-    while( ((millis()-previous)<interval) && ((millis()-previous2)<intervalMAX) && i<MAX_PARSE && !frameNext )
-    {	
-	if( uart==UART0 )
-	{
-	   if(XBee.available())
-	   {
-		memoryBjorn[i]=XBee.read();
-		i++;
-		if(memoryBjorn[i-1]==0x7E)
-		{
-			if( (MAX_PARSE-i) < maxFrame ) frameNext=1;
-			else num_mes++;
-		}
-		previous=millis();
-	   }
-	}
-	else if( uart==UART1 )
-	{
-	   if(XBee2.available())
-	   {
-		memoryBjorn[i]=XBee2.read();	
-		i++;
-		if(memoryBjorn[i-1]==0x7E)
-		{
-			if( (MAX_PARSE-i) < maxFrame ) frameNext=1;
-			else num_mes++;
-		}
-		previous=millis();
-	   }
-	}
-	if( millis()-previous < 0 ) previous=millis(); //avoid millis overflow problem
+        if( millis()-previous < 0 ) previous=millis(); //avoid millis overflow problem
         if( millis()-previous2 < 0 ) previous2=millis(); //avoid millis overflow problem
     }
 	
-#ifdef SEND_MEMORY_LEAK_DEBUG  // ?
-	USB.print("parse5 "); USB.println(freeMemory());
-#endif		
-		
-    num_data=i;
-    i=1;
-	
-	// If some corrupted frame has appeared we jump it
-    if( memoryBjorn[0]!=0x7E ) num_mes++;
-	
-	// Parse the received messages from the XBee
-    while( num_mes>0 )
-    {
-        while( memoryBjorn[i]!=0x7E && i<num_data ) i++;
-        length_mes=i-length_prev;
-		
-		// If some char has been eschaped, it must be converted before parsing it
-        for( it=0;it<length_mes;it++ )
-        {
-            if( memoryBjorn[it+length_prev]==0x7D ) num_esc++;
-        }
-        if( num_esc ) des_esc(memoryBjorn,length_mes,i-length_mes);
-		
-        switch( memoryBjorn[(i-length_mes)+3] )
-        {
-            case 0x88 :	error=atCommandResponse(memoryBjorn,frame,length_mes-num_esc+length_prev,i-length_mes);
-            error_AT=error;
-            break;
-            case 0x8A :	error=modemStatusResponse(memoryBjorn,length_mes-num_esc+length_prev,i-length_mes);
-            break;
-            case 0x80 :	error=rxData(memoryBjorn,length_mes-num_esc+length_prev,i-length_mes);
-            error_RX=error;
-            break;
-            case 0x81 :	error=rxData(memoryBjorn,length_mes-num_esc+length_prev,i-length_mes);
-            error_RX=error;
-            break;
-            case 0x90 :	error=rxData(memoryBjorn,length_mes-num_esc+length_prev,i-length_mes);
-            error_RX=error;
-            break;
-            case 0x91 :	error=rxData(memoryBjorn,length_mes-num_esc+length_prev,i-length_mes);
-            error_RX=error;
-            break;
-            default   :	break;
-        }
-		
-        num_mes--;
-        length_prev=i;
-        i++;
-        num_esc=0;
-        if(!error) good_frame++;
-    }
-		
-    //free(memory);
-    //memory=NULL;
-	
-#ifdef SEND_MEMORY_LEAK_DEBUG  // Never reached via XBeeSendMessagePrivate
-	USB.print("parse6 "); USB.println(freeMemory());
-#endif	
-	
-    if(good_frame) return 0;
-    else return error;	
-#endif	
+    if( waitTX ) return error_TX;
+    if( good_frame ) return 0;
+    else return error;
 }
 
 
 /*
- Function: Generates the correct API frame from an eschaped one
+ Function: Feeds a byte received from the XBee module to the API frame parser
  Parameters:
- 	data_in : The string that contains the eschaped API frame
- 	end : the end of the frame
- 	start : the start of the frame
- Returns: Nothing
+ 	byte : the byte read from the UART
+ Returns: Integer that determines the state of the frame being received
+   1 --> A complete frame with a good checksum is stored in 'rxFrame'
+   0 --> The frame is not complete yet
+   -1 --> The frame has been discarded (bad checksum or too long)
+ Values: Stores in 'rxFrame' the frame without escaped characters, starting by
+ 	the 0x7E delimiter, so it can be passed as it is to the frame handlers
 */
-void WaspXBeeCore::des_esc(uint8_t* data_in, uint16_t end, uint16_t start)
+int8_t WaspXBeeCore::parseByte(uint8_t byte)
 {
-    uint16_t i=0;
-    uint16_t aux=0;
-		
-    while( i<end )
+    // A delimiter always starts a new frame, dropping any truncated one
+    if( byte==0x7E )
     {
-        while( data_in[start+i]!=0x7D && i<end ) i++;
-        if( i<end )
-        {
-            aux=i+1;
-            switch( data_in[start+i+1] )
-            {
-                case 0x31 : 	data_in[start+i]=0x11;
-                break;
-                case 0x33 : 	data_in[start+i]=0x13;
-                break;
-                case 0x5E : 	data_in[start+i]=0x7E;
-                break;
-                case 0x5D : 	data_in[start+i]=0x7D;
-                break;
-            }
-            i++;
-            end--;
-            while( i<(end) ){
-                data_in[start+i]=data_in[start+i+1];
-                i++;
-            }
-            i=aux;
-        }
+        rxFrame[0]=0x7E;
+        rxIndex=1;
+        rxChecksum=0;
+        rxEscaped=0;
+        rxState=XBEE_RX_LENGTH;
+        return 0;
     }
-}
-
-
-/*
- Function: Parses the AT command answer received by the XBee module
- Parameters:
- 	data_in : the answer received by the module
- 	frame : an array that contains the API frame that is expected to receive answer from if it is an AT command
- 	end : the end of the frame
- 	start : the start of the frame
- Returns: Integer that determines if there has been any error 
-   error=2 --> The command has not been executed
-   error=1 --> There has been an error while executing the command
-   error=0 --> The command has been executed with no errors
-*/
-uint8_t WaspXBeeCore::atCommandResponse(uint8_t* data_in, uint8_t* frame, uint16_t end, uint16_t start)
-{	
-	// Check the checksum
-    if(checkChecksum(data_in,end,start)) return 1;
-		
-	// Check the AT Command Response is from the command expected
-    if( data_in[start+5]!=frame[5] || data_in[start+6]!=frame[6] ) return 1;
-		
-	// Check if there is data in the AT Command Response frame
-    if( (end-start)==9 ){
-        if( data_in[start+7]==0 ) return 0;
-        else return 1;
+    if( rxState==XBEE_RX_DELIMITER ) return 0;
+	
+    // Escaped characters are converted as they arrive
+    if( byte==0x7D )
+    {
+        rxEscaped=1;
+        return 0;
     }
-		
-    if( data_in[start+7]!=0 ) return 1;
-	// Store the data in the response frame
-    for(it=0;it<(end-start-9);it++)
+    if( rxEscaped )
     {
-        data[it]=data_in[8+it+start];
+        byte^=0x20;
+        rxEscaped=0;
     }
 	
-	// Check if a ND is performed
-    data_length=end-start-9;
-    if( frame[5]==0x4E && frame[6]==0x44 ){
-        if( data_length>1 ) totalScannedBrothers++;
-        treatScan();
+    switch( rxState )
+    {
+        case XBEE_RX_LENGTH :	rxFrame[rxIndex++]=byte;
+        if( rxIndex==3 )
+        {
+            rxLength=((uint16_t)rxFrame[1]<<8) | rxFrame[2];
+            if( (rxLength==0) || (rxLength>(MAX_FRAME-4)) )
+            {
+                rxState=XBEE_RX_DELIMITER;
+                return -1;
+            }
+            rxState=XBEE_RX_DATA;
+        }
+        break;
+        case XBEE_RX_DATA :	rxFrame[rxIndex++]=byte;
+        rxChecksum+=byte;
+        if( rxIndex==(rxLength+3) ) rxState=XBEE_RX_CHECKSUM;
+        break;
+        case XBEE_RX_CHECKSUM :	rxFrame[rxIndex++]=byte;
+        rxState=XBEE_RX_DELIMITER;
+        if( (uint8_t)(rxChecksum+byte)!=0xFF ) return -1;
+        return 1;
     }
     return 0;
 }
 
 
 /*
- Function: Parses the Modem Status message received by the XBee module
+ Function: Sends an API frame through the selected UART
  Parameters:
- 	data_in : the answer received by the module
- 	end : the end of the frame
- 	start : the start of the frame
- Returns: Integer that determines if there has been any error 
-   error=2 --> The command has not been executed
-   error=1 --> There has been an error while executing the command
-   error=0 --> The command has been executed with no errors
+ 	frame : the escaped API frame to send
+ 	length : number of bytes in 'frame'
+ Returns: Nothing
+ Values: The multiplexer is set once for UART1 and the whole frame is queued in the
+	 UART transmit buffer, so it returns as soon as the last byte has been queued
 */
-uint8_t WaspXBeeCore::modemStatusResponse(uint8_t* data_in, uint16_t end, uint16_t start)
-{		
-	// Check the checksum
-    if(checkChecksum(data_in,end,start)) return 1;	
-		
-    modem_status=data_in[start+4];
-    return 0;
+void WaspXBeeCore::writeFrame(uint8_t* frame, uint16_t length)
+{
+    uint16_t sent=0;
+	
+    if( uart==UART1 ) Utils.setMuxGPRS();
+    while( sent<length )
+    {
+        if( uart==UART0 ) sent+=XBee.write(&frame[sent],length-sent);
+        else if( uart==UART1 ) sent+=XBee2.write(&frame[sent],length-sent);
+        else break;
+    }
 }
 
 
 /*
- Function: Parses the TX Status message received by the XBee module
+ Function: Calls the appropriate function depending on the API frame type stored in 'rxFrame'
  Parameters:
- 	data_in : the answer received by the module
- 	end : the end of the frame
- 	start : the start of the frame
+ 	frame : an array that contains the API frame that is expected to receive answer from if it is an AT command
  Returns: Integer that determines if there has been any error 
    error=2 --> The command has not been executed
    error=1 --> There has been an error while executing the command
    error=0 --> The command has been executed with no errors
 */
-uint8_t WaspXBeeCore::txStatusResponse(uint8_t* ByteIN)
+int8_t WaspXBeeCore::dispatchFrame(uint8_t* frame)
 {
-    long previous=millis();
-    uint16_t numberBytes=7;
-    uint8_t end=0;
-    uint16_t counter3=0;
-    uint8_t undesired=0;
-    uint8_t status=0;
-    uint16_t num_TX=0;
-    uint8_t num_esc=0;
-    int16_t interval=2000;
-    uint8_t num_mes=0;
-    uint16_t i=1;
-    uint16_t length_mes=0;
-    uint16_t length_prev=0;
-    uint8_t maxFrame=110;
-	
-    error_TX=2;
-		
-    if( frameNext )
-    {
-        ByteIN[0]=0x7E;
-        counter3=1;
-        num_mes=1;
-        frameNext=0;
-    }
-	
-    while( end==0 && !frameNext )
-    {
-	if( uart==UART0 )
-	{
-           	if(XBee.available()>0)
-           	{
-           		ByteIN[counter3]=XBee.read();
-           		counter3++;
-           		previous=millis();
-           		if(ByteIN[counter3-1]==0x7E)
-			{
-           			if( (MAX_PARSE-counter3) < maxFrame ) frameNext=1;
-                		else num_mes++;
-            		}
-            		if( (counter3==1) && (ByteIN[counter3-1]!=0x7E) ) counter3=0;	
-            		if( counter3>=MAX_PARSE ) end=1;
-            		if( (counter3==4+status*6+undesired) && (undesired!=1) ) //FIXME
-            		{
-                		if( (ByteIN[counter3-1]!= 0x89) && (ByteIN[counter3-1]!=0x8A) )
-				{
-	                    		undesired=1;
-                    			numberBytes+=3;
-                		}
-            		}
-            		if( undesired==1 ) numberBytes++;
-	            	if( (ByteIN[counter3-1]==0x7D) && (!undesired) )
-        	    	{
-        	        	numberBytes++;
-        	    	}
-        	    	if( (ByteIN[counter3-1]==0x8A) && (counter3==(4+status*6)) )
-        	    	{
-        	        	numberBytes+=6;
-        	       		status++;
-        	    	}
-        	    	if( (ByteIN[counter3-1]==0x7E) && (undesired==1) )
-        	    	{
-        	        	numberBytes--;
-        	        	undesired=numberBytes-7;
-        	    	}
-        	    	if(counter3==numberBytes)
-        	    	{
-        	       		end=1;
-        		}
-        	}
-        	if( millis()-previous < 0 ) previous=millis(); //avoid millis overflow problem
-        	if( (millis()-previous) > interval )
-        	{
-            		end=1;
-            		XBee.flush();
-        	}
-	}
-	else if( uart==UART1 )
-	{
-		if(XBee2.available()>0)
-		{
-			ByteIN[counter3]=XBee2.read();
-			counter3++;
-			previous=millis();
-			if(ByteIN[counter3-1]==0x7E){
-				if( (MAX_PARSE-counter3) < maxFrame ) frameNext=1;
-				else num_mes++;
-			}
-			if( (counter3==1) && (ByteIN[counter3-1]!=0x7E) ) counter3=0;	
-			if( counter3>=MAX_PARSE ) end=1;
-			if( (counter3==4+status*6+undesired) && (undesired!=1) ) //FIXME
-			{
-				if( (ByteIN[counter3-1]!= 0x89) && (ByteIN[counter3-1]!=0x8A) ){
-					undesired=1;
-					numberBytes+=3;
-				}
-			}
-			if( undesired==1 ) numberBytes++;
-			if( (ByteIN[counter3-1]==0x7D) && (!undesired) )
-			{
-				numberBytes++;
-			}
-			if( (ByteIN[counter3-1]==0x8A) && (counter3==(4+status*6)) )
-			{
-				numberBytes+=6;
-				status++;
-			}
-			if( (ByteIN[counter3-1]==0x7E) && (undesired==1) )
-			{
-				numberBytes--;
-				undesired=numberBytes-7;
-			}
-			if(counter3==numberBytes)
-			{
-				end=1;
-			}
-		}
-		if( millis()-previous < 0 ) previous=millis();//avoid millis overflow problem
-		if( (millis()-previous) > interval )
-		{
-			end=1;
-			XBee2.flush();
-		}
-	} 
-    }
-    num_TX=counter3;
-    counter3=0;
-	
-    // If some corrupted frame has appeared we jump it
-    if( ByteIN[0]!=0x7E ) num_mes++;
+    int8_t error=2;
+    uint16_t end=rxLength+4;
 	
-    // Parse the received messages from the XBee
-    while( num_mes>0 )
+    switch( rxFrame[3] )
     {
-        while( ByteIN[i]!=0x7E && i<num_TX ) i++;
-        length_mes=i-length_prev;
-		
-	// If some char has been eschaped, it must be converted before parsing it
-        for( it=0;it<length_mes;it++)
-        {
-            if( ByteIN[it+length_prev]==0x7D ) num_esc++;
-        }
-        if( num_esc ) des_esc(ByteIN,length_mes,i-length_mes);
-		
-        switch( ByteIN[(i-length_mes)+3] )
-        {
-            case 0x8A :	modemStatusResponse(ByteIN,length_mes-num_esc+length_prev,i-length_mes);
-            break;
-            case 0x80 :	error_RX=rxData(ByteIN,length_mes-num_esc+length_prev,i-length_mes);
-            break;
-            case 0x81 :	error_RX=rxData(ByteIN,length_mes-num_esc+length_prev,i-length_mes);
-            break;
-            case 0x89 :	delivery_status=ByteIN[i-length_mes+5];
-            if( delivery_status==0 ) error_TX=0;
-            else error_TX=1;
-            break;
-            default   :	break;
-        }
-		
-        num_mes--;
-        length_prev=i;
-        i++;
-        num_esc=0;
+        case 0x88 :	error=atCommandResponse(rxFrame,frame,end,0);
+        error_AT=error;
+        break;
+        case 0x8A :	error=modemStatusResponse(rxFrame,end,0);
+        break;
+        case 0x80 :
+        case 0x81 :
+        case 0x90 :
+        case 0x91 :	error=rxData(rxFrame,end,0);
+        error_RX=error;
+        break;
+        case 0x89 :	delivery_status=rxFrame[5];
+        if( delivery_status==0 ) error_TX=0;
+        else error_TX=1;
+        error=error_TX;
+        break;
+        case 0x8B :	true_naD[0]=rxFrame[5];
+        true_naD[1]=rxFrame[6];
+        retries_sending=rxFrame[7];
+        delivery_status=rxFrame[8];
+        discovery_status=rxFrame[9];
+        if( delivery_status==0 ) error_TX=0;
+        else error_TX=1;
+        error=error_TX;
+        break;
+        default   :	break;
     }
-	
-    return error_TX;
+    return error;
 }
 
+
 /*
- Function: Parses the ZB TX Status message received by the XBee module
+ Function: Parses the AT command answer received by the XBee module
  Parameters:
  	data_in : the answer received by the module
+ 	frame : an array that contains the API frame that is expected to receive answer from if it is an AT command
  	end : the end of the frame
  	start : the start of the frame
  Returns: Integer that determines if there has been any error 
@@ -5660,181 +4213,52 @@ uint8_t WaspXBeeCore::txStatusResponse(uint8_t* ByteIN)
    error=1 --> There has been an error while executing the command
    error=0 --> The command has been executed with no errors
 */
-uint8_t WaspXBeeCore::txZBStatusResponse(uint8_t* ByteIN)
+uint8_t WaspXBeeCore::atCommandResponse(uint8_t* data_in, uint8_t* frame, uint16_t end, uint16_t start)
 {	
-    long previous=millis();
-    uint16_t numberBytes=11;
-    uint8_t end=0;
-    uint16_t counter3=0;
-    uint8_t undesired=0;
-    uint8_t status=0;
-    uint16_t num_TX=0;
-    uint8_t num_esc=0;
-    int16_t interval=2000;
-    uint8_t num_mes=0;
-    uint16_t i=1;
-    uint16_t length_mes=0;
-    uint16_t length_prev=0;
-    uint8_t maxFrame=110;
-	
-    error_TX=2;
+	// Check the AT Command Response is from the command expected
+    if( data_in[start+5]!=frame[5] || data_in[start+6]!=frame[6] ) return 1;
 		
-    if( frameNext )
-    {
-        ByteIN[0]=0x7E;
-        counter3=1;
-        num_mes=1;
-        frameNext=0;
+	// Check if there is data in the AT Command Response frame
+    if( (end-start)==9 ){
+        if( data_in[start+7]==0 ) return 0;
+        else return 1;
     }
-	
-    while( end==0 && !frameNext )
-    {		
-	if( uart==UART0 )
-	{
-		if(XBee.available()>0)
-       		{
-       			ByteIN[counter3]=XBee.read();
-            		counter3++;
-            		previous=millis();
-            		if(ByteIN[counter3-1]==0x7E)
-			{
-                		if( (MAX_PARSE-counter3) < maxFrame ) frameNext=1;
-                		else num_mes++;
-            		}
-            		if( (counter3==1) && (ByteIN[counter3-1]!=0x7E) ) counter3=0;	
-           		if( counter3>=MAX_PARSE ) end=1;
-           		if( (counter3==4+status*6+undesired) && (undesired!=1) ) //FIXME
-            		{
-                		if( (ByteIN[counter3-1]!= 0x8B) && (ByteIN[counter3-1]!=0x8A) )
-				{
-                    			undesired=1;
-                    			numberBytes+=3;
-                		}
-            		}
-            		if( undesired==1 ) numberBytes++;
-            		if( (ByteIN[counter3-1]==0x7D) && (!undesired) )
-            		{
-                		numberBytes++;
-            		}
-            		if( (ByteIN[counter3-1]==0x8A) && (counter3==(4+status*6)) )
-            		{
-                		numberBytes+=6;
-                		status++;
-            		}
-            		if( (ByteIN[counter3-1]==0x7E) && (undesired==1) )
-            		{
-                		numberBytes--;
-                		undesired=numberBytes-7;
-            		}
-            		if(counter3==numberBytes)
-            		{
-                		end=1;
-           		}
-       		}
-		if( millis()-previous < 0 ) previous=millis(); //avoid millis overflow problem
-        	if( (millis()-previous) > interval )
-       		{
-            		end=1;
-            		XBee.flush();
-        	} 
-    	}
-	else if( uart==UART1 )
-	{
-		if(XBee2.available()>0)
-		{
-			ByteIN[counter3]=XBee2.read();
-			counter3++;
-			previous=millis();
-			if(ByteIN[counter3-1]==0x7E)
-			{
-				if( (MAX_PARSE-counter3) < maxFrame ) frameNext=1;
-				else num_mes++;
-			}
-			if( (counter3==1) && (ByteIN[counter3-1]!=0x7E) ) counter3=0;	
-			if( counter3>=MAX_PARSE ) end=1;
-			if( (counter3==4+status*6+undesired) && (undesired!=1) ) //FIXME
-			{
-				if( (ByteIN[counter3-1]!= 0x8B) && (ByteIN[counter3-1]!=0x8A) )
-				{
-					undesired=1;
-					numberBytes+=3;
-				}
-			}
-			if( undesired==1 ) numberBytes++;
-			if( (ByteIN[counter3-1]==0x7D) && (!undesired) )
-			{
-				numberBytes++;
-			}
-			if( (ByteIN[counter3-1]==0x8A) && (counter3==(4+status*6)) )
-			{
-				numberBytes+=6;
-				status++;
-			}
-			if( (ByteIN[counter3-1]==0x7E) && (undesired==1) )
-			{
-				numberBytes--;
-				undesired=numberBytes-7;
-			}
-			if(counter3==numberBytes)
-			{
-				end=1;
-			}
-		}
-		if( millis()-previous < 0 ) previous=millis(); //avoid millis overflow problem
-		if( (millis()-previous) > interval )
-		{
-			end=1;
-			XBee2.flush();
-		} 
-	}
+		
+    if( data_in[start+7]!=0 ) return 1;
+	// Store the data in the response frame
+    for(it=0;it<(end-start-9);it++)
+    {
+        data[it]=data_in[8+it+start];
     }
-    num_TX=counter3;
-    counter3=0;
 	
-    // If some corrupted frame has appeared we jump it
-    if( ByteIN[0]!=0x7E ) num_mes++;
-	
-    // Parse the received messages from the XBee
-    while( num_mes>0 )
-    {
-        while( ByteIN[i]!=0x7E && i<num_TX ) i++;
-        length_mes=i-length_prev;
-		
-	// If some char has been eschaped, it must be converted before parsing it
-        for( it=0;it<length_mes;it++)
-        {
-            if( ByteIN[it+length_prev]==0x7D ) num_esc++;
-        }
-        if( num_esc ) des_esc(ByteIN,length_mes,i-length_mes);
-		
-        switch( ByteIN[(i-length_mes)+3] )
-        {
-            case 0x8A :	modemStatusResponse(ByteIN,length_mes-num_esc+length_prev,i-length_mes);
-            break;
-            case 0x90 :	error_RX=rxData(ByteIN,length_mes-num_esc+length_prev,i-length_mes);
-            break;
-            case 0x91 :	error_RX=rxData(ByteIN,length_mes-num_esc+length_prev,i-length_mes);
-            break;
-            case 0x8B :	true_naD[0]=ByteIN[i-length_mes+5];
-            true_naD[1]=ByteIN[i-length_mes+6];
-            retries_sending=ByteIN[i-length_mes+7];
-            discovery_status=ByteIN[i-length_mes+9];
-            delivery_status=ByteIN[i-length_mes+8];
-            if( delivery_status==0 ) error_TX=0;
-            else error_TX=1;
-            break;
-            default   :	break;
-        }
-		
-        num_mes--;
-        length_prev=i;
-        i++;
-        num_esc=0;
+	// Check if a ND is performed
+    data_length=end-start-9;
+    if( frame[5]==0x4E && frame[6]==0x44 ){
+        if( data_length>1 ) totalScannedBrothers++;
+        treatScan();
     }
+    return 0;
+}
+
 
-    return error_TX;
+/*
+ Function: Parses the Modem Status message received by the XBee module
+ Parameters:
+ 	data_in : the answer received by the module
+ 	end : the end of the frame
+ 	start : the start of the frame
+ Returns: Integer that determines if there has been any error 
+   error=2 --> The command has not been executed
+   error=1 --> There has been an error while executing the command
+   error=0 --> The command has been executed with no errors
+*/
+uint8_t WaspXBeeCore::modemStatusResponse(uint8_t* data_in, uint16_t end, uint16_t start)
+{		
+    modem_status=data_in[start+4];
+    return 0;
 }
 
+
 /*
  Function: Parses the RX Data message received by the XBee module
  Parameters:
@@ -5848,24 +4272,10 @@ uint8_t WaspXBeeCore::txZBStatusResponse(uint8_t* ByteIN)
 */
 int8_t WaspXBeeCore::rxData(uint8_t* data_in, uint16_t end, uint16_t start)
 {
-    uint8_t* byteIN = (uint8_t*) calloc(120,sizeof(uint8_t));
-    if(byteIN==NULL) return -1;
     int8_t error=2;
-		
-	// Check the checksum
-    if(checkChecksum(data_in,end,start)){
-        free(byteIN);
-        byteIN=NULL;
-        return 1;
-    }	
 	
-	// Copy the data
-    data_length=0;
-    for(it=4+start;it<end-1;it++)
-    {
-        byteIN[it-4-start]=data_in[it];
-        data_length++;
-    }
+	// The frame data is read in place, without the API header and checksum
+    data_length=end-start-5;
 		
     switch( data_in[start+3] )
     {
@@ -5879,9 +4289,7 @@ int8_t WaspXBeeCore::rxData(uint8_t* data_in, uint16_t end, uint16_t start)
         break;
     }
 
-    error=readXBee(byteIN);
-    free(byteIN);
-    byteIN=NULL;
+    error=readXBee(&data_in[start+4]);
 	
     return error;
 }
@@ -5955,31 +4363,6 @@ void WaspXBeeCore::treatScan()
     }
 }
 
-/*
- Function: Checks the checksum is good
- Parameters:
- 	data_in : the answer received by the module
- 	end : the end of the frame
- 	start : the start of the frame
- Returns: Integer that determines if there has been any error 
-   error=2 --> The command has not been executed
-   error=1 --> There has been an error while executing the command
-   error=0 --> The command has been executed with no errors
-*/
-uint8_t WaspXBeeCore::checkChecksum(uint8_t* data_in, uint16_t end, uint16_t start)
-{	
-    uint16_t checksum=0;	
-		
-    for(it=3+start;it<end;it++)
-    {
-        checksum=checksum+data_in[it];
-    }
-    if( (checksum==255) ) return 0;
-    checksum%=256;
-    if( checksum!=255 ) return 1;
-    return 0;
-}
-
 /*
  Function: Clears the variable 'command'
 */
@@ -5993,61 +4376,247 @@ void WaspXBeeCore::clearCommand()
 
 
 /*
- Function: It frees a position in index array
+ Function: It gets a free reassembly slot, dropping the packets which timed out and the
+ 	oldest one if all the slots are in use
+ Returns: the index of the slot in 'rxSlots'
 */
-void WaspXBeeCore::freeIndex()
+uint8_t WaspXBeeCore::getFreeSlot()
 {
-    uint16_t counter1=0;
+    uint8_t slot=MAX_RX_SLOTS;
+    uint8_t oldest=MAX_RX_SLOTS;
+    uint8_t used=0;
+    uint8_t i=0;
+    long time=millis();
 	
-    nextIndex1=0;
-    while( counter1<MAX_FINISH_PACKETS )
+    for(i=0;i<MAX_RX_SLOTS;i++)
     {
-        for(it=counter1;it<(MAX_FINISH_PACKETS-1);it++)
+        if( rxSlots[i].recFragments && ((time-rxSlots[i].time)>TIMEOUT) ) freeSlot(i);
+        if( !rxSlots[i].recFragments )
         {
-            if( pendingFragments[counter1]->time < pendingFragments[it+1]->time ) nextIndex1++;
-            else break;
+            if( slot==MAX_RX_SLOTS ) slot=i;
         }
-        if( nextIndex1==(MAX_FINISH_PACKETS-1) ){
-            nextIndex1=counter1;
-            counter1=MAX_FINISH_PACKETS;
+        else
+        {
+            used++;
+            if( (oldest==MAX_RX_SLOTS) || (rxSlots[i].time < rxSlots[oldest].time) ) oldest=i;
         }
-        else nextIndex1=counter1+1;
-        counter1++;
     }
-    for(it=0;it<MAX_FRAG_PACKETS;it++)
+	
+    // All the slots are in use, so the oldest packet is dropped
+    if( slot==MAX_RX_SLOTS )
     {
-        free(packet_fragments[nextIndex1][it]);
-        packet_fragments[nextIndex1][it]=NULL;
+        freeSlot(oldest);
+        rxSlotFailures++;
+        slot=oldest;
     }
-    pendingFragments[nextIndex1]->time=0;
-    free(pendingFragments[nextIndex1]);
-    pendingFragments[nextIndex1]=NULL;
-    pendingPackets--;
-    indexNotModified=0;
+    else used++;
+	
+    if( used>rxSlotsHighWater ) rxSlotsHighWater=used;
+    return slot;
 }
 
 /*
- Function: It frees index array and matrix
+ Function: It calculates the position in 'rxSlotHash' where a packet should be stored
+ Parameters:
+ 	packetID : Application Level ID of the packet
+ 	source : source addresses of the packet (64b MAC and 16b Network Address)
+ Returns: the position in 'rxSlotHash'
 */
-void WaspXBeeCore::freeAll()
-{	
-    uint8_t temp=0;
+uint8_t WaspXBeeCore::hashSlot(uint8_t packetID, uint8_t* source)
+{
+    uint8_t hash=packetID;
+    uint8_t i=0;
+	
+    for(i=0;i<10;i++)
+    {
+        hash=(hash*31)+source[i];
+    }
+    return hash&(RX_HASH_SIZE-1);
+}
+
+/*
+ Function: It looks for the reassembly slot of a packet already being received
+ Parameters:
+ 	packetID : Application Level ID of the packet
+ 	source : source addresses of the packet (64b MAC and 16b Network Address)
+ Returns: the index of the slot in 'rxSlots', MAX_RX_SLOTS if not found
+*/
+uint8_t WaspXBeeCore::findSlot(uint8_t packetID, uint8_t* source)
+{
+    uint8_t bucket=hashSlot(packetID,source);
+    uint8_t slot=0;
 	
-    for(temp=0;temp<MAX_FINISH_PACKETS;temp++)
+    while( rxSlotHash[bucket] )
     {
-        for(it=0;it<MAX_FRAG_PACKETS;it++)
+        slot=rxSlotHash[bucket]-1;
+        if( (rxSlots[slot].packetID==packetID) && !memcmp(rxSlots[slot].source,source,10) ) return slot;
+        bucket=(bucket+1)&(RX_HASH_SIZE-1);
+    }
+    return MAX_RX_SLOTS;
+}
+
+/*
+ Function: It stores a reassembly slot in 'rxSlotHash', using its packetID and source addresses
+ Parameters:
+ 	slot : the index of the slot in 'rxSlots'
+*/
+void WaspXBeeCore::addSlotHash(uint8_t slot)
+{
+    uint8_t bucket=hashSlot(rxSlots[slot].packetID,rxSlots[slot].source);
+	
+    while( rxSlotHash[bucket] ) bucket=(bucket+1)&(RX_HASH_SIZE-1);
+    rxSlotHash[bucket]=slot+1;
+}
+
+/*
+ Function: It removes a reassembly slot from 'rxSlotHash'
+ Parameters:
+ 	slot : the index of the slot in 'rxSlots'
+*/
+void WaspXBeeCore::removeSlotHash(uint8_t slot)
+{
+    uint8_t i=hashSlot(rxSlots[slot].packetID,rxSlots[slot].source);
+    uint8_t j=0;
+    uint8_t home=0;
+	
+    while( rxSlotHash[i] && (rxSlotHash[i]!=(slot+1)) ) i=(i+1)&(RX_HASH_SIZE-1);
+    if( !rxSlotHash[i] ) return;
+    rxSlotHash[i]=0;
+	
+    // The following entries are moved back so no search stops at the hole
+    j=i;
+    while( 1 )
+    {
+        j=(j+1)&(RX_HASH_SIZE-1);
+        if( !rxSlotHash[j] ) break;
+        home=hashSlot(rxSlots[rxSlotHash[j]-1].packetID,rxSlots[rxSlotHash[j]-1].source);
+        if( (i<=j) ? ((i<home) && (home<=j)) : ((i<home) || (home<=j)) ) continue;
+        rxSlotHash[i]=rxSlotHash[j];
+        rxSlotHash[j]=0;
+        i=j;
+    }
+}
+
+/*
+ Function: It copies a complete packet from a reassembly slot to the 'packet_finished' array
+ Parameters:
+ 	slot : the index of the slot in 'rxSlots'
+ Returns: Integer that determines if there has been any error 
+   error=0 --> The packet has been stored in 'packet_finished'
+   error=-1 --> No more memory available
+*/
+int8_t WaspXBeeCore::finishSlot(uint8_t slot)
+{
+    rxSlot* s=&rxSlots[slot];
+    packetXBee* paq=NULL;
+    uint8_t finishIndex=0;
+    uint8_t offset=0;
+    int8_t i=0;
+	
+    pos++;
+    finishIndex=getFinishIndex();
+    if( pos>=MAX_FINISH_PACKETS ){
+        switch( replacementPolicy )
         {
-							
-            free(packet_fragments[temp][it]);
-            packet_fragments[temp][it]=NULL;
+            case	XBEE_FIFO:	finishIndex=getIndexFIFO();
+            break;
+            case	XBEE_LIFO:	finishIndex=getIndexLIFO();
+            break;
+            case	XBEE_OUT:	pos--;
+            freeSlot(slot);
+            return -1;
         }
-        pendingFragments[temp]->time=0;
-        free(pendingFragments[temp]);
-        pendingFragments[temp]=NULL;
     }
-    pendingPackets=0;
-    nextIndex1=0;
-    indexNotModified=0;
+    paq=(packetXBee*) calloc(1,sizeof(packetXBee));
+    if( paq==NULL ){
+        pos--;
+        freeSlot(slot);
+        rxSlotFailures++;
+        return -1;
+    }
+    packet_finished[finishIndex]=paq;
+	
+    paq->time=s->time;
+    paq->packetID=s->packetID;
+    paq->address_typeS=s->address_typeS;
+    paq->mode=s->mode;
+    if( (protocol!=XBEE_802_15_4) || (s->address_typeS==_64B) )
+    {
+        memcpy(paq->macSH,s->source,4);
+        memcpy(paq->macSL,&s->source[4],4);
+    }
+    if( (protocol!=XBEE_802_15_4) || (s->address_typeS==_16B) )
+    {
+        paq->naS[0]=s->source[8];
+        paq->naS[1]=s->source[9];
+    }
+    paq->RSSI=(s->RSSI)/(s->totalFragments);
+    paq->typeSourceID=s->typeSourceID;
+    switch( s->typeSourceID )
+    {
+        case MY_TYPE:	memcpy(paq->naO,s->origin,2);
+        break;
+        case MAC_TYPE:	memcpy(paq->macOH,s->origin,4);
+        memcpy(paq->macOL,&s->origin[4],4);
+        break;
+        case NI_TYPE:	memcpy(paq->niO,s->origin,s->origin_length);
+        paq->niO[s->origin_length]='#';
+        break;
+    }
+	
+    // Fragments are numbered backwards, the first one carries the highest number
+    for(i=s->totalFragments-1;i>=0;i--)
+    {
+        memcpy(&paq->data[offset],&s->data[s->fragOffset[i]],s->fragLength[i]);
+        offset+=s->fragLength[i];
+    }
+    paq->data_length=offset;
+	
+    if( s->mode==CLUSTER )
+    {
+        paq->SD=s->cluster[0];
+        paq->DE=s->cluster[1];
+        paq->CID[0]=s->cluster[2];
+        paq->CID[1]=s->cluster[3];
+        paq->PID[0]=s->cluster[4];
+        paq->PID[1]=s->cluster[5];
+    }
+	
+    freeSlot(slot);
+    return 0;
+}
+
+/*
+ Function: It frees a reassembly slot
+ Parameters:
+ 	slot : the index of the slot in 'rxSlots'
+*/
+void WaspXBeeCore::freeSlot(uint8_t slot)
+{
+    removeSlotHash(slot);
+    rxSlots[slot].time=0;
+    rxSlots[slot].RSSI=0;
+    rxSlots[slot].totalFragments=0;
+    rxSlots[slot].recFragments=0;
+    rxSlots[slot].fragMask=0;
+    rxSlots[slot].data_length=0;
+}
+
+/*
+ Function: It frees all the reassembly slots
+*/
+void WaspXBeeCore::clearSlotArray()
+{
+    uint8_t slot=0;
+	
+    for(slot=0;slot<RX_HASH_SIZE;slot++)
+    {
+        rxSlotHash[slot]=0;
+    }
+    for(slot=0;slot<MAX_RX_SLOTS;slot++)
+    {
+        freeSlot(slot);
+    }
 }
 
 /*
@@ -6128,22 +4697,6 @@ uint8_t WaspXBeeCore::getIndexLIFO()
     return position;
 }
 
-/*
- Function: It frees the index array and the matrix row corresponding to the position is sent as an input parameter
-*/
-void WaspXBeeCore::freeIndexMatrix(uint8_t position)
-{		
-    for(it=0;it<MAX_FRAG_PACKETS;it++)
-    {
-        free(packet_fragments[position][it]);
-        packet_fragments[position][it]=NULL;
-    }
-    pendingFragments[position]->time=0;
-    free(pendingFragments[position]);
-    pendingFragments[position]=NULL;
-    pendingPackets--;
-}
-
 /*
  Function: It receives the first packet of a new firmware
  Returns: Integer that determines if there has been any error 
@@ -6175,6 +4728,16 @@ uint8_t WaspXBeeCore::new_firmware_received()
 		if( asteriscos == NULL ){
 			return 1;
 		}
+		
+		// Window where chunks received out of order wait for the missing ones
+		free(firm_info.window);
+		firm_info.window = (uint8_t*) calloc(OTA_WINDOW*OTA_CHUNK_SIZE,sizeof(uint8_t));
+		if( firm_info.window == NULL ){
+			free(asteriscos);
+			asteriscos=NULL;
+			return 1;
+		}
+		for(it=0;it<OTA_WINDOW;it++) firm_info.window_length[it]=0;
 
 		// Set OTA Flag and set last time a OTA packet was received
 		programming_ON=1;		
@@ -6248,8 +4811,8 @@ uint8_t WaspXBeeCore::new_firmware_received()
 		
 		firm_info.packets_received=0;
 		firm_info.data_count_packet = 0;
-		firm_info.data_count_packet_ant = 0;
-		firm_info.paq_disordered = 0;
+		firm_info.nack_sent = 0;
+		firm_info.crc = 0xFFFFFFFFUL;
 		firm_info.already_init = 1;
 #ifdef ENOUGH_MEMORY		
 		file2.close();
@@ -6292,10 +4855,15 @@ uint8_t WaspXBeeCore::new_firmware_received()
 #ifdef ENOUGH_MEMORY			
 		if( !error_sd )
 		{
-			if( !file1.open(&root, firm_info.name_file, O_WRITE | O_CREAT | O_EXCL | O_SYNC | O_APPEND) )
+			// Pre-allocate the whole image so chunks are written as sequential blocks
+			if( !file1.createContiguous(&root, firm_info.name_file, OTA_FILE_SIZE) )
 			{
 				file1.remove(&root,firm_info.name_file);
-				if(!file1.open(&root, firm_info.name_file, O_WRITE | O_CREAT | O_EXCL | O_SYNC | O_APPEND)) error_sd=true;
+				if( !file1.createContiguous(&root, firm_info.name_file, OTA_FILE_SIZE) )
+				{
+					// No contiguous space left: grow the file as chunks arrive
+					if(!file1.open(&root, firm_info.name_file, O_WRITE | O_CREAT | O_EXCL | O_SYNC | O_APPEND)) error_sd=true;
+				}
 			}
 			
 			if( !error_sd )
@@ -6349,13 +4917,15 @@ uint8_t WaspXBeeCore::new_firmware_received()
 /*
  Function: It receives the data packets of a new firmware
  Returns: Nothing
+ Values: Chunks ahead of the next one expected are kept in the window until the
+   gap is filled. Chunks beyond the window trigger a NACK with the missing ones
 */
 void WaspXBeeCore::new_firmware_packets()
 {
-	uint8_t data_bin[92];
-	uint16_t sd_index=0;
+	uint8_t offset=0;
+	uint8_t slot=0;
+	uint8_t length=0;
 	bool true_mac = true;
-	bool error_sd = false;
 	
 	it=0;
 	
@@ -6380,69 +4950,43 @@ void WaspXBeeCore::new_firmware_packets()
 		if( true_mac )
 		{
 			firm_info.data_count_packet = packet_finished[pos-1]->data[1];
+			length = packet_finished[pos-1]->data_length-2;
+			if( length>OTA_CHUNK_SIZE ) length=OTA_CHUNK_SIZE;
 			
-			if(	(firm_info.data_count_packet == 0 && firm_info.packets_received==0) ||
-               	(firm_info.data_count_packet - firm_info.data_count_packet_ant) == 1 ||
-               	(firm_info.data_count_packet == 0)&&(firm_info.data_count_packet_ant == 255) )
-            {
-
-				// Copy binary data and calculate length of this field
-				for(sd_index=0;sd_index<(packet_finished[pos-1]->data_length-2);sd_index++){
-                   			data_bin[sd_index]=packet_finished[pos-1]->data[sd_index+2];
-               			}
-								
-				// Write binary data string into firmware file
-#ifdef ENOUGH_MEMORY					
-				if(file1.write(data_bin,sd_index)!=sd_index)				
-				{
-					error_sd=true;
-				}
-#endif								
-				firm_info.already_init = 0;
+			// Distance to the next chunk expected, sequence numbers wrap at 255
+			offset = firm_info.data_count_packet - (uint8_t)firm_info.packets_received;
+			
+			firm_info.already_init = 0;
 
-				// Set new OTA previous packet arrival time 
-				firm_info.time_arrived=millis();
-				
-				if(error_sd)
+			// Set new OTA previous packet arrival time 
+			firm_info.time_arrived=millis();
+			
+			if( offset==0 )
+			{
+				// Write it and the chunks already waiting behind it
+				if( new_firmware_write(&packet_finished[pos-1]->data[2],length) )
 				{
-#ifdef ENOUGH_MEMORY					
 					programming_ON=0;
+#ifdef ENOUGH_MEMORY					
 					file1.remove(&root,firm_info.name_file);
+#endif
 					firm_info.packets_received=0;
-					firm_info.paq_disordered=0;
 					setMulticastConf();
-#endif
-				}
-				else
-				{
-					firm_info.packets_received++;
-					firm_info.data_count_packet_ant = firm_info.data_count_packet;
-					firm_info.paq_disordered=0;
-					sd_index=0;
 				}
 			}
-			else if( !(firm_info.data_count_packet == firm_info.data_count_packet_ant) )
+			else if( offset<OTA_WINDOW )
 			{
-				if( (firm_info.data_count_packet - firm_info.data_count_packet_ant) == 2 )
-				{
-					// re-order one packet lost
-					firm_info.paq_disordered=1;
-				}
-				else
-				{
-					programming_ON=0;
-#ifdef ENOUGH_MEMORY						
-					file1.remove(&root,firm_info.name_file);
-#endif
-					firm_info.packets_received=0;
-					firm_info.paq_disordered=0;
-					setMulticastConf();					
-
-					if( uart==UART0 ) XBee.flush();
-					else if( uart==UART1 ) XBee2.flush();
-					
-				}
+				// Keep it until the previous ones arrive
+				slot = (firm_info.packets_received+offset)%OTA_WINDOW;
+				memcpy(&firm_info.window[slot*OTA_CHUNK_SIZE],&packet_finished[pos-1]->data[2],length);
+				firm_info.window_length[slot]=length;
+			}
+			else if( offset<128 )
+			{
+				// Beyond the window: ask for the missing chunks
+				new_firmware_nack();
 			}
+			// Otherwise it is a retry of a chunk already written
 		}
 		else
 		{
@@ -6461,6 +5005,95 @@ void WaspXBeeCore::new_firmware_packets()
 }
 
 
+/*
+ Function: It writes a firmware chunk into the firmware file, followed by the
+   chunks stored in the window that become consecutive
+ Returns: Integer that determines if there has been any error 
+   error=1 --> There has been an error while writing the file
+   error=0 --> The function has been executed with no errors
+ Parameters:
+   data: chunk to write
+   length: length of the chunk
+*/
+uint8_t WaspXBeeCore::new_firmware_write(uint8_t* data, uint8_t length)
+{
+	uint8_t slot=0;
+	
+	while( length )
+	{
+#ifdef ENOUGH_MEMORY
+		if(file1.write(data,length)!=length) return 1;
+#endif
+		firm_info.crc = ota_crc32(firm_info.crc,data,length);
+		firm_info.packets_received++;
+		firm_info.nack_sent=0;
+		
+		// Next chunk, if it was received ahead of time
+		slot = firm_info.packets_received%OTA_WINDOW;
+		data = &firm_info.window[slot*OTA_CHUNK_SIZE];
+		length = firm_info.window_length[slot];
+		firm_info.window_length[slot]=0;
+	}
+	return 0;
+}
+
+
+/*
+ Function: It sends to the programmer the chunks missing in the window
+ Returns: Nothing
+ Values: The answer is NEW_FIRMWARE_MESSAGE_NACK followed by the number of the
+   next chunk expected, '#' and a bitmap in hex where bit 'i' is set if chunk
+   'next+i' is missing. It is sent once until the window moves forward
+*/
+void WaspXBeeCore::new_firmware_nack()
+{
+	char nack[49];
+	uint8_t bitmap[OTA_WINDOW/8];
+	packetXBee* paq_sent;
+	uint8_t length=0;
+	
+	if( firm_info.nack_sent ) return;
+	firm_info.nack_sent=1;
+	
+	for(it=0;it<OTA_WINDOW/8;it++) bitmap[it]=0;
+	for(it=0;it<OTA_WINDOW;it++)
+	{
+		if( !firm_info.window_length[(firm_info.packets_received+it)%OTA_WINDOW] )
+		{
+			bitmap[it/8] |= (1<<(it%8));
+		}
+	}
+	
+	strcpy(nack,NEW_FIRMWARE_MESSAGE_NACK);
+	length=strlen(nack);
+	Utils.long2array(firm_info.packets_received,&nack[length]);
+	length=strlen(nack);
+	nack[length++]='#';
+	Utils.hex2str(bitmap,&nack[length],OTA_WINDOW/8);
+	length=strlen(nack);
+	while( length<32 ) nack[length++]='$';
+	nack[length]='\0';
+	
+	paq_sent=(packetXBee*) calloc(1,sizeof(packetXBee)); 
+	if( paq_sent==NULL ) return;
+	paq_sent->mode=UNICAST; 
+	paq_sent->MY_known=0; 
+	paq_sent->packetID=0xFB; 
+	paq_sent->opt=0; 
+	hops=0; 
+	setOriginParams(paq_sent, "5678", MY_TYPE); 
+	setDestinationParams(paq_sent, firm_info.mac_programming, nack, MAC_TYPE, DATA_ABSOLUTE);
+	// Try to send the answer for several times
+	for(int k=0; k<MAX_OTA_RETRIES; k++)
+	{		
+	   if(!sendXBee(paq_sent)) k=MAX_OTA_RETRIES;
+	   else delay(rand()%delay_end + delay_start);
+	}  
+	free(paq_sent); 
+	paq_sent=NULL;
+}
+
+
 /*
  Function: It receives the last packet of a new firmware
 */
@@ -6472,6 +5105,10 @@ void WaspXBeeCore::new_firmware_end()
 	bool true_mac = true;
 	char num_packets_char[5];
 	uint16_t num_packets=0;
+	uint32_t crc_received=0;
+	bool crc_present = false;
+	char record[47];
+	uint32_t offset=0;
 	packetXBee* paq_sent;
 	uint8_t destination[8];
 	bool send_ok = true;
@@ -6503,13 +5140,36 @@ void WaspXBeeCore::new_firmware_end()
 		
 		if( true_mac )
 		{
-			for(it=0;it<(packet_finished[pos-1]->data_length-3);it++){
+			for(it=0;it<(packet_finished[pos-1]->data_length-3) && it<4;it++){
+				if( packet_finished[pos-1]->data[it+3]=='#' ) break;
 				num_packets_char[it]=packet_finished[pos-1]->data[it+3];
 			}
 			num_packets_char[it]='\0';
 			num_packets = Utils.array2long(num_packets_char);
 			
-			if( num_packets!=firm_info.packets_received ){
+			// Optional "#<CRC32 in hex>" of the whole image after the number of packets
+			if( (packet_finished[pos-1]->data_length-3-it)==9 && packet_finished[pos-1]->data[it+3]=='#' )
+			{
+				crc_present = true;
+				for(uint8_t i=0;i<4;i++)
+				{
+					crc_received = (crc_received << 8) | Utils.str2hex((char*) &packet_finished[pos-1]->data[it+4+2*i]);
+				}
+			}
+			
+			if( num_packets>firm_info.packets_received )
+			{
+				// Some chunks are still missing: ask for them and wait
+				firm_info.time_arrived=millis();
+				firm_info.nack_sent=0;
+				new_firmware_nack();
+				return;
+			}
+			else if( num_packets!=firm_info.packets_received ){
+				send_ok = false;
+			}
+			else if( crc_present && crc_received!=~firm_info.crc ){
+				// The CRC was computed while writing: no need to read the image back
 				send_ok = false;
 			}
 			else send_ok = true;
@@ -6517,6 +5177,8 @@ void WaspXBeeCore::new_firmware_end()
 			if( send_ok )
 			{
 #ifdef ENOUGH_MEMORY				
+				// Give back the pre-allocated space not used by the image
+				if(!file1.truncate(file1.curPosition())) send_ok = false;
 				file1.close();
 				delay(10);
 				
@@ -6538,28 +5200,32 @@ void WaspXBeeCore::new_firmware_end()
 	{
 		programming_ON=0;
 		firm_info.packets_received=0;
+		// Build the whole boot list record: ID + DATE + "\r\n"
+		strcpy(record,firm_info.ID);
+		strcat(record,firm_info.DATE);
+		strcat(record,"\r\n");
 #ifdef ENOUGH_MEMORY	
-		if(!file2.open(&root, BOOT_LIST, O_WRITE | O_CREAT | O_EXCL | O_SYNC | O_APPEND) )
+		// Without O_SYNC the new file size only reaches the directory entry
+		// in sync(), which writes the data and FAT blocks to the card before
+		// it dirties the entry. A reset before the directory sector is
+		// written leaves the old size, so the record is listed whole or not
+		// at all
+		if(!file2.open(&root, BOOT_LIST, O_WRITE | O_CREAT | O_EXCL | O_APPEND) )
 		{
-			if(!file2.open(&root, BOOT_LIST, O_WRITE | O_SYNC | O_APPEND)) error_sd=true;
+			if(!file2.open(&root, BOOT_LIST, O_WRITE | O_APPEND)) error_sd=true;
 		}
-	
-		// Write program ID into file
-		if(file2.write(firm_info.ID,strlen(firm_info.ID))!=strlen(firm_info.ID))
-		{
-			error_sd=true;
-		}		
 		
-		// Write program date into file
-		if(file2.write(firm_info.DATE,strlen(firm_info.DATE))!=strlen(firm_info.DATE))
-		{
-			error_sd=true;
-		}	
-				
-		// Write "\r\n" into file
-		if(file2.write("\r\n",strlen("\r\n"))!=strlen("\r\n"))
+		if( !error_sd )
 		{
-			error_sd=true;
+			offset = file2.fileSize();
+			if(file2.write(record,strlen(record))!=strlen(record))
+			{
+				// Drop what was written so close() does not commit it
+				file2.truncate(offset);
+				error_sd=true;
+			}
+			else if(!file2.sync()) error_sd=true;
+			file2.close();
 		}
 #endif		
 		if( !error_sd )
@@ -7567,6 +6233,10 @@ void WaspXBeeCore::delete_firmware()
 
 void WaspXBeeCore::setMulticastConf()
 {
+	// The OTA session is over: release the reception window
+	free(firm_info.window);
+	firm_info.window=NULL;
+	
 	switch( firm_info.multi_type )
 	{
 		case 0:		setChannel(firm_info.channel);
@@ -7608,7 +6278,6 @@ uint8_t WaspXBeeCore::checkOtapTimeout()
 		file1.remove(&root,firm_info.name_file);
 #endif		
 		firm_info.packets_received=0;
-		firm_info.paq_disordered=0;
 		setMulticastConf();
 		
 		if( uart==UART0 ) XBee.flush();
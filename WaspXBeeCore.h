@@ -294,40 +294,10 @@ typedef struct packetXBee
 	uint8_t retries;
 };
 
-//! Structure : used for storing the received fragments
+//! Structure : used for reassembling the fragments of a received packet
 /*!    
  */
-typedef struct  matrix
-{
-    private:
-    public:
-	    
-	//! Structure Variable : Fragment data
-	/*!    
-	 */
-        char    data[DATA_MATRIX];
-	
-	//! Structure Variable : Fragment data length
-	/*!    
-	 */
-        uint16_t frag_length;
-	
-	//! Structure Variable : Fragment number for ordering the packet
-	/*!    
-	 */
-        uint8_t numFragment;
-	
-	//! Structure Variable : Specifies if it is the last fragment
-	/*!    
-	 */
-        uint8_t endFragment;
-};
-
-
-//! Structure : used for storing the needed information about the received packets
-/*!    
- */
-typedef struct index
+typedef struct rxSlot
 {
   private:
   public:
@@ -337,45 +307,25 @@ typedef struct index
 	 */
         uint8_t packetID;
 	
-	//! Structure Variable : 32b Lower Mac Source
-	/*!    
-	 */
-        uint8_t macSL[4];
-	
-	//! Structure Variable : 32b Higher Mac Source
-	/*!    
-	 */
-        uint8_t macSH[4];
-	
-	//! Structure Variable : 16b Network Address Source
-	/*!    
-	 */
-        uint8_t naS[2];
-	
-	//! Structure Variable : 32b Higher Mac Origin Source
-	/*!    
-	 */
-        uint8_t macOH[4];
-	
-	//! Structure Variable : 32b Lower Mac Origin Source
+	//! Structure Variable : Source Type ID -> 0=NetAdrress ; 1=MacAddress ; 2=NodeIdentifier
 	/*!    
 	 */
-        uint8_t macOL[4];
+        uint8_t typeSourceID;
 	
-	//! Structure Variable : 16b Network Address origin
+	//! Structure Variable : Origin identification -> naO, macOH+macOL or niO without the ending '#'
 	/*!    
 	 */
-        uint8_t naO[2];
+        uint8_t origin[20];
 	
-	//! Structure Variable : Node Identifier Origin. To use in transmission, it must finish in "#".
+	//! Structure Variable : Origin identification length
 	/*!    
 	 */
-        char niO[20];
+        uint8_t origin_length;
 	
-	//! Structure Variable : Source Type ID -> 0=NetAdrress ; 1=MacAddress ; 2=NodeIdentifier
+	//! Structure Variable : Source addresses -> 32b Higher Mac, 32b Lower Mac and 16b Network Address
 	/*!    
 	 */
-        uint8_t typeSourceID;
+        uint8_t source[10];
 	
 	//! Structure Variable : Source Address Type -> 0=16B ; 1=64B
 	/*!    
@@ -387,60 +337,60 @@ typedef struct index
 	 */
         uint8_t mode;
 	
-	//! Structure Variable : Source Endpoint
+	//! Structure Variable : Sending Options (depends on the XBee module)
 	/*!    
 	 */
-        uint8_t SD;
+        uint8_t opt;
 	
-	//! Structure Variable : Destination Endpoint
+	//! Structure Variable : Source Endpoint, Destination Endpoint, Cluster Identifier and Profile Identifier (ZigBee)
 	/*!    
 	 */
-        uint8_t DE;
+        uint8_t cluster[6];
 	
-	//! Structure Variable : Cluster Identifier
+	//! Structure Variable : Receive Signal Strength Indicator, added up for all the fragments
 	/*!    
 	 */
-        uint8_t CID[2];
+        uint16_t RSSI;
 	
-	//! Structure Variable : Profile Identifier
+	//! Structure Variable : Time in miliseconds at the first fragment was received
 	/*!    
 	 */
-        uint8_t PID[2];
+        long time;
 	
-	//! Structure Variable : Sending Options (depends on the XBee module)
+	//! Structure Variable : Specifies the total number of fragments that are expected -> 0=Unknown
 	/*!    
 	 */
-        uint8_t opt;
+        uint8_t totalFragments;
 	
-	//! Structure Variable : Receive Signal Strength Indicator
+	//! Structure Variable : Specifies the number of fragments received till now -> 0=Empty
 	/*!    
 	 */
-        uint16_t RSSI;
+        uint8_t recFragments;
 	
-	//! Structure Variable : Time in miliseconds at the first fragment was received
+	//! Structure Variable : Bitmap of the fragment numbers received till now
 	/*!    
 	 */
-        long time;
+        uint16_t fragMask;
 	
-	//! Structure Variable : Specifies if the global packet is complete -> 1=Complete ; 0=Uncomplete ; -1=Empty
+	//! Structure Variable : Position in 'data' of each fragment, ordered by fragment number
 	/*!    
 	 */
-        uint8_t complete;
+        uint8_t fragOffset[MAX_FRAG_PACKETS];
 	
-	//! Structure Variable : Specifies the total number of fragments that are expected -> -1=Empty
+	//! Structure Variable : Length of each fragment, ordered by fragment number
 	/*!    
 	 */
-        uint8_t totalFragments;
+        uint8_t fragLength[MAX_FRAG_PACKETS];
 	
-	//! Structure Variable : Specifies the number of fragments received till now. -1=Empty
+	//! Structure Variable : Number of bytes stored in 'data'
 	/*!    
 	 */
-        uint8_t recFragments;
+        uint8_t data_length;
 	
-	//! Structure Variable : Real Data Length
+	//! Structure Variable : Data of the fragments, written in the order they arrive
 	/*!    
 	 */
-        uint16_t data_length;
+        char data[MAX_DATA];
 };
 
 
@@ -486,15 +436,25 @@ typedef struct firmware_struct
 		 */
 		uint8_t data_count_packet;
 		
-		//! Structure Variable : Number of packet received before
+		//! Structure Variable : Chunks received ahead of 'packets_received', OTA_WINDOW slots of OTA_CHUNK_SIZE bytes
+		/*!    
+		 */
+		uint8_t* window;
+		
+		//! Structure Variable : Length of the chunk stored in each window slot (0 if the slot is empty)
+		/*!    
+		 */
+		uint8_t window_length[OTA_WINDOW];
+		
+		//! Structure Variable : Specifies if the missing chunks have already been reported
 		/*!    
 		 */
-		uint8_t data_count_packet_ant;
+		uint8_t nack_sent;
 		
-		//! Structure Variable : Specifies if a packet has been lost
+		//! Structure Variable : CRC32 of the chunks written so far (not inverted)
 		/*!    
 		 */
-		uint8_t paq_disordered;
+		uint32_t crc;
 		
 		//! Structure Variable : Specifies if the function new_firmware_received has been executed previously
 		/*!    
@@ -1103,25 +1063,15 @@ class WaspXBeeCore
 	 */
 	uint8_t sleepMode;
 	
-	//! Variable : bidimensional array for storing the received fragments
+	//! Variable : highest number of reassembly slots used at the same time
 	/*!    
 	 */
-	matrix *packet_fragments[MAX_FINISH_PACKETS][MAX_FRAG_PACKETS];
+	uint8_t rxSlotsHighWater;
 	
-	//! Variable : the number of fragments received
+	//! Variable : number of received packets dropped because no reassembly slot or memory was available
 	/*!    
 	 */
-	uint8_t totalFragmentsReceived;
-	
-	//! Variable : array for storing the information related with each global packet, being able to order the different fragments
-	/*!    
-	 */
-	index *pendingFragments[MAX_FINISH_PACKETS];
-	
-	//! Variable : number of packets pending of being treated
-	/*!    
-	 */
-	uint8_t pendingPackets;
+	uint16_t rxSlotFailures;
 	
 	//! Variable : array for storing the packets received completely
 	/*!    
@@ -1374,14 +1324,27 @@ class WaspXBeeCore
          */
       int8_t parse_message(uint8_t* frame);
 	
-	//! It generates the correct API frame from an eschaped one
+	//! It feeds a byte received from the XBee module to the API frame parser
   	/*!
-      \param uint8_t* data_in : the string that contains the eschaped API frame AT command
-      \param uint16_t end : the end of the frame
-      \param uint16_t start : the start of the frame
+      \param uint8_t byte : the byte read from the UART
+      \return '1' if a complete frame is stored in 'rxFrame', '0' if not complete yet, '-1' if the frame has been discarded
+         */
+      int8_t parseByte(uint8_t byte);
+	
+	//! It calls the appropriate function depending on the API frame type stored in 'rxFrame'
+  	/*!
+      \param uint8_t* frame : an array that contains the API frame that is expected to receive answer from if it is an AT command
       \return '0' if no error, '1' if error
          */
-      void des_esc(uint8_t* data_in, uint16_t end, uint16_t start);
+      int8_t dispatchFrame(uint8_t* frame);
+	
+	//! It queues an API frame in the transmit buffer of the selected UART
+  	/*!
+      \param uint8_t* frame : the API frame to send
+      \param uint16_t length : number of bytes in the frame
+      \return void
+         */
+      void writeFrame(uint8_t* frame, uint16_t length);
 	
 	//! It parses the AT command answer received by the XBee module
   	/*!
@@ -1402,20 +1365,6 @@ class WaspXBeeCore
          */
       uint8_t modemStatusResponse(uint8_t* data_in, uint16_t end, uint16_t start);
 	
-	//! It parses the TX Status message received by the XBee module
-  	/*!
-      \param uint8_t* ByteIN : array to store the received answer
-      \return '0' if no error, '1' if error
-         */
-      uint8_t txStatusResponse(uint8_t* ByteIN);	
-
-	//! It parses the ZB TX Status message received by the XBee module
-  	/*!
-      \param uint8_t* ByteIN : array to store the received answer
-      \return '0' if no error, '1' if error
-         */
-      uint8_t txZBStatusResponse(uint8_t* ByteIN);
-	
 	//! It parses the RX Data message received by the XBee module
   	/*!
       \param uint8_t* data_in : the string that contains the eschaped API frame AT command
@@ -1431,24 +1380,57 @@ class WaspXBeeCore
 	 */
 	void treatScan();		
 	
-	//! It checks the checksum is good
+	//! It gets a free reassembly slot, dropping the packets which timed out and the oldest one if all of them are in use
   	/*!
-        \param uint8_t* data_in : the string that contains the eschaped API frame AT command
-        \param uint16_t end : the end of the frame
-        \param uint16_t start : the start of the frame
-        \return '0' if no error, '1' if error
+        \return the index of the slot in 'rxSlots'
          */
-        uint8_t checkChecksum(uint8_t* data_in, uint16_t end, uint16_t start);	
-		
-	//! It frees a position in index array
+        uint8_t getFreeSlot();
+	
+	//! It calculates the position in 'rxSlotHash' where a packet should be stored
+  	/*!
+        \param uint8_t packetID : Application Level ID of the packet
+        \param uint8_t* source : source addresses of the packet (64b MAC and 16b Network Address)
+        \return the position in 'rxSlotHash'
+         */
+        uint8_t hashSlot(uint8_t packetID, uint8_t* source);
+	
+	//! It looks for the reassembly slot of a packet already being received
+  	/*!
+        \param uint8_t packetID : Application Level ID of the packet
+        \param uint8_t* source : source addresses of the packet (64b MAC and 16b Network Address)
+        \return the index of the slot in 'rxSlots', MAX_RX_SLOTS if not found
+         */
+        uint8_t findSlot(uint8_t packetID, uint8_t* source);
+	
+	//! It stores a reassembly slot in 'rxSlotHash', using its packetID and source addresses
+  	/*!
+        \param uint8_t slot : the index of the slot in 'rxSlots'
+         */
+        void addSlotHash(uint8_t slot);
+	
+	//! It removes a reassembly slot from 'rxSlotHash'
   	/*!
+        \param uint8_t slot : the index of the slot in 'rxSlots'
          */
-        void freeIndex();
+        void removeSlotHash(uint8_t slot);
 	
-	//! It frees index array and matrix
+	//! It copies a complete packet from a reassembly slot to the 'packet_finished' array
   	/*!
+        \param uint8_t slot : the index of the slot in 'rxSlots'
+        \return '0' on success, '-1' if no more memory is available
          */
-        void freeAll();
+        int8_t finishSlot(uint8_t slot);
+	
+	//! It frees a reassembly slot
+  	/*!
+        \param uint8_t slot : the index of the slot in 'rxSlots'
+         */
+        void freeSlot(uint8_t slot);
+	
+	//! It frees all the reassembly slots
+  	/*!
+         */
+        void clearSlotArray();
 	
 	//! It gets the next index where store the finished packet
   	/*!
@@ -1473,12 +1455,6 @@ class WaspXBeeCore
          */
         uint8_t getIndexLIFO();
 	
-	//! It frees the index array and the matrix row corresponding to the position is sent as an input parameter
-  	/*!
-        \param uint8_t position : the position to free
-         */
-        void freeIndexMatrix(uint8_t position);
-	
 	//! It receives the first packet of a new firmware
   	/*!
 	\return 1 if error, 0 otherwise
@@ -1497,6 +1473,20 @@ class WaspXBeeCore
 	 */
 	void new_firmware_end();
 
+	//! It writes a firmware chunk and every buffered chunk that follows it
+  	/*!
+	\param uint8_t* data : chunk to write
+	\param uint8_t length : length of the chunk
+	\return 1 if error, 0 otherwise
+	 */
+	uint8_t new_firmware_write(uint8_t* data, uint8_t length);
+
+	//! It sends the missing-chunk bitmap of the window to the programmer
+  	/*!
+	\return void
+	 */
+	void new_firmware_nack();
+
 	//! It uploads the new firmware
   	/*!
 	\return void
@@ -1622,20 +1612,45 @@ class WaspXBeeCore
 	 */
 	uint8_t retries_sending;
 	
-	//! Variable : specifies the next index where storing the next received fragment
+	//! Variable : slots where the fragments of the received packets are reassembled
+  	/*!
+	 */
+	rxSlot rxSlots[MAX_RX_SLOTS];
+	
+	//! Variable : hash table pointing to the slot of each packet being received (slot+1, 0=empty)
+  	/*!
+	 */
+	uint8_t rxSlotHash[RX_HASH_SIZE];
+	
+	//! Variable : it stores the API frame being received, without escaped characters
+  	/*!
+	 */
+	uint8_t rxFrame[MAX_FRAME];
+	
+	//! Variable : number of bytes stored in 'rxFrame'
+  	/*!
+	 */
+	uint16_t rxIndex;
+	
+	//! Variable : length field of the API frame being received
+  	/*!
+	 */
+	uint16_t rxLength;
+	
+	//! Variable : checksum accumulated over the API frame being received
   	/*!
 	 */
-	uint8_t nextIndex1;
+	uint8_t rxChecksum;
 	
-	//! Variable : flag to indicate if a frame was truncated
+	//! Variable : state of the API frame parser (XBEE_RX_DELIMITER, XBEE_RX_LENGTH, XBEE_RX_DATA or XBEE_RX_CHECKSUM)
   	/*!
 	 */
-	uint8_t frameNext;
+	uint8_t rxState;
 	
-	//! Variable : flag to indicate if the variable 'nextIndex1' has been modified during the last execution of 'readXBee'
+	//! Variable : flag to indicate if the last byte received was the escape character
   	/*!
 	 */
-	uint8_t indexNotModified;
+	uint8_t rxEscaped;
 	
 	//! Variable : specifies if APS encryption is enabled or disabled
   	/*!
@@ -46,8 +46,8 @@ void WaspXBeeDM::init(uint8_t protocol_used, uint8_t frequency, uint8_t model_us
 	frag_length=0;
 	TIME1=0;
 	
-	totalFragmentsReceived=0;
-	pendingPackets=0;
+	rxSlotsHighWater=0;
+	rxSlotFailures=0;
 	pos=0;
 	discoveryOptions=0x00;
 	
@@ -73,14 +73,13 @@ void WaspXBeeDM::init(uint8_t protocol_used, uint8_t frequency, uint8_t model_us
 		netRouteRequest=3;
 		meshNetRetries=1;
 	}
-	nextIndex1=0;
-	frameNext=0;
+	rxState=XBEE_RX_DELIMITER;
 	replacementPolicy=XBEE_OUT;
-	indexNotModified=1;
 	error_AT=2;
 	error_RX=2;
 	error_TX=2;
 	clearFinishArray();
+	clearSlotArray();
 	clearCommand();
 }
 
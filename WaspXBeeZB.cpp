@@ -37,8 +37,8 @@ void	WaspXBeeZB::init(uint8_t protocol_used, uint8_t frequency, uint8_t model_us
 	model=model_used;
 	uart=uart_used;
 	
-	totalFragmentsReceived=0;
-	pendingPackets=0;
+	rxSlotsHighWater=0;
+	rxSlotFailures=0;
 	pos=0;
 	discoveryOptions=0x00;
 	awakeTime[0]=AWAKE_TIME_ZIGBEE_H;
@@ -86,14 +86,13 @@ void	WaspXBeeZB::init(uint8_t protocol_used, uint8_t frequency, uint8_t model_us
 	mode=0;
 	frag_length=0;
 	TIME1=0;
-	nextIndex1=0;
-	frameNext=0;
+	rxState=XBEE_RX_DELIMITER;
 	replacementPolicy=XBEE_OUT;
-	indexNotModified=1;
 	error_AT=2;
 	error_RX=2;
 	error_TX=2;
 	clearFinishArray();
+	clearSlotArray();
 	clearCommand();
 	apsEncryption=0;
 }
@@ -13,6 +13,9 @@
 #include "fat.h"
 #include "fat_config.h"
 #include "sd-reader_config.h"
+#if FAT_FREE_MAP
+#include "sd_cache.h"
+#endif
 
 #include <string.h>
 
@@ -157,16 +160,37 @@ struct fat_fs_struct
     struct partition_struct* partition;
     struct fat_header_struct header;
     cluster_t cluster_free;
+#if FAT_FREE_MAP
+    /* one bit per group of clusters, clear when the group is full */
+    uint8_t free_map[FAT_FREE_MAP_SIZE];
+    /* log2 of the clusters per group */
+    uint8_t free_map_shift;
+    /* number of free clusters, FAT_FREE_COUNT_UNKNOWN until counted */
+    cluster_t free_count;
+    /* value of sd_cache_fat_changes the summary was built with */
+    uint16_t free_map_stamp;
+#endif
 };
 
+#if FAT_FREE_MAP
+#define FAT_FREE_COUNT_UNKNOWN ((cluster_t) -1)
+#endif
+
 struct fat_file_struct
 {
     struct fat_fs_struct* fs;
     struct fat_dir_entry_struct dir_entry;
     offset_t pos;
     cluster_t pos_cluster;
+    /* last cluster of the file when pos is at its end on a cluster boundary */
+    cluster_t end_cluster;
+    uint8_t flags;
 };
 
+/* fat_file_struct flags */
+#define FAT_FILE_DELAY_DIRENTRY 0x01
+#define FAT_FILE_DIRENTRY_DIRTY 0x02
+
 struct fat_dir_struct
 {
     struct fat_fs_struct* fs;
@@ -189,6 +213,9 @@ struct fat_usage_count_callback_arg
 {
     cluster_t cluster_count;
     uintptr_t buffer_size;
+#if FAT_FREE_MAP
+    struct fat_fs_struct* fs;
+#endif
 };
 
 #if !USE_DYNAMIC_MEMORY
@@ -212,6 +239,11 @@ static uint8_t fat_get_fs_free_32_callback(uint8_t* buffer, offset_t offset, voi
 
 #if FAT_WRITE_SUPPORT
 static cluster_t fat_append_clusters(struct fat_fs_struct* fs, cluster_t cluster_num, cluster_t count);
+#if FAT_FREE_MAP
+static void fat_free_map_init(struct fat_fs_struct* fs);
+static void fat_free_map_check(struct fat_fs_struct* fs);
+static void fat_free_map_release(struct fat_fs_struct* fs, cluster_t cluster_num);
+#endif
 static uint8_t fat_free_clusters(struct fat_fs_struct* fs, cluster_t cluster_num);
 static uint8_t fat_terminate_clusters(struct fat_fs_struct* fs, cluster_t cluster_num);
 static uint8_t fat_clear_cluster(const struct fat_fs_struct* fs, cluster_t cluster_num);
@@ -275,6 +307,10 @@ struct fat_fs_struct* fat_open(struct partition_struct* partition)
 #endif
         return 0;
     }
+
+#if FAT_FREE_MAP
+    fat_free_map_init(fs);
+#endif
     
     return fs;
 }
@@ -497,6 +533,10 @@ cluster_t fat_append_clusters(struct fat_fs_struct* fs, cluster_t cluster_num, c
     if(!fs)
         return 0;
 
+#if FAT_FREE_MAP
+    fat_free_map_check(fs);
+#endif
+
     device_read_t device_read = fs->partition->device_read;
     device_write_t device_write = fs->partition->device_write;
     offset_t fat_offset = fs->header.fat_offset;
@@ -517,10 +557,50 @@ cluster_t fat_append_clusters(struct fat_fs_struct* fs, cluster_t cluster_num, c
 
     fs->cluster_free = 0;
     cluster_t cluster_left = cluster_count;
+#if FAT_FREE_MAP
+    /* first cluster of the current run without free clusters */
+    cluster_t cluster_run = cluster_current;
+    cluster_t group;
+    cluster_t group_first;
+    cluster_t group_mask = ((cluster_t) 1 << fs->free_map_shift) - 1;
+#endif
     for( cluster_left = cluster_count; cluster_left > 0; --cluster_left, ++cluster_current)
     {
         if(cluster_current < 2 || cluster_current >= cluster_count)
+        {
             cluster_current = 2;
+#if FAT_FREE_MAP
+            cluster_run = 2;
+#endif
+        }
+
+#if FAT_FREE_MAP
+        group = cluster_current >> fs->free_map_shift;
+
+        /* The previous group was scanned from its first cluster without
+         * leaving a free one, so it is full now.
+         */
+        if(!(cluster_current & group_mask) && group > 0)
+        {
+            group_first = cluster_current - group_mask - 1;
+            if(group_first < 2)
+                group_first = 2;
+            if(cluster_run <= group_first)
+                fs->free_map[(group - 1) / 8] &= ~(1 << ((group - 1) % 8));
+        }
+
+        /* jump over groups known to be full */
+        if(!(fs->free_map[group / 8] & (1 << (group % 8))))
+        {
+            cluster_t skip = group_mask - (cluster_current & group_mask);
+            if(skip >= cluster_left)
+                skip = cluster_left - 1;
+            cluster_current += skip;
+            cluster_left -= skip;
+            cluster_run = cluster_current + 1;
+            continue;
+        }
+#endif
 
 #if FAT_FAT32_SUPPORT
         if(is_fat32)
@@ -588,6 +668,11 @@ cluster_t fat_append_clusters(struct fat_fs_struct* fs, cluster_t cluster_num, c
                 break;
         }
 
+#if FAT_FREE_MAP
+        if(fs->free_count != FAT_FREE_COUNT_UNKNOWN)
+            --fs->free_count;
+#endif
+
         cluster_next = cluster_current;
         --count_left;
     }
@@ -688,7 +773,12 @@ uint8_t fat_free_clusters(struct fat_fs_struct* fs, cluster_t cluster_num)
 
             /* free cluster */
             fat_entry = HTOL32(FAT32_CLUSTER_FREE);
-            fs->partition->device_write(fat_offset + cluster_num * sizeof(fat_entry), (uint8_t*) &fat_entry, sizeof(fat_entry));
+            if(fs->partition->device_write(fat_offset + cluster_num * sizeof(fat_entry), (uint8_t*) &fat_entry, sizeof(fat_entry)))
+            {
+#if FAT_FREE_MAP
+                fat_free_map_release(fs, cluster_num);
+#endif
+            }
 
             /* We continue in any case here, even if freeing the cluster failed.
              * The cluster is lost, but maybe we can still free up some later ones.
@@ -720,9 +810,20 @@ uint8_t fat_free_clusters(struct fat_fs_struct* fs, cluster_t cluster_num)
             if(cluster_num_next >= FAT16_CLUSTER_LAST_MIN && cluster_num_next <= FAT16_CLUSTER_LAST_MAX)
                 cluster_num_next = 0;
 
+            /* We know we will free the cluster, so remember it as
+             * free for the next allocation.
+             */
+            if(!fs->cluster_free)
+                fs->cluster_free = cluster_num;
+
             /* free cluster */
             fat_entry = HTOL16(FAT16_CLUSTER_FREE);
-            fs->partition->device_write(fat_offset + cluster_num * sizeof(fat_entry), (uint8_t*) &fat_entry, sizeof(fat_entry));
+            if(fs->partition->device_write(fat_offset + cluster_num * sizeof(fat_entry), (uint8_t*) &fat_entry, sizeof(fat_entry)))
+            {
+#if FAT_FREE_MAP
+                fat_free_map_release(fs, cluster_num);
+#endif
+            }
 
             /* We continue in any case here, even if freeing the cluster failed.
              * The cluster is lost, but maybe we can still free up some later ones.
@@ -736,6 +837,72 @@ uint8_t fat_free_clusters(struct fat_fs_struct* fs, cluster_t cluster_num)
 }
 #endif
 
+#if FAT_FREE_MAP
+/**
+ * \ingroup fat_fs
+ * Resets the free cluster summary of a filesystem.
+ *
+ * Every group is marked as possibly holding free clusters and the
+ * free cluster count is unknown until fat_get_fs_free() is called.
+ *
+ * \param[in] fs The filesystem to reset the summary of.
+ */
+void fat_free_map_init(struct fat_fs_struct* fs)
+{
+    cluster_t cluster_count;
+#if FAT_FAT32_SUPPORT
+    if(fs->partition->type == PARTITION_TYPE_FAT32)
+        cluster_count = fs->header.fat_size / sizeof(uint32_t);
+    else
+#endif
+        cluster_count = fs->header.fat_size / sizeof(uint16_t);
+
+    /* smallest group size which fits all the clusters into the map */
+    fs->free_map_shift = 0;
+    while(((cluster_count - 1) >> fs->free_map_shift) >= FAT_FREE_MAP_SIZE * 8)
+        ++fs->free_map_shift;
+
+    memset(fs->free_map, 0xff, sizeof(fs->free_map));
+    fs->free_count = FAT_FREE_COUNT_UNKNOWN;
+    fs->free_map_stamp = sd_cache_fat_changes;
+}
+
+/**
+ * \ingroup fat_fs
+ * Resets the free cluster summary if the FAT was changed by SdFat.
+ *
+ * SdFat shares the card through the block cache but allocates and
+ * frees clusters on its own, which this summary does not see.
+ *
+ * \param[in] fs The filesystem to check the summary of.
+ */
+void fat_free_map_check(struct fat_fs_struct* fs)
+{
+    if(fs->free_map_stamp != sd_cache_fat_changes)
+        fat_free_map_init(fs);
+}
+
+#if DOXYGEN || FAT_WRITE_SUPPORT
+/**
+ * \ingroup fat_fs
+ * Accounts for a cluster which has just been freed.
+ *
+ * \param[in] fs The filesystem on which to operate.
+ * \param[in] cluster_num The freed cluster.
+ */
+void fat_free_map_release(struct fat_fs_struct* fs, cluster_t cluster_num)
+{
+    fat_free_map_check(fs);
+
+    cluster_t group = cluster_num >> fs->free_map_shift;
+
+    fs->free_map[group / 8] |= (1 << (group % 8));
+    if(fs->free_count != FAT_FREE_COUNT_UNKNOWN)
+        ++fs->free_count;
+}
+#endif
+#endif
+
 #if DOXYGEN || FAT_WRITE_SUPPORT
 /**
  * \ingroup fat_fs
@@ -952,6 +1119,8 @@ struct fat_file_struct* fat_open_file(struct fat_fs_struct* fs, const struct fat
     fd->fs = fs;
     fd->pos = 0;
     fd->pos_cluster = dir_entry->cluster;
+    fd->end_cluster = 0;
+    fd->flags = 0;
 
     return fd;
 }
@@ -970,6 +1139,9 @@ void fat_close_file(struct fat_file_struct* fd)
 #if FAT_DELAY_DIRENTRY_UPDATE
         /* write directory entry */
         fat_write_dir_entry(fd->fs, &fd->dir_entry);
+#elif FAT_WRITE_SUPPORT
+        /* write directory entry if its update was delayed */
+        fat_sync_file(fd);
 #endif
 
 #if USE_DYNAMIC_MEMORY
@@ -1101,6 +1273,17 @@ intptr_t fat_write_file(struct fat_file_struct* fd, const uint8_t* buffer, uintp
     uintptr_t buffer_left = buffer_len;
     uint16_t first_cluster_offset = (uint16_t) (fd->pos & (cluster_size - 1));
 
+    /* the file ends on a cluster boundary and we are appending to it, so
+     * the new cluster goes right after the last one we wrote
+     */
+    if(!cluster_num && fd->end_cluster && !first_cluster_offset && fd->pos == fd->dir_entry.file_size)
+    {
+        cluster_num = fat_append_clusters(fd->fs, fd->end_cluster, 1);
+        if(!cluster_num)
+            return -1;
+    }
+    fd->end_cluster = 0;
+
     /* find cluster in which to start writing */
     if(!cluster_num)
     {
@@ -1168,6 +1351,8 @@ intptr_t fat_write_file(struct fat_file_struct* fd, const uint8_t* buffer, uintp
             if(!cluster_num_next)
             {
                 fd->pos_cluster = 0;
+                if(!buffer_left)
+                    fd->end_cluster = cluster_num;
                 break;
             }
 
@@ -1190,8 +1375,12 @@ intptr_t fat_write_file(struct fat_file_struct* fd, const uint8_t* buffer, uintp
         fd->dir_entry.file_size = fd->pos;
 
 #if !FAT_DELAY_DIRENTRY_UPDATE
-        /* write directory entry */
-        if(!fat_write_dir_entry(fd->fs, &fd->dir_entry))
+        /* write directory entry, or leave it for fat_sync_file() */
+        if(fd->flags & FAT_FILE_DELAY_DIRENTRY)
+        {
+            fd->flags |= FAT_FILE_DIRENTRY_DIRTY;
+        }
+        else if(!fat_write_dir_entry(fd->fs, &fd->dir_entry))
         {
             /* We do not return an error here since we actually wrote
              * some data to disk. So we calculate the amount of data
@@ -1207,6 +1396,55 @@ intptr_t fat_write_file(struct fat_file_struct* fd, const uint8_t* buffer, uintp
 }
 #endif
 
+#if DOXYGEN || FAT_WRITE_SUPPORT
+/**
+ * \ingroup fat_file
+ * Delays the directory entry updates of a file.
+ *
+ * While enabled, fat_write_file() only updates the file size in memory.
+ * The directory entry is written by fat_sync_file() or fat_close_file().
+ * This saves one sector write per call when a file is appended to often,
+ * at the cost of losing the size update of unsynced writes on power loss.
+ *
+ * \param[in] fd The file handle.
+ * \param[in] delay 1 to delay the updates, 0 to write them on every call.
+ * \see fat_sync_file
+ */
+void fat_delay_dir_entry(struct fat_file_struct* fd, uint8_t delay)
+{
+    if(!fd)
+        return;
+
+    if(delay)
+        fd->flags |= FAT_FILE_DELAY_DIRENTRY;
+    else
+        fd->flags &= ~FAT_FILE_DELAY_DIRENTRY;
+}
+
+/**
+ * \ingroup fat_file
+ * Writes the directory entry of a file if a delayed update is pending.
+ *
+ * \param[in] fd The file handle.
+ * \returns 0 on failure, 1 on success.
+ * \see fat_delay_dir_entry
+ */
+uint8_t fat_sync_file(struct fat_file_struct* fd)
+{
+    if(!fd)
+        return 0;
+
+    if(fd->flags & FAT_FILE_DIRENTRY_DIRTY)
+    {
+        if(!fat_write_dir_entry(fd->fs, &fd->dir_entry))
+            return 0;
+        fd->flags &= ~FAT_FILE_DIRENTRY_DIRTY;
+    }
+
+    return 1;
+}
+#endif
+
 /**
  * \ingroup fat_file
  * Repositions the read/write file offset.
@@ -1263,6 +1501,7 @@ uint8_t fat_seek_file(struct fat_file_struct* fd, int32_t* offset, uint8_t whenc
 
     fd->pos = new_pos;
     fd->pos_cluster = 0;
+    fd->end_cluster = 0;
 
     *offset = (int32_t) new_pos;
     return 1;
@@ -1293,6 +1532,9 @@ uint8_t fat_resize_file(struct fat_file_struct* fd, uint32_t size)
     if(!fd)
         return 0;
 
+    /* the cluster chain is about to change */
+    fd->end_cluster = 0;
+
     cluster_t cluster_num = fd->dir_entry.cluster;
     uint16_t cluster_size = fd->fs->header.cluster_size;
     uint32_t size_new = size;
@@ -2377,15 +2619,28 @@ offset_t fat_get_fs_size(const struct fat_fs_struct* fs)
  * \param[in] fs The filesystem on which to operate.
  * \returns 0 on failure, the free filesystem space in bytes otherwise.
  */
-offset_t fat_get_fs_free(const struct fat_fs_struct* fs)
+offset_t fat_get_fs_free(struct fat_fs_struct* fs)
 {
     if(!fs)
         return 0;
 
+#if FAT_FREE_MAP
+    /* counted before and kept up to date since */
+    fat_free_map_check(fs);
+    if(fs->free_count != FAT_FREE_COUNT_UNKNOWN)
+        return (offset_t) fs->free_count * fs->header.cluster_size;
+#endif
+
     uint8_t fat[32];
     struct fat_usage_count_callback_arg count_arg;
     count_arg.cluster_count = 0;
     count_arg.buffer_size = sizeof(fat);
+#if FAT_FREE_MAP
+    count_arg.fs = fs;
+
+    /* the scan marks every group it finds a free cluster in */
+    memset(fs->free_map, 0, sizeof(fs->free_map));
+#endif
 
     offset_t fat_offset = fs->header.fat_offset;
     uint32_t fat_size = fs->header.fat_size;
@@ -2409,12 +2664,21 @@ offset_t fat_get_fs_free(const struct fat_fs_struct* fs)
                                                 &count_arg
                                                )
           )
+        {
+#if FAT_FREE_MAP
+            fat_free_map_init(fs);
+#endif
             return 0;
+        }
 
         fat_offset += length;
         fat_size -= length;
     }
 
+#if FAT_FREE_MAP
+    fs->free_count = count_arg.cluster_count;
+#endif
+
     return (offset_t) count_arg.cluster_count * fs->header.cluster_size;
 }
 
@@ -2428,11 +2692,24 @@ uint8_t fat_get_fs_free_16_callback(uint8_t* buffer, offset_t offset, void* p)
     uintptr_t buffer_size = count_arg->buffer_size;
 
     uintptr_t i = 0;
+#if FAT_FREE_MAP
+    struct fat_fs_struct* fs = count_arg->fs;
+    cluster_t cluster_num = (offset - fs->header.fat_offset) / sizeof(uint16_t);
+    cluster_t group;
+#endif
     for( i = 0; i < buffer_size; i += 2, buffer += 2)
     {
         uint16_t cluster = *((uint16_t*) &buffer[0]);
         if(cluster == HTOL16(FAT16_CLUSTER_FREE))
+        {
             ++(count_arg->cluster_count);
+#if FAT_FREE_MAP
+            group = (cluster_num + i / 2) >> fs->free_map_shift;
+            fs->free_map[group / 8] |= (1 << (group % 8));
+            if(!fs->cluster_free)
+                fs->cluster_free = cluster_num + i / 2;
+#endif
+        }
     }
 
     return 1;
@@ -2449,11 +2726,24 @@ uint8_t fat_get_fs_free_32_callback(uint8_t* buffer, offset_t offset, void* p)
     uintptr_t buffer_size = count_arg->buffer_size;
 
     uintptr_t i = 0;
+#if FAT_FREE_MAP
+    struct fat_fs_struct* fs = count_arg->fs;
+    cluster_t cluster_num = (offset - fs->header.fat_offset) / sizeof(uint32_t);
+    cluster_t group;
+#endif
     for( i = 0; i < buffer_size; i += 4, buffer += 4)
     {
         uint32_t cluster = *((uint32_t*) &buffer[0]);
         if(cluster == HTOL32(FAT32_CLUSTER_FREE))
+        {
             ++(count_arg->cluster_count);
+#if FAT_FREE_MAP
+            group = (cluster_num + i / 4) >> fs->free_map_shift;
+            fs->free_map[group / 8] |= (1 << (group % 8));
+            if(!fs->cluster_free)
+                fs->cluster_free = cluster_num + i / 4;
+#endif
+        }
     }
 
     return 1;
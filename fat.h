@@ -98,6 +98,8 @@ intptr_t fat_read_file(struct fat_file_struct* fd, uint8_t* buffer, uintptr_t bu
 intptr_t fat_write_file(struct fat_file_struct* fd, const uint8_t* buffer, uintptr_t buffer_len);
 uint8_t fat_seek_file(struct fat_file_struct* fd, int32_t* offset, uint8_t whence);
 uint8_t fat_resize_file(struct fat_file_struct* fd, uint32_t size);
+void fat_delay_dir_entry(struct fat_file_struct* fd, uint8_t delay);
+uint8_t fat_sync_file(struct fat_file_struct* fd);
 
 struct fat_dir_struct* fat_open_dir(struct fat_fs_struct* fs, const struct fat_dir_entry_struct* dir_entry);
 void fat_close_dir(struct fat_dir_struct* dd);
@@ -115,7 +117,7 @@ void fat_get_file_modification_time(const struct fat_dir_entry_struct* dir_entry
 uint8_t fat_get_dir_entry_of_path(struct fat_fs_struct* fs, const char* path, struct fat_dir_entry_struct* dir_entry);
 
 offset_t fat_get_fs_size(const struct fat_fs_struct* fs);
-offset_t fat_get_fs_free(const struct fat_fs_struct* fs);
+offset_t fat_get_fs_free(struct fat_fs_struct* fs);
 
 /**
  * @}
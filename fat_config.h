@@ -71,6 +71,26 @@ extern "C"
  */
 #define FAT_DELAY_DIRENTRY_UPDATE 0
 
+/**
+ * \ingroup fat_config
+ * Controls the in-RAM summary of free clusters.
+ *
+ * Set to 1 to keep the number of free clusters and one bit per group
+ * of FAT entries telling whether the group may still hold a free
+ * cluster. After the first fat_get_fs_free() scan, the free space is
+ * known without reading the FAT, and allocations skip full groups.
+ */
+#define FAT_FREE_MAP 1
+
+/**
+ * \ingroup fat_config
+ * Size in bytes of the free cluster summary.
+ *
+ * With 32 bytes, each bit covers one FAT sector on the largest FAT16
+ * volumes (256 entries). Bigger FATs share a bit between several sectors.
+ */
+#define FAT_FREE_MAP_SIZE 32
+
 /**
  * \ingroup fat_config
  * Determines the function used for retrieving current date and time.
@@ -101,8 +121,11 @@ void get_datetime(uint16_t* year, uint8_t* month, uint8_t* day, uint8_t* hour, u
 /**
  * \ingroup fat_config
  * Maximum number of file handles.
+ *
+ * One is kept by an open SDLog, one by an open SDQueue and the last one
+ * serves the WaspSD file functions.
  */
-#define FAT_FILE_COUNT 1
+#define FAT_FILE_COUNT 3
 
 /**
  * \ingroup fat_config
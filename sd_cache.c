@@ -0,0 +1,253 @@
+/*
+ * This file is free software; you can redistribute it and/or modify
+ * it under the terms of either the GNU General Public License version 2
+ * or the GNU Lesser General Public License version 2.1, both as
+ * published by the Free Software Foundation.
+ */
+
+#include "sd_cache.h"
+
+/**
+ * \addtogroup sd_cache Shared SD block cache
+ *
+ * This module keeps SD_CACHE_SLOTS blocks of the card in RAM for
+ * both FAT stacks of the tree. Blocks are identified by their
+ * number on the card, so the same block is never held twice and
+ * both stacks always see the same data. Slots are replaced in
+ * least recently used order and modified blocks are only written
+ * back when they are evicted or on sd_cache_sync().
+ *
+ * Every slot remembers the function of the stack that modified it,
+ * so it is written back through the same driver.
+ *
+ * @{
+ */
+/**
+ * \file
+ * Shared SD block cache implementation (license: GPLv2 or LGPLv2.1)
+ */
+
+#define SD_CACHE_VALID 0x01
+#define SD_CACHE_DIRTY 0x02
+
+struct sd_cache_slot
+{
+    uint32_t block;
+    uint16_t used;
+    uint8_t flags;
+    sd_cache_write_t write;
+    uint8_t data[512];
+};
+
+static struct sd_cache_slot sd_cache_slots[SD_CACHE_SLOTS];
+static uint16_t sd_cache_tick;
+
+uint16_t sd_cache_fat_changes;
+uint32_t sd_cache_hits;
+uint32_t sd_cache_misses;
+
+/* private helper functions */
+static struct sd_cache_slot* sd_cache_find(uint32_t block);
+static struct sd_cache_slot* sd_cache_victim(void);
+static uint8_t sd_cache_write_back(struct sd_cache_slot* slot);
+
+/**
+ * \ingroup sd_cache
+ * Gets a block of the card in the cache.
+ *
+ * \param[in] block The number of the block on the card.
+ * \param[in] action SD_CACHE_READ, or SD_CACHE_WRITE optionally combined with SD_CACHE_NO_READ.
+ * \param[in] read The function reading the block from the card on a miss.
+ * \param[in] write The function writing the block back if it is modified.
+ * \returns A pointer to the 512 bytes of the block, 0 on failure.
+ */
+uint8_t* sd_cache_get(uint32_t block, uint8_t action, sd_cache_read_t read, sd_cache_write_t write)
+{
+    struct sd_cache_slot* slot = sd_cache_find(block);
+
+    if(slot)
+    {
+        ++sd_cache_hits;
+    }
+    else
+    {
+        ++sd_cache_misses;
+
+        slot = sd_cache_victim();
+        if(!sd_cache_write_back(slot))
+            return 0;
+
+        slot->flags = 0;
+        if(!(action & SD_CACHE_NO_READ) && !read(block, slot->data))
+            return 0;
+        slot->block = block;
+        slot->flags = SD_CACHE_VALID;
+    }
+
+    slot->used = ++sd_cache_tick;
+    if(action & SD_CACHE_WRITE)
+    {
+        slot->flags |= SD_CACHE_DIRTY;
+        slot->write = write;
+    }
+
+    return slot->data;
+}
+
+/**
+ * \ingroup sd_cache
+ * Takes the least recently used slot out of the cache to be used as a plain buffer.
+ *
+ * The slot returns to the cache the next time it is replaced.
+ *
+ * \returns A pointer to 512 bytes, 0 if the block held in the slot could not be written back.
+ */
+uint8_t* sd_cache_claim()
+{
+    struct sd_cache_slot* slot = sd_cache_victim();
+
+    if(!sd_cache_write_back(slot))
+        return 0;
+    slot->flags = 0;
+
+    return slot->data;
+}
+
+/**
+ * \ingroup sd_cache
+ * Checks if a block is held in the cache.
+ *
+ * \param[in] block The number of the block on the card.
+ * \returns 1 if the block is cached, 0 if it is not.
+ */
+uint8_t sd_cache_contains(uint32_t block)
+{
+    return sd_cache_find(block) != 0;
+}
+
+/**
+ * \ingroup sd_cache
+ * Marks the block held in a buffer returned by sd_cache_get() as modified.
+ *
+ * \param[in] buffer The buffer returned by sd_cache_get().
+ * \param[in] write The function writing the block back.
+ */
+void sd_cache_set_dirty(uint8_t* buffer, sd_cache_write_t write)
+{
+    uint8_t i;
+
+    for(i = 0; i < SD_CACHE_SLOTS; ++i)
+    {
+        if(sd_cache_slots[i].data == buffer && (sd_cache_slots[i].flags & SD_CACHE_VALID))
+        {
+            sd_cache_slots[i].flags |= SD_CACHE_DIRTY;
+            sd_cache_slots[i].write = write;
+        }
+    }
+}
+
+/**
+ * \ingroup sd_cache
+ * Drops cached blocks without writing them back.
+ *
+ * Used when the blocks are overwritten on the card directly.
+ *
+ * \param[in] block The number of the first block.
+ * \param[in] count The number of blocks.
+ */
+void sd_cache_invalidate(uint32_t block, uint32_t count)
+{
+    uint8_t i;
+
+    for(i = 0; i < SD_CACHE_SLOTS; ++i)
+    {
+        if(sd_cache_slots[i].block - block < count)
+            sd_cache_slots[i].flags = 0;
+    }
+}
+
+/**
+ * \ingroup sd_cache
+ * Writes every modified block back to the card.
+ *
+ * \returns 0 on failure, 1 on success.
+ */
+uint8_t sd_cache_sync()
+{
+    uint8_t i;
+
+    for(i = 0; i < SD_CACHE_SLOTS; ++i)
+    {
+        if(!sd_cache_write_back(&sd_cache_slots[i]))
+            return 0;
+    }
+
+    return 1;
+}
+
+/**
+ * \ingroup sd_cache
+ * Looks for the slot holding a block.
+ *
+ * \param[in] block The number of the block on the card.
+ * \returns The slot, 0 if the block is not cached.
+ */
+struct sd_cache_slot* sd_cache_find(uint32_t block)
+{
+    uint8_t i;
+
+    for(i = 0; i < SD_CACHE_SLOTS; ++i)
+    {
+        if((sd_cache_slots[i].flags & SD_CACHE_VALID) && sd_cache_slots[i].block == block)
+            return &sd_cache_slots[i];
+    }
+
+    return 0;
+}
+
+/**
+ * \ingroup sd_cache
+ * Chooses the slot to replace: an empty one, else the least recently used.
+ *
+ * \returns The slot to replace.
+ */
+struct sd_cache_slot* sd_cache_victim()
+{
+    struct sd_cache_slot* victim = &sd_cache_slots[0];
+    uint8_t i;
+
+    for(i = 0; i < SD_CACHE_SLOTS; ++i)
+    {
+        if(!(sd_cache_slots[i].flags & SD_CACHE_VALID))
+            return &sd_cache_slots[i];
+
+        /* the tick wraps around, compare ages instead of stamps */
+        if((uint16_t) (sd_cache_tick - sd_cache_slots[i].used) > (uint16_t) (sd_cache_tick - victim->used))
+            victim = &sd_cache_slots[i];
+    }
+
+    return victim;
+}
+
+/**
+ * \ingroup sd_cache
+ * Writes a slot back to the card if it was modified.
+ *
+ * \param[in] slot The slot to write.
+ * \returns 0 on failure, 1 on success.
+ */
+uint8_t sd_cache_write_back(struct sd_cache_slot* slot)
+{
+    if((slot->flags & (SD_CACHE_VALID | SD_CACHE_DIRTY)) != (SD_CACHE_VALID | SD_CACHE_DIRTY))
+        return 1;
+
+    if(!slot->write(slot->block, slot->data))
+        return 0;
+    slot->flags &= ~SD_CACHE_DIRTY;
+
+    return 1;
+}
+
+/**
+ * @}
+ */
@@ -0,0 +1,78 @@
+/*
+ * This file is free software; you can redistribute it and/or modify
+ * it under the terms of either the GNU General Public License version 2
+ * or the GNU Lesser General Public License version 2.1, both as
+ * published by the Free Software Foundation.
+ */
+
+#ifndef SD_CACHE_H
+#define SD_CACHE_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/**
+ * \addtogroup sd_cache
+ *
+ * @{
+ */
+/**
+ * \file
+ * Shared SD block cache header (license: GPLv2 or LGPLv2.1)
+ */
+
+/**
+ * Number of 512 byte blocks kept in RAM.
+ *
+ * The cache is shared by the sd-reader (sd_raw.c) and the SdFat
+ * (SdVolume/SdFile) stacks, so one slot replaces the two buffers
+ * they used to have. More slots avoid re-reading the FAT and the
+ * directory while a file is written.
+ */
+#ifndef SD_CACHE_SLOTS
+#define SD_CACHE_SLOTS 1
+#endif
+
+/** The block is only read. */
+#define SD_CACHE_READ 0x00
+/** The block will be modified and has to be written back. */
+#define SD_CACHE_WRITE 0x01
+/** The whole block will be overwritten, it is not read from the card. */
+#define SD_CACHE_NO_READ 0x02
+
+typedef uint8_t (*sd_cache_read_t)(uint32_t block, uint8_t* buffer);
+typedef uint8_t (*sd_cache_write_t)(uint32_t block, const uint8_t* buffer);
+
+uint8_t* sd_cache_get(uint32_t block, uint8_t action, sd_cache_read_t read, sd_cache_write_t write);
+uint8_t* sd_cache_claim(void);
+uint8_t sd_cache_contains(uint32_t block);
+void sd_cache_set_dirty(uint8_t* buffer, sd_cache_write_t write);
+void sd_cache_invalidate(uint32_t block, uint32_t count);
+uint8_t sd_cache_sync(void);
+
+/**
+ * Incremented by SdFat each time it changes a FAT entry.
+ *
+ * The sd-reader keeps a summary of the free clusters (FAT_FREE_MAP)
+ * and drops it when this counter moved since it was built.
+ */
+extern uint16_t sd_cache_fat_changes;
+
+/** Number of requests served from RAM. */
+extern uint32_t sd_cache_hits;
+/** Number of requests that had to read (or allocate) a block. */
+extern uint32_t sd_cache_misses;
+
+/**
+ * @}
+ */
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -11,6 +11,7 @@
 #include <string.h>
 #include <avr/io.h>
 #include "sd_raw.h"
+#include "sd_cache.h"
 
 /**
  * \addtogroup sd_raw MMC/SD/SDHC card raw access
@@ -90,6 +91,8 @@
 #define CMD_SD_SEND_OP_COND 0x29
 /* CMD42: arg0[31:0]: stuff bits, response R1b */
 #define CMD_LOCK_UNLOCK 0x2a
+/* ACMD23: arg0[22:0]: number of blocks to pre-erase, response R1 */
+#define CMD_SET_WR_BLK_ERASE_COUNT 0x17
 /* CMD55: arg0[31:0]: stuff bits, response R1 */
 #define CMD_APP 0x37
 /* CMD58: arg0[31:0]: stuff bits, response R3 */
@@ -139,22 +142,16 @@
 #define DR_STATUS_CRC_ERR 0x0a
 #define DR_STATUS_WRITE_ERR 0x0c
 
+/* data tokens */
+#define TOKEN_START_BLOCK 0xfe
+#define TOKEN_START_MULTI_WRITE 0xfc
+#define TOKEN_STOP_MULTI_WRITE 0xfd
+
 /* status bits for card types */
 #define SD_RAW_SPEC_1 0
 #define SD_RAW_SPEC_2 1
 #define SD_RAW_SPEC_SDHC 2
 
-#if !SD_RAW_SAVE_RAM
-/* static data buffer for acceleration */
-static uint8_t raw_block[512];
-/* offset where the data within raw_block lies on the card */
-static offset_t raw_block_address;
-#if SD_RAW_WRITE_BUFFERING
-/* flag to remember if raw_block was written to the card */
-static uint8_t raw_block_written;
-#endif
-#endif
-
 /* card type state */
 static uint8_t sd_raw_card_type;
 
@@ -162,6 +159,18 @@ static uint8_t sd_raw_card_type;
 static void sd_raw_send_byte(uint8_t b);
 static uint8_t sd_raw_rec_byte();
 static uint8_t sd_raw_send_command(uint8_t command, uint32_t arg);
+#if !SD_RAW_SAVE_RAM
+static uint8_t sd_raw_read_block(uint32_t block, uint8_t* buffer);
+#if SD_RAW_WRITE_SUPPORT
+static uint8_t sd_raw_write_block(uint32_t block, const uint8_t* buffer);
+#endif
+#endif
+#if SD_RAW_MULTI_BLOCK
+static uint8_t sd_raw_read_blocks(offset_t block_address, uint8_t* buffer, uint16_t count);
+#if SD_RAW_WRITE_SUPPORT
+static uint8_t sd_raw_write_blocks(offset_t block_address, const uint8_t* buffer, uint16_t count);
+#endif
+#endif
 
 
 /**
@@ -324,13 +333,12 @@ uint8_t sd_raw_init()
     SPCR &= ~((1 << SPR1) | (1 << SPR0)); /* Clock Frequency: f_OSC / 4 */
     SPSR |= (1 << SPI2X); /* Doubled Clock Frequency: f_OSC / 2 */
 
+    /* the card may have been replaced, forget what is cached */
+    sd_cache_invalidate(0, (uint32_t) -1);
+
 #if !SD_RAW_SAVE_RAM
     /* the first block is likely to be accessed first, so precache it here */
-    raw_block_address = (offset_t) -1;
-#if SD_RAW_WRITE_BUFFERING
-    raw_block_written = 1;
-#endif
-    if(!sd_raw_read(0, raw_block, sizeof(raw_block)))
+    if(!sd_cache_get(0, SD_CACHE_READ, sd_raw_read_block, 0))
         return 0;
 #endif
 
@@ -437,6 +445,144 @@ uint8_t sd_raw_send_command(uint8_t command, uint32_t arg)
     return response;
 }
 
+#if SD_RAW_MULTI_BLOCK
+/**
+ * \ingroup sd_raw
+ * Reads a run of whole blocks with a single READ_MULTIPLE_BLOCK command.
+ *
+ * \param[in] block_address The byte address of the first block, a multiple of 512.
+ * \param[out] buffer The buffer receiving count * 512 bytes.
+ * \param[in] count The number of blocks to read.
+ * \returns 0 on failure, 1 on success.
+ */
+uint8_t sd_raw_read_blocks(offset_t block_address, uint8_t* buffer, uint16_t count)
+{
+    uint16_t i=0;
+
+    /* address card */
+    select_card();
+
+    /* send multiple block request */
+#if SD_RAW_SDHC
+    if(sd_raw_send_command(CMD_READ_MULTIPLE_BLOCK, (sd_raw_card_type & (1 << SD_RAW_SPEC_SDHC) ? block_address / 512 : block_address)))
+#else
+    if(sd_raw_send_command(CMD_READ_MULTIPLE_BLOCK, block_address))
+#endif
+    {
+        unselect_card();
+        return 0;
+    }
+
+    while(count-- > 0)
+    {
+        /* wait for data block (start byte 0xfe) */
+        while(sd_raw_rec_byte() != TOKEN_START_BLOCK);
+
+        /* read byte block */
+        for( i = 0; i < 512; ++i)
+            *buffer++ = sd_raw_rec_byte();
+
+        /* read crc16 */
+        sd_raw_rec_byte();
+        sd_raw_rec_byte();
+    }
+
+    /* end the transfer and wait while card is busy */
+    sd_raw_send_command(CMD_STOP_TRANSMISSION, 0);
+    while(sd_raw_rec_byte() != 0xff);
+
+    /* deaddress card */
+    unselect_card();
+
+    /* let card some time to finish */
+    sd_raw_rec_byte();
+
+    return 1;
+}
+
+#if SD_RAW_WRITE_SUPPORT
+/**
+ * \ingroup sd_raw
+ * Writes a run of whole blocks with a single WRITE_MULTIPLE_BLOCK command.
+ *
+ * SD cards are told the length of the run beforehand (ACMD23) so they can
+ * erase it in advance, which is what makes long appends fast.
+ *
+ * \param[in] block_address The byte address of the first block, a multiple of 512.
+ * \param[in] buffer The buffer holding count * 512 bytes.
+ * \param[in] count The number of blocks to write.
+ * \returns 0 on failure, 1 on success.
+ */
+uint8_t sd_raw_write_blocks(offset_t block_address, const uint8_t* buffer, uint16_t count)
+{
+    uint16_t i=0;
+    uint8_t response;
+
+    /* address card */
+    select_card();
+
+    /* pre-erase hint, SD cards only */
+    if(sd_raw_card_type & ((1 << SD_RAW_SPEC_1) | (1 << SD_RAW_SPEC_2)))
+    {
+        sd_raw_send_command(CMD_APP, 0);
+        sd_raw_send_command(CMD_SET_WR_BLK_ERASE_COUNT, count);
+    }
+
+    /* send multiple block request */
+#if SD_RAW_SDHC
+    if(sd_raw_send_command(CMD_WRITE_MULTIPLE_BLOCK, (sd_raw_card_type & (1 << SD_RAW_SPEC_SDHC) ? block_address / 512 : block_address)))
+#else
+    if(sd_raw_send_command(CMD_WRITE_MULTIPLE_BLOCK, block_address))
+#endif
+    {
+        unselect_card();
+        return 0;
+    }
+
+    while(count-- > 0)
+    {
+        /* send start byte */
+        sd_raw_send_byte(TOKEN_START_MULTI_WRITE);
+
+        /* write byte block */
+        for( i = 0; i < 512; ++i)
+            sd_raw_send_byte(*buffer++);
+
+        /* write dummy crc16 */
+        sd_raw_send_byte(0xff);
+        sd_raw_send_byte(0xff);
+
+        /* check the data response, then wait while card is busy */
+        response = sd_raw_rec_byte();
+        while(sd_raw_rec_byte() != 0xff);
+
+        if((response & DR_STATUS_MASK) != (DR_STATUS_ACCEPTED & DR_STATUS_MASK))
+        {
+            /* end the transfer anyway */
+            sd_raw_send_byte(TOKEN_STOP_MULTI_WRITE);
+            sd_raw_rec_byte();
+            while(sd_raw_rec_byte() != 0xff);
+            unselect_card();
+            return 0;
+        }
+    }
+
+    /* send stop token and wait while card is busy */
+    sd_raw_send_byte(TOKEN_STOP_MULTI_WRITE);
+    sd_raw_rec_byte();
+    while(sd_raw_rec_byte() != 0xff);
+
+    /* deaddress card */
+    unselect_card();
+
+    /* let card some time to finish */
+    sd_raw_rec_byte();
+
+    return 1;
+}
+#endif
+#endif
+
 /**
  * \ingroup sd_raw
  * Reads raw data from the card.
@@ -452,81 +598,86 @@ uint8_t sd_raw_read(offset_t offset, uint8_t* buffer, uintptr_t length)
     offset_t block_address;
     uint16_t block_offset;
     uint16_t read_length;
+#if SD_RAW_SAVE_RAM
     uint16_t i=0;
+#else
+    uint8_t* cache;
+#endif
 
     while(length > 0)
     {
         /* determine byte count to read at once */
         block_offset = offset & 0x01ff;
         block_address = offset - block_offset;
-        read_length = 512 - block_offset; /* read up to block border */
-        if(read_length > length)
-            read_length = length;
-        
-#if !SD_RAW_SAVE_RAM
-        /* check if the requested data is cached */
-        if(block_address != raw_block_address)
-#endif
-        {
-#if SD_RAW_WRITE_BUFFERING
-            if(!sd_raw_sync())
-                return 0;
-#endif
 
-            /* address card */
-            select_card();
+#if SD_RAW_MULTI_BLOCK
+        /* stream whole blocks straight into the caller's buffer */
+        if(block_offset == 0 && length >= 1024)
+        {
+            uint16_t count = length / 512;
 
-            /* send single block request */
-#if SD_RAW_SDHC
-            if(sd_raw_send_command(CMD_READ_SINGLE_BLOCK, (sd_raw_card_type & (1 << SD_RAW_SPEC_SDHC) ? block_address / 512 : block_address)))
-#else
-            if(sd_raw_send_command(CMD_READ_SINGLE_BLOCK, block_address))
-#endif
-            {
-                unselect_card();
+            /* cached blocks may be newer than the card */
+            if(!sd_cache_sync())
+                return 0;
+            if(!sd_raw_read_blocks(block_address, buffer, count))
                 return 0;
-            }
 
-            /* wait for data block (start byte 0xfe) */
-            while(sd_raw_rec_byte() != 0xfe);
+            read_length = count * 512;
+            buffer += read_length;
+            length -= read_length;
+            offset += read_length;
+            continue;
+        }
+#endif
 
+        read_length = 512 - block_offset; /* read up to block border */
+        if(read_length > length)
+            read_length = length;
+        
 #if SD_RAW_SAVE_RAM
-            /* read byte block */
-            uint16_t read_to = block_offset + read_length;
-            for( i = 0; i < 512; ++i)
-            {
-                uint8_t b = sd_raw_rec_byte();
-                if(i >= block_offset && i < read_to)
-                    *buffer++ = b;
-            }
-#else
-            /* read byte block */
-            uint8_t* cache = raw_block;
-            for( i = 0; i < 512; ++i)
-                *cache++ = sd_raw_rec_byte();
-            raw_block_address = block_address;
+        /* address card */
+        select_card();
 
-            memcpy(buffer, raw_block + block_offset, read_length);
-            buffer += read_length;
+        /* send single block request */
+#if SD_RAW_SDHC
+        if(sd_raw_send_command(CMD_READ_SINGLE_BLOCK, (sd_raw_card_type & (1 << SD_RAW_SPEC_SDHC) ? block_address / 512 : block_address)))
+#else
+        if(sd_raw_send_command(CMD_READ_SINGLE_BLOCK, block_address))
 #endif
-            
-            /* read crc16 */
-            sd_raw_rec_byte();
-            sd_raw_rec_byte();
-            
-            /* deaddress card */
+        {
             unselect_card();
-
-            /* let card some time to finish */
-            sd_raw_rec_byte();
+            return 0;
         }
-#if !SD_RAW_SAVE_RAM
-        else
+
+        /* wait for data block (start byte 0xfe) */
+        while(sd_raw_rec_byte() != 0xfe);
+
+        /* read byte block */
+        uint16_t read_to = block_offset + read_length;
+        for( i = 0; i < 512; ++i)
         {
-            /* use cached data */
-            memcpy(buffer, raw_block + block_offset, read_length);
-            buffer += read_length;
+            uint8_t b = sd_raw_rec_byte();
+            if(i >= block_offset && i < read_to)
+                *buffer++ = b;
         }
+        
+        /* read crc16 */
+        sd_raw_rec_byte();
+        sd_raw_rec_byte();
+        
+        /* deaddress card */
+        unselect_card();
+
+        /* let card some time to finish */
+        sd_raw_rec_byte();
+#else
+        /* the block cache is shared with SdFat */
+        cache = sd_cache_get(block_address / 512, SD_CACHE_READ, sd_raw_read_block, 0);
+        if(!cache)
+            return 0;
+
+        memcpy(buffer, cache + block_offset, read_length);
+        buffer += read_length;
 #endif
 
         length -= read_length;
@@ -536,6 +687,55 @@ uint8_t sd_raw_read(offset_t offset, uint8_t* buffer, uintptr_t length)
     return 1;
 }
 
+#if !SD_RAW_SAVE_RAM
+/**
+ * \ingroup sd_raw
+ * Reads a single block from the card, used by the block cache on a miss.
+ *
+ * \param[in] block The number of the block.
+ * \param[out] buffer The buffer receiving the 512 bytes.
+ * \returns 0 on failure, 1 on success.
+ */
+uint8_t sd_raw_read_block(uint32_t block, uint8_t* buffer)
+{
+    offset_t block_address = (offset_t) block * 512;
+    uint16_t i=0;
+
+    /* address card */
+    select_card();
+
+    /* send single block request */
+#if SD_RAW_SDHC
+    if(sd_raw_send_command(CMD_READ_SINGLE_BLOCK, (sd_raw_card_type & (1 << SD_RAW_SPEC_SDHC) ? block : block_address)))
+#else
+    if(sd_raw_send_command(CMD_READ_SINGLE_BLOCK, block_address))
+#endif
+    {
+        unselect_card();
+        return 0;
+    }
+
+    /* wait for data block (start byte 0xfe) */
+    while(sd_raw_rec_byte() != 0xfe);
+
+    /* read byte block */
+    for( i = 0; i < 512; ++i)
+        *buffer++ = sd_raw_rec_byte();
+
+    /* read crc16 */
+    sd_raw_rec_byte();
+    sd_raw_rec_byte();
+
+    /* deaddress card */
+    unselect_card();
+
+    /* let card some time to finish */
+    sd_raw_rec_byte();
+
+    return 1;
+}
+#endif
+
 /**
  * \ingroup sd_raw
  * Continuously reads units of \c interval bytes and calls a callback function.
@@ -683,90 +883,106 @@ uint8_t sd_raw_write(offset_t offset, const uint8_t* buffer, uintptr_t length)
     offset_t block_address;
     uint16_t block_offset;
     uint16_t write_length;
-    uint16_t i=0;
+    uint8_t* cache;
 
     while(length > 0)
     {
         /* determine byte count to write at once */
         block_offset = offset & 0x01ff;
         block_address = offset - block_offset;
+
+#if SD_RAW_MULTI_BLOCK
+        /* whole blocks need no merging, send them in one command */
+        if(block_offset == 0 && length >= 1024)
+        {
+            uint16_t count = length / 512;
+
+            /* cached copies of these blocks are about to be overwritten */
+            sd_cache_invalidate(block_address / 512, count);
+
+            if(!sd_raw_write_blocks(block_address, buffer, count))
+                return 0;
+
+            write_length = count * 512;
+            buffer += write_length;
+            offset += write_length;
+            length -= write_length;
+            continue;
+        }
+#endif
+
         write_length = 512 - block_offset; /* write up to block border */
         if(write_length > length)
             write_length = length;
         
         /* Merge the data to write with the content of the block.
-         * Use the cached block if available.
+         * A whole block does not need to be read first.
          */
-        if(block_address != raw_block_address)
-        {
-#if SD_RAW_WRITE_BUFFERING
-            if(!sd_raw_sync())
-                return 0;
-#endif
+        cache = sd_cache_get(block_address / 512,
+                             (block_offset || write_length < 512) ? SD_CACHE_WRITE : SD_CACHE_WRITE | SD_CACHE_NO_READ,
+                             sd_raw_read_block, sd_raw_write_block);
+        if(!cache)
+            return 0;
 
-            if(block_offset || write_length < 512)
-            {
-                if(!sd_raw_read(block_address, raw_block, sizeof(raw_block))){
-                    return 0;
-		}
-            }
-            raw_block_address = block_address;
-        }
+        memcpy(cache + block_offset, buffer, write_length);
 
-        if(buffer != raw_block)
-        {
-            memcpy(raw_block + block_offset, buffer, write_length);
+#if !SD_RAW_WRITE_BUFFERING
+        if(!sd_cache_sync())
+            return 0;
+#endif
 
-#if SD_RAW_WRITE_BUFFERING
-            raw_block_written = 0;
+        buffer += write_length;
+        offset += write_length;
+        length -= write_length;
+    }
+    return 1;
+}
 
-            if(length == write_length){
-                return 1;
-	    }
-#endif
-        }
+/**
+ * \ingroup sd_raw
+ * Writes a single block to the card, used by the block cache to write back.
+ *
+ * \param[in] block The number of the block.
+ * \param[in] buffer The buffer holding the 512 bytes.
+ * \returns 0 on failure, 1 on success.
+ */
+uint8_t sd_raw_write_block(uint32_t block, const uint8_t* buffer)
+{
+    offset_t block_address = (offset_t) block * 512;
+    uint16_t i=0;
 
-        /* address card */
-        select_card();
+    /* address card */
+    select_card();
 
-        /* send single block request */
+    /* send single block request */
 #if SD_RAW_SDHC
-        if(sd_raw_send_command(CMD_WRITE_SINGLE_BLOCK, (sd_raw_card_type & (1 << SD_RAW_SPEC_SDHC) ? block_address / 512 : block_address)))
+    if(sd_raw_send_command(CMD_WRITE_SINGLE_BLOCK, (sd_raw_card_type & (1 << SD_RAW_SPEC_SDHC) ? block : block_address)))
 #else
-        if(sd_raw_send_command(CMD_WRITE_SINGLE_BLOCK, block_address))
+    if(sd_raw_send_command(CMD_WRITE_SINGLE_BLOCK, block_address))
 #endif
-        {
-            unselect_card();
-            return 0;
-        }
-
-        /* send start byte */
-        sd_raw_send_byte(0xfe);
+    {
+        unselect_card();
+        return 0;
+    }
 
-        /* write byte block */
-        uint8_t* cache = raw_block;
-        for( i = 0; i < 512; ++i)
-            sd_raw_send_byte(*cache++);
+    /* send start byte */
+    sd_raw_send_byte(0xfe);
 
-        /* write dummy crc16 */
-        sd_raw_send_byte(0xff);
-        sd_raw_send_byte(0xff);
+    /* write byte block */
+    for( i = 0; i < 512; ++i)
+        sd_raw_send_byte(*buffer++);
 
-        /* wait while card is busy */
-        while(sd_raw_rec_byte() != 0xff);
-        sd_raw_rec_byte();
+    /* write dummy crc16 */
+    sd_raw_send_byte(0xff);
+    sd_raw_send_byte(0xff);
 
-        /* deaddress card */
-        unselect_card();
+    /* wait while card is busy */
+    while(sd_raw_rec_byte() != 0xff);
+    sd_raw_rec_byte();
 
-        buffer += write_length;
-        offset += write_length;
-        length -= write_length;
+    /* deaddress card */
+    unselect_card();
 
-#if SD_RAW_WRITE_BUFFERING
-        raw_block_written = 1;
-#endif
-    }
     return 1;
 }
 #endif
@@ -837,14 +1053,8 @@ uint8_t sd_raw_write_interval(offset_t offset, uint8_t* buffer, uintptr_t length
  */
 uint8_t sd_raw_sync()
 {
-#if SD_RAW_WRITE_BUFFERING
-    if(raw_block_written)
-        return 1;
-    if(!sd_raw_write(raw_block_address, raw_block, sizeof(raw_block)))
-        return 0;
-    raw_block_written = 1;
-#endif
-    return 1;
+    /* blocks modified through SdFat are written back as well */
+    return sd_cache_sync();
 }
 #endif
 
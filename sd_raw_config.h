@@ -58,6 +58,16 @@ extern "C"
  */
 #define SD_RAW_SAVE_RAM 1
 
+/**
+ * \ingroup sd_raw_config
+ * Controls multi-block transfers.
+ *
+ * Set to 1 to move runs of two or more whole, aligned blocks with
+ * READ_MULTIPLE_BLOCK / WRITE_MULTIPLE_BLOCK instead of one command
+ * per block, set to 0 to always use single-block commands.
+ */
+#define SD_RAW_MULTI_BLOCK 1
+
 /**
  * \ingroup sd_raw_config
  * Controls support for SDHC cards.
@@ -83,6 +83,11 @@ void serialWrite(unsigned char, uint8_t);
 int serialAvailable(uint8_t);
 int serialRead(uint8_t);
 void serialFlush(uint8_t);
+int serialWriteBuffer(const uint8_t*, int, uint8_t);
+int serialWriteAvailable(uint8_t);
+uint8_t serialFlushTX(uint8_t, unsigned long);
+int serialReadBytes(uint8_t, uint8_t*, int);
+unsigned int serialOverflows(uint8_t, uint8_t);
 void printMode(int, uint8_t);
 void printByte(unsigned char c, uint8_t);
 void printNewline(uint8_t);
@@ -125,6 +130,7 @@ void disableInterrupts(uint32_t);
 void onHAIwakeUP(void);
 void onLAIwakeUP(void);
 void clearIntFlag();
+void attachInterruptRad(void (*)(void));
 
 //////////////////////
 
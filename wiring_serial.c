@@ -16,6 +16,8 @@
  */
  
 
+#include <string.h>
+
 #include "wiring_private.h"
 
 #ifndef __WASPCONSTANTS_H__
@@ -23,20 +25,99 @@
 #endif
 
 
-// Define constants and variables for buffering incoming serial data.  We're
-// using a ring buffer (I think), in which rx_buffer_head is the index of the
-// location to which to write the next incoming character and rx_buffer_tail
-// is the index of the location from which to read.
+// Define constants and variables for buffering incoming serial data. Each
+// port has a single-producer/single-consumer ring: the RX interrupt is the
+// only writer of rx_buffer_head and the reading functions are the only
+// writers of rx_buffer_tail. Sizes must be powers of two so indices wrap with
+// a mask, and can be changed per port at build time.
+#ifndef RX_BUFFER_SIZE_0
 #define RX_BUFFER_SIZE_0 512
+#endif
+#ifndef RX_BUFFER_SIZE_1
 #define RX_BUFFER_SIZE_1 128
-#define	UART_LIMIT 134217728
+#endif
+
+#if (RX_BUFFER_SIZE_0 & (RX_BUFFER_SIZE_0 - 1)) || RX_BUFFER_SIZE_0 > 32768
+#error "RX_BUFFER_SIZE_0 must be a power of two"
+#endif
+#if (RX_BUFFER_SIZE_1 & (RX_BUFFER_SIZE_1 - 1)) || RX_BUFFER_SIZE_1 > 32768
+#error "RX_BUFFER_SIZE_1 must be a power of two"
+#endif
+
+#define RX_MASK_0 (RX_BUFFER_SIZE_0 - 1)
+#define RX_MASK_1 (RX_BUFFER_SIZE_1 - 1)
+
+// rings up to 256 bytes use 8-bit indices, which the AVR reads and writes in
+// one instruction. Bigger rings need 16-bit indices, and the side that is
+// not the interrupt must not be interrupted halfway through them
+#if RX_BUFFER_SIZE_0 > 256
+typedef uint16_t rx_index0_t;
+#define RX_ATOMIC_0(code) { uint8_t oldSREG = SREG; cli(); code; SREG = oldSREG; }
+#else
+typedef uint8_t rx_index0_t;
+#define RX_ATOMIC_0(code) { code; }
+#endif
+
+#if RX_BUFFER_SIZE_1 > 256
+typedef uint16_t rx_index1_t;
+#define RX_ATOMIC_1(code) { uint8_t oldSREG = SREG; cli(); code; SREG = oldSREG; }
+#else
+typedef uint8_t rx_index1_t;
+#define RX_ATOMIC_1(code) { code; }
+#endif
 
 	unsigned char rx_buffer0[RX_BUFFER_SIZE_0];
 	unsigned char rx_buffer1[RX_BUFFER_SIZE_1];
-	int rx_buffer_head0 = 0;
-	int rx_buffer_tail0 = 0;
-	int rx_buffer_head1 = 0;
-	int rx_buffer_tail1 = 0;
+	volatile rx_index0_t rx_buffer_head0 = 0;
+	volatile rx_index0_t rx_buffer_tail0 = 0;
+	volatile rx_index1_t rx_buffer_head1 = 0;
+	volatile rx_index1_t rx_buffer_tail1 = 0;
+	// bytes dropped because the ring was full
+	volatile uint16_t rx_overflow0 = 0;
+	volatile uint16_t rx_overflow1 = 0;
+
+// Outgoing data is queued in a second ring per port and shifted out by the
+// data register empty interrupt, so serialWrite() only blocks when the ring
+// is full. Sizes must be powers of two (indices are wrapped with a mask).
+#ifndef TX_BUFFER_SIZE_0
+#define TX_BUFFER_SIZE_0 128
+#endif
+#ifndef TX_BUFFER_SIZE_1
+#define TX_BUFFER_SIZE_1 64
+#endif
+
+#if (TX_BUFFER_SIZE_0 & (TX_BUFFER_SIZE_0 - 1)) || TX_BUFFER_SIZE_0 > 256
+#error "TX_BUFFER_SIZE_0 must be a power of two no bigger than 256"
+#endif
+#if (TX_BUFFER_SIZE_1 & (TX_BUFFER_SIZE_1 - 1)) || TX_BUFFER_SIZE_1 > 256
+#error "TX_BUFFER_SIZE_1 must be a power of two no bigger than 256"
+#endif
+
+#define TX_MASK_0 (TX_BUFFER_SIZE_0 - 1)
+#define TX_MASK_1 (TX_BUFFER_SIZE_1 - 1)
+
+// clears the transmit complete flag by writing it as one. UCSRnA is written
+// directly: a read-modify-write would also clear any other flag found set,
+// so only U2X and MPCM are kept
+#define TX_CLEAR_TXC_0() (UCSR0A = (UCSR0A & ((1 << U2X0) | (1 << MPCM0))) | (1 << TXC0))
+#define TX_CLEAR_TXC_1() (UCSR1A = (UCSR1A & ((1 << U2X1) | (1 << MPCM1))) | (1 << TXC1))
+
+// poll period of serialFlushTX() while interrupts are disabled, shorter
+// than a byte at the fastest baud rate in use
+#define TX_POLL_US 50
+
+// time closeSerial() waits for pending bytes before turning the UART off
+#define TX_CLOSE_TIMEOUT 200
+
+	unsigned char tx_buffer0[TX_BUFFER_SIZE_0];
+	unsigned char tx_buffer1[TX_BUFFER_SIZE_1];
+	volatile uint8_t tx_buffer_head0 = 0;
+	volatile uint8_t tx_buffer_tail0 = 0;
+	volatile uint8_t tx_buffer_head1 = 0;
+	volatile uint8_t tx_buffer_tail1 = 0;
+	// set once a byte has been queued, cleared when the line is idle again
+	volatile uint8_t tx_written0 = 0;
+	volatile uint8_t tx_written1 = 0;
 
 // connects the internal peripheral in the processor and configures it
 void beginSerial(long baud, uint8_t portNum)
@@ -53,6 +134,10 @@ void beginSerial(long baud, uint8_t portNum)
 		// enable interrupt on complete reception of a byte
 		sbi(UCSR0B, RXCIE0);
 		
+		// start with an empty transmit ring
+		tx_buffer_head0 = tx_buffer_tail0 = 0;
+		tx_written0 = 0;
+		
 		
 	} else {
 		setIPF_(IPUSART1);
@@ -65,6 +150,10 @@ void beginSerial(long baud, uint8_t portNum)
 		
 		// enable interrupt on complete reception of a byte
 		sbi(UCSR1B, RXCIE1);
+		
+		// start with an empty transmit ring
+		tx_buffer_head1 = tx_buffer_tail1 = 0;
+		tx_written1 = 0;
 	}
 	// defaults to 8-bit, no parity, 1 stop bit
 }
@@ -72,92 +161,293 @@ void beginSerial(long baud, uint8_t portNum)
 // disconnects the internal peripheral in the processor
 void closeSerial(uint8_t portNum)
 {
+	// let the queued bytes leave before the transmitter is switched off
+	serialFlushTX(portNum, TX_CLOSE_TIMEOUT);
+	
 	if (portNum == 0) {
 		// turn off the internal peripheral, but also the interface
 		// resetIPF is just turning off the clock, what is not helping
 		// to save power, you gotta get rid of all the pull-ups in the sytem
 		resetIPF_(IPUSART0);
+		cbi(UCSR0B, UDRIE0);
  		cbi(UCSR0B, RXEN0);
                 cbi(UCSR0B, TXEN0);
+		tx_buffer_head0 = tx_buffer_tail0 = 0;
 	} else {
 		// turn off the internal peripheral, but also the interface
 		// resetIPF is just turning off the clock, what is not helping
 		// to save power, you gotta get rid of all the pull-ups in the sytem
 		resetIPF_(IPUSART1);
+		cbi(UCSR1B, UDRIE1);
  		cbi(UCSR1B, RXEN1);
                 cbi(UCSR1B, TXEN1);
+		tx_buffer_head1 = tx_buffer_tail1 = 0;
 	}
 }
 
 void serialWrite(unsigned char c, uint8_t portNum)
 {
+	uint8_t i;
+	
 	if (portNum == 0) {
-		while (!(UCSR0A & (1 << UDRE0)))
-			;
-
-		UDR0 = c;
+		i = (tx_buffer_head0 + 1) & TX_MASK_0;
+		
+		// the ring is full: wait for the interrupt to make room. With
+		// interrupts disabled nobody will, so feed the register by hand
+		while (i == tx_buffer_tail0) {
+			if (!(SREG & (1 << SREG_I)) && (UCSR0A & (1 << UDRE0))) {
+				TX_CLEAR_TXC_0();
+				UDR0 = tx_buffer0[tx_buffer_tail0];
+				tx_buffer_tail0 = (tx_buffer_tail0 + 1) & TX_MASK_0;
+			}
+		}
+		
+		tx_buffer0[tx_buffer_head0] = c;
+		tx_buffer_head0 = i;
+		tx_written0 = 1;
+		sbi(UCSR0B, UDRIE0);
 	} else {
-		while (!(UCSR1A & (1 << UDRE1)))
-			;
+		i = (tx_buffer_head1 + 1) & TX_MASK_1;
+		
+		while (i == tx_buffer_tail1) {
+			if (!(SREG & (1 << SREG_I)) && (UCSR1A & (1 << UDRE1))) {
+				TX_CLEAR_TXC_1();
+				UDR1 = tx_buffer1[tx_buffer_tail1];
+				tx_buffer_tail1 = (tx_buffer_tail1 + 1) & TX_MASK_1;
+			}
+		}
+		
+		tx_buffer1[tx_buffer_head1] = c;
+		tx_buffer_head1 = i;
+		tx_written1 = 1;
+		sbi(UCSR1B, UDRIE1);
+	}
+}
 
-		UDR1 = c;
+// queues as many bytes of 'buf' as fit in the transmit ring and returns
+// how many were taken, without waiting for the line. With interrupts
+// disabled the ring is drained by hand while the data register is free,
+// so callers looping until everything is taken still make progress
+int serialWriteBuffer(const uint8_t* buf, int len, uint8_t portNum)
+{
+	int n = 0;
+	uint8_t i;
+	
+	if (portNum == 0) {
+		while (n < len) {
+			i = (tx_buffer_head0 + 1) & TX_MASK_0;
+			if (i == tx_buffer_tail0) {
+				if (!(SREG & (1 << SREG_I)) && (UCSR0A & (1 << UDRE0))) {
+					TX_CLEAR_TXC_0();
+					UDR0 = tx_buffer0[tx_buffer_tail0];
+					tx_buffer_tail0 = (tx_buffer_tail0 + 1) & TX_MASK_0;
+					continue;
+				}
+				break;
+			}
+			tx_buffer0[tx_buffer_head0] = buf[n++];
+			tx_buffer_head0 = i;
+		}
+		if (n) {
+			tx_written0 = 1;
+			sbi(UCSR0B, UDRIE0);
+		}
+	} else {
+		while (n < len) {
+			i = (tx_buffer_head1 + 1) & TX_MASK_1;
+			if (i == tx_buffer_tail1) {
+				if (!(SREG & (1 << SREG_I)) && (UCSR1A & (1 << UDRE1))) {
+					TX_CLEAR_TXC_1();
+					UDR1 = tx_buffer1[tx_buffer_tail1];
+					tx_buffer_tail1 = (tx_buffer_tail1 + 1) & TX_MASK_1;
+					continue;
+				}
+				break;
+			}
+			tx_buffer1[tx_buffer_head1] = buf[n++];
+			tx_buffer_head1 = i;
+		}
+		if (n) {
+			tx_written1 = 1;
+			sbi(UCSR1B, UDRIE1);
+		}
 	}
+	return n;
 }
 
-int serialAvailable(uint8_t portNum)
+// free room in the transmit ring
+int serialWriteAvailable(uint8_t portNum)
 {
 	if (portNum == 0)
-		return (RX_BUFFER_SIZE_0 + rx_buffer_head0 - rx_buffer_tail0) % RX_BUFFER_SIZE_0;
+		return (tx_buffer_tail0 - tx_buffer_head0 - 1) & TX_MASK_0;
 	else
-		return (RX_BUFFER_SIZE_1 + rx_buffer_head1 - rx_buffer_tail1) % RX_BUFFER_SIZE_1;
+		return (tx_buffer_tail1 - tx_buffer_head1 - 1) & TX_MASK_1;
+}
+
+// waits until every queued byte has been shifted out of the UART. Returns 0
+// when the line is idle, 1 if 'timeout' milliseconds went by first. With
+// interrupts disabled millis() stands still and the data register interrupt
+// never runs, so the ring is drained by hand and the time is counted in
+// polls of TX_POLL_US microseconds
+uint8_t serialFlushTX(uint8_t portNum, unsigned long timeout)
+{
+	unsigned long previous = millis();
+	unsigned long polls = 0;
+	uint8_t irq = SREG & (1 << SREG_I);
+	
+	if (portNum == 0) {
+		// the transmitter is off or nothing was sent since the last flush
+		if (!(UCSR0B & (1 << TXEN0)) || !tx_written0) return 0;
+		while ((UCSR0B & (1 << UDRIE0)) || !(UCSR0A & (1 << TXC0))) {
+			if (!irq) {
+				if ((UCSR0B & (1 << UDRIE0)) && (UCSR0A & (1 << UDRE0))) {
+					if (tx_buffer_head0 == tx_buffer_tail0) {
+						cbi(UCSR0B, UDRIE0);
+					} else {
+						TX_CLEAR_TXC_0();
+						UDR0 = tx_buffer0[tx_buffer_tail0];
+						tx_buffer_tail0 = (tx_buffer_tail0 + 1) & TX_MASK_0;
+					}
+				}
+				delayMicroseconds(TX_POLL_US);
+				if (++polls > timeout * (1000 / TX_POLL_US)) return 1;
+				continue;
+			}
+			if (millis() - previous > timeout) return 1;
+			if (millis() < previous) previous = millis();
+		}
+		tx_written0 = 0;
+	} else {
+		if (!(UCSR1B & (1 << TXEN1)) || !tx_written1) return 0;
+		while ((UCSR1B & (1 << UDRIE1)) || !(UCSR1A & (1 << TXC1))) {
+			if (!irq) {
+				if ((UCSR1B & (1 << UDRIE1)) && (UCSR1A & (1 << UDRE1))) {
+					if (tx_buffer_head1 == tx_buffer_tail1) {
+						cbi(UCSR1B, UDRIE1);
+					} else {
+						TX_CLEAR_TXC_1();
+						UDR1 = tx_buffer1[tx_buffer_tail1];
+						tx_buffer_tail1 = (tx_buffer_tail1 + 1) & TX_MASK_1;
+					}
+				}
+				delayMicroseconds(TX_POLL_US);
+				if (++polls > timeout * (1000 / TX_POLL_US)) return 1;
+				continue;
+			}
+			if (millis() - previous > timeout) return 1;
+			if (millis() < previous) previous = millis();
+		}
+		tx_written1 = 0;
+	}
+	return 0;
+}
+
+int serialAvailable(uint8_t portNum)
+{
+	if (portNum == 0) {
+		rx_index0_t head;
+		RX_ATOMIC_0(head = rx_buffer_head0);
+		return (head - rx_buffer_tail0) & RX_MASK_0;
+	} else {
+		rx_index1_t head;
+		RX_ATOMIC_1(head = rx_buffer_head1);
+		return (head - rx_buffer_tail1) & RX_MASK_1;
+	}
 }
 
 int serialRead(uint8_t portNum)
 {
+	unsigned char c;
+	
 	if (portNum == 0) {
+		rx_index0_t head;
+		RX_ATOMIC_0(head = rx_buffer_head0);
 		// if the head isn't ahead of the tail, we don't have any characters
-		if (rx_buffer_head0 == rx_buffer_tail0) {
-			return -1;
-		} else {
-			unsigned char c = rx_buffer0[rx_buffer_tail0];
-			rx_buffer_tail0 = (rx_buffer_tail0 + 1) % RX_BUFFER_SIZE_0;
-			return c;
-		}
+		if (head == rx_buffer_tail0) return -1;
+		c = rx_buffer0[rx_buffer_tail0];
+		RX_ATOMIC_0(rx_buffer_tail0 = (rx_buffer_tail0 + 1) & RX_MASK_0);
+		return c;
 	}
 	else {
-		// if the head isn't ahead of the tail, we don't have any characters
-		if (rx_buffer_head1 == rx_buffer_tail1) {
-			return -1;
-		} else {
-			unsigned char c = rx_buffer1[rx_buffer_tail1];
-			rx_buffer_tail1 = (rx_buffer_tail1 + 1) % RX_BUFFER_SIZE_1;
-			return c;
+		rx_index1_t head;
+		RX_ATOMIC_1(head = rx_buffer_head1);
+		if (head == rx_buffer_tail1) return -1;
+		c = rx_buffer1[rx_buffer_tail1];
+		RX_ATOMIC_1(rx_buffer_tail1 = (rx_buffer_tail1 + 1) & RX_MASK_1);
+		return c;
+	}
+}
+
+// copies up to 'len' received bytes into 'buf' and returns how many were
+// read. It never waits: it only takes what is already in the ring
+int serialReadBytes(uint8_t portNum, uint8_t* buf, int len)
+{
+	int n = 0;
+	int chunk;
+	
+	if (portNum == 0) {
+		rx_index0_t head, tail = rx_buffer_tail0;
+		RX_ATOMIC_0(head = rx_buffer_head0);
+		while (n < len && tail != head) {
+			// contiguous run up to the head or the end of the array
+			chunk = (head > tail ? head : RX_BUFFER_SIZE_0) - tail;
+			if (chunk > len - n) chunk = len - n;
+			memcpy(&buf[n], &rx_buffer0[tail], chunk);
+			n += chunk;
+			tail = (tail + chunk) & RX_MASK_0;
 		}
+		RX_ATOMIC_0(rx_buffer_tail0 = tail);
+	} else {
+		rx_index1_t head, tail = rx_buffer_tail1;
+		RX_ATOMIC_1(head = rx_buffer_head1);
+		while (n < len && tail != head) {
+			chunk = (head > tail ? head : RX_BUFFER_SIZE_1) - tail;
+			if (chunk > len - n) chunk = len - n;
+			memcpy(&buf[n], &rx_buffer1[tail], chunk);
+			n += chunk;
+			tail = (tail + chunk) & RX_MASK_1;
+		}
+		RX_ATOMIC_1(rx_buffer_tail1 = tail);
 	}
+	return n;
 }
 
 void serialFlush(uint8_t portNum)
 {
-	// don't reverse this or there may be problems if the RX interrupt
-	// occurs after reading the value of rx_buffer_head but before writing
-	// the value to rx_buffer_tail; the previous value of rx_buffer_head
-	// may be written to rx_buffer_tail, making it appear as if the buffer
-	// were full, not empty.
+	// only the tail is moved: the head belongs to the RX interrupt, so
+	// discarding everything means catching up with it
 	if (portNum == 0){
-		rx_buffer_tail0=0;
-		rx_buffer_head0 = rx_buffer_tail0;
+		RX_ATOMIC_0(rx_buffer_tail0 = rx_buffer_head0);
 	}
 	else{
-		rx_buffer_tail1=0;
-		rx_buffer_head1 = rx_buffer_tail1;
+		RX_ATOMIC_1(rx_buffer_tail1 = rx_buffer_head1);
 	}
 }
 
+// number of received bytes dropped because the ring was full. Reading it
+// clears the count when 'reset' is set
+unsigned int serialOverflows(uint8_t portNum, uint8_t reset)
+{
+	unsigned int count;
+	uint8_t oldSREG = SREG;
+	
+	cli();
+	if (portNum == 0) {
+		count = rx_overflow0;
+		if (reset) rx_overflow0 = 0;
+	} else {
+		count = rx_overflow1;
+		if (reset) rx_overflow1 = 0;
+	}
+	SREG = oldSREG;
+	return count;
+}
+
 SIGNAL(USART0_RX_vect)
 {
 		unsigned char c = UDR0;
 		
-		int i = (rx_buffer_head0 + 1) % RX_BUFFER_SIZE_0;
+		rx_index0_t i = (rx_buffer_head0 + 1) & RX_MASK_0;
 		
 		// if we should be storing the received character into the location
 		// just before the tail (meaning that the head would advance to the
@@ -166,11 +456,8 @@ SIGNAL(USART0_RX_vect)
 		if (i != rx_buffer_tail0) {
 			rx_buffer0[rx_buffer_head0] = c;
 			rx_buffer_head0 = i;
-			if(rx_buffer_head0==UART_LIMIT)
-			{
-				rx_buffer_head0=0;
-				rx_buffer_tail0=0;
-			}
+		} else if (rx_overflow0 != 0xFFFF) {
+			rx_overflow0++;
 		}
 }
 
@@ -178,20 +465,40 @@ SIGNAL(USART1_RX_vect)
 {
 		unsigned char c = UDR1;
 
-		int i = (rx_buffer_head1 + 1) % RX_BUFFER_SIZE_1;
+		rx_index1_t i = (rx_buffer_head1 + 1) & RX_MASK_1;
 
-		// if we should be storing the received character into the location
-		// just before the tail (meaning that the head would advance to the
-		// current location of the tail), we're about to overflow the buffer
-		// and so we don't write the character or advance the head.
 		if (i != rx_buffer_tail1) {
 			rx_buffer1[rx_buffer_head1] = c;
 			rx_buffer_head1 = i;
-			if(rx_buffer_head1==UART_LIMIT)
-			{
-				rx_buffer_head1=0;
-				rx_buffer_tail1=0;
-			}
+		} else if (rx_overflow1 != 0xFFFF) {
+			rx_overflow1++;
+		}
+}
+
+SIGNAL(USART0_UDRE_vect)
+{
+		if (tx_buffer_head0 == tx_buffer_tail0) {
+			// nothing left to send
+			cbi(UCSR0B, UDRIE0);
+		} else {
+			unsigned char c = tx_buffer0[tx_buffer_tail0];
+			tx_buffer_tail0 = (tx_buffer_tail0 + 1) & TX_MASK_0;
+			// clear the transmit complete flag together with the new
+			// byte so serialFlushTX() sees the real end
+			TX_CLEAR_TXC_0();
+			UDR0 = c;
+		}
+}
+
+SIGNAL(USART1_UDRE_vect)
+{
+		if (tx_buffer_head1 == tx_buffer_tail1) {
+			cbi(UCSR1B, UDRIE1);
+		} else {
+			unsigned char c = tx_buffer1[tx_buffer_tail1];
+			tx_buffer_tail1 = (tx_buffer_tail1 + 1) & TX_MASK_1;
+			TX_CLEAR_TXC_1();
+			UDR1 = c;
 		}
 }
 